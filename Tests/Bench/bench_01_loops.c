@@ -0,0 +1,19 @@
+// Bench: Nested counting loops (triple nest, sums of products, inner trip count depending on the outer index)
+int total = 0;
+
+void main() {
+    int i, j, k, s, t;
+
+    s = 0;
+    for (i = 0; i < 40; i = i + 1) {
+        for (j = 0; j < i; j = j + 1) {
+            t = 0;
+            for (k = 0; k < 10; k = k + 1) {
+                t = t + i * k - j;
+            }
+            s = s + t;
+        }
+        total = total + s % 1000;
+    }
+    print("sum ", s, " total ", total, "\n");
+}
@@ -0,0 +1,20 @@
+// Bench: Bit-twiddling hashes (FNV-like multiply and xor, murmur-like mixing with rotates and shifts)
+int seed = 16777619;
+
+void main() {
+    int i, h, x, m, r;
+
+    h = -2128831035;
+    m = 0;
+    for (i = 0; i < 3000; i = i + 1) {
+        h = (h ^ (i & 255)) * seed;
+        x = i * 668265261;
+        x = x ^ (x >>> 15);
+        x = (x << 13) | (x >>> 19);
+        x = x * 5 + 430675100;
+        m = m ^ x;
+        m = (m << 7) ^ (m >>> 3) ^ h;
+    }
+    r = (h >>> 16) ^ (h & 65535);
+    print("fnv ", h, " mix ", m, " fold ", r, "\n");
+}
@@ -0,0 +1,23 @@
+// Bench: Prime counting by trial division with modulo (no arrays in MiniC, divisors tried up to the square root)
+int count = 0;
+int last = 0;
+
+void main() {
+    int n, d, prime;
+
+    for (n = 2; n < 4000; n = n + 1) {
+        prime = 1;
+        d = 2;
+        while (prime == 1 && d * d <= n) {
+            if (n % d == 0) {
+                prime = 0;
+            }
+            d = d + 1;
+        }
+        if (prime == 1) {
+            count = count + 1;
+            last = n;
+        }
+    }
+    print("primes ", count, " last ", last, "\n");
+}
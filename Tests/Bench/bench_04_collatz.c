@@ -0,0 +1,26 @@
+// Bench: Collatz sequences (data-dependent branch, halving and 3n+1 steps, longest chain search)
+void main() {
+    int n, x, steps, best, arg, sum;
+
+    best = 0;
+    arg = 0;
+    sum = 0;
+    for (n = 1; n < 3000; n = n + 1) {
+        x = n;
+        steps = 0;
+        while (x != 1) {
+            if ((x & 1) == 0) {
+                x = x >> 1;
+            } else {
+                x = 3 * x + 1;
+            }
+            steps = steps + 1;
+        }
+        sum = sum + steps;
+        if (steps > best) {
+            best = steps;
+            arg = n;
+        }
+    }
+    print("longest ", best, " from ", arg, " total ", sum, "\n");
+}
@@ -0,0 +1,45 @@
+// Bench: Euclid GCD with modulo and binary GCD with shifts, over pairs of a quadratic sequence
+void main() {
+    int i, j, a, b, t, k, g1, g2, s1, s2;
+
+    s1 = 0;
+    s2 = 0;
+    for (i = 1; i < 60; i = i + 1) {
+        for (j = 1; j < 60; j = j + 1) {
+            a = i * i + 7 * j;
+            b = j * j + 3 * i;
+            while (b != 0) {
+                t = a % b;
+                a = b;
+                b = t;
+            }
+            g1 = a;
+            a = i * i + 7 * j;
+            b = j * j + 3 * i;
+            k = 0;
+            while (((a | b) & 1) == 0) {
+                a = a >> 1;
+                b = b >> 1;
+                k = k + 1;
+            }
+            while ((a & 1) == 0) {
+                a = a >> 1;
+            }
+            while (b != 0) {
+                while ((b & 1) == 0) {
+                    b = b >> 1;
+                }
+                if (a > b) {
+                    t = a;
+                    a = b;
+                    b = t;
+                }
+                b = b - a;
+            }
+            g2 = a << k;
+            s1 = s1 + g1;
+            s2 = s2 + g2;
+        }
+    }
+    print("euclid ", s1, " binary ", s2, "\n");
+}
@@ -0,0 +1,20 @@
+// Bench: CRC-32 style shift and xor loop over a generated message, bit by bit
+void main() {
+    int i, b, byte, crc, poly;
+
+    poly = -306674912;
+    crc = -1;
+    for (i = 0; i < 1500; i = i + 1) {
+        byte = (i * 37 + 11) & 255;
+        crc = crc ^ byte;
+        for (b = 0; b < 8; b = b + 1) {
+            if ((crc & 1) != 0) {
+                crc = (crc >>> 1) ^ poly;
+            } else {
+                crc = crc >>> 1;
+            }
+        }
+    }
+    crc = ~crc;
+    print("crc ", crc, "\n");
+}
@@ -0,0 +1,20 @@
+// Bench: Print-heavy report (a table of squares, cubes and residues with labels on every line)
+void main() {
+    int i, sq, cu, r;
+    bool even;
+
+    print("table\n");
+    for (i = 0; i < 150; i = i + 1) {
+        sq = i * i;
+        cu = sq * i;
+        r = cu % 7;
+        even = (i % 2) == 0;
+        print("n=", i, " sq=", sq, " cu=", cu, " mod7=", r);
+        if (even) {
+            print(" even\n");
+        } else {
+            print(" odd\n");
+        }
+    }
+    print("end\n");
+}
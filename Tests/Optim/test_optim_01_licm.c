@@ -0,0 +1,23 @@
+// Test: Loop-invariant expressions, strings and guarded divisions
+int n = 10;
+int limit = 7;
+
+void main() {
+    int i, j, s = 0, t = 0, d = 4;
+
+    for (i = 0; i < n; i = i + 1) {
+        s = s + n * 4 + (limit - 1);
+        for (j = 0; j < limit; j = j + 1) {
+            t = t + i * 3 + n * 4 + 100 / d;
+        }
+        print(".");
+    }
+    print("s = ", s, " t = ", t, "\n");
+
+    i = 0;
+    do {
+        s = s - 1000 / d;
+        i = i + 1;
+    } while (i < limit - 2);
+    print("s = ", s, "\n");
+}
@@ -0,0 +1,50 @@
+// Test: Counted for-loops (full and partial unrolling, remainders, bounds near overflow)
+void main() {
+    int i, j, s = 0, n = 37, m = 0 - 5, t = 0, low = 0 - 2147483647;
+
+    for (i = 0; i < n; i = i + 1) s = s + i;
+    print("a ", s, " ", i, "\n");
+
+    for (i = 100; i > m; i = i - 7) {
+        s = s + i;
+        print(i, " ");
+    }
+    print("b ", s, " ", i, "\n");
+
+    for (i = 3; 50 >= i; i = 3 + i) {
+        s = s ^ i;
+    }
+    print("c ", s, " ", i, "\n");
+
+    for (i = 0; i <= 4; i = i + 1) {
+        int k = i * 2;
+        for (j = 0; j < 3; j = j + 1) {
+            int q = k + j;
+            t = t + q;
+        }
+    }
+    print("d ", t, " ", i, " ", j, "\n");
+
+    for (i = low + 5; i > low; i = i - 1) {
+        t = t + 1;
+    }
+    print("e ", t, " ", i, "\n");
+
+    n = low;
+    for (i = 10; i < n; i = i + 1) {
+        t = t + 1;
+    }
+    print("f ", t, " ", i, "\n");
+
+    n = 1000;
+    for (i = 0; i < n; i = i + 3) {
+        t = t + i;
+        if (i % 2 == 0) t = t - 1;
+    }
+    print("g ", t, " ", i, "\n");
+
+    for (i = 5; i < 5; i = i + 1) {
+        t = t + 1;
+    }
+    print("h ", t, " ", i, "\n");
+}
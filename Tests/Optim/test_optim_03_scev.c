@@ -0,0 +1,71 @@
+// Test: Reduction loops replaced by closed forms (affine and polynomial, wraparound, guards)
+int g = 3;
+
+void main() {
+    int i, j, s = 0, t = 7, u = 0, v = 1, w, n = 100, m = 0 - 4, big = 2147483647;
+
+    for (i = 0; i < n; i = i + 1) s = s + i;
+    print("a ", s, " ", i, "\n");
+
+    for (i = 1; i <= 10; i = i + 3) {
+        s = s + g;
+        t = t - i * i;
+        u = u + (i << 2) - 1;
+    }
+    print("b ", s, " ", t, " ", u, " ", i, "\n");
+
+    i = n;
+    while (i > m) {
+        v = v + s;
+        s = s + i * 3;
+        w = 42;
+        i = i - 2;
+    }
+    print("c ", s, " ", v, " ", w, " ", i, "\n");
+
+    n = 70000;
+    s = 0;
+    t = 0;
+    for (i = 0; i < n; i = i + 1) {
+        int q = i * i;
+        s = s + q;
+        t = t + s;
+    }
+    print("d ", s, " ", t, " ", i, "\n");
+
+    for (i = 5; i < 5; i = i + 1) {
+        s = s + 1;
+        w = 0;
+    }
+    print("e ", s, " ", w, " ", i, "\n");
+
+    n = big - 1;
+    i = big - 3;
+    s = 0;
+    while (i < n) {
+        s = s + 1;
+        i = i + 1;
+    }
+    print("f ", s, " ", i, "\n");
+
+    i = 0 - 3;
+    s = 0;
+    while (i < 3) {
+        s = s + i;
+        i = i + 1;
+    }
+    print("g ", s, " ", i, "\n");
+
+    for (i = 0; i < 20; i = i + 1) {
+        s = s + i;
+        print(".");
+    }
+    print("h ", s, "\n");
+
+    for (i = 0; i < 10; i = i + 1) {
+        for (j = 0; j < 10; j = j + 1) {
+            s = s + j;
+        }
+    }
+    print("i ", s, " ", i, " ", j, "\n");
+}
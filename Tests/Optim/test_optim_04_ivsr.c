@@ -0,0 +1,52 @@
+// Test: Strength reduction of induction variable products (several updates, test replacement)
+int stride = 12;
+
+void main() {
+    int i, j, s = 0, t = 0, k = 0 - 7, n = 30;
+
+    for (i = 0; i < 20; i = i + 1) {
+        s = s + i * 4 + (i * stride) - 3 * i;
+    }
+    print("a ", s, " ", i, "\n");
+
+    for (i = 50; i >= 0 - 10; i = i - 3) {
+        t = i * k;
+        print(t, " ");
+    }
+    print("b ", i, "\n");
+
+    i = 0;
+    while (i < n) {
+        t = t ^ (i * 5);
+        i = i + 1;
+        t = t + i * 5;
+        i = i + 2;
+    }
+    print("c ", t, " ", i, "\n");
+
+    j = 3;
+    do {
+        int q = j * stride;
+        s = s + q;
+        j = j + 2;
+    } while (j * 2 < n);
+    print("d ", s, " ", j, "\n");
+
+    for (i = 0; i < n; i = i + 1) {
+        for (j = 0; j < 4; j = j + 1) {
+            s = s + i * n + j * stride;
+        }
+    }
+    print("e ", s, " ", i, " ", j, "\n");
+
+    for (i = 2147483600; i < 2147483640; i = i + 5) {
+        t = t + i * 3;
+    }
+    print("f ", t, " ", i, "\n");
+
+    for (i = 0; i < 10; i = i + 1) {
+        if (i > 5) i = i + 1;
+        s = s + i * 9;
+    }
+    print("g ", s, " ", i, "\n");
+}
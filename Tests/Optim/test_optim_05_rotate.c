@@ -0,0 +1,41 @@
+// Test: Rotated while/for loops (guarded entry, first test known true, zero-trip loops)
+int g = 0;
+
+void main() {
+    int i, j = 10, s = 0;
+    bool go = true;
+
+    for (i = 0; i < 5; i = i + 1) {
+        s = s + i;
+    }
+    print("a ", s, " ", i, "\n");
+
+    for (i = j; i < 5; i = i + 1) {
+        s = s + 100;
+    }
+    print("b ", s, " ", i, "\n");
+
+    while (j > 0) {
+        s = s + j;
+        j = j - 3;
+    }
+    print("c ", s, " ", j, "\n");
+
+    while (j > 100) {
+        s = 0;
+    }
+    print("d ", s, " ", j, "\n");
+
+    while (true) {
+        g = g + 1;
+        if (g > 4) go = false;
+        while (go) {
+            g = g + 2;
+            go = false;
+        }
+        go = g < 12;
+        if (!go) i = 0 - 1;
+        while (i < 0) i = (g = g + 1) - g;
+        if (g >= 12) j = 1 / (g - g);
+    }
+}
@@ -0,0 +1,37 @@
+// Test: Algebraic identities, comparison canonicalisation and reassociation (traps kept)
+int g = 7;
+
+void main() {
+    int a = 5, b = 0 - 3, c, z = 0;
+    bool t = true, f = false, r;
+
+    c = a + 0 + (0 + b) + (a - 0) + (a * 1) + (1 * b) + (a / 1) + (a | 0) + (a ^ 0) + (a & (0 - 1));
+    print("a ", c, "\n");
+
+    c = (a * 0) + (b & 0) + (a % 1) + (a | (0 - 1)) + (a - a) + (b ^ b) + (a & a) + (b | b);
+    print("b ", c, "\n");
+
+    c = ~~a + -(-b) + (0 - a) + (b * (0 - 1)) + (a << 0) + (b >> 0);
+    print("c ", c, "\n");
+
+    r = (t == true) && (f == false) && (t != false) && !(f != true) && !!t;
+    print("d ", r, "\n");
+
+    r = !(a < b) && !(a == b) && (3 < a) && !(b >= a) && (a == a) && !(b != b);
+    print("e ", r, "\n");
+
+    c = a + 1 + 2 + (3 + a - 4) + (g - 10 + b + 10) + (a * 3 * 4) + ((b & 12) & 10) + (2 ^ a ^ 7);
+    print("f ", c, "\n");
+
+    c = a + b - a + (g * 8) + (g * 1024) + (b * (0 - 2147483647 - 1)) + (a - 2147483647 - 1 - 1);
+    print("g ", c, "\n");
+
+    r = (t && f) || (f || t) && (t && true) || (f && false);
+    print("h ", r, "\n");
+
+    c = (g = g + 1) * 0 + (g - g);
+    print("i ", c, " ", g, "\n");
+
+    c = (a / z) * 0;
+    print("unreachable\n");
+}
@@ -0,0 +1,45 @@
+// Test: Value ranges (guarded divisions, loop bounds, power of two divisors, trap kept)
+int size = 13;
+int zero;
+
+void main() {
+    int i, d, h = 5381, q = 0, r = 0, n = 40, neg = 0 - 17;
+
+    for (i = 1; i < n; i = i + 1) {
+        h = (h * 33) ^ i;
+        if (h < 0) h = 0 - (h + 1);
+        q = q + h / i + h % 8 + h / 16;
+        r = r + h % size;
+    }
+    print("a ", h, " ", q, " ", r, "\n");
+
+    d = h - 3;
+    if (d != 0) {
+        q = n / d + n % d;
+    }
+    if (d > 0 && n / d >= 0) {
+        q = q + 1;
+    }
+    print("b ", q, "\n");
+
+    q = neg / 4 + neg % 8 + (neg / 2) % 4;
+    print("c ", q, "\n");
+
+    d = 0;
+    do {
+        d = d + 2;
+        q = q + 100 / d;
+    } while (d < 10);
+    print("d ", q, " ", d, "\n");
+
+    i = 10;
+    while (i >= 0) {
+        i = i - 1;
+        if (i > 3) r = r + 1000 / (i - 3);
+    }
+    print("e ", r, " ", i, "\n");
+
+    if (zero == 0 || n / zero > 0) {
+        print("unreachable\n");
+    }
+}
@@ -0,0 +1,33 @@
+// Test: Compile-time evaluation (nested loops, wrap around, escapes, both operands of && evaluated)
+int limit = 12;
+bool verbose;
+
+void main() {
+    int i, j, s = 0, f = 1, h = 0 - 2147483647;
+    bool prime;
+
+    for (i = 2; i < limit * 3; i = i + 1) {
+        prime = true;
+        j = 2;
+        while (j * j <= i) {
+            if (i % j == 0) prime = false;
+            j = j + 1;
+        }
+        if (prime) print(i, " ");
+    }
+    print("\n");
+
+    i = 0;
+    do {
+        i = i + 1;
+        f = f * i;
+        h = h - 3;
+    } while (i < 15);
+    print("f ", f, " h ", h, "\n");
+
+    if (!verbose && (s = s + 5) > 0) {
+        print("s ", s, " \"quoted\"\n");
+    }
+    s = (f >> 3) + (f >>> 28) + (0 - 7) / 2 + (0 - 7) % 2 + (h << 4);
+    print("t ", s, "\n");
+}
@@ -0,0 +1,33 @@
+// Test: Print coalescing (adjacent literals, constant variables, merges blocked by traps and assignments)
+int g = 4;
+
+void main() {
+    int i, k = 7, n = 0, z = 0;
+    bool b = true;
+
+    print("a = ", k, "\n");
+    print("b = ", b, " ");
+    print("g = ", g, "\n");
+
+    k = 12;
+    print("k ", k);
+    n = n + 3;
+    print(" n ", n, "\n");
+
+    for (i = 0; i < 3; i = i + 1) {
+        print("i ", i);
+        print("\n");
+        k = i;
+        print("k ", k, "\n");
+    }
+    print("after ", k, "\n");
+
+    n = 100;
+    print("n ", n, "\n");
+    if (g > 2) {
+        n = 5;
+    }
+    print("n ", n, " \"q\"\n");
+    k = g / z;
+    print("unreachable\n");
+}
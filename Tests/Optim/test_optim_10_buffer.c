@@ -0,0 +1,18 @@
+// Test: Buffered output (buffer filled several times, negative and extreme integers, flush before a trap)
+int big = 2147483647;
+
+void main() {
+    int i, v = 1, small = 0 - big - 1, zero = 0;
+
+    print("limits ", big, " ", small, " ", zero, "\n");
+    for (i = 0; i < 300; i = i + 1) {
+        v = v * 0 - 7 * i + 3;
+        print("v", i, "=", v, ";");
+        if (i % 20 == 19) {
+            print("\n");
+        }
+    }
+    print("last line before the trap\n");
+    v = v / zero;
+    print("unreachable\n");
+}
@@ -0,0 +1,22 @@
+// Test: Data layout (repeated literals, suffix sharing, escapes, empty string, globals ordered by use)
+int cold, hot = 3, warm = 1;
+bool flag = true;
+
+void main() {
+    int i, j;
+
+    cold = 5;
+    print("new value\n");
+    print("value\n");
+    print("\n");
+    print("new value\n");
+    print("a \"q\"\n", cold, "\"q\"\n", "");
+    for (i = 0; i < 3; i = i + 1) {
+        warm = warm + i;
+        for (j = 0; j < 2; j = j + 1) {
+            hot = hot + j;
+            print("value\n");
+        }
+    }
+    print("hot ", hot, " warm ", warm, " flag ", flag, " cold ", cold, "\n");
+}
@@ -0,0 +1,21 @@
+// Test: Packed data (bools as bytes, zeroed globals in .space, strings moved after the initialised globals)
+int a = 5, z, big = 7;
+bool f = true, g, h = false;
+int w = 9;
+bool k = true;
+
+void main() {
+    int i;
+
+    for (i = 0; i < 4; i = i + 1) {
+        z = z + i;
+        g = !g;
+        k = k && g;
+        w = w + a;
+    }
+    print("a ", a, " z ", z, " big ", big, " f ", f, " g ", g, " h ", h, " w ", w, " k ", k, "\n");
+    if (f) {
+        h = true;
+    }
+    print("h ", h, "\n");
+}
@@ -0,0 +1,25 @@
+// Test: Peephole rules (store then load of a slot, shared global base, printed copies, double negation, empty else)
+int g = 3, h;
+bool b = true;
+
+void main() {
+    int x = 4, y, i;
+    bool c;
+
+    y = x;
+    x = x + y;
+    g = g + x;
+    h = g;
+    c = !!b;
+    for (i = 0; i < 3; i = i + 1) {
+        if (c) {
+            h = h + i;
+        } else {
+        }
+        c = !c;
+    }
+    while (!(x > 20)) {
+        x = x + 5;
+    }
+    print("x ", x, " y ", y, " g ", g, " h ", h, " c ", c, "\n");
+}
@@ -0,0 +1,40 @@
+// Test: Jump threading (jumps to jumps from nested if/else, loop flags known after a store, first loop test known)
+int g = 0;
+
+void main() {
+    int i, s = 0, t = 0;
+    bool done = false, odd;
+
+    for (i = 0; i < 12; i = i + 1) {
+        if (i > 5) {
+            if (i % 2 == 0) {
+                s = s + 1;
+            } else {
+                s = s + 2;
+            }
+        } else {
+            if (i < 2) {
+                s = s - 1;
+            }
+        }
+    }
+    while (!done) {
+        t = t + 3;
+        if (t > 40) {
+            done = true;
+        }
+    }
+    odd = false;
+    while (odd) {
+        g = g + 1;
+    }
+    i = 0;
+    do {
+        g = g + i;
+        i = i + 1;
+        if (g > 100) {
+            i = 50;
+        }
+    } while (i < 20);
+    print("s ", s, " t ", t, " g ", g, " i ", i, "\n");
+}
@@ -0,0 +1,35 @@
+// Test: Tail merging and hoisting (arms ending with the same print and store, arms starting with the same string, three way chains)
+int g = 1;
+
+void main() {
+    int i, x = 0, y = 0;
+
+    for (i = 0; i < 9; i = i + 1) {
+        if (i % 3 == 0) {
+            x = x + i;
+            print("even ", i, "\n");
+        } else {
+            y = 3;
+            print("odd ", i, "\n");
+        }
+        if (i > 4) {
+            print("big ");
+            g = g + 1;
+        } else {
+            print("big ");
+            g = g + 2;
+        }
+        if (i == 1) {
+            x = 7;
+            print(">\n");
+        } else {
+            if (i == 2) {
+                x = 8;
+                print(">\n");
+            } else {
+                print(">\n");
+            }
+        }
+    }
+    print(x, " ", y, " ", g, "\n");
+}
@@ -0,0 +1,32 @@
+// Test: If-conversion (min/max/abs/clamp diamonds and ifs without else, arms with a print or a division kept)
+int g = 0;
+
+void main() {
+    int a, b, i, lo, hi, m, s = 0;
+    bool big;
+
+    a = 7;
+    b = 3;
+    for (i = 0; i < 16; i = i + 1) {
+        b = (b * 13 + 5) % 17 - 8;
+        if (a < b) lo = a; else lo = b;
+        if (a > b) hi = a; else hi = b;
+        m = b;
+        if (m < 0) m = -m;
+        if (m > 5) m = 5;
+        if (b != 0) g = g + 1;
+        if (!(b == 2)) s = s + m;
+        big = false;
+        if (hi > 6) big = true;
+        if (big) s = s + 100;
+        if (b > 0) {
+            print("+");
+        } else {
+            s = s - 1;
+        }
+        if (b != 0) {
+            a = a + 1000 / b;
+        }
+    }
+    print("\n", lo, " ", hi, " ", m, " ", s, " ", g, " ", a, "\n");
+}
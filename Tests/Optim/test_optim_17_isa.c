@@ -0,0 +1,20 @@
+// Test: Instruction selection for -march (mul, rotates, bit-field extract and insert, conditional moves)
+int h = 0;
+
+void main() {
+    int x, y, i, f, lo, k;
+
+    x = 305419896;
+    f = 0;
+    for (i = 0; i < 12; i = i + 1) {
+        x = (x << 7) | (x >>> 25);
+        y = (x >>> 13) | (x << 19);
+        h = h * 31 + ((x >> 8) & 255) + ((y >>> 20) & 4095);
+        f = (f & ~(15 << 4)) | ((i & 15) << 4);
+        f = (f & ~(255 << 24)) | (i << 24);
+        k = i * i * 7;
+        if (k < h) lo = k; else lo = h;
+        if (x < 0) x = -x;
+    }
+    print(x, " ", y, " ", h, " ", f, " ", lo, "\n");
+}
@@ -0,0 +1,24 @@
+// Test: Delay slot filling (store moved under a branch, loop head copied into the back edge, nested loops, while with a break condition, division trap)
+int g = 0;
+
+void main() {
+    int i, j, s = 0, n = 20, d = 3;
+
+    for (i = 0; i < 6; i = i + 1) {
+        g = g + i;
+        for (j = i; j > 0; j = j - 2) {
+            s = s + j * d;
+        }
+        if (s > 40) {
+            s = s - 40;
+        } else {
+            s = s + 1;
+        }
+    }
+    while (n > 1 && s != 0) {
+        n = n / d;
+        s = s - 1;
+    }
+    d = 100 / d;
+    print(s, " ", g, " ", n, " ", d, "\n");
+}
@@ -0,0 +1,20 @@
+// Test: Instruction scheduling (independent loads and products interleaved, stores and loads of distinct locals, divisions kept after their check, globals)
+int g = 5, h = 9;
+
+void main() {
+    int i, a = 3, b = 4, c = 6, d = 7, s = 0, p = 1, q;
+
+    for (i = 1; i < 12; i = i + 1) {
+        a = b * c + d * i;
+        b = a % 13 + g * h;
+        c = (a + b) / i + (c - d) * (a - i);
+        d = c / 7 - b / 3;
+        s = s + a * b - c * d;
+        g = h + i;
+        h = g - s % 5;
+        p = (p * 3 + s) % 1000;
+    }
+    q = s / p;
+    print(a, " ", b, " ", c, " ", d, "\n");
+    print(s, " ", p, " ", q, " ", g, " ", h, "\n");
+}
@@ -0,0 +1,30 @@
+// Test: Block layout (negative and zero tests moved out of line, equality arms, divisions whose check traps, nested arms)
+int errors = 0;
+
+void main() {
+    int i, x, s = 0, t = 0, z = 0, n = 0;
+
+    for (i = -3; i < 40; i = i + 1) {
+        x = (i * 7) % 11 - 2;
+        if (x < 0) {
+            n = n + 1;
+        } else {
+            s = s + x;
+        }
+        if (x == 0) {
+            z = z + 1;
+            if (i > 20) {
+                errors = errors + 1;
+            }
+        }
+        if (i != 5) {
+            t = t + 100 / (x + 3);
+        } else {
+            t = t - 1;
+        }
+        if (s >= 0) {
+            s = s + 1;
+        }
+    }
+    print(s, " ", t, " ", z, " ", n, " ", errors, "\n");
+}
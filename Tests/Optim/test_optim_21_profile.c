@@ -0,0 +1,30 @@
+// Test: Profile-guided optimisation (a loop never entered, a short loop, an almost always taken branch, a 50/50 branch)
+int errors = 0;
+
+void main() {
+    int i, j, x, s = 0, t = 0, u = 0, n = 0;
+
+    n = 0;
+    for (i = 0; i < n; i = i + 1) {
+        errors = errors + 1;
+    }
+    for (i = 0; i < 200; i = i + 1) {
+        x = (i * 13) % 97;
+        if (x != 50) {
+            s = s + x;
+        } else {
+            s = s - 1;
+        }
+        if (i % 2 == 0) {
+            t = t + 1;
+        } else {
+            t = t + 3;
+        }
+        j = 0;
+        while (j < 3) {
+            u = u + j * x;
+            j = j + 1;
+        }
+    }
+    print(s, " ", t, " ", u, " ", errors, "\n");
+}
@@ -0,0 +1,14 @@
+// Test: Reassociation keeps x and -x when another term of the chain assigns x
+void main() {
+    int x = 3, y, z = 4;
+
+    y = x + (x = 5) - x;
+    print("y=", y, "\n");
+
+    x = 2;
+    y = x - (x = 7) - x + 1 + 2;
+    print("y=", y, " x=", x, "\n");
+
+    y = (z = z + 1) * 2 * z * 3;
+    print("y=", y, " z=", z, "\n");
+}
@@ -1,10 +1,44 @@
 #include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
 
 #include "arch.h"
 
 #define num_arch_registers 8
 static int32_t max_regs = num_arch_registers;
 
+// ISA levels for -march, MIPS I by default
+typedef struct _isa_s {
+    const char * name;
+    uint32_t features;
+} isa_s;
+
+static const isa_s isas[] = {
+    { "mips1", 0 },
+    { "mips32", ISA_MUL | ISA_MOVCOND },
+    { "mips32r2", ISA_MUL | ISA_MOVCOND | ISA_ROTATE | ISA_BITFIELD },
+};
+
+static const isa_s * isa = &isas[0];
+
+// pipelines for -mtune, the classic 5 stage one by default
+typedef struct _core_s {
+    const char * name;
+    int32_t latency[NUM_LATENCIES];
+    int32_t branch;         // cycles lost by a taken branch, delay slot included
+    int32_t cache_size;     // bytes of each of the direct mapped I and D caches
+    int32_t line_size;
+    int32_t miss;           // cycles to fill a line
+} core_s;
+
+static const core_s cores[] = {
+    { "r3000", { 1, 2, 12, 35 }, 1, 4096, 16, 6 },
+    { "r4000", { 1, 3, 10, 69 }, 3, 8192, 16, 12 },
+    { "24k", { 1, 2, 5, 35 }, 2, 32768, 32, 20 },
+};
+
+static const core_s * core = &cores[0];
+
 
 void set_max_registers(int32_t n) {
     max_regs = n;
@@ -34,3 +68,56 @@ int32_t get_data_sec_start_addr() {
     return 0x10010000;
 }
 
+
+bool set_isa(const char * name) {
+    for (int32_t i = 0; i < (int32_t)(sizeof(isas) / sizeof(isas[0])); i++) {
+        if (strcmp(name, isas[i].name) == 0) {
+            isa = &isas[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+const char * get_isa_name() {
+    return isa->name;
+}
+
+uint32_t get_isa_features() {
+    return isa->features;
+}
+
+
+bool set_tune(const char * name) {
+    for (int32_t i = 0; i < (int32_t)(sizeof(cores) / sizeof(cores[0])); i++) {
+        if (strcmp(name, cores[i].name) == 0) {
+            core = &cores[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+const char * get_tune_name() {
+    return core->name;
+}
+
+int32_t get_latency(latency_kind kind) {
+    return core->latency[kind];
+}
+
+int32_t get_branch_penalty() {
+    return core->branch;
+}
+
+int32_t get_cache_size() {
+    return core->cache_size;
+}
+
+int32_t get_cache_line_size() {
+    return core->line_size;
+}
+
+int32_t get_miss_penalty() {
+    return core->miss;
+}
@@ -10,5 +10,33 @@ int32_t get_r0();
 int32_t get_stack_reg();
 int32_t get_data_sec_start_addr();
 
+// instructions beyond MIPS I available on the target
+#define ISA_MUL         0x01    // mul (MIPS32)
+#define ISA_MOVCOND     0x02    // movn, movz (MIPS32)
+#define ISA_ROTATE      0x04    // rotr, rotrv (MIPS32r2)
+#define ISA_BITFIELD    0x08    // ext, ins (MIPS32r2)
+
+bool set_isa(const char * name);
+const char * get_isa_name();
+uint32_t get_isa_features();
+
+// pipeline of the core chosen with -mtune: cycles until the result of an
+// instruction can be used, and costs of the simulator
+typedef enum latency_kind_s {
+    LATENCY_ALU,
+    LATENCY_LOAD,
+    LATENCY_MUL,            // mult, multu, mul
+    LATENCY_DIV,            // div, divu
+    NUM_LATENCIES,
+} latency_kind;
+
+bool set_tune(const char * name);
+const char * get_tune_name();
+int32_t get_latency(latency_kind kind);
+int32_t get_branch_penalty();
+int32_t get_cache_size();
+int32_t get_cache_line_size();
+int32_t get_miss_penalty();
+
 
 #endif
@@ -0,0 +1,777 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "arch.h"
+#include "optim.h"
+#include "asm.h"
+#include "report.h"
+#include "stats.h"
+
+extern int trace_level;
+
+
+// Assembly passes.
+// The instructions built by passe_2 are only reachable through the library,
+// which offers a fixed set of instructions. Passes that need other ones, or
+// the whole program, work on the written file: it is read back into lines,
+// transformed, and written again.
+
+#define MAX_LINE 4096
+
+static const char * reg_names[32] = {
+    "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+    "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+    "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+    "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra",
+};
+
+
+// parsing
+static char * trim(char * s) {
+    char * end;
+
+    while (isspace((unsigned char)*s)) {
+        s++;
+    }
+    end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) {
+        *--end = '\0';
+    }
+    return s;
+}
+
+static bool parse_reg(const char * s, int32_t * reg) {
+    char * end;
+
+    if (*s++ != '$') {
+        return false;
+    }
+    if (isdigit((unsigned char)*s)) {
+        long r = strtol(s, &end, 10);
+        *reg = (int32_t)r;
+        return *end == '\0' && r >= 0 && r < 32;
+    }
+    for (int32_t i = 0; i < 32; i++) {
+        if (strcmp(s, reg_names[i]) == 0) {
+            *reg = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_arg(char * s, asm_arg_s * arg) {
+    char * paren = strchr(s, '(');
+    char * end;
+
+    arg->label = NULL;
+    if (*s == '$') {
+        arg->kind = ASM_ARG_REG;
+        return parse_reg(s, &arg->reg);
+    }
+    if (paren != NULL) {
+        char * close = strchr(paren, ')');
+        if (close == NULL || close[1] != '\0') {
+            return false;
+        }
+        *close = '\0';
+        *paren = '\0';
+        arg->kind = ASM_ARG_MEM;
+        arg->imm = (*s == '\0') ? 0 : (int32_t)strtol(s, &end, 0);
+        return (*s == '\0' || *end == '\0') && parse_reg(trim(paren + 1), &arg->reg);
+    }
+    if (isdigit((unsigned char)*s) || *s == '-') {
+        arg->kind = ASM_ARG_IMM;
+        arg->imm = (int32_t)strtoll(s, &end, 0);
+        return *end == '\0';
+    }
+    arg->kind = ASM_ARG_LABEL;
+    arg->label = strdupl(s);
+    return true;
+}
+
+static bool is_label_char(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '$';
+}
+
+// parses one line, a label followed by something on the same line gives two lines
+static int32_t parse_line(char * s, asm_line_s * lines) {
+    char * p = s;
+    int32_t n = 0;
+
+    memset(lines, 0, 2 * sizeof(asm_line_s));
+    s[strcspn(s, "\r\n")] = '\0';
+    if (*trim(s) == '\0' || *trim(s) == '#') {
+        lines[0].kind = ASM_LINE_TEXT;
+        lines[0].text = strdupl(s);
+        return 1;
+    }
+
+    s = trim(s);
+    p = s;
+    while (is_label_char(*p)) {
+        p++;
+    }
+    if (p > s && *p == ':') {
+        *p = '\0';
+        lines[0].kind = ASM_LINE_LABEL;
+        lines[0].text = strdupl(s);
+        n = 1;
+        s = trim(p + 1);
+        if (*s == '\0') {
+            return n;
+        }
+    }
+
+    asm_line_s * l = &lines[n];
+    if (*s == '.') {
+        l->kind = ASM_LINE_DIRECTIVE;
+        l->text = strdupl(s);
+        return n + 1;
+    }
+
+    l->kind = ASM_LINE_INST;
+    p = s;
+    while (*p != '\0' && !isspace((unsigned char)*p)) {
+        p++;
+    }
+    if (p - s >= (int32_t)sizeof(l->op)) {
+        return -1;
+    }
+    memcpy(l->op, s, p - s);
+    l->op[p - s] = '\0';
+
+    s = trim(p);
+    while (*s != '\0') {
+        char * comma = strchr(s, ',');
+        if (comma != NULL) {
+            *comma = '\0';
+        }
+        if (l->nargs == ASM_MAX_ARGS || !parse_arg(trim(s), &l->args[l->nargs])) {
+            return -1;
+        }
+        l->nargs++;
+        if (comma == NULL) {
+            break;
+        }
+        s = comma + 1;
+    }
+    return n + 1;
+}
+
+static void add_lines(asm_prog_s * prog, int32_t pos, asm_line_s * lines, int32_t n) {
+    if (prog->size + n > prog->capacity) {
+        prog->capacity = 2 * (prog->size + n);
+        prog->lines = realloc(prog->lines, prog->capacity * sizeof(asm_line_s));
+    }
+    memmove(&prog->lines[pos + n], &prog->lines[pos], (prog->size - pos) * sizeof(asm_line_s));
+    memcpy(&prog->lines[pos], lines, n * sizeof(asm_line_s));
+    prog->size += n;
+}
+
+// a whole line, however long; the strings folded by peval can be very long
+static char * read_line(FILE * f, char ** buf, int32_t * size) {
+    int32_t len = 0;
+
+    while (fgets(*buf + len, *size - len, f) != NULL) {
+        len += (int32_t)strlen(*buf + len);
+        if ((*buf)[len - 1] == '\n') {
+            return *buf;
+        }
+        *size *= 2;
+        *buf = realloc(*buf, *size);
+    }
+    return (len > 0) ? *buf : NULL;
+}
+
+void asm_read(const char * filename, asm_prog_s * prog) {
+    FILE * f = fopen(filename, "r");
+    int32_t size = MAX_LINE;
+    char * buf = malloc(size);
+    asm_line_s lines[2];
+    int32_t lineno = 0, mark = 0, src;
+    double weight;
+
+    if (f == NULL) {
+        fprintf(stderr, "Error: cannot read back '%s'\n", filename);
+        exit(1);
+    }
+    while (read_line(f, &buf, &size) != NULL) {
+        const char * s = report_costs ? strstr(buf, "# line ") : NULL;
+        lineno++;
+        // the source line of -a goes with the instructions that follow
+        if (s != NULL && sscanf(s, "# line %d %lf", &src, &weight) == 2) {
+            mark = report_mark(src, weight);
+            continue;
+        }
+        int32_t n = parse_line(buf, lines);
+        if (n < 0) {
+            fprintf(stderr, "Error: '%s' line %d: unexpected assembly\n", filename, lineno);
+            exit(1);
+        }
+        for (int32_t i = 0; i < n; i++) {
+            lines[i].mark = mark;
+        }
+        add_lines(prog, prog->size, lines, n);
+    }
+    free(buf);
+    fclose(f);
+}
+
+
+// writing
+static void write_inst(FILE * f, asm_line_s * l) {
+    bool hex = (strcmp(l->op, "ori") == 0 || strcmp(l->op, "andi") == 0
+                || strcmp(l->op, "xori") == 0 || strcmp(l->op, "lui") == 0);
+
+    fprintf(f, "    %s", l->op);
+    for (int32_t i = 0; i < l->nargs; i++) {
+        asm_arg_s * a = &l->args[i];
+        fprintf(f, i == 0 ? " " : ", ");
+        switch (a->kind) {
+            case ASM_ARG_REG:
+                fprintf(f, "$%d", a->reg);
+                break;
+            case ASM_ARG_IMM:
+                if (hex) {
+                    fprintf(f, "0x%x", (uint32_t)a->imm);
+                } else {
+                    fprintf(f, "%d", a->imm);
+                }
+                break;
+            case ASM_ARG_MEM:
+                fprintf(f, "%d($%d)", a->imm, a->reg);
+                break;
+            case ASM_ARG_LABEL:
+                fprintf(f, "%s", a->label);
+                break;
+        }
+    }
+    fprintf(f, "\n");
+}
+
+void asm_write(const char * filename, asm_prog_s * prog) {
+    FILE * f = fopen(filename, "w");
+
+    if (f == NULL) {
+        fprintf(stderr, "Error: cannot write '%s'\n", filename);
+        exit(1);
+    }
+    for (int32_t i = 0; i < prog->size; i++) {
+        asm_line_s * l = &prog->lines[i];
+        switch (l->kind) {
+            case ASM_LINE_INST:
+                write_inst(f, l);
+                break;
+            case ASM_LINE_LABEL:
+                // a data label stays on the line of its directive
+                if (i + 1 < prog->size && prog->lines[i + 1].kind == ASM_LINE_DIRECTIVE) {
+                    fprintf(f, "%s: %s\n", l->text, prog->lines[++i].text);
+                } else {
+                    fprintf(f, "%s:\n", l->text);
+                }
+                break;
+            case ASM_LINE_DIRECTIVE:
+            case ASM_LINE_TEXT:
+                fprintf(f, "%s\n", l->text);
+                break;
+        }
+    }
+    fclose(f);
+}
+
+static void free_line(asm_line_s * l) {
+    free(l->text);
+    for (int32_t i = 0; i < l->nargs; i++) {
+        free(l->args[i].label);
+    }
+}
+
+void asm_free(asm_prog_s * prog) {
+    for (int32_t i = 0; i < prog->size; i++) {
+        free_line(&prog->lines[i]);
+    }
+    free(prog->lines);
+    prog->lines = NULL;
+    prog->size = 0;
+    prog->capacity = 0;
+}
+
+
+// editing
+// inserts the line given in assembly syntax before pos, returns the number
+// of lines added (a label and its directive make two)
+int32_t asm_insert(asm_prog_s * prog, int32_t pos, const char * fmt, ...) {
+    char buf[MAX_LINE];
+    asm_line_s lines[2];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    int32_t n = parse_line(buf, lines);
+    if (n < 0) {
+        fprintf(stderr, "Error: bad generated assembly '%s'\n", buf);
+        exit(1);
+    }
+    // code added after an instruction is charged to its line by -a
+    for (int32_t i = 0; i < n && pos > 0 && prog->lines[pos - 1].kind == ASM_LINE_INST; i++) {
+        lines[i].mark = prog->lines[pos - 1].mark;
+    }
+    add_lines(prog, pos, lines, n);
+    return n;
+}
+
+void asm_remove(asm_prog_s * prog, int32_t pos) {
+    free_line(&prog->lines[pos]);
+    memmove(&prog->lines[pos], &prog->lines[pos + 1], (prog->size - pos - 1) * sizeof(asm_line_s));
+    prog->size--;
+}
+
+bool asm_is_inst(asm_line_s * l, const char * op) {
+    return l->kind == ASM_LINE_INST && strcmp(l->op, op) == 0;
+}
+
+int32_t asm_find_directive(asm_prog_s * prog, const char * directive) {
+    for (int32_t i = 0; i < prog->size; i++) {
+        if (prog->lines[i].kind == ASM_LINE_DIRECTIVE && strcmp(prog->lines[i].text, directive) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int32_t asm_find_label(asm_prog_s * prog, const char * label) {
+    for (int32_t i = 0; i < prog->size; i++) {
+        if (prog->lines[i].kind == ASM_LINE_LABEL && strcmp(prog->lines[i].text, label) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool asm_is_referenced(asm_prog_s * prog, const char * label) {
+    for (int32_t i = 0; i < prog->size; i++) {
+        asm_line_s * l = &prog->lines[i];
+        for (int32_t a = 0; l->kind == ASM_LINE_INST && a < l->nargs; a++) {
+            if (l->args[a].kind == ASM_ARG_LABEL && strcmp(l->args[a].label, label) == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// name of a label not used yet, in the numbering of passe_2
+void asm_new_label(asm_prog_s * prog, char * name, int32_t size) {
+    int32_t max = 0;
+
+    for (int32_t i = 0; i < prog->size; i++) {
+        asm_line_s * l = &prog->lines[i];
+        if (l->kind == ASM_LINE_LABEL && strncmp(l->text, "_L", 2) == 0 && atoi(l->text + 2) > max) {
+            max = atoi(l->text + 2);
+        }
+    }
+    snprintf(name, size, "_L%d", max + 1);
+}
+
+// position after the last line of the .data section
+int32_t asm_data_end(asm_prog_s * prog) {
+    int32_t pos = asm_find_directive(prog, ".text");
+
+    if (pos < 0) {
+        pos = prog->size;
+    }
+    while (pos > 0 && prog->lines[pos - 1].kind == ASM_LINE_TEXT) {
+        pos--;
+    }
+    return pos;
+}
+
+
+// instruction set
+// Operands of each instruction, in order: d is a written register, s a read
+// register, u a register read and written, m a memory operand (its base
+// register is read), i an immediate, l a label. HI and LO are counted as the
+// registers 32 and 33. The MIPS32 ones only come from -march.
+typedef struct _asm_op_s {
+    const char * op;
+    const char * operands;
+    uint32_t flags;
+    asm_regs uses;          // implicit operands
+    asm_regs defs;
+} asm_op_s;
+
+#define REG(r) ((asm_regs)1 << (r))
+#define HILO (REG(ASM_REG_HI) | REG(ASM_REG_LO))
+
+static const asm_op_s asm_ops[] = {
+    { "addu", "dss", 0, 0, 0 },
+    { "subu", "dss", 0, 0, 0 },
+    { "and", "dss", 0, 0, 0 },
+    { "or", "dss", 0, 0, 0 },
+    { "xor", "dss", 0, 0, 0 },
+    { "nor", "dss", 0, 0, 0 },
+    { "slt", "dss", 0, 0, 0 },
+    { "sltu", "dss", 0, 0, 0 },
+    { "sllv", "dss", 0, 0, 0 },
+    { "srlv", "dss", 0, 0, 0 },
+    { "srav", "dss", 0, 0, 0 },
+    { "addiu", "dsi", 0, 0, 0 },
+    { "andi", "dsi", 0, 0, 0 },
+    { "ori", "dsi", 0, 0, 0 },
+    { "xori", "dsi", 0, 0, 0 },
+    { "slti", "dsi", 0, 0, 0 },
+    { "sltiu", "dsi", 0, 0, 0 },
+    { "sll", "dsi", 0, 0, 0 },
+    { "srl", "dsi", 0, 0, 0 },
+    { "sra", "dsi", 0, 0, 0 },
+    { "lui", "di", 0, 0, 0 },
+    { "rotr", "dsi", 0, 0, 0 },
+    { "rotrv", "dss", 0, 0, 0 },
+    { "ext", "dsii", 0, 0, 0 },
+    { "ins", "usii", 0, 0, 0 },
+    { "movn", "uss", 0, 0, 0 },
+    { "movz", "uss", 0, 0, 0 },
+    { "mult", "ss", 0, 0, HILO },
+    { "multu", "ss", 0, 0, HILO },
+    { "div", "ss", 0, 0, HILO },
+    { "divu", "ss", 0, 0, HILO },
+    { "mul", "dss", 0, 0, HILO },
+    { "mflo", "d", 0, REG(ASM_REG_LO), 0 },
+    { "mfhi", "d", 0, REG(ASM_REG_HI), 0 },
+    { "lw", "dm", ASM_OP_LOAD, 0, 0 },
+    { "lb", "dm", ASM_OP_LOAD, 0, 0 },
+    { "sw", "sm", ASM_OP_STORE, 0, 0 },
+    { "sb", "sm", ASM_OP_STORE, 0, 0 },
+    { "beq", "ssl", ASM_OP_BRANCH, 0, 0 },
+    { "bne", "ssl", ASM_OP_BRANCH, 0, 0 },
+    { "bgez", "sl", ASM_OP_BRANCH, 0, 0 },
+    { "bltz", "sl", ASM_OP_BRANCH, 0, 0 },
+    { "bgtz", "sl", ASM_OP_BRANCH, 0, 0 },
+    { "blez", "sl", ASM_OP_BRANCH, 0, 0 },
+    { "j", "l", ASM_OP_JUMP, 0, 0 },
+    { "jr", "s", ASM_OP_JUMP, 0, 0 },
+    // the runtime of buffer-output clobbers $2-$7 and $31
+    { "jal", "l", ASM_OP_CALL, REG(2) | REG(4), 0xFC | REG(31) },
+    { "teq", "ss", ASM_OP_TRAP, 0, 0 },
+    // buffer-output replaces the prints by calls that clobber $4, the file
+    // services of -fprofile-generate read $5 and $6
+    { "syscall", "", ASM_OP_SYSCALL, REG(2) | REG(4) | REG(5) | REG(6), REG(2) | REG(4) },
+    { "nop", "", 0, 0, 0 },
+};
+
+#define NUM_ASM_OPS ((int32_t)(sizeof(asm_ops) / sizeof(asm_ops[0])))
+
+static const asm_op_s * find_op(asm_line_s * l) {
+    if (l->kind != ASM_LINE_INST) {
+        return NULL;
+    }
+    for (int32_t i = 0; i < NUM_ASM_OPS; i++) {
+        if (strcmp(asm_ops[i].op, l->op) == 0) {
+            return &asm_ops[i];
+        }
+    }
+    return NULL;
+}
+
+uint32_t asm_op_flags(asm_line_s * l) {
+    const asm_op_s * op = find_op(l);
+
+    if (l->kind != ASM_LINE_INST) {
+        return 0;
+    }
+    return (op == NULL) ? ASM_OP_UNKNOWN : op->flags;
+}
+
+// registers read by an instruction, all of them for an unknown one
+asm_regs asm_uses(asm_line_s * l) {
+    const asm_op_s * op = find_op(l);
+    asm_regs uses;
+
+    if (op == NULL) {
+        return (l->kind == ASM_LINE_INST) ? ~(asm_regs)0 : 0;
+    }
+    uses = op->uses;
+    for (int32_t i = 0; op->operands[i] != '\0' && i < l->nargs; i++) {
+        if (op->operands[i] == 's' || op->operands[i] == 'u' || op->operands[i] == 'm') {
+            uses |= REG(l->args[i].reg);
+        }
+    }
+    return uses & ~REG(0);
+}
+
+// registers written by an instruction, all of them for an unknown one
+asm_regs asm_defs(asm_line_s * l) {
+    const asm_op_s * op = find_op(l);
+    asm_regs defs;
+
+    if (op == NULL) {
+        return (l->kind == ASM_LINE_INST) ? ~(asm_regs)0 : 0;
+    }
+    defs = op->defs;
+    if ((op->operands[0] == 'd' || op->operands[0] == 'u') && l->nargs > 0) {
+        defs |= REG(l->args[0].reg);
+    }
+    return defs & ~REG(0);
+}
+
+// the written register keeps some of its bits, like for movn or ins
+bool asm_reads_dest(asm_line_s * l) {
+    const asm_op_s * op = find_op(l);
+
+    return op != NULL && op->operands[0] == 'u';
+}
+
+// cycles until the result of an instruction can be used, on the core of
+// -mtune; for mult and div, their result in HI and LO
+int32_t asm_latency(asm_line_s * l) {
+    if (asm_op_flags(l) & ASM_OP_LOAD) {
+        return get_latency(LATENCY_LOAD);
+    }
+    if (asm_is_inst(l, "mult") || asm_is_inst(l, "multu") || asm_is_inst(l, "mul")) {
+        return get_latency(LATENCY_MUL);
+    }
+    if (asm_is_inst(l, "div") || asm_is_inst(l, "divu")) {
+        return get_latency(LATENCY_DIV);
+    }
+    return get_latency(LATENCY_ALU);
+}
+
+// bytes accessed by a load or a store
+int32_t asm_mem_width(asm_line_s * l) {
+    return (l->op[1] == 'b') ? 1 : 4;
+}
+
+// label of a branch or a jump, NULL for jr
+const char * asm_target(asm_line_s * l) {
+    if (l->nargs == 0 || l->args[l->nargs - 1].kind != ASM_ARG_LABEL) {
+        return NULL;
+    }
+    return l->args[l->nargs - 1].label;
+}
+
+void asm_set_target(asm_line_s * l, const char * label) {
+    free(l->args[l->nargs - 1].label);
+    l->args[l->nargs - 1].label = strdupl((char *)label);
+}
+
+// a label or a transfer of control, passe_2 keeps no value in a register
+// across it
+bool asm_is_boundary(asm_line_s * l) {
+    return l->kind == ASM_LINE_LABEL
+        || (asm_op_flags(l) & (ASM_OP_BRANCH | ASM_OP_JUMP | ASM_OP_CALL | ASM_OP_UNKNOWN)) != 0;
+}
+
+// value computed by an ALU instruction from the values of its register
+// operands a and b, the immediate being taken from the line
+bool asm_eval(asm_line_s * l, int32_t a, int32_t b, int32_t * result) {
+    uint32_t ua = (uint32_t)a, ub = (uint32_t)b;
+    const char * op = l->op;
+
+    if (l->kind != ASM_LINE_INST) {
+        return false;
+    }
+    if (strcmp(op, "lui") == 0) {
+        *result = (int32_t)((uint32_t)l->args[1].imm << 16);
+        return true;
+    }
+    if (l->nargs != 3 || l->args[0].kind != ASM_ARG_REG) {
+        return false;
+    }
+    if (l->args[2].kind == ASM_ARG_IMM) {
+        b = l->args[2].imm;
+        // the logical immediates are zero extended
+        if (strcmp(op, "andi") == 0 || strcmp(op, "ori") == 0 || strcmp(op, "xori") == 0) {
+            b &= 0xFFFF;
+        }
+        ub = (uint32_t)b;
+    }
+
+    if (strcmp(op, "addu") == 0 || strcmp(op, "addiu") == 0) {
+        *result = (int32_t)(ua + ub);
+    } else if (strcmp(op, "subu") == 0) {
+        *result = (int32_t)(ua - ub);
+    } else if (strcmp(op, "and") == 0 || strcmp(op, "andi") == 0) {
+        *result = a & b;
+    } else if (strcmp(op, "or") == 0 || strcmp(op, "ori") == 0) {
+        *result = a | b;
+    } else if (strcmp(op, "xor") == 0 || strcmp(op, "xori") == 0) {
+        *result = a ^ b;
+    } else if (strcmp(op, "nor") == 0) {
+        *result = ~(a | b);
+    } else if (strcmp(op, "slt") == 0 || strcmp(op, "slti") == 0) {
+        *result = a < b;
+    } else if (strcmp(op, "sltu") == 0 || strcmp(op, "sltiu") == 0) {
+        *result = ua < ub;
+    } else if (strcmp(op, "mul") == 0) {
+        *result = (int32_t)(ua * ub);
+    } else if (strcmp(op, "rotrv") == 0 || strcmp(op, "rotr") == 0) {
+        *result = (int32_t)((ua >> (ub & 31)) | (ua << ((32 - (ub & 31)) & 31)));
+    } else if (strcmp(op, "sllv") == 0 || strcmp(op, "sll") == 0) {
+        *result = (int32_t)(ua << (ub & 31));
+    } else if (strcmp(op, "srlv") == 0 || strcmp(op, "srl") == 0) {
+        *result = (int32_t)(ua >> (ub & 31));
+    } else if (strcmp(op, "srav") == 0 || strcmp(op, "sra") == 0) {
+        *result = a >> (ub & 31);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// outcome of a conditional branch from the values of its operands
+bool asm_eval_branch(asm_line_s * l, int32_t a, int32_t b, bool * taken) {
+    const char * op = l->op;
+
+    if (strcmp(op, "beq") == 0) {
+        *taken = (a == b);
+    } else if (strcmp(op, "bne") == 0) {
+        *taken = (a != b);
+    } else if (strcmp(op, "bgez") == 0) {
+        *taken = (a >= 0);
+    } else if (strcmp(op, "bltz") == 0) {
+        *taken = (a < 0);
+    } else if (strcmp(op, "bgtz") == 0) {
+        *taken = (a > 0);
+    } else if (strcmp(op, "blez") == 0) {
+        *taken = (a <= 0);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+
+// data layout
+static int32_t asciiz_size(const char * s) {
+    const char * open = strchr(s, '"');
+    const char * close = strrchr(s, '"');
+    int32_t size = 1;
+
+    if (open == NULL || close == open) {
+        return size;
+    }
+    for (const char * p = open + 1; p < close; p++) {
+        if (*p == '\\') {
+            p++;
+        }
+        size++;
+    }
+    return size;
+}
+
+static int32_t count_values(const char * s) {
+    int32_t n = 1;
+
+    for (; *s != '\0'; s++) {
+        n += (*s == ',');
+    }
+    return n;
+}
+
+// bytes of the .data section, with the alignment of the assembler
+int32_t asm_data_size(asm_prog_s * prog) {
+    int32_t size = 0;
+    bool in_data = false;
+
+    for (int32_t i = 0; i < prog->size; i++) {
+        asm_line_s * l = &prog->lines[i];
+        if (l->kind != ASM_LINE_DIRECTIVE) {
+            continue;
+        }
+        if (strcmp(l->text, ".data") == 0 || strcmp(l->text, ".text") == 0) {
+            in_data = (l->text[1] == 'd');
+        } else if (!in_data) {
+            continue;
+        } else if (strncmp(l->text, ".word", 5) == 0) {
+            size = (size + 3) & ~3;
+            size += 4 * count_values(l->text + 5);
+        } else if (strncmp(l->text, ".half", 5) == 0) {
+            size = (size + 1) & ~1;
+            size += 2 * count_values(l->text + 5);
+        } else if (strncmp(l->text, ".byte", 5) == 0) {
+            size += count_values(l->text + 5);
+        } else if (strncmp(l->text, ".asciiz", 7) == 0) {
+            size += asciiz_size(l->text + 7);
+        } else if (strncmp(l->text, ".space", 6) == 0) {
+            size += atoi(l->text + 6);
+        } else if (strncmp(l->text, ".align", 6) == 0) {
+            int32_t a = 1 << atoi(l->text + 6);
+            size = (size + a - 1) & ~(a - 1);
+        }
+    }
+    return size;
+}
+
+
+// entry point, after the program has been written
+void optimise_asm(node_t root, const char * filename) {
+    asm_prog_s prog = { NULL, 0, 0 };
+    bool changed = false;
+
+    if (get_isa_features() == 0 && !opt_pack_data && !opt_thread_jumps && !opt_merge_tails && !opt_if_convert
+        && !opt_peephole && !opt_buffer_output && !opt_layout && !opt_schedule && !opt_delay_slots
+        && !opt_profile_generate && !report_costs && !opt_stats && !opt_stats_json) {
+        return;
+    }
+
+    asm_read(filename, &prog);
+    // the code as passe_2 wrote it, then its marks go
+    if (opt_stats || opt_stats_json) {
+        changed |= stats_asm(&prog);
+    }
+    // the data addresses are still the ones built by passe_2
+    if (opt_pack_data) {
+        changed |= pack_data_asm(&prog, root);
+    }
+    // the counters go after the final data section, before any code moves
+    if (opt_profile_generate) {
+        changed |= instrument_asm(&prog);
+    }
+    if (get_isa_features() != 0) {
+        changed |= select_insts_asm(&prog);
+    }
+    if (opt_thread_jumps) {
+        changed |= thread_jumps_asm(&prog);
+    }
+    if (opt_merge_tails) {
+        changed |= merge_tails_asm(&prog);
+    }
+    if (opt_if_convert) {
+        changed |= if_convert_asm(&prog);
+    }
+    if (opt_peephole) {
+        changed |= peephole_asm(&prog);
+    }
+    if (opt_buffer_output) {
+        changed |= buffer_output_asm(&prog);
+    }
+    if (opt_layout) {
+        changed |= layout_asm(&prog);
+    }
+    if (opt_schedule) {
+        changed |= schedule_asm(&prog);
+    }
+    // last, the other passes do not know about the slots
+    if (opt_delay_slots) {
+        changed |= fill_delay_slots_asm(&prog);
+    }
+    // the code as it runs, without the marks of passe_2
+    if (report_costs) {
+        report_costs_asm(&prog);
+        changed = true;
+    }
+    if (changed) {
+        asm_write(filename, &prog);
+    }
+    asm_free(&prog);
+}
@@ -0,0 +1,108 @@
+
+#ifndef _ASM_H_
+#define _ASM_H_
+
+#include "defs.h"
+
+
+/* Assembly program, as read back from the file written by the library */
+
+typedef enum asm_line_kind_s {
+    ASM_LINE_INST,
+    ASM_LINE_LABEL,
+    ASM_LINE_DIRECTIVE,
+    ASM_LINE_TEXT,          // blank line or comment, kept verbatim
+} asm_line_kind;
+
+typedef enum asm_arg_kind_s {
+    ASM_ARG_REG,
+    ASM_ARG_IMM,
+    ASM_ARG_MEM,            // imm($reg)
+    ASM_ARG_LABEL,
+} asm_arg_kind;
+
+typedef struct _asm_arg_s {
+    asm_arg_kind kind;
+    int32_t reg;
+    int32_t imm;
+    char * label;
+} asm_arg_s;
+
+#define ASM_MAX_ARGS 4
+
+typedef struct _asm_line_s {
+    asm_line_kind kind;
+    char * text;            // label name, directive with its operands, or verbatim line
+    char op[8];
+    int32_t nargs;
+    asm_arg_s args[ASM_MAX_ARGS];
+    int32_t mark;           // source line of -a it was emitted for, 0 if none
+} asm_line_s;
+
+// registers as a bit mask, with HI and LO after the 32 general ones
+typedef uint64_t asm_regs;
+
+#define ASM_REG_HI 32
+#define ASM_REG_LO 33
+
+// registers allocated by passe_2, dead at a label or a transfer of control
+#define ASM_SCRATCH_REGS ((asm_regs)0x03FFFF00)
+
+// kinds of instruction
+#define ASM_OP_LOAD     0x01
+#define ASM_OP_STORE    0x02
+#define ASM_OP_BRANCH   0x04    // conditional
+#define ASM_OP_JUMP     0x08
+#define ASM_OP_CALL     0x10
+#define ASM_OP_TRAP     0x20
+#define ASM_OP_SYSCALL  0x40
+#define ASM_OP_UNKNOWN  0x80
+
+typedef struct _asm_prog_s {
+    asm_line_s * lines;
+    int32_t size;
+    int32_t capacity;
+} asm_prog_s;
+
+void asm_read(const char * filename, asm_prog_s * prog);
+void asm_write(const char * filename, asm_prog_s * prog);
+void asm_free(asm_prog_s * prog);
+int32_t asm_insert(asm_prog_s * prog, int32_t pos, const char * fmt, ...);
+void asm_remove(asm_prog_s * prog, int32_t pos);
+bool asm_is_inst(asm_line_s * l, const char * op);
+int32_t asm_find_directive(asm_prog_s * prog, const char * directive);
+int32_t asm_find_label(asm_prog_s * prog, const char * label);
+bool asm_is_referenced(asm_prog_s * prog, const char * label);
+void asm_new_label(asm_prog_s * prog, char * name, int32_t size);
+int32_t asm_data_end(asm_prog_s * prog);
+int32_t asm_data_size(asm_prog_s * prog);
+uint32_t asm_op_flags(asm_line_s * l);
+asm_regs asm_uses(asm_line_s * l);
+asm_regs asm_defs(asm_line_s * l);
+bool asm_reads_dest(asm_line_s * l);
+int32_t asm_latency(asm_line_s * l);
+int32_t asm_mem_width(asm_line_s * l);
+const char * asm_target(asm_line_s * l);
+void asm_set_target(asm_line_s * l, const char * label);
+bool asm_is_boundary(asm_line_s * l);
+bool asm_eval(asm_line_s * l, int32_t a, int32_t b, int32_t * result);
+bool asm_eval_branch(asm_line_s * l, int32_t a, int32_t b, bool * taken);
+void optimise_asm(node_t root, const char * filename);
+
+
+/* Passes */
+
+bool pack_data_asm(asm_prog_s * prog, node_t root);
+bool instrument_asm(asm_prog_s * prog);
+int32_t get_branch_profile(const char * label);
+bool select_insts_asm(asm_prog_s * prog);
+bool thread_jumps_asm(asm_prog_s * prog);
+bool merge_tails_asm(asm_prog_s * prog);
+bool if_convert_asm(asm_prog_s * prog);
+bool peephole_asm(asm_prog_s * prog);
+bool buffer_output_asm(asm_prog_s * prog);
+bool layout_asm(asm_prog_s * prog);
+bool schedule_asm(asm_prog_s * prog);
+bool fill_delay_slots_asm(asm_prog_s * prog);
+
+#endif
@@ -12,12 +12,15 @@
 #include "defs.h"
 #include "common.h"
 #include "arch.h"
+#include "optim.h"
 
 extern char *infile;
 extern char *outfile;
 int32_t trace_level = DEFAULT_TRACE_LEVEL;
 extern bool stop_after_syntax;
 extern bool stop_after_verif;
+extern bool run_program;
+extern bool report_costs;
 
 static void print_banner(void)
 {
@@ -34,8 +37,26 @@ static void print_help(const char *prog_name)
     printf("  -o <filename> Output assembly file (default: out.s)\n");
     printf("  -t <int>      Trace level 0-5 (default: 0)\n");
     printf("  -r <int>      Max registers 4-8 (default: 8)\n");
+    printf("  -O <int>      Optimisation level 0-2 (default: 0)\n");
+    printf("  -f <pass>     Enable (-f<pass>) or disable (-fno-<pass>) an optimisation:\n");
+    printf("                simplify, licm, unroll, scev, ivsr, rotate, vrp, merge-prints,\n");
+    printf("                merge-strings, order-globals, pack-data, peephole, thread-jumps,\n");
+    printf("                merge-tails, if-convert, layout, schedule,\n");
+    printf("                peval, buffer-output, delay-slots, profile-generate, profile-use\n");
+    printf("                (not implied by -O; the profile is written to and read from minicc.prof)\n");
+    printf("                stats, stats-json: code generation statistics on stderr\n");
+    printf("  -f <p>=<int>  Set an optimisation parameter:\n");
+    printf("                unroll-factor (2-16, default 4), unroll-budget (8-4096, default 128),\n");
+    printf("                peval-fuel (1000-1000000000, default 1000000),\n");
+    printf("                ifconv-limit (0-64, default 4)\n");
+    printf("  -march=<isa>  Target ISA: mips1 (default), mips32, mips32r2\n");
+    printf("  -mtune=<core> Pipeline latencies for scheduling: r3000 (default), r4000, 24k\n");
     printf("  -s            Stop after syntax analysis\n");
     printf("  -v            Stop after verification (passe_1)\n");
+    printf("  -x            Run the program in the built-in simulator, statistics on stderr\n");
+    printf("                (a .s input file is run without compiling)\n");
+    printf("  -a            Annotate the source with the cycles each line is estimated to cost,\n");
+    printf("                and list the hottest lines, on stderr (nothing is run)\n");
     printf("  -h            Display this help message\n");
 }
 
@@ -46,8 +67,11 @@ void parse_args(int argc, char **argv)
     bool help = false;
     int max_reg = 8;
     bool max_reg_set = false;
+    int level = 0;
+    char *opt_flags_args[32];
+    int num_opt_flags = 0;
 
-    while ((opt = getopt(argc, argv, "bo:t:r:svh")) != -1)
+    while ((opt = getopt(argc, argv, "bo:t:r:O:f:m:svxah")) != -1)
     {
         switch (opt)
         {
@@ -74,12 +98,49 @@ void parse_args(int argc, char **argv)
                 exit(1);
             }
             break;
+        case 'O':
+            level = atoi(optarg);
+            if (level < 0 || level > 2)
+            {
+                fprintf(stderr, "Error: optimisation level must be between 0 and 2\n");
+                exit(1);
+            }
+            break;
+        case 'f':
+            if (num_opt_flags == 32)
+            {
+                fprintf(stderr, "Error: too many -f options\n");
+                exit(1);
+            }
+            opt_flags_args[num_opt_flags++] = optarg;
+            break;
+        case 'm':
+            if (strncmp(optarg, "tune=", 5) == 0)
+            {
+                if (!set_tune(optarg + 5))
+                {
+                    fprintf(stderr, "Error: core must be -mtune=r3000, r4000 or 24k\n");
+                    exit(1);
+                }
+            }
+            else if (strncmp(optarg, "arch=", 5) != 0 || !set_isa(optarg + 5))
+            {
+                fprintf(stderr, "Error: target must be -march=mips1, mips32 or mips32r2\n");
+                exit(1);
+            }
+            break;
         case 's':
             stop_after_syntax = true;
             break;
         case 'v':
             stop_after_verif = true;
             break;
+        case 'x':
+            run_program = true;
+            break;
+        case 'a':
+            report_costs = true;
+            break;
         case 'h':
             help = true;
             break;
@@ -121,6 +182,24 @@ void parse_args(int argc, char **argv)
         set_max_registers(max_reg);
     }
 
+    // Optimisation level first, then the individual -f switches override it
+    set_opt_level(level);
+    for (int i = 0; i < num_opt_flags; i++)
+    {
+        if (!set_opt_flag(opt_flags_args[i]))
+        {
+            fprintf(stderr, "Error: invalid optimisation option '%s'\n", opt_flags_args[i]);
+            exit(1);
+        }
+    }
+
+    // Validation: a profile is either written or read
+    if (opt_profile_generate && opt_profile_use)
+    {
+        fprintf(stderr, "Error: -fprofile-generate and -fprofile-use are mutually exclusive\n");
+        exit(1);
+    }
+
     // Input file is required
     if (optind >= argc)
     {
@@ -144,6 +223,8 @@ void parse_args(int argc, char **argv)
     void free_nodes(node_t n) {
         if (!n) return;
 
+        drop_profile_site(n);
+
         if (n->opr) {
             for (int32_t i = 0; i < n->nops; i++) {
                 free_nodes(n->opr[i]);
@@ -201,18 +282,29 @@ static int32_t dump_tree2dot_rec(FILE *f, node_t n, int32_t node_num)
         break;
     case NODE_STRINGVAL:
     {
+        // text between the quotes, cut to the size of the label
         char str[32];
-        int32_t i = 1;
-        while (true)
+        int32_t len = (int32_t)strlen(n->str) - 2;
+        if (len > (int32_t)sizeof(str) - 1)
         {
-            str[i - 1] = n->str[i];
-            i += 1;
-            if (n->str[i] == '"')
-            {
-                str[i - 1] = '\0';
-                break;
-            }
+            len = (int32_t)sizeof(str) - 1;
+        }
+        if (len < 0)
+        {
+            len = 0;
+        }
+        memcpy(str, n->str + 1, len);
+        // an escape cut in two would escape the end of the label
+        int32_t backslashes = 0;
+        while (backslashes < len && str[len - 1 - backslashes] == '\\')
+        {
+            backslashes++;
+        }
+        if (backslashes % 2 == 1)
+        {
+            len--;
         }
+        str[len] = '\0';
         fprintf(f, "    N%d [shape=record, label=\"{{NODE %s|Type: %s}|{val: %s}}\"];\n", node_num, node_nature2string(n->nature), node_type2string(n->type), str);
     }
     break;
@@ -0,0 +1,420 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "miniccutils.h"
+#include "arch.h"
+#include "optim.h"
+#include "asm.h"
+
+extern int trace_level;
+
+
+// Data layout.
+// String literals are pooled: identical literals share one .asciiz, and a
+// literal that ends another one points into it ("value\n" is the end of
+// "new value\n"). Globals are placed by decreasing use count, uses in loops
+// counting more, so the hot ones come first in the data section.
+// With pack-data, the written program gets a packed data section: bools take
+// one byte, accessed with lb and sb, and the globals initialised to 0 move to
+// a .space region after the strings, so that they take no initialiser.
+
+// weight of a use at loop depth d is 1 << (USE_WEIGHT_SHIFT * d), capped
+#define USE_WEIGHT_SHIFT 3
+#define MAX_USE_WEIGHT_DEPTH 8
+
+typedef struct _literal_s {
+    char * str;             // as written, with its quotes
+    char * bytes;           // decoded text
+    int32_t len;
+    int32_t offset;
+    int32_t first;          // rank of the first occurrence, for a stable order
+} literal_s;
+
+typedef struct _global_s {
+    node_t decl;
+    int64_t weight;
+    int32_t rank;
+    int32_t size;           // 1 for a bool, 4 for an int
+    int32_t init;
+    int32_t offset;         // given by passe_1 and order_globals
+} global_s;
+
+// regions of the packed data section, in address order
+typedef enum _region_e {
+    REGION_WORDS,
+    REGION_BYTES,
+    REGION_ZERO_WORDS,
+    REGION_ZERO_BYTES,
+} region_e;
+
+
+// string literals
+static char * decode(const char * str, int32_t * len) {
+    int32_t n = (int32_t)strlen(str);
+    char * bytes = malloc(n + 1);
+    int32_t j = 0;
+
+    for (int32_t i = 1; i < n - 1; i++) {
+        if (str[i] == '\\' && i + 1 < n - 1) {
+            i++;
+            bytes[j++] = (str[i] == 'n') ? '\n' : (str[i] == 't') ? '\t' : str[i];
+        } else {
+            bytes[j++] = str[i];
+        }
+    }
+    bytes[j] = '\0';
+    *len = j;
+    return bytes;
+}
+
+static void collect_literals(node_t n, node_t ** nodes, int32_t * size, int32_t * capacity) {
+    if (n == NULL) {
+        return;
+    }
+    // address nodes (str == NULL) refer to a literal collected elsewhere
+    if (n->nature == NODE_STRINGVAL && n->str != NULL) {
+        if (*size == *capacity) {
+            *capacity = *capacity ? 2 * *capacity : 32;
+            *nodes = realloc(*nodes, *capacity * sizeof(node_t));
+        }
+        (*nodes)[(*size)++] = n;
+        return;
+    }
+    for (int32_t i = 0; i < n->nops; i++) {
+        collect_literals(n->opr[i], nodes, size, capacity);
+    }
+}
+
+static int32_t find_literal(literal_s * lits, int32_t num, const char * bytes, int32_t len) {
+    for (int32_t i = 0; i < num; i++) {
+        if (lits[i].len == len && memcmp(lits[i].bytes, bytes, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// longest first, so that a literal meets the ones it may be a suffix of
+static int compare_literals(const void * a, const void * b) {
+    const literal_s * la = a;
+    const literal_s * lb = b;
+
+    if (la->len != lb->len) {
+        return lb->len - la->len;
+    }
+    return la->first - lb->first;
+}
+
+void pool_strings(node_t root) {
+    node_t * nodes = NULL;
+    int32_t num_nodes = 0, capacity = 0;
+    literal_s * lits;
+    int32_t num_lits = 0, num_stored = 0, saved = 0;
+
+    collect_literals(root, &nodes, &num_nodes, &capacity);
+    lits = malloc((num_nodes + 1) * sizeof(literal_s));
+
+    for (int32_t i = 0; i < num_nodes; i++) {
+        int32_t len;
+        char * bytes = decode(nodes[i]->str, &len);
+        if (find_literal(lits, num_lits, bytes, len) >= 0) {
+            saved += len + 1;
+            free(bytes);
+            continue;
+        }
+        lits[num_lits].str = nodes[i]->str;
+        lits[num_lits].bytes = bytes;
+        lits[num_lits].len = len;
+        lits[num_lits].first = num_lits;
+        num_lits++;
+    }
+    qsort(lits, num_lits, sizeof(literal_s), compare_literals);
+
+    // lits[0 .. num_stored - 1] hold the literals given to the library
+    for (int32_t i = 0; i < num_lits; i++) {
+        int32_t owner = -1;
+        for (int32_t j = 0; j < i && owner < 0; j++) {
+            if (lits[j].len >= lits[i].len
+                && memcmp(lits[j].bytes + lits[j].len - lits[i].len, lits[i].bytes, lits[i].len) == 0) {
+                owner = j;
+            }
+        }
+        if (owner >= 0) {
+            lits[i].offset = lits[owner].offset + lits[owner].len - lits[i].len;
+            saved += lits[i].len + 1;
+        } else {
+            lits[i].offset = add_string(lits[i].str);
+            num_stored++;
+        }
+    }
+
+    for (int32_t i = 0; i < num_nodes; i++) {
+        int32_t len;
+        char * bytes = decode(nodes[i]->str, &len);
+        nodes[i]->offset = lits[find_literal(lits, num_lits, bytes, len)].offset;
+        free(bytes);
+    }
+
+    printf_level(2, "merge-strings: %d literals, %d stored, %d bytes saved\n", num_nodes, num_stored, saved);
+    for (int32_t i = 0; i < num_lits; i++) {
+        free(lits[i].bytes);
+    }
+    free(lits);
+    free(nodes);
+}
+
+
+// globals
+static void collect_globals(node_t decls, node_type type, global_s ** globals, int32_t * size) {
+    if (decls == NULL) {
+        return;
+    }
+
+    switch (decls->nature) {
+        case NODE_LIST:
+            collect_globals(decls->opr[0], type, globals, size);
+            collect_globals(decls->opr[1], type, globals, size);
+            break;
+        case NODE_DECLS:
+            collect_globals(decls->opr[1], decls->opr[0]->type, globals, size);
+            break;
+        case NODE_DECL: {
+            node_t init = decls->nops > 1 ? decls->opr[1] : NULL;
+            global_s * g;
+            *globals = realloc(*globals, (*size + 1) * sizeof(global_s));
+            g = &(*globals)[*size];
+            g->decl = decls->opr[0];
+            g->weight = 0;
+            g->rank = *size;
+            g->size = (type == TYPE_BOOL) ? 1 : 4;
+            g->init = (init != NULL && (init->nature == NODE_INTVAL || init->nature == NODE_BOOLVAL))
+                      ? (int32_t)init->value : 0;
+            g->offset = g->decl->offset;
+            (*size)++;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void count_uses(node_t n, int32_t depth, global_s * globals, int32_t num) {
+    if (n == NULL) {
+        return;
+    }
+    if (n->nature == NODE_IDENT && n->decl_node != NULL && n->decl_node->global_decl) {
+        int32_t d = depth < MAX_USE_WEIGHT_DEPTH ? depth : MAX_USE_WEIGHT_DEPTH;
+        for (int32_t i = 0; i < num; i++) {
+            if (globals[i].decl == n->decl_node) {
+                globals[i].weight += (int64_t)1 << (USE_WEIGHT_SHIFT * d);
+                break;
+            }
+        }
+        return;
+    }
+    for (int32_t i = 0; i < n->nops; i++) {
+        count_uses(n->opr[i], depth + (is_loop(n) ? 1 : 0), globals, num);
+    }
+}
+
+static int compare_globals(const void * a, const void * b) {
+    const global_s * ga = a;
+    const global_s * gb = b;
+
+    if (ga->weight != gb->weight) {
+        return ga->weight < gb->weight ? 1 : -1;
+    }
+    return ga->rank - gb->rank;
+}
+
+// new offsets of the globals, passe_2 emits them in offset order
+void order_globals(node_t root) {
+    global_s * globals = NULL;
+    int32_t num = 0, moved = 0;
+
+    collect_globals(root->opr[0], TYPE_NONE, &globals, &num);
+    // only the layout of passe_1, one word per global, is known here
+    for (int32_t i = 0; i < num; i++) {
+        if (globals[i].decl->offset != 4 * i) {
+            free(globals);
+            return;
+        }
+    }
+
+    count_uses(root->opr[1], 0, globals, num);
+    qsort(globals, num, sizeof(global_s), compare_globals);
+    for (int32_t i = 0; i < num; i++) {
+        moved += (globals[i].decl->offset != 4 * i);
+        globals[i].decl->offset = 4 * i;
+    }
+    printf_level(2, "order-globals: %d globals, %d moved\n", num, moved);
+    free(globals);
+}
+
+
+// packed data
+static region_e region(global_s * g) {
+    if (g->init != 0) {
+        return (g->size == 4) ? REGION_WORDS : REGION_BYTES;
+    }
+    return (g->size == 4) ? REGION_ZERO_WORDS : REGION_ZERO_BYTES;
+}
+
+static int compare_packed(const void * a, const void * b) {
+    global_s * ga = (global_s *)a;
+    global_s * gb = (global_s *)b;
+
+    if (region(ga) != region(gb)) {
+        return region(ga) - region(gb);
+    }
+    return compare_globals(a, b);
+}
+
+static int compare_offsets(const void * a, const void * b) {
+    return ((const global_s *)a)->offset - ((const global_s *)b)->offset;
+}
+
+static global_s * global_at(global_s * globals, int32_t num, int32_t offset) {
+    for (int32_t i = 0; i < num; i++) {
+        if (globals[i].offset == offset) {
+            return &globals[i];
+        }
+    }
+    return NULL;
+}
+
+// passe_2 builds each data address with a lui of the data section followed
+// by its only use: a lw or sw of a global, or an ori giving a literal
+static bool is_data_base(asm_line_s * l) {
+    return asm_is_inst(l, "lui") && l->args[1].imm == (get_data_sec_start_addr() >> 16);
+}
+
+static bool check_data_refs(asm_prog_s * prog, int32_t globals_size) {
+    for (int32_t i = 0; i < prog->size; i++) {
+        if (!is_data_base(&prog->lines[i])) {
+            continue;
+        }
+        if (i + 1 == prog->size) {
+            return false;
+        }
+        int32_t base = prog->lines[i].args[0].reg;
+        asm_line_s * use = &prog->lines[i + 1];
+        if ((asm_is_inst(use, "lw") || asm_is_inst(use, "sw")) && use->args[1].reg == base) {
+            if (use->args[1].imm >= globals_size || use->args[1].imm % 4 != 0) {
+                return false;
+            }
+        } else if (asm_is_inst(use, "ori") && use->args[1].reg == base) {
+            if (use->args[2].imm < globals_size) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void relocate_data_refs(asm_prog_s * prog, global_s * globals, int32_t num, int32_t shift) {
+    for (int32_t i = 0; i + 1 < prog->size; i++) {
+        if (!is_data_base(&prog->lines[i])) {
+            continue;
+        }
+        asm_line_s * use = &prog->lines[i + 1];
+        if (asm_is_inst(use, "ori")) {
+            use->args[2].imm -= shift;
+        } else {
+            global_s * g = global_at(globals, num, use->args[1].imm);
+            use->args[1].imm = g->decl->offset;
+            if (g->size == 1) {
+                strcpy(use->op, asm_is_inst(use, "lw") ? "lb" : "sb");
+            }
+        }
+    }
+}
+
+static void rewrite_data(asm_prog_s * prog, global_s * globals, int32_t num) {
+    int32_t pos = asm_find_directive(prog, ".data") + 1;
+
+    // the words of passe_2, a label followed by its .word
+    for (int32_t i = pos; i + 1 < prog->size; ) {
+        asm_line_s * l = &prog->lines[i];
+        asm_line_s * next = &prog->lines[i + 1];
+        if (l->kind == ASM_LINE_DIRECTIVE && strcmp(l->text, ".text") == 0) {
+            break;
+        }
+        if (l->kind == ASM_LINE_LABEL && next->kind == ASM_LINE_DIRECTIVE && strncmp(next->text, ".word", 5) == 0) {
+            asm_remove(prog, i + 1);
+            asm_remove(prog, i);
+        } else {
+            i++;
+        }
+    }
+
+    for (int32_t i = 0; i < num; i++) {
+        global_s * g = &globals[i];
+        if (region(g) == REGION_WORDS || region(g) == REGION_BYTES) {
+            pos += asm_insert(prog, pos, "%s: %s %d", g->decl->ident, g->size == 4 ? ".word" : ".byte", g->init);
+        }
+    }
+
+    pos = asm_data_end(prog);
+    pos += asm_insert(prog, pos, ".align 2");
+    for (int32_t i = 0; i < num; i++) {
+        global_s * g = &globals[i];
+        if (region(g) == REGION_ZERO_WORDS || region(g) == REGION_ZERO_BYTES) {
+            pos += asm_insert(prog, pos, "%s: .space %d", g->decl->ident, g->size);
+        }
+    }
+}
+
+bool pack_data_asm(asm_prog_s * prog, node_t root) {
+    global_s * globals = NULL;
+    int32_t num = 0;
+    int32_t i, offset = 0, init_size, bss_start, strings_size, shift;
+
+    collect_globals(root->opr[0], TYPE_NONE, &globals, &num);
+    qsort(globals, num, sizeof(global_s), compare_offsets);
+    for (i = 0; i < num; i++) {
+        if (globals[i].offset != 4 * i) {
+            num = -1;
+            break;
+        }
+    }
+    if (num <= 0 || asm_find_directive(prog, ".data") < 0 || !check_data_refs(prog, 4 * num)) {
+        printf_level(2, "pack-data: data section left as is\n");
+        free(globals);
+        return false;
+    }
+    strings_size = asm_data_size(prog) - 4 * num;
+
+    count_uses(root->opr[1], 0, globals, num);
+    qsort(globals, num, sizeof(global_s), compare_packed);
+
+    // initialised words then bytes, followed by the strings
+    for (i = 0; i < num && region(&globals[i]) < REGION_ZERO_WORDS; i++) {
+        globals[i].decl->offset = offset;
+        offset += globals[i].size;
+    }
+    init_size = offset;
+    shift = 4 * num - init_size;
+
+    // the zeroed globals after the strings, in the .space region
+    offset = bss_start = (init_size + strings_size + 3) & ~3;
+    for (; i < num; i++) {
+        globals[i].decl->offset = offset;
+        offset += globals[i].size;
+    }
+
+    relocate_data_refs(prog, globals, num, shift);
+    rewrite_data(prog, globals, num);
+
+    printf_level(2, "pack-data: %d globals, %d bytes of initialised globals instead of %d, %d bytes in .space\n",
+                 num, init_size, 4 * num, offset - bss_start);
+    free(globals);
+    return true;
+}
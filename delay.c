@@ -0,0 +1,221 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "asm.h"
+
+extern int trace_level;
+
+
+// Branch delay slots.
+// On hardware with delayed branching, the instruction after a branch, a
+// jump or a call is executed before the transfer of control. The code of
+// passe_2 assumes it is not, so every such instruction gets its slot filled:
+// - with an instruction of its block moved from before it, when that keeps
+//   the dependences on the registers and on memory,
+// - or with a copy of the first instruction at its target, the branch then
+//   going past it; for a conditional branch the copy must not write a
+//   register live on the fall through path, nor memory,
+// - or else with a nop.
+// This runs after all the other passes, which are not aware of the slots.
+
+// instructions looked at before a branch
+#define WINDOW 8
+
+#define REG(r) ((asm_regs)1 << (r))
+
+static int32_t num_before;
+static int32_t num_target;
+static int32_t num_nops;
+
+
+static bool has_slot(asm_line_s * l) {
+    return (asm_op_flags(l) & (ASM_OP_BRANCH | ASM_OP_JUMP | ASM_OP_CALL)) != 0;
+}
+
+// an instruction that may be executed in a slot
+static bool slot_inst(asm_line_s * l) {
+    return l->kind == ASM_LINE_INST && (asm_op_flags(l) & ~(ASM_OP_LOAD | ASM_OP_STORE)) == 0;
+}
+
+
+// liveness
+// registers live before each line; the lines before done have their slot
+// filled, and it is executed on both ways out of them
+static asm_regs * liveness(asm_prog_s * prog, int32_t text, int32_t done) {
+    int32_t size = prog->size;
+    asm_regs * live = calloc(size + 1, sizeof(asm_regs));
+    asm_regs * uses = calloc(size, sizeof(asm_regs));
+    asm_regs * defs = calloc(size, sizeof(asm_regs));
+    int32_t * target = malloc(size * sizeof(int32_t));
+    int32_t * from = malloc(size * sizeof(int32_t));
+    bool changed = true;
+
+    for (int32_t i = text; i < size; i++) {
+        asm_line_s * l = &prog->lines[i];
+        const char * label = (l->kind == ASM_LINE_INST) ? asm_target(l) : NULL;
+
+        uses[i] = asm_uses(l);
+        defs[i] = asm_defs(l);
+        target[i] = (label != NULL) ? asm_find_label(prog, label) : -1;
+        // the control leaves from the slot of a filled branch
+        from[i] = (i > text && i - 1 < done && has_slot(&prog->lines[i - 1])) ? i - 1 : i;
+    }
+    live[size] = ~(asm_regs)0;
+    while (changed) {
+        changed = false;
+        for (int32_t i = size - 1; i >= text; i--) {
+            asm_line_s * l = &prog->lines[i];
+            int32_t b = from[i];
+            uint32_t flags = asm_op_flags(&prog->lines[b]);
+            asm_regs out, in;
+
+            if (l->kind != ASM_LINE_INST) {
+                in = live[i + 1];
+            } else {
+                if (b == i && i < done && has_slot(l)) {
+                    out = live[i + 1];
+                } else if (asm_is_inst(&prog->lines[b], "jr") || ((flags & ASM_OP_JUMP) && target[b] < 0)) {
+                    out = ~(asm_regs)0;
+                } else if (flags & ASM_OP_JUMP) {
+                    out = live[target[b]];
+                } else if (flags & ASM_OP_BRANCH) {
+                    out = live[i + 1] | ((target[b] < 0) ? ~(asm_regs)0 : live[target[b]]);
+                } else {
+                    out = live[i + 1];
+                }
+                in = uses[i] | (out & ~defs[i]);
+            }
+            if (in != live[i]) {
+                live[i] = in;
+                changed = true;
+            }
+        }
+    }
+    free(uses);
+    free(defs);
+    free(target);
+    free(from);
+    return live;
+}
+
+
+// filling
+// moves an instruction of the block before the branch at line i into its
+// slot, returns false when none can be moved
+static bool fill_before(asm_prog_s * prog, int32_t i) {
+    asm_regs uses = asm_uses(&prog->lines[i]);
+    asm_regs defs = asm_defs(&prog->lines[i]);
+    bool loads = false, stores = false;
+    int32_t n = 0;
+
+    for (int32_t p = i - 1; p >= 0 && n < WINDOW; p--) {
+        asm_line_s * l = &prog->lines[p];
+        uint32_t flags = asm_op_flags(l);
+
+        if (l->kind == ASM_LINE_TEXT) {
+            continue;
+        }
+        if (l->kind != ASM_LINE_INST || asm_is_boundary(l) || !slot_inst(l)
+            || (p > 0 && has_slot(&prog->lines[p - 1]))) {
+            return false;
+        }
+        n++;
+        if ((asm_defs(l) & (uses | defs)) == 0 && (asm_uses(l) & defs) == 0
+            && !((flags & ASM_OP_LOAD) && stores) && !((flags & ASM_OP_STORE) && (loads || stores))) {
+            asm_line_s moved = *l;
+            memmove(&prog->lines[p], &prog->lines[p + 1], (i - p) * sizeof(asm_line_s));
+            prog->lines[i] = moved;
+            return true;
+        }
+        uses |= asm_uses(l);
+        defs |= asm_defs(l);
+        loads |= (flags & ASM_OP_LOAD) != 0;
+        stores |= (flags & ASM_OP_STORE) != 0;
+    }
+    return false;
+}
+
+// copies the first instruction at the target of the jump or branch at line
+// *i into its slot, and makes it go past that instruction
+static bool fill_target(asm_prog_s * prog, int32_t text, int32_t * i) {
+    asm_line_s * l = &prog->lines[*i];
+    bool branch = (asm_op_flags(l) & ASM_OP_BRANCH) != 0;
+    int32_t label, t;
+    asm_line_s copy;
+    char name[32];
+
+    if ((!branch && !asm_is_inst(l, "j")) || (label = asm_find_label(prog, asm_target(l))) < 0) {
+        return false;
+    }
+    for (t = label + 1; t < prog->size && prog->lines[t].kind != ASM_LINE_INST; t++) {
+        if (prog->lines[t].kind == ASM_LINE_DIRECTIVE) {
+            return false;
+        }
+    }
+    if (t >= prog->size || t == *i + 1 || !slot_inst(&prog->lines[t])) {
+        return false;
+    }
+    if (branch) {
+        asm_regs * live = liveness(prog, text, *i);
+        bool safe = (asm_op_flags(&prog->lines[t]) & ASM_OP_STORE) == 0
+            && (asm_defs(&prog->lines[t]) & live[*i + 1]) == 0;
+        free(live);
+        if (!safe) {
+            return false;
+        }
+    }
+
+    // an instruction has no label operand, the copy shares nothing
+    copy = prog->lines[t];
+    if (t + 1 < prog->size && prog->lines[t + 1].kind == ASM_LINE_LABEL) {
+        snprintf(name, sizeof(name), "%s", prog->lines[t + 1].text);
+    } else {
+        asm_new_label(prog, name, sizeof(name));
+        asm_insert(prog, t + 1, "%s:", name);
+        if (t + 1 <= *i) {
+            (*i)++;
+        }
+    }
+    asm_set_target(&prog->lines[*i], name);
+    asm_insert(prog, *i + 1, "nop");
+    memcpy(prog->lines[*i + 1].op, copy.op, sizeof(copy.op));
+    prog->lines[*i + 1].nargs = copy.nargs;
+    memcpy(prog->lines[*i + 1].args, copy.args, sizeof(copy.args));
+    return true;
+}
+
+bool fill_delay_slots_asm(asm_prog_s * prog) {
+    int32_t text = asm_find_directive(prog, ".text");
+
+    num_before = 0;
+    num_target = 0;
+    num_nops = 0;
+    if (text < 0) {
+        return false;
+    }
+
+    for (int32_t i = text; i < prog->size; i++) {
+        if (!has_slot(&prog->lines[i])) {
+            continue;
+        }
+        if (fill_before(prog, i)) {
+            num_before++;
+            i--;
+        } else if (fill_target(prog, text, &i)) {
+            num_target++;
+        } else {
+            asm_insert(prog, i + 1, "nop");
+            num_nops++;
+        }
+        i++;
+    }
+
+    printf_level(2, "delay-slots: %d filled from before the branch, %d from its target, %d nops\n",
+                 num_before, num_target, num_nops);
+    return true;
+}
@@ -12,6 +12,8 @@
 #include "miniccutils.h"
 #include "passe_1.h"
 #include "passe_2.h"
+#include "optim.h"
+#include "asm.h"
 
 
 
@@ -281,10 +283,12 @@ void analyse_tree(node_t root) {
         analyse_passe_1(root);
         dump_tree(root, "apres_passe_1.dot");
         if (!stop_after_verif) {
+            optimise_tree(root);
             create_program(); 
             gen_code_passe_2(root);
             dump_mips_program(outfile);
             free_program();
+            optimise_asm(root, outfile);
         }
         free_global_strings();
     }
@@ -0,0 +1,338 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "arch.h"
+#include "optim.h"
+#include "asm.h"
+
+extern int trace_level;
+
+
+// If-conversion.
+// gen_if compiles "if (a < b) m = a; else m = b;" as a branch over an arm
+// storing into m, a jump and the other arm storing into the same place.
+// When both arms only compute registers of passe_2 and end with that store,
+// they are executed one after the other and the stored value is selected
+// with a mask built from the condition:
+//     m = e ^ ((t ^ e) & -(c != 0))
+// or with movn and movz when -march allows them.
+// An if without else is handled the same way, the other value being the
+// one already in memory. Arms with a division, an output or another store
+// are left alone, and so are the diamonds whose longest path would grow by
+// more than the ifconv-limit parameter. With -fprofile-use, so are the
+// branches going the same way nearly every time, layout makes them cheap.
+
+#define REG(r) ((asm_regs)1 << (r))
+
+// permille of the runs beyond which a profiled branch is kept
+#define PROFILE_BIAS 900
+
+// the straight-line code of an arm, ending with its store
+typedef struct _arm_s {
+    int32_t first;
+    int32_t store;
+    int32_t size;
+    asm_regs regs;
+} arm_s;
+
+static int32_t num_diamonds;
+static int32_t num_triangles;
+
+
+// arms
+static int32_t next_line(asm_prog_s * prog, int32_t i) {
+    for (i++; i < prog->size && prog->lines[i].kind == ASM_LINE_TEXT; i++) {
+    }
+    return i;
+}
+
+// safe to execute whatever the condition
+static bool can_speculate(asm_line_s * l) {
+    return l->kind == ASM_LINE_INST && (asm_op_flags(l) & ~ASM_OP_LOAD) == 0
+        && !asm_is_inst(l, "div") && !asm_is_inst(l, "divu")
+        && (asm_defs(l) & ~(ASM_SCRATCH_REGS | REG(ASM_REG_HI) | REG(ASM_REG_LO))) == 0;
+}
+
+// the instructions in [first, end), which must be speculable up to one
+// final store of a register of passe_2
+static bool read_arm(asm_prog_s * prog, int32_t first, int32_t end, arm_s * arm) {
+    arm->first = first;
+    arm->store = -1;
+    arm->size = 0;
+    arm->regs = 0;
+    for (int32_t i = first; i < end; i = next_line(prog, i)) {
+        asm_line_s * l = &prog->lines[i];
+
+        if (arm->store >= 0) {
+            return false;
+        }
+        if (l->kind == ASM_LINE_INST && (asm_op_flags(l) & ASM_OP_STORE)) {
+            if ((REG(l->args[0].reg) & ASM_SCRATCH_REGS) == 0 || l->args[0].reg == l->args[1].reg) {
+                return false;
+            }
+            arm->store = i;
+        } else if (!can_speculate(l)) {
+            return false;
+        }
+        arm->regs |= asm_uses(l) | asm_defs(l);
+        arm->size++;
+    }
+    return arm->store >= 0;
+}
+
+// the line defining the base register of the store of the arm, -1 for the
+// stack pointer or when it is not set in the arm
+static int32_t base_def(asm_prog_s * prog, arm_s * arm) {
+    int32_t base = prog->lines[arm->store].args[1].reg;
+    int32_t def = -1;
+
+    for (int32_t i = arm->first; i < arm->store; i = next_line(prog, i)) {
+        if (asm_defs(&prog->lines[i]) & REG(base)) {
+            def = i;
+        }
+    }
+    return def;
+}
+
+// the store writes a fixed address: the stack or a lui of the data section
+static bool fixed_address(asm_prog_s * prog, arm_s * arm) {
+    int32_t def = base_def(prog, arm);
+
+    if (prog->lines[arm->store].args[1].reg == 29) {
+        return def < 0;
+    }
+    return def >= 0 && asm_is_inst(&prog->lines[def], "lui");
+}
+
+static bool same_address(asm_prog_s * prog, arm_s * t, arm_s * e) {
+    asm_line_s * a = &prog->lines[t->store];
+    asm_line_s * b = &prog->lines[e->store];
+    int32_t da, db;
+
+    if (strcmp(a->op, b->op) != 0 || a->args[1].reg != b->args[1].reg || a->args[1].imm != b->args[1].imm
+        || !fixed_address(prog, t) || !fixed_address(prog, e)) {
+        return false;
+    }
+    da = base_def(prog, t);
+    db = base_def(prog, e);
+    return da < 0 || prog->lines[da].args[1].imm == prog->lines[db].args[1].imm;
+}
+
+
+// conversion
+// the condition register only holds 0 or 1
+static bool is_boolean(asm_prog_s * prog, int32_t branch, int32_t reg) {
+    for (int32_t i = branch - 1; i >= 0; i--) {
+        asm_line_s * l = &prog->lines[i];
+        if (l->kind == ASM_LINE_LABEL || l->kind == ASM_LINE_DIRECTIVE || asm_is_boundary(l)) {
+            return false;
+        }
+        if (asm_defs(l) & REG(reg)) {
+            return asm_is_inst(l, "slt") || asm_is_inst(l, "sltu") || asm_is_inst(l, "slti")
+                || asm_is_inst(l, "sltiu");
+        }
+    }
+    return false;
+}
+
+// takes n registers of passe_2 left free, within the -r budget
+static bool free_regs(asm_regs used, int32_t * regs, int32_t n) {
+    for (int32_t r = get_first_reg(); r < get_first_reg() + get_num_registers() && n > 0; r++) {
+        if ((ASM_SCRATCH_REGS & REG(r)) && !(used & REG(r))) {
+            regs[--n] = r;
+        }
+    }
+    return n == 0;
+}
+
+// replaces the branch at line i by the mask, all ones when the fall through
+// arm is taken, or by a copy of the condition for movn and movz
+static void write_mask(asm_prog_s * prog, int32_t i, bool boolean, int32_t mask) {
+    asm_line_s * l = &prog->lines[i];
+    int32_t c = l->args[0].reg;
+    int32_t n = 0;
+
+    if (get_isa_features() & ISA_MOVCOND) {
+        if (mask != c) {
+            asm_insert(prog, i + 1, "addu $%d, $%d, $0", mask, c);
+        }
+    } else if (asm_is_inst(l, "beq")) {
+        if (!boolean) {
+            n += asm_insert(prog, i + 1 + n, "sltu $%d, $0, $%d", mask, c);
+            c = mask;
+        }
+        n += asm_insert(prog, i + 1 + n, "subu $%d, $0, $%d", mask, c);
+    } else if (boolean) {
+        n += asm_insert(prog, i + 1 + n, "addiu $%d, $%d, -1", mask, c);
+    } else {
+        n += asm_insert(prog, i + 1 + n, "sltiu $%d, $%d, 1", mask, c);
+        n += asm_insert(prog, i + 1 + n, "subu $%d, $0, $%d", mask, mask);
+    }
+    asm_remove(prog, i);
+}
+
+// the register for the mask, the condition itself when movn and movz can
+// use it after the arms; returns the instructions written for it
+static int32_t mask_reg(asm_prog_s * prog, int32_t i, asm_regs arms, int32_t reg, int32_t * mask) {
+    int32_t c = prog->lines[i].args[0].reg;
+
+    if (get_isa_features() & ISA_MOVCOND) {
+        *mask = (arms & REG(c)) ? reg : c;
+        return (*mask == c) ? 0 : 1;
+    }
+    *mask = reg;
+    return is_boolean(prog, i, c) ? 1 : 2;
+}
+
+// instructions added on the longest path
+static bool within_limit(int32_t converted, int32_t branchy) {
+    return converted - branchy <= opt_ifconv_limit;
+}
+
+// "beq c, L1; t; sw; j L2; L1: e; sw; L2:"
+static bool convert_diamond(asm_prog_s * prog, int32_t i, int32_t j, int32_t label, int32_t join) {
+    asm_line_s * branch = &prog->lines[i];
+    bool boolean = is_boolean(prog, i, branch->args[0].reg);
+    bool movcond = (get_isa_features() & ISA_MOVCOND) != 0;
+    bool beq = asm_is_inst(branch, "beq");
+    int32_t regs[2];
+    int32_t mask;
+    arm_s t, e;
+
+    if (join <= label || !read_arm(prog, next_line(prog, i), j, &t)
+        || !read_arm(prog, next_line(prog, label), join, &e) || !same_address(prog, &t, &e)
+        || !free_regs(t.regs | e.regs | REG(branch->args[0].reg), regs, 2)
+        || !within_limit(mask_reg(prog, i, t.regs | e.regs, regs[0], &mask) + t.size + e.size + (movcond ? 1 : 3),
+                         1 + ((t.size + 1 > e.size) ? t.size + 1 : e.size))) {
+        return false;
+    }
+
+    int32_t diff = regs[1];
+    int32_t tval = prog->lines[t.store].args[0].reg;
+    int32_t eval = prog->lines[e.store].args[0].reg;
+
+    // from the bottom, so that the positions above stay valid
+    if (movcond) {
+        asm_insert(prog, e.store, "%s $%d, $%d, $%d", beq ? "movn" : "movz", eval, diff, mask);
+    } else {
+        asm_insert(prog, e.store, "xor $%d, $%d, $%d", diff, diff, eval);
+        asm_insert(prog, e.store + 1, "and $%d, $%d, $%d", diff, diff, mask);
+        asm_insert(prog, e.store + 2, "xor $%d, $%d, $%d", eval, eval, diff);
+    }
+    asm_remove(prog, label);
+    asm_remove(prog, j);
+    asm_remove(prog, t.store);
+    asm_insert(prog, t.store, "addu $%d, $%d, $0", diff, tval);
+    write_mask(prog, i, boolean, mask);
+    num_diamonds++;
+    return true;
+}
+
+// "beq c, L1; t; sw; L1:"
+static bool convert_triangle(asm_prog_s * prog, int32_t i, int32_t label) {
+    asm_line_s * branch = &prog->lines[i];
+    bool boolean = is_boolean(prog, i, branch->args[0].reg);
+    bool movcond = (get_isa_features() & ISA_MOVCOND) != 0;
+    bool beq = asm_is_inst(branch, "beq");
+    int32_t regs[2];
+    int32_t mask;
+    arm_s t;
+
+    if (!read_arm(prog, next_line(prog, i), label, &t) || !fixed_address(prog, &t)
+        || !free_regs(t.regs | REG(branch->args[0].reg), regs, 2)
+        || !within_limit(mask_reg(prog, i, t.regs, regs[0], &mask) + t.size + (movcond ? 2 : 4), 1 + t.size)) {
+        return false;
+    }
+
+    asm_line_s * store = &prog->lines[t.store];
+    int32_t old = regs[1];
+    int32_t tval = store->args[0].reg;
+    int32_t base = store->args[1].reg;
+    int32_t offset = store->args[1].imm;
+    const char * load = asm_is_inst(store, "sb") ? "lb" : "lw";
+
+    asm_insert(prog, t.store, "%s $%d, %d($%d)", load, old, offset, base);
+    if (movcond) {
+        asm_insert(prog, t.store + 1, "%s $%d, $%d, $%d", beq ? "movz" : "movn", tval, old, mask);
+    } else {
+        asm_insert(prog, t.store + 1, "xor $%d, $%d, $%d", tval, tval, old);
+        asm_insert(prog, t.store + 2, "and $%d, $%d, $%d", tval, tval, mask);
+        asm_insert(prog, t.store + 3, "xor $%d, $%d, $%d", tval, tval, old);
+    }
+    write_mask(prog, i, boolean, mask);
+    num_triangles++;
+    return true;
+}
+
+// the branch at line i, on a register compared with $0
+static bool convert(asm_prog_s * prog, int32_t i) {
+    asm_line_s * branch = &prog->lines[i];
+    const char * target = asm_target(branch);
+    int32_t label, last = -1;
+
+    int32_t taken = get_branch_profile(target);
+
+    if ((!asm_is_inst(branch, "beq") && !asm_is_inst(branch, "bne")) || branch->args[1].reg != 0
+        || (label = asm_find_label(prog, target)) < i
+        || taken >= PROFILE_BIAS || (taken >= 0 && taken <= 1000 - PROFILE_BIAS)) {
+        return false;
+    }
+    for (int32_t k = next_line(prog, i); k < label; k = next_line(prog, k)) {
+        if (prog->lines[k].kind != ASM_LINE_INST) {
+            return false;
+        }
+        last = k;
+    }
+    if (last < 0) {
+        return false;
+    }
+    if (!asm_is_inst(&prog->lines[last], "j")) {
+        return convert_triangle(prog, i, label);
+    }
+
+    // the else arm must only be reached through the branch
+    for (int32_t k = 0; k < prog->size; k++) {
+        if (k != i && asm_target(&prog->lines[k]) != NULL && strcmp(asm_target(&prog->lines[k]), target) == 0) {
+            return false;
+        }
+    }
+    int32_t join = asm_find_label(prog, asm_target(&prog->lines[last]));
+    for (int32_t k = next_line(prog, label); k < join; k = next_line(prog, k)) {
+        if (prog->lines[k].kind != ASM_LINE_INST) {
+            return false;
+        }
+    }
+    return convert_diamond(prog, i, last, label, join);
+}
+
+bool if_convert_asm(asm_prog_s * prog) {
+    int32_t text = asm_find_directive(prog, ".text");
+
+    num_diamonds = 0;
+    num_triangles = 0;
+    if (text < 0) {
+        return false;
+    }
+
+    for (int32_t i = text; i < prog->size; i++) {
+        if (asm_op_flags(&prog->lines[i]) & ASM_OP_BRANCH) {
+            convert(prog, i);
+        }
+    }
+    for (int32_t i = text; i < prog->size; ) {
+        asm_line_s * l = &prog->lines[i];
+        if (l->kind == ASM_LINE_LABEL && strcmp(l->text, "main") != 0 && !asm_is_referenced(prog, l->text)) {
+            asm_remove(prog, i);
+        } else {
+            i++;
+        }
+    }
+
+    printf_level(2, "if-convert: %d if/else and %d if converted\n", num_diamonds, num_triangles);
+    return num_diamonds + num_triangles > 0;
+}
@@ -0,0 +1,421 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "arch.h"
+#include "asm.h"
+
+extern int trace_level;
+
+
+// Instruction selection for -march.
+// The library building the program only knows the MIPS I instructions, so
+// the richer forms of MIPS32 and MIPS32r2 are selected on the code passe_2
+// wrote, inside each block:
+//     mult $a, $b; mflo $d                  ->  mul $d, $a, $b
+//     (x << k) | (x >>> (32 - k))           ->  rotr $d, $x, 32 - k
+//     (x >> p) & (2^n - 1)                  ->  ext $d, $x, p, n
+//     (h & ~((2^n - 1) << p)) | (v << p)    ->  ins $h, $v, p, n
+// where v has at most n bits, the shift amounts and masks being constants
+// loaded in the block. The values of x on both sides of a rotate are
+// compared through the copies and the loads of the same word. The
+// computations made dead by these rewrites are removed.
+
+#define REG(r) ((asm_regs)1 << (r))
+
+static int32_t num_mul;
+static int32_t num_rotr;
+static int32_t num_ext;
+static int32_t num_ins;
+static int32_t num_dead;
+
+
+// values in a block
+static int32_t next_inst(asm_prog_s * prog, int32_t i) {
+    for (i++; i < prog->size && prog->lines[i].kind == ASM_LINE_TEXT; i++) {
+    }
+    return i;
+}
+
+// last line of the block before line i writing reg, -1 when there is none
+static int32_t prev_def(asm_prog_s * prog, int32_t start, int32_t i, int32_t reg) {
+    for (int32_t j = i - 1; j >= start; j--) {
+        if (asm_defs(&prog->lines[j]) & REG(reg)) {
+            return j;
+        }
+    }
+    return -1;
+}
+
+// constant held by reg before line i
+static bool const_reg(asm_prog_s * prog, int32_t start, int32_t i, int32_t reg, int32_t * value) {
+    int32_t p = prev_def(prog, start, i, reg);
+    int32_t a, b = 0;
+    asm_line_s * l;
+
+    if (reg == 0) {
+        *value = 0;
+        return true;
+    }
+    if (p < 0) {
+        return false;
+    }
+    l = &prog->lines[p];
+    if (asm_is_inst(l, "lui")) {
+        return asm_eval(l, 0, 0, value);
+    }
+    if (l->nargs != 3 || l->args[1].kind != ASM_ARG_REG || asm_op_flags(l) != 0
+        || !const_reg(prog, start, p, l->args[1].reg, &a)
+        || (l->args[2].kind == ASM_ARG_REG && !const_reg(prog, start, p, l->args[2].reg, &b))) {
+        return false;
+    }
+    return asm_eval(l, a, b, value);
+}
+
+static bool is_copy(asm_line_s * l) {
+    return (asm_is_inst(l, "addu") || asm_is_inst(l, "or")) && l->args[2].reg == 0;
+}
+
+static bool has_store(asm_prog_s * prog, int32_t from, int32_t to) {
+    for (int32_t j = from; j < to; j++) {
+        if (asm_op_flags(&prog->lines[j]) & ASM_OP_STORE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// reg x before line p holds the same value as reg y before line q
+static bool same_value(asm_prog_s * prog, int32_t start, int32_t p, int32_t x, int32_t q, int32_t y) {
+    int32_t dp = prev_def(prog, start, p, x);
+    int32_t dq = prev_def(prog, start, q, y);
+    asm_line_s * a;
+    asm_line_s * b;
+
+    if (x == y && dp == dq) {
+        return true;
+    }
+    if (dp >= 0 && is_copy(&prog->lines[dp])) {
+        return same_value(prog, start, dp, prog->lines[dp].args[1].reg, q, y);
+    }
+    if (dq >= 0 && is_copy(&prog->lines[dq])) {
+        return same_value(prog, start, p, x, dq, prog->lines[dq].args[1].reg);
+    }
+    if (dp < 0 || dq < 0) {
+        return false;
+    }
+    a = &prog->lines[dp];
+    b = &prog->lines[dq];
+    return (asm_op_flags(a) & ASM_OP_LOAD) && strcmp(a->op, b->op) == 0 && a->args[1].imm == b->args[1].imm
+        && !has_store(prog, (dp < dq) ? dp : dq, (dp < dq) ? dq : dp)
+        && same_value(prog, start, dp, a->args[1].reg, dq, b->args[1].reg);
+}
+
+// shift by a constant amount at line p, false for other instructions
+static bool const_shift(asm_prog_s * prog, int32_t start, int32_t p, const char * op, int32_t * amount) {
+    asm_line_s * l = &prog->lines[p];
+    char var[8];
+
+    snprintf(var, sizeof(var), "%sv", op);
+    if (asm_is_inst(l, op)) {
+        *amount = l->args[2].imm & 31;
+        return true;
+    }
+    return asm_is_inst(l, var) && const_reg(prog, start, p, l->args[2].reg, amount) && (*amount & ~31) == 0;
+}
+
+// the value written at line p is only read by the instruction at line i,
+// which may overwrite it
+static bool single_use(asm_prog_s * prog, int32_t p, int32_t i) {
+    int32_t reg = prog->lines[p].args[0].reg;
+
+    for (int32_t j = p + 1; j < i; j++) {
+        if (asm_uses(&prog->lines[j]) & REG(reg)) {
+            return false;
+        }
+    }
+    if (asm_defs(&prog->lines[i]) & REG(reg)) {
+        return true;
+    }
+    for (int32_t j = i + 1; j < prog->size; j++) {
+        asm_line_s * l = &prog->lines[j];
+        if (l->kind == ASM_LINE_TEXT) {
+            continue;
+        }
+        if (asm_uses(l) & REG(reg)) {
+            return false;
+        }
+        if ((asm_defs(l) & REG(reg)) || asm_is_boundary(l)) {
+            break;
+        }
+    }
+    return (ASM_SCRATCH_REGS & REG(reg)) != 0;
+}
+
+static void replace(asm_prog_s * prog, int32_t i, const char * fmt, int32_t a, int32_t b, int32_t c, int32_t d) {
+    asm_remove(prog, i);
+    asm_insert(prog, i, fmt, a, b, c, d);
+}
+
+// the line i, computing d from the value written at line p, now computed
+// at p
+static void forward_result(asm_prog_s * prog, int32_t p, int32_t i) {
+    int32_t d = prog->lines[i].args[0].reg;
+
+    if (prog->lines[p].args[0].reg == d) {
+        asm_remove(prog, i);
+    } else {
+        replace(prog, i, "addu $%d, $%d, $0", d, prog->lines[p].args[0].reg, 0, 0);
+    }
+}
+
+
+// rules
+static bool select_mul(asm_prog_s * prog, int32_t i) {
+    asm_line_s * l = &prog->lines[i];
+    int32_t k = next_inst(prog, i);
+
+    if (!(get_isa_features() & ISA_MUL) || !asm_is_inst(l, "mult") || k >= prog->size
+        || !asm_is_inst(&prog->lines[k], "mflo")) {
+        return false;
+    }
+    for (int32_t j = next_inst(prog, k); j < prog->size; j = next_inst(prog, j)) {
+        asm_line_s * n = &prog->lines[j];
+        if (asm_uses(n) & (REG(ASM_REG_HI) | REG(ASM_REG_LO))) {
+            return false;
+        }
+        if ((asm_defs(n) & REG(ASM_REG_HI)) || asm_is_boundary(n)) {
+            break;
+        }
+    }
+    int32_t d = prog->lines[k].args[0].reg;
+    asm_remove(prog, k);
+    replace(prog, i, "mul $%d, $%d, $%d", d, l->args[0].reg, l->args[1].reg, 0);
+    num_mul++;
+    return true;
+}
+
+// or of a left and a right shift of the same value
+static bool select_rotr(asm_prog_s * prog, int32_t start, int32_t i) {
+    asm_line_s * l = &prog->lines[i];
+
+    if (!(get_isa_features() & ISA_ROTATE) || !asm_is_inst(l, "or")) {
+        return false;
+    }
+    for (int32_t side = 1; side <= 2; side++) {
+        int32_t pa = prev_def(prog, start, i, l->args[side].reg);
+        int32_t pb = prev_def(prog, start, i, l->args[3 - side].reg);
+        int32_t k, m;
+
+        if (pa < 0 || pb < 0 || !const_shift(prog, start, pa, "sll", &k) || !const_shift(prog, start, pb, "srl", &m)
+            || k == 0 || k + m != 32 || !single_use(prog, pa, i)
+            || !same_value(prog, start, pa, prog->lines[pa].args[1].reg, pb, prog->lines[pb].args[1].reg)) {
+            continue;
+        }
+        asm_line_s * s = &prog->lines[pa];
+        replace(prog, pa, "rotr $%d, $%d, %d", s->args[0].reg, s->args[1].reg, m, 0);
+        forward_result(prog, pa, i);
+        num_rotr++;
+        return true;
+    }
+    return false;
+}
+
+// mask of the n low bits
+static bool low_mask(int32_t mask, int32_t * n) {
+    uint32_t m = (uint32_t)mask;
+
+    if (m == 0 || (m & (m + 1)) != 0) {
+        return false;
+    }
+    for (*n = 0; m != 0; m >>= 1) {
+        (*n)++;
+    }
+    return true;
+}
+
+// and of a right shift with a mask of low bits
+static bool select_ext(asm_prog_s * prog, int32_t start, int32_t i) {
+    asm_line_s * l = &prog->lines[i];
+    int32_t mask, n, pos;
+
+    if (!(get_isa_features() & ISA_BITFIELD) || (!asm_is_inst(l, "and") && !asm_is_inst(l, "andi"))) {
+        return false;
+    }
+    for (int32_t side = 1; side <= (asm_is_inst(l, "and") ? 2 : 1); side++) {
+        int32_t p = prev_def(prog, start, i, l->args[side].reg);
+
+        if (asm_is_inst(l, "andi")) {
+            mask = l->args[2].imm & 0xFFFF;
+        } else if (!const_reg(prog, start, i, l->args[3 - side].reg, &mask)) {
+            continue;
+        }
+        if (p < 0 || !low_mask(mask, &n) || n == 32
+            || (!const_shift(prog, start, p, "srl", &pos) && !const_shift(prog, start, p, "sra", &pos))
+            || pos == 0 || pos + n > 32 || !single_use(prog, p, i)) {
+            continue;
+        }
+        asm_line_s * s = &prog->lines[p];
+        replace(prog, p, "ext $%d, $%d, %d, %d", s->args[0].reg, s->args[1].reg, pos, n);
+        forward_result(prog, p, i);
+        num_ext++;
+        return true;
+    }
+    return false;
+}
+
+// the value before line p has no bit set above the n low ones
+static bool fits(asm_prog_s * prog, int32_t start, int32_t p, int32_t reg, int32_t n) {
+    int32_t d = prev_def(prog, start, p, reg);
+    int32_t mask, bits;
+    asm_line_s * l;
+
+    if (d < 0) {
+        return false;
+    }
+    l = &prog->lines[d];
+    if (asm_is_inst(l, "andi")) {
+        return low_mask(l->args[2].imm & 0xFFFF, &bits) && bits <= n;
+    }
+    if (asm_is_inst(l, "and")) {
+        return (const_reg(prog, start, d, l->args[2].reg, &mask) || const_reg(prog, start, d, l->args[1].reg, &mask))
+            && low_mask(mask, &bits) && bits <= n;
+    }
+    return asm_is_inst(l, "ext") && l->args[3].imm <= n;
+}
+
+// or of a value with a field cleared and of a value shifted into the field
+static bool select_ins(asm_prog_s * prog, int32_t start, int32_t i) {
+    asm_line_s * l = &prog->lines[i];
+
+    if (!(get_isa_features() & ISA_BITFIELD) || !asm_is_inst(l, "or") || l->args[1].reg == 0 || l->args[2].reg == 0) {
+        return false;
+    }
+    for (int32_t side = 1; side <= 2; side++) {
+        int32_t pa = prev_def(prog, start, i, l->args[side].reg);
+        int32_t pb = prev_def(prog, start, i, l->args[3 - side].reg);
+        int32_t mask, n, pos, shift;
+
+        if (pa < 0 || pb < 0 || !asm_is_inst(&prog->lines[pa], "and") || !const_shift(prog, start, pb, "sll", &shift)
+            || !(const_reg(prog, start, pa, prog->lines[pa].args[2].reg, &mask)
+                 || const_reg(prog, start, pa, prog->lines[pa].args[1].reg, &mask))) {
+            continue;
+        }
+        // the cleared field
+        mask = ~mask;
+        if (mask == 0) {
+            continue;
+        }
+        for (pos = 0; !(((uint32_t)mask >> pos) & 1); pos++) {
+        }
+        if (shift != pos || !low_mask((int32_t)((uint32_t)mask >> pos), &n) || n == 32
+            || (pos + n < 32 && !fits(prog, start, pb, prog->lines[pb].args[1].reg, n))
+            || !single_use(prog, pa, i) || !single_use(prog, pb, i)) {
+            continue;
+        }
+
+        asm_line_s * b = &prog->lines[pb];
+        int32_t a = prog->lines[pa].args[0].reg;
+        int32_t d = l->args[0].reg;
+        int32_t v = b->args[0].reg;
+        int32_t src = b->args[1].reg;
+
+        // the field is inserted from the value before its shift
+        if (v == src) {
+            asm_remove(prog, pb);
+            i--;
+        } else {
+            replace(prog, pb, "addu $%d, $%d, $0", v, src, 0, 0);
+        }
+        replace(prog, i, "ins $%d, $%d, %d, %d", a, v, pos, n);
+        if (d != a) {
+            asm_insert(prog, i + 1, "addu $%d, $%d, $0", d, a);
+        }
+        num_ins++;
+        return true;
+    }
+    return false;
+}
+
+// computations of registers of passe_2 no longer read
+static bool remove_dead(asm_prog_s * prog, int32_t text) {
+    asm_regs live = ~ASM_SCRATCH_REGS;
+    bool changed = false;
+
+    for (int32_t i = prog->size - 1; i >= text; i--) {
+        asm_line_s * l = &prog->lines[i];
+        uint32_t flags = asm_op_flags(l);
+        asm_regs defs = asm_defs(l);
+
+        if (l->kind == ASM_LINE_LABEL || asm_is_boundary(l)) {
+            live = ~ASM_SCRATCH_REGS | asm_uses(l);
+            continue;
+        }
+        if (l->kind != ASM_LINE_INST) {
+            continue;
+        }
+        if ((flags & ~ASM_OP_LOAD) == 0 && defs != 0 && (defs & ~ASM_SCRATCH_REGS) == 0 && (defs & live) == 0) {
+            asm_remove(prog, i);
+            num_dead++;
+            changed = true;
+            continue;
+        }
+        live = (live & ~defs) | asm_uses(l);
+    }
+    return changed;
+}
+
+// the rules that look back for the operands, to the start of the block
+typedef bool (*select_fn)(asm_prog_s * prog, int32_t start, int32_t i);
+
+static select_fn rules[] = { select_rotr, select_ext, select_ins };
+
+bool select_insts_asm(asm_prog_s * prog) {
+    int32_t text = asm_find_directive(prog, ".text");
+    bool changed = true;
+
+    num_mul = 0;
+    num_rotr = 0;
+    num_ext = 0;
+    num_ins = 0;
+    num_dead = 0;
+    if (text < 0) {
+        return false;
+    }
+
+    while (changed) {
+        int32_t start = text;
+
+        changed = false;
+        for (int32_t i = text; i < prog->size; i++) {
+            asm_line_s * l = &prog->lines[i];
+
+            if (l->kind == ASM_LINE_LABEL || asm_is_boundary(l)) {
+                start = i + 1;
+                continue;
+            }
+            if (l->kind != ASM_LINE_INST) {
+                continue;
+            }
+            if (select_mul(prog, i)) {
+                changed = true;
+                continue;
+            }
+            for (int32_t r = 0; r < (int32_t)(sizeof(rules) / sizeof(rules[0])); r++) {
+                if (rules[r](prog, start, i)) {
+                    changed = true;
+                    break;
+                }
+            }
+        }
+        changed |= remove_dead(prog, text);
+    }
+
+    printf_level(2, "select (%s): %d mul, %d rotr, %d ext, %d ins, %d instructions removed\n",
+                 get_isa_name(), num_mul, num_rotr, num_ext, num_ins, num_dead);
+    return num_mul + num_rotr + num_ext + num_ins > 0;
+}
@@ -0,0 +1,429 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "optim.h"
+
+
+// Induction-variable strength reduction.
+// A basic induction variable is only written by top-level statements
+// "i = i + c" of the loop body (or by the for increment), c constant. Each
+// product i * k (or shift i << k) with k invariant is replaced by a temporary set to i * k
+// before the loop and increased by c * k right after every update of i.
+// When a counted for-loop is left with no other use of i than its test and
+// increment, the test is rewritten against the temporary, i is no longer
+// updated and receives its exit value after the loop.
+
+typedef struct _derived_s {
+    node_t iv;
+    node_t factor;       // invariant multiplier: constant or variable
+    node_t tmp;          // holds iv * factor
+    int32_t step;        // step for which inc was computed
+    node_t inc;          // temporary holding step * factor, if needed
+} derived_s;
+
+typedef struct _ivsr_ctx_s {
+    decl_set_s assigned;
+    decl_set_s ivs;
+    derived_s * derived;
+    int32_t size;
+    int32_t capacity;
+    node_t preheader;
+} ivsr_ctx_s;
+
+
+static node_t make_binop(node_nature nature, node_type type, node_t l, node_t r) {
+    node_t n = make_node(nature, 2, l, r);
+    n->type = type;
+    n->lineno = l->lineno;
+    return n;
+}
+
+static node_t append(node_t list, node_t elem) {
+    return list == NULL ? elem : list_append(list, elem);
+}
+
+// matches "var = var + c", "var = c + var" and "var = var - c"
+static bool iv_update(node_t stmt, node_t * var, int32_t * step) {
+    if (stmt == NULL || stmt->nature != NODE_AFFECT) {
+        return false;
+    }
+
+    node_t v = stmt->opr[0]->decl_node;
+    node_t e = stmt->opr[1];
+    if (e->nature == NODE_PLUS && is_var(e->opr[0], v) && e->opr[1]->nature == NODE_INTVAL) {
+        *step = (int32_t)e->opr[1]->value;
+    } else if (e->nature == NODE_PLUS && is_var(e->opr[1], v) && e->opr[0]->nature == NODE_INTVAL) {
+        *step = (int32_t)e->opr[0]->value;
+    } else if (e->nature == NODE_MINUS && is_var(e->opr[0], v) && e->opr[1]->nature == NODE_INTVAL) {
+        *step = (int32_t)(0u - (uint32_t)e->opr[1]->value);
+    } else {
+        return false;
+    }
+    *var = v;
+    return v->type == TYPE_INT;
+}
+
+// number of writes to var: assignments and initialised declarations
+static int32_t count_writes(node_t n, node_t var) {
+    int32_t count = 0;
+
+    if (n == NULL) {
+        return 0;
+    }
+    if ((n->nature == NODE_AFFECT && n->opr[0]->decl_node == var)
+        || (n->nature == NODE_DECL && n->opr[0] == var && n->nops > 1 && n->opr[1] != NULL)) {
+        count++;
+    }
+    for (int32_t i = 0; i < n->nops; i++) {
+        count += count_writes(n->opr[i], var);
+    }
+    return count;
+}
+
+// top-level updates of var, reached through lists and blocks only
+static int32_t count_top_updates(node_t stmt, node_t var) {
+    node_t v;
+    int32_t step;
+
+    if (stmt == NULL) {
+        return 0;
+    }
+    if (stmt->nature == NODE_LIST) {
+        return count_top_updates(stmt->opr[0], var) + count_top_updates(stmt->opr[1], var);
+    }
+    if (stmt->nature == NODE_BLOCK) {
+        return count_top_updates(stmt->opr[1], var);
+    }
+    return (iv_update(stmt, &v, &step) && v == var) ? 1 : 0;
+}
+
+static node_t * body_slot(node_t loop) {
+    return loop->nature == NODE_FOR ? &loop->opr[3]
+         : loop->nature == NODE_WHILE ? &loop->opr[1] : &loop->opr[0];
+}
+
+static node_t loop_cond(node_t loop) {
+    return loop->nature == NODE_WHILE ? loop->opr[0] : loop->opr[1];
+}
+
+static void find_ivs(ivsr_ctx_s * ctx, node_t loop) {
+    node_t body = *body_slot(loop);
+    node_t incr = loop->nature == NODE_FOR ? loop->opr[2] : NULL;
+
+    for (int32_t i = 0; i < ctx->assigned.size; i++) {
+        node_t var = ctx->assigned.decls[i];
+        int32_t top = count_top_updates(body, var) + count_top_updates(incr, var);
+        if (top > 0 && count_writes(loop_cond(loop), var) == 0
+            && top == count_writes(body, var) + count_writes(incr, var)) {
+            decl_set_add(&ctx->ivs, var);
+        }
+    }
+}
+
+
+// products replaced by temporaries
+static bool is_factor(ivsr_ctx_s * ctx, node_t n) {
+    return n->nature == NODE_INTVAL
+        || (n->nature == NODE_IDENT && !decl_set_contains(&ctx->assigned, n->decl_node));
+}
+
+static derived_s * find_derived(ivsr_ctx_s * ctx, node_t iv, node_t factor) {
+    for (int32_t i = 0; i < ctx->size; i++) {
+        if (ctx->derived[i].iv == iv && same_tree(ctx->derived[i].factor, factor)) {
+            return &ctx->derived[i];
+        }
+    }
+
+    if (ctx->size == ctx->capacity) {
+        ctx->capacity = ctx->capacity ? 2 * ctx->capacity : 4;
+        ctx->derived = realloc(ctx->derived, ctx->capacity * sizeof(derived_s));
+    }
+    derived_s * d = &ctx->derived[ctx->size++];
+    d->iv = iv;
+    d->factor = copy_tree(factor);
+    d->tmp = new_temporary(TYPE_INT);
+    d->step = 0;
+    d->inc = NULL;
+
+    node_t init = make_binop(NODE_MUL, TYPE_INT, make_ref(iv), copy_tree(factor));
+    ctx->preheader = append(ctx->preheader, make_binop(NODE_AFFECT, TYPE_INT, d->tmp, init));
+    return d;
+}
+
+// iv * k, k * iv, and iv << k as the product iv * 2^k
+static bool match_product(ivsr_ctx_s * ctx, node_t n, node_t * iv, node_t * factor) {
+    if (n->nature != NODE_MUL && n->nature != NODE_SLL) {
+        return false;
+    }
+
+    node_t l = n->opr[0], r = n->opr[1];
+    if (n->nature == NODE_MUL) {
+        if (l->nature == NODE_IDENT && decl_set_contains(&ctx->ivs, l->decl_node) && is_factor(ctx, r)) {
+            *iv = l->decl_node;
+            *factor = copy_tree(r);
+            return true;
+        }
+        if (r->nature == NODE_IDENT && decl_set_contains(&ctx->ivs, r->decl_node) && is_factor(ctx, l)) {
+            *iv = r->decl_node;
+            *factor = copy_tree(l);
+            return true;
+        }
+    } else {
+        if (l->nature == NODE_IDENT && decl_set_contains(&ctx->ivs, l->decl_node)
+            && r->nature == NODE_INTVAL && r->value >= 0 && r->value < 32) {
+            *iv = l->decl_node;
+            *factor = make_int((int32_t)(1u << r->value));
+            return true;
+        }
+    }
+    return false;
+}
+
+static void replace_products(ivsr_ctx_s * ctx, node_t * pn) {
+    node_t n = *pn;
+    node_t iv, factor;
+
+    if (n == NULL) {
+        return;
+    }
+
+    if (match_product(ctx, n, &iv, &factor)) {
+        derived_s * d = find_derived(ctx, iv, factor);
+        free_nodes(factor);
+        *pn = make_ref(d->tmp);
+        (*pn)->lineno = n->lineno;
+        free_nodes(n);
+        return;
+    }
+
+    for (int32_t i = 0; i < n->nops; i++) {
+        replace_products(ctx, &n->opr[i]);
+    }
+}
+
+
+// updates of the temporaries
+static node_t make_update(ivsr_ctx_s * ctx, derived_s * d, int32_t step) {
+    node_t inc;
+
+    if (d->factor->nature == NODE_INTVAL) {
+        inc = make_int((int32_t)((uint32_t)step * (uint32_t)d->factor->value));
+    } else if (step == 1) {
+        inc = make_ref(d->factor->decl_node);
+    } else {
+        if (d->inc == NULL || d->step != step) {
+            d->inc = new_temporary(TYPE_INT);
+            d->step = step;
+            node_t value = make_binop(NODE_MUL, TYPE_INT, make_int(step), copy_tree(d->factor));
+            ctx->preheader = append(ctx->preheader, make_binop(NODE_AFFECT, TYPE_INT, d->inc, value));
+        }
+        inc = make_ref(d->inc);
+    }
+
+    node_t sum = make_binop(NODE_PLUS, TYPE_INT, make_ref(d->tmp), inc);
+    return make_binop(NODE_AFFECT, TYPE_INT, make_ref(d->tmp), sum);
+}
+
+// updates following "var = var + step", except for the temporary skip
+static node_t updates_for(ivsr_ctx_s * ctx, node_t var, int32_t step, node_t skip) {
+    node_t list = NULL;
+
+    for (int32_t i = 0; i < ctx->size; i++) {
+        if (ctx->derived[i].iv == var && ctx->derived[i].tmp != skip) {
+            list = append(list, make_update(ctx, &ctx->derived[i], step));
+        }
+    }
+    return list;
+}
+
+static node_t updates_after(ivsr_ctx_s * ctx, node_t stmt) {
+    node_t var;
+    int32_t step;
+
+    return iv_update(stmt, &var, &step) ? updates_for(ctx, var, step, NULL) : NULL;
+}
+
+static void insert_updates(ivsr_ctx_s * ctx, node_t * pstmt) {
+    node_t stmt = *pstmt;
+
+    if (stmt == NULL) {
+        return;
+    }
+    if (stmt->nature == NODE_LIST) {
+        insert_updates(ctx, &stmt->opr[0]);
+        insert_updates(ctx, &stmt->opr[1]);
+        return;
+    }
+    if (stmt->nature == NODE_BLOCK) {
+        insert_updates(ctx, &stmt->opr[1]);
+        return;
+    }
+
+    node_t updates = updates_after(ctx, stmt);
+    if (updates != NULL) {
+        *pstmt = make_block_list(list_append(stmt, updates));
+    }
+}
+
+
+// linear function test replacement in a counted for-loop
+static bool fits(int64_t v) {
+    return v >= INT32_MIN && v <= INT32_MAX;
+}
+
+static derived_s * replace_test(ivsr_ctx_s * ctx, node_t loop, counted_loop_s * cl,
+                                int32_t start, int32_t last) {
+    int32_t bound;
+    decl_set_s var = { NULL, 0, 0 };
+
+    decl_set_add(&var, cl->var);
+    bool used = uses_any(loop->opr[3], &var);
+    decl_set_free(&var);
+    if (used || !eval_const_expr(cl->bound, NULL, 0, &bound)) {
+        return NULL;
+    }
+
+    for (int32_t i = 0; i < ctx->size; i++) {
+        derived_s * d = &ctx->derived[i];
+        if (d->iv != cl->var || d->factor->nature != NODE_INTVAL || d->factor->value == 0) {
+            continue;
+        }
+        int64_t k = (int32_t)d->factor->value;
+        if (!fits(start * k) || !fits(last * k) || !fits(bound * k)) {
+            continue;
+        }
+
+        node_nature rel = k > 0 ? cl->rel : swap_rel(cl->rel);
+        free_nodes(loop->opr[1]);
+        loop->opr[1] = make_binop(rel, TYPE_BOOL, make_ref(d->tmp), make_int(bound * k));
+        free_nodes(loop->opr[2]);
+        loop->opr[2] = make_update(ctx, d, cl->step);
+        return d;
+    }
+    return NULL;
+}
+
+
+// one loop; returns the statement replacing it
+static node_t reduce_loop(node_t loop) {
+    ivsr_ctx_s ctx = { { NULL, 0, 0 }, { NULL, 0, 0 }, NULL, 0, 0, NULL };
+    counted_loop_s cl;
+    int32_t count, last, start;
+    node_t init = NULL, post = NULL;
+
+    bool counted = loop->nature == NODE_FOR && match_counted_loop(loop, &cl)
+        && counted_trip_count(loop, &cl, &count, &last);
+    if (counted) {
+        eval_const_expr(loop->opr[0]->opr[1], NULL, 0, &start);
+    }
+
+    if (loop->nature == NODE_FOR) {
+        // the initialisation is not part of the loop: the preheader follows it
+        init = loop->opr[0];
+        loop->opr[0] = NULL;
+    }
+
+    collect_assigned(loop, &ctx.assigned);
+    find_ivs(&ctx, loop);
+    for (int32_t i = 0; i < loop->nops && ctx.ivs.size > 0; i++) {
+        replace_products(&ctx, &loop->opr[i]);
+    }
+
+    if (ctx.size > 0) {
+        derived_s * kept = counted ? replace_test(&ctx, loop, &cl, start, last) : NULL;
+
+        if (kept != NULL) {
+            // the counter is only needed after the loop
+            node_t others = updates_for(&ctx, cl.var, cl.step, kept->tmp);
+            if (others != NULL) {
+                loop->opr[3] = make_block_list(append(loop->opr[3], others));
+            }
+            post = make_binop(NODE_AFFECT, TYPE_INT, make_ref(cl.var), make_int(last));
+        } else {
+            insert_updates(&ctx, body_slot(loop));
+            if (loop->nature == NODE_FOR && loop->opr[2] != NULL) {
+                node_t updates = updates_after(&ctx, loop->opr[2]);
+                if (updates != NULL) {
+                    // the updates follow the increment at the end of the body
+                    node_t latch = list_append(loop->opr[2], updates);
+                    loop->opr[3] = make_block_list(append(loop->opr[3], latch));
+                    loop->opr[2] = NULL;
+                }
+            }
+        }
+    }
+
+    for (int32_t i = 0; i < ctx.size; i++) {
+        free_nodes(ctx.derived[i].factor);
+    }
+    free(ctx.derived);
+    decl_set_free(&ctx.assigned);
+    decl_set_free(&ctx.ivs);
+
+    if (ctx.preheader == NULL) {
+        if (init != NULL) {
+            loop->opr[0] = init;
+        }
+        return loop;
+    }
+
+    node_t list = init != NULL ? list_append(init, ctx.preheader) : ctx.preheader;
+    list = list_append(list, loop);
+    if (post != NULL) {
+        list = list_append(list, post);
+    }
+    return make_block_list(list);
+}
+
+
+// tree walk, innermost loops first
+static void ivsr_instr(node_t * pinstr) {
+    node_t instr = *pinstr;
+
+    if (instr == NULL) {
+        return;
+    }
+
+    switch (instr->nature) {
+        case NODE_LIST:
+            ivsr_instr(&instr->opr[0]);
+            ivsr_instr(&instr->opr[1]);
+            break;
+
+        case NODE_BLOCK:
+            ivsr_instr(&instr->opr[1]);
+            break;
+
+        case NODE_IF:
+            ivsr_instr(&instr->opr[1]);
+            ivsr_instr(&instr->opr[2]);
+            break;
+
+        case NODE_WHILE:
+            ivsr_instr(&instr->opr[1]);
+            *pinstr = reduce_loop(instr);
+            break;
+
+        case NODE_FOR:
+            ivsr_instr(&instr->opr[3]);
+            *pinstr = reduce_loop(instr);
+            break;
+
+        case NODE_DOWHILE:
+            ivsr_instr(&instr->opr[0]);
+            *pinstr = reduce_loop(instr);
+            break;
+
+        default:
+            break;
+    }
+}
+
+void ivsr_tree(node_t root) {
+    node_t func = root->opr[1];
+    ivsr_instr(&func->opr[2]);
+}
@@ -0,0 +1,370 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "asm.h"
+
+extern int trace_level;
+
+
+// Jump threading.
+// gen_if leaves jumps to labels followed by another jump, and the test of a
+// loop is often reached from a block that has just stored the tested
+// variable. For each jump, branch or fall through into a label, the code at
+// the destination is evaluated with the values known at the end of the
+// edge: constants in registers and words stored since the start of the
+// block. When it only computes registers of passe_2 up to a jump whose
+// outcome is known, the edge goes directly to the final destination, which
+// is safe as these registers are dead there. Labels no longer referenced and
+// the code that became unreachable are then removed.
+
+// instructions evaluated along an edge
+#define MAX_PATH 32
+#define MAX_SLOTS 16
+
+#define REG(r) ((asm_regs)1 << (r))
+
+// a memory word or byte, relative to the stack pointer or absolute
+typedef struct _slot_s {
+    bool stack;
+    int32_t addr;
+    int32_t width;
+    int32_t value;
+} slot_s;
+
+typedef struct _values_s {
+    bool known[32];
+    int32_t reg[32];
+    slot_s slots[MAX_SLOTS];
+    int32_t num_slots;
+} values_s;
+
+static int32_t num_threaded;
+static int32_t num_falls;
+static int32_t num_labels;
+static int32_t num_unreachable;
+
+
+// values
+static void values_reset(values_s * v) {
+    memset(v, 0, sizeof(*v));
+    v->known[0] = true;
+}
+
+// address of a memory operand, false when its base is unknown
+static bool slot_addr(values_s * v, asm_line_s * l, bool * stack, int32_t * addr) {
+    int32_t base = l->args[1].reg;
+
+    *stack = (base == 29);
+    if (!*stack && !v->known[base]) {
+        return false;
+    }
+    *addr = (*stack ? 0 : v->reg[base]) + l->args[1].imm;
+    return true;
+}
+
+// forgets the slots overlapping a store, all the data section ones when its
+// address is unknown
+static void kill_slots(values_s * v, bool known, bool stack, int32_t addr, int32_t width) {
+    for (int32_t i = 0; i < v->num_slots; ) {
+        slot_s * s = &v->slots[i];
+        bool overlap = known ? (s->stack == stack && s->addr < addr + width && addr < s->addr + s->width)
+                             : !s->stack;
+        if (overlap) {
+            *s = v->slots[--v->num_slots];
+        } else {
+            i++;
+        }
+    }
+}
+
+static bool load_slot(values_s * v, asm_line_s * l, int32_t * value) {
+    bool stack;
+    int32_t addr;
+
+    if (!slot_addr(v, l, &stack, &addr)) {
+        return false;
+    }
+    for (int32_t i = 0; i < v->num_slots; i++) {
+        slot_s * s = &v->slots[i];
+        if (s->stack == stack && s->addr == addr && s->width == asm_mem_width(l)) {
+            *value = s->value;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void store_slot(values_s * v, asm_line_s * l) {
+    int32_t src = l->args[0].reg;
+    int32_t width = asm_mem_width(l);
+    bool stack;
+    int32_t addr;
+
+    if (!slot_addr(v, l, &stack, &addr)) {
+        kill_slots(v, false, stack, 0, 0);
+        return;
+    }
+    kill_slots(v, true, stack, addr, width);
+    if (v->known[src] && v->num_slots < MAX_SLOTS) {
+        slot_s * s = &v->slots[v->num_slots++];
+        s->stack = stack;
+        s->addr = addr;
+        s->width = width;
+        // lb sign extends the byte
+        s->value = (width == 1) ? (int32_t)(int8_t)v->reg[src] : v->reg[src];
+    }
+}
+
+// executes one instruction on the known values
+static void values_step(values_s * v, asm_line_s * l) {
+    uint32_t flags = asm_op_flags(l);
+    asm_regs defs = asm_defs(l);
+    int32_t a = 0, b = 0, result;
+    bool known = false;
+
+    if (flags & (ASM_OP_CALL | ASM_OP_UNKNOWN)) {
+        values_reset(v);
+        return;
+    }
+    if (flags & ASM_OP_STORE) {
+        store_slot(v, l);
+        return;
+    }
+    if (flags & ASM_OP_LOAD) {
+        known = load_slot(v, l, &result);
+    } else if (l->nargs >= 2 && l->args[1].kind == ASM_ARG_REG && v->known[l->args[1].reg]) {
+        a = v->reg[l->args[1].reg];
+        if (l->nargs < 3 || l->args[2].kind != ASM_ARG_REG || v->known[l->args[2].reg]) {
+            b = (l->nargs < 3 || l->args[2].kind != ASM_ARG_REG) ? 0 : v->reg[l->args[2].reg];
+            known = asm_eval(l, a, b, &result);
+        }
+    } else if (asm_is_inst(l, "lui")) {
+        known = asm_eval(l, 0, 0, &result);
+    }
+
+    for (int32_t r = 1; r < 32; r++) {
+        if (defs & REG(r)) {
+            v->known[r] = false;
+        }
+    }
+    if (known && (defs & ~REG(ASM_REG_HI) & ~REG(ASM_REG_LO)) != 0 && l->args[0].reg != 0) {
+        v->known[l->args[0].reg] = true;
+        v->reg[l->args[0].reg] = result;
+    }
+}
+
+// values known after the instructions of the block that precede line i
+static void edge_values(asm_prog_s * prog, int32_t i, values_s * v) {
+    int32_t start = i;
+
+    values_reset(v);
+    while (start > 0 && prog->lines[start - 1].kind != ASM_LINE_LABEL
+           && prog->lines[start - 1].kind != ASM_LINE_DIRECTIVE && !asm_is_boundary(&prog->lines[start - 1])) {
+        start--;
+    }
+    for (int32_t j = start; j < i; j++) {
+        if (prog->lines[j].kind == ASM_LINE_INST) {
+            values_step(v, &prog->lines[j]);
+        }
+    }
+}
+
+
+// paths
+// only writes registers of passe_2, which are dead at the end of the path
+static bool can_skip(asm_line_s * l) {
+    uint32_t flags = asm_op_flags(l);
+    asm_regs defs = asm_defs(l);
+
+    return (flags & ~ASM_OP_LOAD) == 0 && (defs & ~ASM_SCRATCH_REGS) == 0;
+}
+
+// follows the code from the label with the values of the edge, returns the
+// position where the execution certainly continues after at least one jump
+// or branch, or -1, skipped counts the instructions left out
+static int32_t resolve(asm_prog_s * prog, const char * label, values_s * v, int32_t * skipped) {
+    int32_t pos = asm_find_label(prog, label);
+    int32_t dest = -1;
+    int32_t n = 0;
+
+    *skipped = 0;
+    if (pos < 0) {
+        return -1;
+    }
+    while (++pos < prog->size && n < MAX_PATH) {
+        asm_line_s * l = &prog->lines[pos];
+        uint32_t flags = asm_op_flags(l);
+        bool taken;
+
+        if (l->kind == ASM_LINE_LABEL || l->kind == ASM_LINE_TEXT) {
+            continue;
+        }
+        if (l->kind != ASM_LINE_INST) {
+            break;
+        }
+        n++;
+        if (asm_is_inst(l, "j")) {
+            pos = asm_find_label(prog, asm_target(l));
+            if (pos < 0) {
+                break;
+            }
+        } else if (flags & ASM_OP_BRANCH) {
+            int32_t a = l->args[0].reg;
+            int32_t b = (l->nargs == 3) ? l->args[1].reg : 0;
+            if (!v->known[a] || !v->known[b]
+                || !asm_eval_branch(l, v->reg[a], v->reg[b], &taken)) {
+                break;
+            }
+            if (taken) {
+                pos = asm_find_label(prog, asm_target(l));
+                if (pos < 0) {
+                    break;
+                }
+            }
+        } else if (can_skip(l)) {
+            values_step(v, l);
+            continue;
+        } else {
+            break;
+        }
+        dest = pos + (prog->lines[pos].kind != ASM_LINE_LABEL);
+        *skipped = n;
+        if (dest < prog->size && prog->lines[dest].kind == ASM_LINE_LABEL) {
+            pos = dest;
+        } else {
+            pos = dest - 1;
+        }
+    }
+    return dest;
+}
+
+// label at the position, added when there is none
+static const char * label_at(asm_prog_s * prog, int32_t * pos, int32_t * i) {
+    char name[32];
+
+    if (*pos < prog->size && prog->lines[*pos].kind == ASM_LINE_LABEL) {
+        return prog->lines[*pos].text;
+    }
+    asm_new_label(prog, name, sizeof(name));
+    asm_insert(prog, *pos, "%s:", name);
+    if (*pos <= *i) {
+        (*i)++;
+    }
+    return prog->lines[*pos].text;
+}
+
+// a jump or a branch at line i
+static void thread_jump(asm_prog_s * prog, int32_t * i) {
+    asm_line_s * l = &prog->lines[*i];
+    values_s v;
+    int32_t skipped;
+    int32_t dest;
+
+    edge_values(prog, *i, &v);
+    dest = resolve(prog, asm_target(l), &v, &skipped);
+    if (dest < 0) {
+        return;
+    }
+    const char * label = label_at(prog, &dest, i);
+    l = &prog->lines[*i];
+    if (strcmp(label, asm_target(l)) != 0) {
+        asm_set_target(l, label);
+        num_threaded++;
+    }
+}
+
+// the fall through into the label at line i, a jump is added when it skips
+// some code
+static void thread_fall(asm_prog_s * prog, int32_t * i) {
+    values_s v;
+    int32_t skipped;
+    int32_t dest;
+    char label[32];
+
+    edge_values(prog, *i, &v);
+    dest = resolve(prog, prog->lines[*i].text, &v, &skipped);
+    if (dest < 0 || skipped < 2) {
+        return;
+    }
+    snprintf(label, sizeof(label), "%s", label_at(prog, &dest, i));
+    asm_insert(prog, *i, "j %s", label);
+    (*i)++;
+    num_falls++;
+}
+
+// previous line that is not a comment
+static asm_line_s * prev_line(asm_prog_s * prog, int32_t i) {
+    while (--i >= 0) {
+        if (prog->lines[i].kind != ASM_LINE_TEXT) {
+            return &prog->lines[i];
+        }
+    }
+    return NULL;
+}
+
+
+// cleanup
+static bool remove_dead_code(asm_prog_s * prog, int32_t text) {
+    bool changed = false;
+    bool reachable = true;
+
+    for (int32_t i = text; i < prog->size; ) {
+        asm_line_s * l = &prog->lines[i];
+
+        if (l->kind == ASM_LINE_LABEL && strcmp(l->text, "main") != 0 && !asm_is_referenced(prog, l->text)) {
+            asm_remove(prog, i);
+            num_labels++;
+            changed = true;
+            continue;
+        }
+        if (l->kind == ASM_LINE_LABEL) {
+            reachable = true;
+        } else if (l->kind == ASM_LINE_INST && !reachable) {
+            asm_remove(prog, i);
+            num_unreachable++;
+            changed = true;
+            continue;
+        } else if (asm_is_inst(l, "j") || asm_is_inst(l, "jr")) {
+            reachable = false;
+        }
+        i++;
+    }
+    return changed;
+}
+
+bool thread_jumps_asm(asm_prog_s * prog) {
+    int32_t text = asm_find_directive(prog, ".text");
+
+    num_threaded = 0;
+    num_falls = 0;
+    num_labels = 0;
+    num_unreachable = 0;
+    if (text < 0) {
+        return false;
+    }
+
+    for (int32_t i = text; i < prog->size; i++) {
+        asm_line_s * l = &prog->lines[i];
+        asm_line_s * prev;
+
+        if (asm_op_flags(l) & (ASM_OP_BRANCH | ASM_OP_JUMP)) {
+            if (asm_target(l) != NULL) {
+                thread_jump(prog, &i);
+            }
+        } else if (l->kind == ASM_LINE_LABEL && (prev = prev_line(prog, i)) != NULL
+                   && prev->kind == ASM_LINE_INST && !asm_is_inst(prev, "j") && !asm_is_inst(prev, "jr")) {
+            thread_fall(prog, &i);
+        }
+    }
+    while (remove_dead_code(prog, text)) {
+    }
+
+    printf_level(2, "thread-jumps: %d edges threaded, %d jumps added, %d labels and %d instructions removed\n",
+                 num_threaded, num_falls, num_labels, num_unreachable);
+    return num_threaded + num_falls + num_labels + num_unreachable > 0;
+}
@@ -0,0 +1,338 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "asm.h"
+
+extern int trace_level;
+
+
+// Block layout.
+// passe_2 lays the code out in the order of the source: the then arm of an
+// if falls through from its test and the else arm is behind a jump, which
+// costs a taken branch or jump on the path that runs most. Each forward
+// branch is predicted with static heuristics, tried in order:
+// - the exit of a loop is not taken, and its layout is kept,
+// - a path where a trap fires, or the program exits, is cold,
+// - a value is unlikely to be zero or negative, and two values are
+//   unlikely to be equal.
+// When the arm after a branch is predicted cold, the branch is inverted and
+// the arm moved to the end of .text, from where it jumps back. When the arm
+// at its target is, it is moved the same way and the jump over it removed.
+// The likely path then falls through. Back edges are left in place, the
+// body of a loop already falls through from its test. With -fprofile-use,
+// the branch of an if goes by its measured probability instead.
+
+#define REG(r) (((r) >= 0) ? (asm_regs)1 << (r) : 0)
+
+// permille of the runs from which a profiled branch is predicted either way
+#define PROFILE_TAKEN 667
+#define PROFILE_NOT_TAKEN 333
+
+static int32_t num_predicted;
+static int32_t num_moved;
+static int32_t num_jumps;
+
+
+// helpers
+static int32_t prev_line(asm_prog_s * prog, int32_t i) {
+    for (i--; i >= 0 && prog->lines[i].kind == ASM_LINE_TEXT; i--) {
+    }
+    return i;
+}
+
+static int32_t next_line(asm_prog_s * prog, int32_t i) {
+    for (i++; i < prog->size && prog->lines[i].kind == ASM_LINE_TEXT; i++) {
+    }
+    return i;
+}
+
+static bool ends_flow(asm_line_s * l) {
+    return asm_is_inst(l, "j") || asm_is_inst(l, "jr");
+}
+
+// a line outside of [s, e] refers to the label
+static bool referenced_outside(asm_prog_s * prog, const char * label, int32_t s, int32_t e) {
+    for (int32_t i = 0; i < prog->size; i++) {
+        const char * target = (prog->lines[i].kind == ASM_LINE_INST) ? asm_target(&prog->lines[i]) : NULL;
+        if ((i < s || i > e) && target != NULL && strcmp(target, label) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// the labels of [s, e] are only reached from inside, and there is no
+// directive, so the lines can go elsewhere
+static bool movable(asm_prog_s * prog, int32_t s, int32_t e) {
+    for (int32_t i = s; i <= e; i++) {
+        asm_line_s * l = &prog->lines[i];
+        if (l->kind == ASM_LINE_DIRECTIVE
+            || (l->kind == ASM_LINE_LABEL && i > s
+                && (!asm_is_referenced(prog, l->text) || referenced_outside(prog, l->text, s, e)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// last line of the arm starting at label s: the lines up to the next label
+// reached from before it, or the end of the text
+static int32_t arm_end(asm_prog_s * prog, int32_t s) {
+    int32_t e = s;
+
+    for (int32_t i = s + 1; i < prog->size; i++) {
+        asm_line_s * l = &prog->lines[i];
+        if (l->kind == ASM_LINE_DIRECTIVE
+            || (l->kind == ASM_LINE_LABEL
+                && (!asm_is_referenced(prog, l->text) || referenced_outside(prog, l->text, s, i)))) {
+            break;
+        }
+        e = i;
+    }
+    return e;
+}
+
+
+// prediction
+// the lines of [s, e] exit the program, or trap when the registers a and b
+// are equal, as they are on that path
+static bool cold(asm_prog_s * prog, int32_t s, int32_t e, int32_t a, int32_t b) {
+    for (int32_t i = s; i <= e; i++) {
+        asm_line_s * l = &prog->lines[i];
+        if ((asm_op_flags(l) & ASM_OP_TRAP)
+            && ((l->args[0].reg == a && l->args[1].reg == b) || (l->args[0].reg == b && l->args[1].reg == a))) {
+            return true;
+        }
+        if (asm_defs(l) & (REG(a) | REG(b))) {
+            a = -1;
+            b = -1;
+        }
+        if (asm_is_inst(l, "syscall")) {
+            int32_t p = prev_line(prog, i);
+            if (p >= s && asm_is_inst(&prog->lines[p], "ori") && prog->lines[p].args[0].reg == 2
+                && prog->lines[p].args[1].reg == 0 && prog->lines[p].args[2].imm == 10) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// the register read by the line i holds zero, as set in the block
+static bool is_zero(asm_prog_s * prog, int32_t i, int32_t reg) {
+    if (reg == 0) {
+        return true;
+    }
+    for (int32_t p = prev_line(prog, i); p >= 0; p = prev_line(prog, p)) {
+        asm_line_s * l = &prog->lines[p];
+
+        if (l->kind != ASM_LINE_INST || asm_is_boundary(l)) {
+            return false;
+        }
+        if (asm_defs(l) & REG(reg)) {
+            return (asm_is_inst(l, "ori") || asm_is_inst(l, "addiu")) && l->args[1].reg == 0 && l->args[2].imm == 0;
+        }
+    }
+    return false;
+}
+
+// whether the register read by the line i is likely non zero, 1, or likely
+// zero, -1, from the comparison that set it in the block
+static int32_t likely_set(asm_prog_s * prog, int32_t i, int32_t reg) {
+    for (int32_t p = prev_line(prog, i); p >= 0; p = prev_line(prog, p)) {
+        asm_line_s * l = &prog->lines[p];
+
+        if (l->kind != ASM_LINE_INST || asm_is_boundary(l)) {
+            return 0;
+        }
+        if (!(asm_defs(l) & REG(reg))) {
+            continue;
+        }
+        if (asm_is_inst(l, "sltu") && is_zero(prog, p, l->args[1].reg)) {
+            return 1;           // x != 0
+        }
+        if (asm_is_inst(l, "sltiu") && l->args[2].imm == 1) {
+            return -1;          // x == 0
+        }
+        if ((asm_is_inst(l, "slt") && is_zero(prog, p, l->args[2].reg))
+            || (asm_is_inst(l, "slti") && l->args[2].imm == 0)) {
+            return -1;          // x < 0
+        }
+        if (asm_is_inst(l, "slt") && is_zero(prog, p, l->args[1].reg)) {
+            return 1;           // x > 0
+        }
+        if (asm_is_inst(l, "xori") && l->args[2].imm == 1) {
+            return -likely_set(prog, p, l->args[1].reg);
+        }
+        if (asm_is_inst(l, "slt") || asm_is_inst(l, "sltu") || asm_is_inst(l, "slti")
+            || asm_is_inst(l, "sltiu") || asm_is_inst(l, "and") || asm_is_inst(l, "or")) {
+            return 0;           // a boolean of no known bias
+        }
+        return 1;               // a value, compared to zero
+    }
+    return 0;
+}
+
+// the branch at line i to the label at line target: 1 when it is likely
+// taken, -1 when it is likely not, 0 when the layout is to be kept
+static int32_t predict(asm_prog_s * prog, int32_t i, int32_t target) {
+    asm_line_s * l = &prog->lines[i];
+    int32_t p = prev_line(prog, target);
+    bool eq = asm_is_inst(l, "beq"), ne = asm_is_inst(l, "bne");
+    int32_t set, taken;
+
+    if (p >= 0 && prog->lines[p].kind == ASM_LINE_INST && asm_target(&prog->lines[p]) != NULL) {
+        int32_t back = asm_find_label(prog, asm_target(&prog->lines[p]));
+        if (back >= 0 && back < p) {
+            return 0;
+        }
+    }
+    if ((taken = get_branch_profile(asm_target(l))) >= 0) {
+        return (taken >= PROFILE_TAKEN) ? 1 : (taken <= PROFILE_NOT_TAKEN) ? -1 : 0;
+    }
+    if (cold(prog, i + 1, target - 1, ne ? l->args[0].reg : -1, ne ? l->args[1].reg : -1)) {
+        return 1;
+    }
+    if (cold(prog, target, arm_end(prog, target), eq ? l->args[0].reg : -1, eq ? l->args[1].reg : -1)) {
+        return -1;
+    }
+
+    if (asm_is_inst(l, "bltz") || asm_is_inst(l, "blez")) {
+        return -1;
+    }
+    if (asm_is_inst(l, "bgez") || asm_is_inst(l, "bgtz")) {
+        return 1;
+    }
+    if (!eq && !ne) {
+        return 0;
+    }
+    if (l->args[0].reg != 0 && l->args[1].reg != 0) {
+        return eq ? -1 : 1;
+    }
+    set = likely_set(prog, i, (l->args[0].reg != 0) ? l->args[0].reg : l->args[1].reg);
+    return eq ? -set : set;
+}
+
+
+// placement
+static void invert(asm_line_s * l) {
+    static const char * pairs[][2] = {
+        { "beq", "bne" }, { "bne", "beq" }, { "bltz", "bgez" },
+        { "bgez", "bltz" }, { "bgtz", "blez" }, { "blez", "bgtz" },
+    };
+
+    for (int32_t k = 0; k < (int32_t)(sizeof(pairs) / sizeof(pairs[0])); k++) {
+        if (strcmp(l->op, pairs[k][0]) == 0) {
+            snprintf(l->op, sizeof(l->op), "%s", pairs[k][1]);
+            return;
+        }
+    }
+}
+
+// moves the lines [s, e] to the end of the program behind a label, which
+// is written in name, followed by a jump to join unless they end with one
+static void move_to_end(asm_prog_s * prog, int32_t s, int32_t e, const char * join, char * name, int32_t size) {
+    int32_t n = e - s + 1;
+    asm_line_s * arm = malloc(n * sizeof(asm_line_s));
+    int32_t last;
+
+    memcpy(arm, &prog->lines[s], n * sizeof(asm_line_s));
+    memmove(&prog->lines[s], &prog->lines[e + 1], (prog->size - e - 1) * sizeof(asm_line_s));
+    memcpy(&prog->lines[prog->size - n], arm, n * sizeof(asm_line_s));
+    free(arm);
+
+    if (prog->lines[prog->size - n].kind == ASM_LINE_LABEL) {
+        snprintf(name, size, "%s", prog->lines[prog->size - n].text);
+    } else {
+        asm_new_label(prog, name, size);
+        asm_insert(prog, prog->size - n, "%s:", name);
+    }
+    last = prev_line(prog, prog->size);
+    if (!ends_flow(&prog->lines[last])) {
+        asm_insert(prog, prog->size, "j %s", join);
+    }
+    num_moved++;
+}
+
+// the arm after the branch at line i, up to its target; returns the number
+// of lines taken out of the place
+static int32_t move_fall_through(asm_prog_s * prog, int32_t i, int32_t target) {
+    char name[32];
+
+    if (target == i + 1 || !movable(prog, i + 1, target - 1)) {
+        return 0;
+    }
+    move_to_end(prog, i + 1, target - 1, prog->lines[target].text, name, sizeof(name));
+    invert(&prog->lines[i]);
+    asm_set_target(&prog->lines[i], name);
+    return target - i - 1;
+}
+
+// the arm at the target of the branch at line i, behind a jump
+static int32_t move_target(asm_prog_s * prog, int32_t i, int32_t target) {
+    int32_t p = prev_line(prog, target);
+    int32_t e = arm_end(prog, target);
+    int32_t next;
+    char name[32];
+
+    if (p < 0 || !ends_flow(&prog->lines[p]) || referenced_outside(prog, prog->lines[target].text, i, i)
+        || e + 1 >= prog->size || prog->lines[e + 1].kind != ASM_LINE_LABEL
+        || !movable(prog, target, e)) {
+        return 0;
+    }
+    move_to_end(prog, target, e, prog->lines[e + 1].text, name, sizeof(name));
+    asm_set_target(&prog->lines[i], name);
+
+    // the jump over the arm now goes to the next line
+    next = next_line(prog, p);
+    if (asm_is_inst(&prog->lines[p], "j") && prog->lines[next].kind == ASM_LINE_LABEL
+        && strcmp(asm_target(&prog->lines[p]), prog->lines[next].text) == 0) {
+        asm_remove(prog, p);
+        num_jumps++;
+        return e - target + 2;
+    }
+    return e - target + 1;
+}
+
+bool layout_asm(asm_prog_s * prog) {
+    int32_t text = asm_find_directive(prog, ".text");
+    int32_t limit = prog->size;
+
+    num_predicted = 0;
+    num_moved = 0;
+    num_jumps = 0;
+    if (text < 0) {
+        return false;
+    }
+
+    // the arms moved to the end are not looked at again
+    for (int32_t i = text; i < limit; i++) {
+        asm_line_s * l = &prog->lines[i];
+        int32_t target;
+
+        if (!(asm_op_flags(l) & ASM_OP_BRANCH) || (target = asm_find_label(prog, asm_target(l))) <= i) {
+            continue;
+        }
+        switch (predict(prog, i, target)) {
+            case 1:
+                num_predicted++;
+                limit -= move_fall_through(prog, i, target);
+                break;
+            case -1:
+                num_predicted++;
+                limit -= move_target(prog, i, target);
+                break;
+            default:
+                break;
+        }
+    }
+
+    printf_level(2, "layout: %d branches predicted, %d cold arms moved to the end, %d jumps removed\n",
+                 num_predicted, num_moved, num_jumps);
+    return num_moved > 0;
+}
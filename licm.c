@@ -0,0 +1,315 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "optim.h"
+
+
+// Loop-invariant code motion.
+// Loops are visited outermost first, so an expression invariant in several
+// nested loops lands in the preheader of the outermost one. Each distinct
+// invariant expression is computed once into a temporary before the loop and
+// every occurrence inside the loop is replaced by a load of that temporary.
+
+typedef struct _licm_ctx_s {
+    decl_set_s assigned;
+    node_t * exprs;       // hoisted expressions (or string literals)
+    node_t * temps;       // matching temporaries
+    int32_t size;
+    int32_t capacity;
+    node_t preheader;     // list of assignments to emit before the loop
+} licm_ctx_s;
+
+
+static void add_hoisted(licm_ctx_s * ctx, node_t expr, node_t tmp, node_t rhs) {
+    if (ctx->size == ctx->capacity) {
+        ctx->capacity = ctx->capacity ? 2 * ctx->capacity : 8;
+        ctx->exprs = realloc(ctx->exprs, ctx->capacity * sizeof(node_t));
+        ctx->temps = realloc(ctx->temps, ctx->capacity * sizeof(node_t));
+    }
+    ctx->exprs[ctx->size] = expr;
+    ctx->temps[ctx->size] = tmp;
+    ctx->size++;
+
+    node_t affect = make_node(NODE_AFFECT, 2, tmp, rhs);
+    affect->type = tmp->type;
+    affect->lineno = rhs->lineno;
+    ctx->preheader = ctx->preheader ? list_append(ctx->preheader, affect) : affect;
+}
+
+static node_t find_hoisted(licm_ctx_s * ctx, node_t expr) {
+    for (int32_t i = 0; i < ctx->size; i++) {
+        if (same_tree(ctx->exprs[i], expr)) {
+            return ctx->temps[i];
+        }
+    }
+    return NULL;
+}
+
+static bool is_invariant(licm_ctx_s * ctx, node_t e) {
+    if (e == NULL) {
+        return true;
+    }
+    if (e->nature == NODE_AFFECT || e->nature == NODE_STRINGVAL) {
+        return false;
+    }
+    if (e->nature == NODE_IDENT) {
+        return !decl_set_contains(&ctx->assigned, e->decl_node);
+    }
+    for (int32_t i = 0; i < e->nops; i++) {
+        if (!is_invariant(ctx, e->opr[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// expressions
+// safe: the expression is evaluated in the first iteration before any output,
+// so a division in it may trap in the preheader instead.
+static void hoist_expr(licm_ctx_s * ctx, node_t * pexpr, bool safe) {
+    node_t e = *pexpr;
+
+    if (e == NULL || is_leaf(e)) {
+        return;
+    }
+
+    if (e->nature == NODE_AFFECT) {
+        hoist_expr(ctx, &e->opr[1], safe);
+        return;
+    }
+
+    if (is_invariant(ctx, e) && (safe || !may_trap(e))) {
+        int32_t lineno = e->lineno;
+        node_t tmp = find_hoisted(ctx, e);
+        if (tmp == NULL) {
+            tmp = new_temporary(e->type);
+            add_hoisted(ctx, e, tmp, e);
+        } else {
+            free_nodes(e);
+        }
+        *pexpr = make_ref(tmp);
+        (*pexpr)->lineno = lineno;
+        return;
+    }
+
+    for (int32_t i = 0; i < e->nops; i++) {
+        hoist_expr(ctx, &e->opr[i], safe);
+    }
+}
+
+// print items: the address of each string literal is kept in a temporary
+static void hoist_print_strings(licm_ctx_s * ctx, node_t item) {
+    if (item == NULL) {
+        return;
+    }
+
+    if (item->nature == NODE_LIST) {
+        hoist_print_strings(ctx, item->opr[0]);
+        hoist_print_strings(ctx, item->opr[1]);
+        return;
+    }
+
+    if (item->nature != NODE_STRINGVAL || item->decl_node != NULL) {
+        return;
+    }
+
+    node_t tmp = find_hoisted(ctx, item);
+    if (tmp == NULL) {
+        // an address node has no text of its own and points to the literal
+        node_t addr = make_node(NODE_STRINGVAL, 0);
+        addr->decl_node = item;
+        addr->lineno = item->lineno;
+        tmp = new_temporary(TYPE_INT);
+        add_hoisted(ctx, item, tmp, addr);
+    }
+    item->decl_node = tmp;
+}
+
+
+// instructions
+static void hoist_decls(licm_ctx_s * ctx, node_t decls, bool safe) {
+    if (decls == NULL) {
+        return;
+    }
+
+    if (decls->nature == NODE_DECL) {
+        if (decls->nops > 1) {
+            hoist_expr(ctx, &decls->opr[1], safe);
+        }
+        return;
+    }
+
+    for (int32_t i = 0; i < decls->nops; i++) {
+        hoist_decls(ctx, decls->opr[i], safe);
+    }
+}
+
+static void hoist_instr(licm_ctx_s * ctx, node_t * pinstr, bool * safe) {
+    node_t instr = *pinstr;
+    bool inner_safe;
+
+    if (instr == NULL) {
+        return;
+    }
+
+    switch (instr->nature) {
+        case NODE_LIST:
+            hoist_instr(ctx, &instr->opr[0], safe);
+            hoist_instr(ctx, &instr->opr[1], safe);
+            break;
+
+        case NODE_BLOCK:
+            hoist_decls(ctx, instr->opr[0], *safe);
+            hoist_instr(ctx, &instr->opr[1], safe);
+            break;
+
+        case NODE_PRINT:
+            hoist_print_strings(ctx, instr->opr[0]);
+            *safe = false;
+            break;
+
+        case NODE_IF:
+            hoist_expr(ctx, &instr->opr[0], *safe);
+            inner_safe = false;
+            hoist_instr(ctx, &instr->opr[1], &inner_safe);
+            inner_safe = false;
+            hoist_instr(ctx, &instr->opr[2], &inner_safe);
+            *safe = *safe && !has_output_or_loop(instr);
+            break;
+
+        case NODE_WHILE:
+            hoist_expr(ctx, &instr->opr[0], *safe);
+            inner_safe = *safe && loop_first_test_true(instr);
+            hoist_instr(ctx, &instr->opr[1], &inner_safe);
+            *safe = false;
+            break;
+
+        case NODE_FOR:
+            hoist_expr(ctx, &instr->opr[0], *safe);
+            hoist_expr(ctx, &instr->opr[1], *safe);
+            inner_safe = *safe && loop_first_test_true(instr);
+            hoist_instr(ctx, &instr->opr[3], &inner_safe);
+            hoist_expr(ctx, &instr->opr[2], inner_safe);
+            *safe = false;
+            break;
+
+        case NODE_DOWHILE:
+            hoist_instr(ctx, &instr->opr[0], safe);
+            hoist_expr(ctx, &instr->opr[1], *safe);
+            *safe = false;
+            break;
+
+        default:
+            hoist_expr(ctx, pinstr, *safe);
+            break;
+    }
+}
+
+// hoists out of one loop; returns the statement replacing it
+static node_t hoist_loop(node_t loop) {
+    licm_ctx_s ctx = { { NULL, 0, 0 }, NULL, NULL, 0, 0, NULL };
+    bool safe = true;
+    node_t init = NULL;
+
+    switch (loop->nature) {
+        case NODE_WHILE:
+            collect_assigned(loop, &ctx.assigned);
+            // the test runs at least once, whatever its outcome
+            hoist_expr(&ctx, &loop->opr[0], true);
+            safe = loop_first_test_true(loop);
+            hoist_instr(&ctx, &loop->opr[1], &safe);
+            break;
+
+        case NODE_FOR:
+            // the initialisation is not part of the loop: the preheader follows it
+            safe = loop_first_test_true(loop);
+            init = loop->opr[0];
+            loop->opr[0] = NULL;
+            collect_assigned(loop, &ctx.assigned);
+            hoist_expr(&ctx, &loop->opr[1], true);
+            hoist_instr(&ctx, &loop->opr[3], &safe);
+            hoist_expr(&ctx, &loop->opr[2], safe);
+            break;
+
+        case NODE_DOWHILE:
+            collect_assigned(loop, &ctx.assigned);
+            hoist_instr(&ctx, &loop->opr[0], &safe);
+            hoist_expr(&ctx, &loop->opr[1], safe);
+            break;
+
+        default:
+            break;
+    }
+
+    decl_set_free(&ctx.assigned);
+    free(ctx.exprs);
+    free(ctx.temps);
+
+    if (ctx.preheader == NULL) {
+        if (init != NULL) {
+            loop->opr[0] = init;
+        }
+        return loop;
+    }
+
+    node_t list = ctx.preheader;
+    if (init != NULL) {
+        list = list_append(init, list);
+    }
+    return make_block_list(list_append(list, loop));
+}
+
+
+// tree walk
+static void licm_instr(node_t * pinstr) {
+    node_t instr = *pinstr;
+
+    if (instr == NULL) {
+        return;
+    }
+
+    switch (instr->nature) {
+        case NODE_LIST:
+            licm_instr(&instr->opr[0]);
+            licm_instr(&instr->opr[1]);
+            break;
+
+        case NODE_BLOCK:
+            licm_instr(&instr->opr[1]);
+            break;
+
+        case NODE_IF:
+            licm_instr(&instr->opr[1]);
+            licm_instr(&instr->opr[2]);
+            break;
+
+        case NODE_WHILE:
+            *pinstr = hoist_loop(instr);
+            licm_instr(&instr->opr[1]);
+            break;
+
+        case NODE_FOR:
+            *pinstr = hoist_loop(instr);
+            licm_instr(&instr->opr[3]);
+            break;
+
+        case NODE_DOWHILE:
+            *pinstr = hoist_loop(instr);
+            licm_instr(&instr->opr[0]);
+            break;
+
+        default:
+            break;
+    }
+}
+
+void licm_tree(node_t root) {
+    node_t func = root->opr[1];
+    licm_instr(&func->opr[2]);
+}
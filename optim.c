@@ -0,0 +1,693 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "optim.h"
+
+int32_t opt_level = 0;
+bool opt_licm = false;
+bool opt_unroll = false;
+bool opt_scev = false;
+bool opt_ivsr = false;
+bool opt_rotate = false;
+bool opt_simplify = false;
+bool opt_vrp = false;
+bool opt_peval = false;
+bool opt_merge_prints = false;
+bool opt_buffer_output = false;
+bool opt_merge_strings = false;
+bool opt_order_globals = false;
+bool opt_pack_data = false;
+bool opt_peephole = false;
+bool opt_thread_jumps = false;
+bool opt_merge_tails = false;
+bool opt_if_convert = false;
+bool opt_layout = false;
+bool opt_schedule = false;
+bool opt_delay_slots = false;
+bool opt_profile_generate = false;
+bool opt_profile_use = false;
+bool opt_stats = false;
+bool opt_stats_json = false;
+int32_t opt_unroll_factor = 4;
+int32_t opt_unroll_budget = 128;
+int32_t opt_peval_fuel = 1000000;
+int32_t opt_ifconv_limit = 4;
+
+extern int yylineno;
+
+static node_t curr_func = NULL;
+static int32_t num_temporaries = 0;
+
+
+// option handling
+typedef struct _opt_flag_s {
+    const char * name;
+    bool * enabled;
+    int32_t min_level;
+} opt_flag_s;
+
+static opt_flag_s opt_flags[] = {
+    { "simplify", &opt_simplify, 1 },
+    { "licm", &opt_licm, 1 },
+    { "unroll", &opt_unroll, 2 },
+    { "scev", &opt_scev, 2 },
+    { "ivsr", &opt_ivsr, 2 },
+    { "rotate", &opt_rotate, 1 },
+    { "vrp", &opt_vrp, 2 },
+    { "merge-prints", &opt_merge_prints, 1 },
+    { "merge-strings", &opt_merge_strings, 1 },
+    { "order-globals", &opt_order_globals, 2 },
+    { "pack-data", &opt_pack_data, 2 },
+    { "peephole", &opt_peephole, 1 },
+    { "thread-jumps", &opt_thread_jumps, 1 },
+    { "merge-tails", &opt_merge_tails, 2 },
+    { "if-convert", &opt_if_convert, 2 },
+    { "layout", &opt_layout, 2 },
+    { "schedule", &opt_schedule, 2 },
+    { "peval", &opt_peval, 3 },                 // only on request
+    { "buffer-output", &opt_buffer_output, 3 }, // only on request
+    { "delay-slots", &opt_delay_slots, 3 },     // only on request
+    { "profile-generate", &opt_profile_generate, 3 }, // only on request
+    { "profile-use", &opt_profile_use, 3 },     // only on request
+    { "stats", &opt_stats, 3 },                 // only on request
+    { "stats-json", &opt_stats_json, 3 },       // only on request
+};
+
+#define NUM_OPT_FLAGS ((int32_t)(sizeof(opt_flags) / sizeof(opt_flags[0])))
+
+typedef struct _opt_param_s {
+    const char * name;
+    int32_t * value;
+    int32_t min;
+    int32_t max;
+} opt_param_s;
+
+static opt_param_s opt_params[] = {
+    { "unroll-factor", &opt_unroll_factor, 2, 16 },
+    { "unroll-budget", &opt_unroll_budget, 8, 4096 },
+    { "peval-fuel", &opt_peval_fuel, 1000, 1000000000 },
+    { "ifconv-limit", &opt_ifconv_limit, 0, 64 },
+};
+
+#define NUM_OPT_PARAMS ((int32_t)(sizeof(opt_params) / sizeof(opt_params[0])))
+
+void set_opt_level(int32_t level) {
+    opt_level = level;
+    for (int32_t i = 0; i < NUM_OPT_FLAGS; i++) {
+        *opt_flags[i].enabled = (level >= opt_flags[i].min_level);
+    }
+}
+
+// accepts "<name>", "no-<name>" and "<param>=<int>", returns false on an
+// unknown name, or a value that is not a whole number in range
+bool set_opt_flag(const char * flag) {
+    bool value = true;
+    const char * eq = strchr(flag, '=');
+
+    if (eq != NULL) {
+        for (int32_t i = 0; i < NUM_OPT_PARAMS; i++) {
+            if (strlen(opt_params[i].name) == (size_t)(eq - flag)
+                && strncmp(flag, opt_params[i].name, eq - flag) == 0) {
+                char * end;
+                long v = strtol(eq + 1, &end, 10);
+                if (!isdigit((unsigned char)eq[1]) || *end != '\0'
+                    || v < opt_params[i].min || v > opt_params[i].max) {
+                    return false;
+                }
+                *opt_params[i].value = (int32_t)v;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    if (strncmp(flag, "no-", 3) == 0) {
+        value = false;
+        flag += 3;
+    }
+
+    for (int32_t i = 0; i < NUM_OPT_FLAGS; i++) {
+        if (strcmp(flag, opt_flags[i].name) == 0) {
+            *opt_flags[i].enabled = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// declaration sets
+void decl_set_add(decl_set_s * set, node_t decl) {
+    if (decl == NULL || decl_set_contains(set, decl)) {
+        return;
+    }
+    if (set->size == set->capacity) {
+        set->capacity = set->capacity ? 2 * set->capacity : 16;
+        set->decls = realloc(set->decls, set->capacity * sizeof(node_t));
+    }
+    set->decls[set->size++] = decl;
+}
+
+bool decl_set_contains(decl_set_s * set, node_t decl) {
+    for (int32_t i = 0; i < set->size; i++) {
+        if (set->decls[i] == decl) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void decl_set_free(decl_set_s * set) {
+    free(set->decls);
+    set->decls = NULL;
+    set->size = 0;
+    set->capacity = 0;
+}
+
+// every variable written by an assignment or an initialised declaration in n
+void collect_assigned(node_t n, decl_set_s * set) {
+    if (n == NULL) {
+        return;
+    }
+
+    if (n->nature == NODE_AFFECT) {
+        decl_set_add(set, n->opr[0]->decl_node);
+    } else if (n->nature == NODE_DECL && n->nops > 1 && n->opr[1] != NULL) {
+        decl_set_add(set, n->opr[0]);
+    }
+
+    for (int32_t i = 0; i < n->nops; i++) {
+        collect_assigned(n->opr[i], set);
+    }
+}
+
+
+// node construction
+// Temporaries live in fresh stack slots appended to the frame of main.
+// The returned ident is its own declaration, as for passe_1 declarations.
+node_t new_temporary(node_type type) {
+    char name[32];
+    node_t tmp = make_node(NODE_IDENT, 0);
+
+    snprintf(name, sizeof(name), "_t%d", num_temporaries++);
+    tmp->ident = strdupl(name);
+    tmp->type = type;
+    tmp->offset = curr_func->offset;
+    tmp->global_decl = false;
+    tmp->decl_node = tmp;
+    tmp->lineno = curr_func->lineno;
+    curr_func->offset += 4;
+
+    return tmp;
+}
+
+node_t make_ref(node_t decl) {
+    node_t ref = make_node(NODE_IDENT, 0);
+
+    ref->ident = strdupl(decl->ident);
+    ref->type = decl->type;
+    ref->offset = decl->offset;
+    ref->global_decl = decl->global_decl;
+    ref->decl_node = decl;
+    ref->lineno = decl->lineno;
+
+    return ref;
+}
+
+node_t make_block_list(node_t list) {
+    node_t block = make_node(NODE_BLOCK, 2, NULL, list);
+    block->lineno = list->lineno;
+    return block;
+}
+
+node_t copy_tree(node_t n) {
+    if (n == NULL) {
+        return NULL;
+    }
+
+    node_t c = malloc(sizeof(node_s));
+    *c = *n;
+    copy_profile_site(n, c);
+    c->ident = n->ident ? strdupl(n->ident) : NULL;
+    c->str = n->str ? strdupl(n->str) : NULL;
+    c->opr = NULL;
+
+    if (n->nops > 0) {
+        c->opr = malloc(n->nops * sizeof(node_t));
+        for (int32_t i = 0; i < n->nops; i++) {
+            c->opr[i] = copy_tree(n->opr[i]);
+        }
+    }
+
+    return c;
+}
+
+static void pair_decls(node_t orig, node_t copy, decl_set_s * from, decl_set_s * to) {
+    if (orig == NULL) {
+        return;
+    }
+    if (orig->nature == NODE_DECL) {
+        decl_set_add(from, orig->opr[0]);
+        decl_set_add(to, copy->opr[0]);
+    }
+    for (int32_t i = 0; i < orig->nops; i++) {
+        pair_decls(orig->opr[i], copy->opr[i], from, to);
+    }
+}
+
+static void remap_decls(node_t n, decl_set_s * from, decl_set_s * to) {
+    if (n == NULL) {
+        return;
+    }
+    if (n->nature == NODE_IDENT) {
+        for (int32_t i = 0; i < from->size; i++) {
+            if (n->decl_node == from->decls[i]) {
+                n->decl_node = to->decls[i];
+                break;
+            }
+        }
+    }
+    for (int32_t i = 0; i < n->nops; i++) {
+        remap_decls(n->opr[i], from, to);
+    }
+}
+
+// Deep copy of an instruction. Variables declared inside it get their own
+// declaration nodes in the copy, so that passes comparing decl_node pointers
+// keep telling the copies apart.
+node_t copy_instr(node_t n) {
+    decl_set_s from = { NULL, 0, 0 };
+    decl_set_s to = { NULL, 0, 0 };
+    node_t c = copy_tree(n);
+
+    pair_decls(n, c, &from, &to);
+    remap_decls(c, &from, &to);
+
+    decl_set_free(&from);
+    decl_set_free(&to);
+    return c;
+}
+
+int32_t count_nodes(node_t n) {
+    int32_t count = 0;
+
+    if (n == NULL) {
+        return 0;
+    }
+    for (int32_t i = 0; i < n->nops; i++) {
+        count += count_nodes(n->opr[i]);
+    }
+    return count + 1;
+}
+
+
+// tree predicates
+bool same_tree(node_t a, node_t b) {
+    if (a == NULL || b == NULL) {
+        return a == b;
+    }
+    if (a->nature != b->nature || a->nops != b->nops) {
+        return false;
+    }
+
+    switch (a->nature) {
+        case NODE_INTVAL:
+        case NODE_BOOLVAL:
+            return a->value == b->value;
+        case NODE_IDENT:
+            return a->decl_node == b->decl_node;
+        case NODE_STRINGVAL:
+            return a->str != NULL && b->str != NULL && strcmp(a->str, b->str) == 0;
+        default:
+            break;
+    }
+
+    for (int32_t i = 0; i < a->nops; i++) {
+        if (!same_tree(a->opr[i], b->opr[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// true when e reads one of the variables of set
+bool uses_any(node_t e, decl_set_s * set) {
+    if (e == NULL) {
+        return false;
+    }
+    if (e->nature == NODE_IDENT) {
+        return decl_set_contains(set, e->decl_node);
+    }
+    for (int32_t i = 0; i < e->nops; i++) {
+        if (uses_any(e->opr[i], set)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool is_leaf(node_t n) {
+    return n->nature == NODE_INTVAL || n->nature == NODE_BOOLVAL
+        || n->nature == NODE_IDENT || n->nature == NODE_STRINGVAL;
+}
+
+bool is_loop(node_t n) {
+    return n != NULL
+        && (n->nature == NODE_WHILE || n->nature == NODE_FOR || n->nature == NODE_DOWHILE);
+}
+
+bool has_side_effect(node_t n) {
+    if (n == NULL) {
+        return false;
+    }
+    if (n->nature == NODE_AFFECT || n->nature == NODE_PRINT) {
+        return true;
+    }
+    for (int32_t i = 0; i < n->nops; i++) {
+        if (has_side_effect(n->opr[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// a division or modulo whose divisor is not a non-zero constant executes a teq
+bool may_trap(node_t n) {
+    if (n == NULL) {
+        return false;
+    }
+    if (n->nature == NODE_DIV || n->nature == NODE_MOD) {
+        node_t divisor = n->opr[1];
+        if (divisor->nature != NODE_INTVAL || divisor->value == 0) {
+            return true;
+        }
+    }
+    for (int32_t i = 0; i < n->nops; i++) {
+        if (may_trap(n->opr[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// prints are observable, loops may not terminate: neither can be reordered with a trap
+bool has_output_or_loop(node_t n) {
+    if (n == NULL) {
+        return false;
+    }
+    if (n->nature == NODE_PRINT || is_loop(n)) {
+        return true;
+    }
+    for (int32_t i = 0; i < n->nops; i++) {
+        if (has_output_or_loop(n->opr[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// constant evaluation
+// Evaluates e with 32-bit MIPS semantics. The variable var, if not NULL, is
+// bound to val. Fails on anything unknown and on divisions that would trap.
+bool eval_const_expr(node_t e, node_t var, int32_t val, int32_t * res) {
+    int32_t l = 0, r = 0;
+
+    if (e == NULL) {
+        return false;
+    }
+
+    switch (e->nature) {
+        case NODE_INTVAL:
+        case NODE_BOOLVAL:
+            *res = (int32_t)e->value;
+            return true;
+
+        case NODE_IDENT:
+            if (var != NULL && e->decl_node == var) {
+                *res = val;
+                return true;
+            }
+            return false;
+
+        case NODE_NOT:
+        case NODE_BNOT:
+        case NODE_UMINUS:
+            if (!eval_const_expr(e->opr[0], var, val, &l)) {
+                return false;
+            }
+            if (e->nature == NODE_NOT) {
+                *res = l ^ 1;
+            } else if (e->nature == NODE_BNOT) {
+                *res = ~l;
+            } else {
+                *res = (int32_t)(0u - (uint32_t)l);
+            }
+            return true;
+
+        case NODE_AFFECT:
+        case NODE_PRINT:
+        case NODE_STRINGVAL:
+            return false;
+
+        default:
+            break;
+    }
+
+    if (e->nops != 2
+        || !eval_const_expr(e->opr[0], var, val, &l)
+        || !eval_const_expr(e->opr[1], var, val, &r)) {
+        return false;
+    }
+
+    switch (e->nature) {
+        case NODE_PLUS:  *res = (int32_t)((uint32_t)l + (uint32_t)r); break;
+        case NODE_MINUS: *res = (int32_t)((uint32_t)l - (uint32_t)r); break;
+        case NODE_MUL:   *res = (int32_t)((uint32_t)l * (uint32_t)r); break;
+        case NODE_DIV:
+        case NODE_MOD:
+            if (r == 0 || (l == INT32_MIN && r == -1)) {
+                return false;
+            }
+            *res = (e->nature == NODE_DIV) ? l / r : l % r;
+            break;
+        case NODE_LT:    *res = l < r; break;
+        case NODE_GT:    *res = l > r; break;
+        case NODE_LE:    *res = l <= r; break;
+        case NODE_GE:    *res = l >= r; break;
+        case NODE_EQ:    *res = l == r; break;
+        case NODE_NE:    *res = l != r; break;
+        case NODE_AND:
+        case NODE_BAND:  *res = l & r; break;
+        case NODE_OR:
+        case NODE_BOR:   *res = l | r; break;
+        case NODE_BXOR:  *res = l ^ r; break;
+        case NODE_SLL:   *res = (int32_t)((uint32_t)l << (r & 31)); break;
+        case NODE_SRL:   *res = (int32_t)((uint32_t)l >> (r & 31)); break;
+        case NODE_SRA:   *res = l >> (r & 31); break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+// true when the first evaluation of the loop test is known to succeed
+bool loop_first_test_true(node_t loop) {
+    int32_t res;
+
+    switch (loop->nature) {
+        case NODE_DOWHILE:
+            return true;
+
+        case NODE_WHILE:
+            return eval_const_expr(loop->opr[0], NULL, 0, &res) && res;
+
+        case NODE_FOR: {
+            node_t init = loop->opr[0];
+            if (init != NULL && init->nature == NODE_AFFECT) {
+                int32_t start;
+                if (!eval_const_expr(init->opr[1], NULL, 0, &start)) {
+                    return false;
+                }
+                return eval_const_expr(loop->opr[1], init->opr[0]->decl_node, start, &res) && res;
+            }
+            return init == NULL && eval_const_expr(loop->opr[1], NULL, 0, &res) && res;
+        }
+
+        default:
+            return false;
+    }
+}
+
+
+// counted for-loops: for (i = init; i rel bound; i = i + step) body
+node_nature swap_rel(node_nature rel) {
+    switch (rel) {
+        case NODE_LT: return NODE_GT;
+        case NODE_GT: return NODE_LT;
+        case NODE_LE: return NODE_GE;
+        case NODE_GE: return NODE_LE;
+        default: return rel;
+    }
+}
+
+bool is_var(node_t n, node_t var) {
+    return n != NULL && n->nature == NODE_IDENT && n->decl_node == var;
+}
+
+bool match_counted_loop(node_t loop, counted_loop_s * cl) {
+    node_t init = loop->opr[0];
+    node_t cond = loop->opr[1];
+    node_t incr = loop->opr[2];
+    node_t body = loop->opr[3];
+
+    if (init == NULL || init->nature != NODE_AFFECT) {
+        return false;
+    }
+    cl->var = init->opr[0]->decl_node;
+
+    // test
+    if (cond == NULL || (cond->nature != NODE_LT && cond->nature != NODE_LE
+                         && cond->nature != NODE_GT && cond->nature != NODE_GE)) {
+        return false;
+    }
+    if (is_var(cond->opr[0], cl->var)) {
+        cl->rel = cond->nature;
+        cl->bound = cond->opr[1];
+    } else if (is_var(cond->opr[1], cl->var)) {
+        cl->rel = swap_rel(cond->nature);
+        cl->bound = cond->opr[0];
+    } else {
+        return false;
+    }
+
+    // increment
+    if (incr == NULL || incr->nature != NODE_AFFECT || incr->opr[0]->decl_node != cl->var) {
+        return false;
+    }
+    node_t e = incr->opr[1];
+    if (e->nature == NODE_PLUS && is_var(e->opr[0], cl->var) && e->opr[1]->nature == NODE_INTVAL) {
+        cl->step = (int32_t)e->opr[1]->value;
+    } else if (e->nature == NODE_PLUS && is_var(e->opr[1], cl->var) && e->opr[0]->nature == NODE_INTVAL) {
+        cl->step = (int32_t)e->opr[0]->value;
+    } else if (e->nature == NODE_MINUS && is_var(e->opr[0], cl->var) && e->opr[1]->nature == NODE_INTVAL) {
+        cl->step = -(int32_t)e->opr[1]->value;
+    } else {
+        return false;
+    }
+
+    // the induction variable must move towards the bound
+    if (cl->step == 0 || cl->step > 0xFFFF || cl->step < -0xFFFF) {
+        return false;
+    }
+    if ((cl->rel == NODE_LT || cl->rel == NODE_LE) ? cl->step < 0 : cl->step > 0) {
+        return false;
+    }
+
+    // the bound is evaluated once instead of at every test
+    if (has_side_effect(cl->bound) || may_trap(cl->bound)) {
+        return false;
+    }
+
+    // neither i nor the bound may change inside the body, and the bound may not depend on i
+    decl_set_s assigned = { NULL, 0, 0 };
+    collect_assigned(body, &assigned);
+    bool ok = !decl_set_contains(&assigned, cl->var);
+    decl_set_add(&assigned, cl->var);
+    ok = ok && !uses_any(cl->bound, &assigned);
+    decl_set_free(&assigned);
+
+    return ok;
+}
+
+// number of iterations when both ends are constants and i never wraps around
+bool counted_trip_count(node_t loop, counted_loop_s * cl, int32_t * count, int32_t * last) {
+    int32_t start, bound;
+    int64_t n = 0;
+
+    if (!eval_const_expr(loop->opr[0]->opr[1], NULL, 0, &start)
+        || !eval_const_expr(cl->bound, NULL, 0, &bound)) {
+        return false;
+    }
+
+    int64_t s = start, b = bound, step = cl->step;
+    switch (cl->rel) {
+        case NODE_LT: n = (s < b) ? (b - s + step - 1) / step : 0; break;
+        case NODE_LE: n = (s <= b) ? (b - s) / step + 1 : 0; break;
+        case NODE_GT: n = (s > b) ? (s - b - step - 1) / -step : 0; break;
+        case NODE_GE: n = (s >= b) ? (s - b) / -step + 1 : 0; break;
+        default: return false;
+    }
+
+    int64_t end = s + n * step;
+    if (end < INT32_MIN || end > INT32_MAX) {
+        return false;
+    }
+
+    *count = (int32_t)n;
+    *last = (int32_t)end;
+    return true;
+}
+
+
+// main entry point
+void optimise_tree(node_t root) {
+    if (root->opr[1] == NULL) {
+        return;
+    }
+
+    curr_func = root->opr[1];
+    num_temporaries = 0;
+    // the nodes made by the passes are on no line of the source, -a charges
+    // their code to the statement before
+    yylineno = 0;
+
+    // the sites of the profile are the ifs and loops of the source
+    if (opt_profile_generate || opt_profile_use) {
+        number_profile_sites(root);
+    }
+    if (opt_profile_use) {
+        read_profile();
+    }
+
+    // a program evaluated at compile time is left with a single print; the
+    // instrumented program keeps its loops, so that each site is counted
+    if (opt_peval && !opt_profile_generate && peval_tree(root)) {
+        return;
+    }
+    if (opt_simplify) {
+        simplify_tree(root);
+    }
+    if (opt_scev && !opt_profile_generate) {
+        scev_tree(root);
+    }
+    if (opt_unroll && !opt_profile_generate) {
+        unroll_tree(root);
+    }
+    // the loop transformations leave constant subexpressions behind
+    if (opt_simplify && (opt_scev || opt_unroll)) {
+        simplify_tree(root);
+    }
+    if (opt_merge_prints) {
+        merge_prints_tree(root);
+    }
+    if (opt_licm) {
+        licm_tree(root);
+    }
+    if (opt_ivsr) {
+        ivsr_tree(root);
+    }
+    // last, the division nodes it proves safe are looked up by passe_2
+    if (opt_vrp) {
+        vrp_tree(root);
+    }
+    if (opt_order_globals) {
+        order_globals(root);
+    }
+}
@@ -0,0 +1,122 @@
+
+#ifndef _OPTIM_H_
+#define _OPTIM_H_
+
+#include "defs.h"
+
+
+/* Optimisation level and per-pass switches */
+
+extern int32_t opt_level;
+extern bool opt_licm;
+extern bool opt_unroll;
+extern bool opt_scev;
+extern bool opt_ivsr;
+extern bool opt_rotate;
+extern bool opt_simplify;
+extern bool opt_vrp;
+extern bool opt_peval;
+extern bool opt_merge_prints;
+extern bool opt_buffer_output;
+extern bool opt_merge_strings;
+extern bool opt_order_globals;
+extern bool opt_pack_data;
+extern bool opt_peephole;
+extern bool opt_thread_jumps;
+extern bool opt_merge_tails;
+extern bool opt_if_convert;
+extern bool opt_layout;
+extern bool opt_schedule;
+extern bool opt_delay_slots;
+extern bool opt_profile_generate;
+extern bool opt_profile_use;
+extern bool opt_stats;
+extern bool opt_stats_json;
+extern int32_t opt_unroll_factor;
+extern int32_t opt_unroll_budget;
+extern int32_t opt_peval_fuel;
+extern int32_t opt_ifconv_limit;
+
+void set_opt_level(int32_t level);
+bool set_opt_flag(const char * flag);
+void optimise_tree(node_t root);
+
+
+/* Tree helpers shared by the passes */
+
+typedef struct _decl_set_s {
+    node_t * decls;
+    int32_t size;
+    int32_t capacity;
+} decl_set_s;
+
+void decl_set_add(decl_set_s * set, node_t decl);
+bool decl_set_contains(decl_set_s * set, node_t decl);
+void decl_set_free(decl_set_s * set);
+void collect_assigned(node_t n, decl_set_s * set);
+
+node_t new_temporary(node_type type);
+node_t make_ref(node_t decl);
+node_t make_block_list(node_t list);
+node_t copy_tree(node_t n);
+node_t copy_instr(node_t n);
+int32_t count_nodes(node_t n);
+bool same_tree(node_t a, node_t b);
+bool uses_any(node_t e, decl_set_s * set);
+bool is_leaf(node_t n);
+bool is_loop(node_t n);
+bool has_side_effect(node_t n);
+bool may_trap(node_t n);
+bool has_output_or_loop(node_t n);
+bool eval_const_expr(node_t e, node_t var, int32_t val, int32_t * res);
+bool loop_first_test_true(node_t loop);
+bool is_var(node_t n, node_t var);
+node_nature swap_rel(node_nature rel);
+
+typedef struct _counted_loop_s {
+    node_t var;          // induction variable declaration
+    node_t bound;        // invariant bound of the test
+    node_nature rel;     // test normalised as "var rel bound"
+    int32_t step;        // constant added by the increment
+} counted_loop_s;
+
+bool match_counted_loop(node_t loop, counted_loop_s * cl);
+bool counted_trip_count(node_t loop, counted_loop_s * cl, int32_t * count, int32_t * last);
+
+
+/* Passes */
+
+bool peval_tree(node_t root);
+void simplify_tree(node_t root);
+void licm_tree(node_t root);
+void unroll_tree(node_t root);
+void scev_tree(node_t root);
+void ivsr_tree(node_t root);
+void vrp_tree(node_t root);
+void merge_prints_tree(node_t root);
+void order_globals(node_t root);
+void pool_strings(node_t root);
+bool divisor_nonzero(node_t div);
+
+
+/* Profile of -fprofile-generate, read back by -fprofile-use */
+
+#define PROFILE_FILE "minicc.prof"
+
+void number_profile_sites(node_t root);
+int32_t profile_site(node_t n);
+void copy_profile_site(node_t n, node_t c);
+void drop_profile_site(node_t n);
+bool read_profile(void);
+bool get_profile(node_t n, int64_t * entries, int64_t * arm);
+void set_branch_profile(int32_t label, node_t n);
+
+
+/* Node constructors from grammar.y */
+
+node_t make_node(node_nature nature, int nops, ...);
+node_t make_int(int64_t v);
+node_t make_bool(bool b);
+node_t list_append(node_t list, node_t elem);
+
+#endif
@@ -0,0 +1,211 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "arch.h"
+#include "asm.h"
+
+extern int trace_level;
+
+
+// Buffered output.
+// Each printed item costs a syscall. With this pass, a small runtime is added
+// to the program: the prints call it to append their string or the decimal
+// text of their integer to a buffer, which is printed by one syscall when it
+// is full, before a division check that traps and at the exit. The runtime
+// only uses $2-$7 and $31, which are not allocated by passe_2.
+
+#define OUT_BUFFER_SIZE 1024
+#define DIGITS_SIZE 12
+
+// print services of the syscall, as set in $2 just before it
+#define SERVICE_PRINT_INT 1
+#define SERVICE_PRINT_STRING 4
+#define SERVICE_EXIT 10
+#define SERVICE_OPEN 13
+#define SERVICE_WRITE 15
+#define SERVICE_CLOSE 16
+
+static int32_t num_buffered;
+static int32_t num_traps;
+
+
+// lui/ori pair loading an address of the data section
+static void load_addr(asm_prog_s * prog, int32_t * pos, int32_t reg, int32_t addr) {
+    *pos += asm_insert(prog, *pos, "lui $%d, 0x%x", reg, ((uint32_t)addr >> 16) & 0xFFFF);
+    *pos += asm_insert(prog, *pos, "ori $%d, $%d, 0x%x", reg, reg, (uint32_t)addr & 0xFFFF);
+}
+
+// service number set in $2 by the instruction before a syscall, or -1
+static int32_t syscall_service(asm_prog_s * prog, int32_t i) {
+    asm_line_s * l;
+
+    if (i == 0) {
+        return -1;
+    }
+    l = &prog->lines[i - 1];
+    if (asm_is_inst(l, "ori") && l->args[0].reg == 2 && l->args[1].kind == ASM_ARG_REG
+        && l->args[1].reg == 0 && l->args[2].kind == ASM_ARG_IMM) {
+        return l->args[2].imm;
+    }
+    return -1;
+}
+
+static bool check_syscalls(asm_prog_s * prog) {
+    for (int32_t i = 0; i < prog->size; i++) {
+        if (asm_is_inst(&prog->lines[i], "syscall")) {
+            int32_t service = syscall_service(prog, i);
+            // the file services of -fprofile-generate are left alone
+            if (service != SERVICE_PRINT_INT && service != SERVICE_PRINT_STRING && service != SERVICE_EXIT
+                && service != SERVICE_OPEN && service != SERVICE_WRITE && service != SERVICE_CLOSE) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+// runtime
+static void add_data(asm_prog_s * prog, int32_t buffer) {
+    int32_t pos = asm_data_end(prog);
+
+    pos += asm_insert(prog, pos, ".align 2");
+    pos += asm_insert(prog, pos, "_out_ptr: .word %d", buffer);
+    pos += asm_insert(prog, pos, "_out_buf: .space %d", OUT_BUFFER_SIZE + 1);
+    pos += asm_insert(prog, pos, "_out_digits: .space %d", DIGITS_SIZE);
+}
+
+static void add_runtime(asm_prog_s * prog, int32_t ptr, int32_t buffer, int32_t digits) {
+    int32_t pos = prog->size;
+
+    // _out_flush: prints the buffer, clobbers $2, $4-$6
+    pos += asm_insert(prog, pos, "_out_flush:");
+    load_addr(prog, &pos, 5, ptr);
+    pos += asm_insert(prog, pos, "lw $6, 0($5)");
+    load_addr(prog, &pos, 4, buffer);
+    pos += asm_insert(prog, pos, "beq $6, $4, _out_flush_end");
+    pos += asm_insert(prog, pos, "sb $0, 0($6)");
+    pos += asm_insert(prog, pos, "sw $4, 0($5)");
+    pos += asm_insert(prog, pos, "ori $2, $0, 0x%x", SERVICE_PRINT_STRING);
+    pos += asm_insert(prog, pos, "syscall");
+    pos += asm_insert(prog, pos, "_out_flush_end:");
+    pos += asm_insert(prog, pos, "jr $31");
+
+    // _out_str: appends the string at $4, clobbers $2-$7
+    pos += asm_insert(prog, pos, "_out_str:");
+    load_addr(prog, &pos, 5, ptr);
+    pos += asm_insert(prog, pos, "lw $6, 0($5)");
+    load_addr(prog, &pos, 7, buffer + OUT_BUFFER_SIZE);
+    pos += asm_insert(prog, pos, "_out_str_loop:");
+    pos += asm_insert(prog, pos, "lb $3, 0($4)");
+    pos += asm_insert(prog, pos, "beq $3, $0, _out_str_end");
+    pos += asm_insert(prog, pos, "bne $6, $7, _out_str_put");
+    pos += asm_insert(prog, pos, "sb $0, 0($6)");
+    pos += asm_insert(prog, pos, "addu $3, $4, $0");
+    load_addr(prog, &pos, 4, buffer);
+    pos += asm_insert(prog, pos, "addu $6, $4, $0");
+    pos += asm_insert(prog, pos, "ori $2, $0, 0x%x", SERVICE_PRINT_STRING);
+    pos += asm_insert(prog, pos, "syscall");
+    pos += asm_insert(prog, pos, "addu $4, $3, $0");
+    pos += asm_insert(prog, pos, "lb $3, 0($4)");
+    pos += asm_insert(prog, pos, "_out_str_put:");
+    pos += asm_insert(prog, pos, "sb $3, 0($6)");
+    pos += asm_insert(prog, pos, "addiu $6, $6, 1");
+    pos += asm_insert(prog, pos, "addiu $4, $4, 1");
+    pos += asm_insert(prog, pos, "j _out_str_loop");
+    pos += asm_insert(prog, pos, "_out_str_end:");
+    pos += asm_insert(prog, pos, "sw $6, 0($5)");
+    pos += asm_insert(prog, pos, "jr $31");
+
+    // _out_int: appends the decimal text of $4, the digits are written
+    // backwards, u / 10 being computed as (u * 0xCCCCCCCD) >> 35
+    pos += asm_insert(prog, pos, "_out_int:");
+    load_addr(prog, &pos, 5, digits + DIGITS_SIZE - 1);
+    pos += asm_insert(prog, pos, "addu $3, $4, $0");
+    pos += asm_insert(prog, pos, "bgez $4, _out_int_loop");
+    pos += asm_insert(prog, pos, "subu $4, $0, $4");
+    pos += asm_insert(prog, pos, "_out_int_loop:");
+    pos += asm_insert(prog, pos, "lui $6, 0xcccc");
+    pos += asm_insert(prog, pos, "ori $6, $6, 0xcccd");
+    pos += asm_insert(prog, pos, "multu $4, $6");
+    pos += asm_insert(prog, pos, "mfhi $2");
+    pos += asm_insert(prog, pos, "srl $2, $2, 3");
+    pos += asm_insert(prog, pos, "sll $6, $2, 3");
+    pos += asm_insert(prog, pos, "sll $7, $2, 1");
+    pos += asm_insert(prog, pos, "addu $6, $6, $7");
+    pos += asm_insert(prog, pos, "subu $6, $4, $6");
+    pos += asm_insert(prog, pos, "addiu $6, $6, 48");
+    pos += asm_insert(prog, pos, "addiu $5, $5, -1");
+    pos += asm_insert(prog, pos, "sb $6, 0($5)");
+    pos += asm_insert(prog, pos, "addu $4, $2, $0");
+    pos += asm_insert(prog, pos, "bne $4, $0, _out_int_loop");
+    pos += asm_insert(prog, pos, "bgez $3, _out_int_str");
+    pos += asm_insert(prog, pos, "ori $6, $0, 0x2d");
+    pos += asm_insert(prog, pos, "addiu $5, $5, -1");
+    pos += asm_insert(prog, pos, "sb $6, 0($5)");
+    pos += asm_insert(prog, pos, "_out_int_str:");
+    pos += asm_insert(prog, pos, "addu $4, $5, $0");
+    pos += asm_insert(prog, pos, "j _out_str");
+}
+
+
+// calls
+static void rewrite_calls(asm_prog_s * prog) {
+    for (int32_t i = 0; i < prog->size; i++) {
+        asm_line_s * l = &prog->lines[i];
+
+        if (asm_is_inst(l, "syscall")) {
+            switch (syscall_service(prog, i)) {
+                case SERVICE_PRINT_INT:
+                case SERVICE_PRINT_STRING: {
+                    bool is_int = (syscall_service(prog, i) == SERVICE_PRINT_INT);
+                    asm_remove(prog, i);
+                    asm_remove(prog, i - 1);
+                    asm_insert(prog, i - 1, "jal %s", is_int ? "_out_int" : "_out_str");
+                    num_buffered++;
+                    break;
+                }
+                case SERVICE_EXIT:
+                    asm_insert(prog, i - 1, "jal _out_flush");
+                    i++;
+                    break;
+                default:
+                    break;
+            }
+        } else if (asm_is_inst(l, "teq")) {
+            // the pending output is printed when the check fails
+            asm_line_s teq = *l;
+            asm_insert(prog, i, "bne $%d, $%d, _out_trap%d", teq.args[0].reg, teq.args[1].reg, num_traps);
+            asm_insert(prog, i + 1, "jal _out_flush");
+            asm_insert(prog, i + 3, "_out_trap%d:", num_traps);
+            num_traps++;
+            i += 3;
+        }
+    }
+}
+
+bool buffer_output_asm(asm_prog_s * prog) {
+    num_buffered = 0;
+    num_traps = 0;
+
+    if (!check_syscalls(prog)) {
+        printf_level(2, "buffer-output: unknown syscall, output not buffered\n");
+        return false;
+    }
+
+    int32_t ptr = get_data_sec_start_addr() + ((asm_data_size(prog) + 3) & ~3);
+    int32_t buffer = ptr + 4;
+    int32_t digits = buffer + OUT_BUFFER_SIZE + 1;
+
+    rewrite_calls(prog);
+    add_data(prog, buffer);
+    add_runtime(prog, ptr, buffer, digits);
+
+    printf_level(2, "buffer-output: %d prints buffered, %d checks flush before trapping\n",
+                 num_buffered, num_traps);
+    return true;
+}
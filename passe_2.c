@@ -7,9 +7,30 @@
 #include "passe_2.h"
 #include "miniccutils.h"
 #include "arch.h"
+#include "optim.h"
+#include "report.h"
+#include "stats.h"
 
 extern int trace_level;
 
+// times the code being generated is expected to run, for -a
+static double line_weight = 1.0;
+
+// values saved on the stack when no register is left, counted for -fstats
+static void spill(int32_t reg) {
+    if (opt_stats || opt_stats_json) {
+        stats_spill();
+    }
+    push_temporary(reg);
+}
+
+static void reload(int32_t reg) {
+    if (opt_stats || opt_stats_json) {
+        stats_reload();
+    }
+    pop_temporary(reg);
+}
+
 // collect strings
 static void collect_strings(node_t node) {
     if (node == NULL) {
@@ -17,7 +38,10 @@ static void collect_strings(node_t node) {
     }
 
     if (node->nature == NODE_STRINGVAL) {
-        node->offset = add_string(node->str);
+        // address nodes (str == NULL) refer to a literal collected elsewhere
+        if (node->str != NULL) {
+            node->offset = add_string(node->str);
+        }
         return;
     }
 
@@ -27,38 +51,57 @@ static void collect_strings(node_t node) {
 }
 
 // global declarations
-static void gen_global_decls(node_t decls) {
+static void collect_global_decls(node_t decls, node_t ** list, int32_t * size) {
     if (decls == NULL) {
         return;
     }
 
     switch (decls->nature) {
         case NODE_LIST:
-            gen_global_decls(decls->opr[0]);
-            gen_global_decls(decls->opr[1]);
+            collect_global_decls(decls->opr[0], list, size);
+            collect_global_decls(decls->opr[1], list, size);
             break;
 
         case NODE_DECLS:
-            gen_global_decls(decls->opr[1]);
+            collect_global_decls(decls->opr[1], list, size);
             break;
 
-        case NODE_DECL: {
-            node_t ident = decls->opr[0];
-            node_t init = decls->opr[1];
-            int32_t init_value = 0;
-
-            if (init != NULL && (init->nature == NODE_INTVAL || init->nature == NODE_BOOLVAL)) {
-                init_value = (int32_t)init->value;
-            }
-            create_word_inst(ident->ident, init_value);
+        case NODE_DECL:
+            *list = realloc(*list, (*size + 1) * sizeof(node_t));
+            (*list)[(*size)++] = decls;
             break;
-        }
 
         default:
             break;
     }
 }
 
+static int compare_decl_offsets(const void * a, const void * b) {
+    return (*(node_t *)a)->opr[0]->offset - (*(node_t *)b)->opr[0]->offset;
+}
+
+// the words are emitted in the order of their offsets, which may have been
+// changed by the data layout
+static void gen_global_decls(node_t decls) {
+    node_t * list = NULL;
+    int32_t size = 0;
+
+    collect_global_decls(decls, &list, &size);
+    qsort(list, size, sizeof(node_t), compare_decl_offsets);
+
+    for (int32_t i = 0; i < size; i++) {
+        node_t ident = list[i]->opr[0];
+        node_t init = (list[i]->nops > 1) ? list[i]->opr[1] : NULL;
+        int32_t init_value = 0;
+
+        if (init != NULL && (init->nature == NODE_INTVAL || init->nature == NODE_BOOLVAL)) {
+            init_value = (int32_t)init->value;
+        }
+        create_word_inst(ident->ident, init_value);
+    }
+    free(list);
+}
+
 static void gen_data_section(node_t root) {
     create_data_sec_inst();
 
@@ -95,6 +138,13 @@ static void gen_expr(node_t expr) {
             }
             break;
 
+        case NODE_STRINGVAL:
+            // address of the literal pointed to by decl_node (hoisted out of a loop)
+            reg = get_current_reg();
+            create_lui_inst(reg, 0x1001);
+            create_ori_inst(reg, reg, expr->decl_node->offset);
+            break;
+
         case NODE_IDENT: {
             node_t decl = expr->decl_node;
             reg = get_current_reg();
@@ -132,13 +182,13 @@ static void gen_expr(node_t expr) {
             reg_left = get_current_reg();
             spilled = !reg_available();
             if (spilled) {
-                push_temporary(reg_left);
+                spill(reg_left);
             }
             allocate_reg();
             gen_expr(expr->opr[1]);
             reg_right = get_current_reg();
             if (spilled) {
-                pop_temporary(get_restore_reg());
+                reload(get_restore_reg());
                 create_addu_inst(reg_right, get_restore_reg(), reg_right);
             } else {
                 create_addu_inst(reg_left, reg_left, reg_right);
@@ -151,13 +201,13 @@ static void gen_expr(node_t expr) {
             reg_left = get_current_reg();
             spilled = !reg_available();
             if (spilled) {
-                push_temporary(reg_left);
+                spill(reg_left);
             }
             allocate_reg();
             gen_expr(expr->opr[1]);
             reg_right = get_current_reg();
             if (spilled) {
-                pop_temporary(get_restore_reg());
+                reload(get_restore_reg());
                 create_subu_inst(reg_right, get_restore_reg(), reg_right);
             } else {
                 create_subu_inst(reg_left, reg_left, reg_right);
@@ -170,13 +220,13 @@ static void gen_expr(node_t expr) {
             reg_left = get_current_reg();
             spilled = !reg_available();
             if (spilled) {
-                push_temporary(reg_left);
+                spill(reg_left);
             }
             allocate_reg();
             gen_expr(expr->opr[1]);
             reg_right = get_current_reg();
             if (spilled) {
-                pop_temporary(get_restore_reg());
+                reload(get_restore_reg());
                 create_mult_inst(get_restore_reg(), reg_right);
                 create_mflo_inst(reg_right);
             } else {
@@ -191,19 +241,23 @@ static void gen_expr(node_t expr) {
             reg_left = get_current_reg();
             spilled = !reg_available();
             if (spilled) {
-                push_temporary(reg_left);
+                spill(reg_left);
             }
             allocate_reg();
             gen_expr(expr->opr[1]);
             reg_right = get_current_reg();
             if (spilled) {
-                pop_temporary(get_restore_reg());
+                reload(get_restore_reg());
                 create_div_inst(get_restore_reg(), reg_right);
-                create_teq_inst(reg_right, get_r0());
+                if (!divisor_nonzero(expr)) {
+                    create_teq_inst(reg_right, get_r0());
+                }
                 create_mflo_inst(reg_right);
             } else {
                 create_div_inst(reg_left, reg_right);
-                create_teq_inst(reg_right, get_r0());
+                if (!divisor_nonzero(expr)) {
+                    create_teq_inst(reg_right, get_r0());
+                }
                 create_mflo_inst(reg_left);
                 release_reg();
             }
@@ -214,19 +268,23 @@ static void gen_expr(node_t expr) {
             reg_left = get_current_reg();
             spilled = !reg_available();
             if (spilled) {
-                push_temporary(reg_left);
+                spill(reg_left);
             }
             allocate_reg();
             gen_expr(expr->opr[1]);
             reg_right = get_current_reg();
             if (spilled) {
-                pop_temporary(get_restore_reg());
+                reload(get_restore_reg());
                 create_div_inst(get_restore_reg(), reg_right);
-                create_teq_inst(reg_right, get_r0());
+                if (!divisor_nonzero(expr)) {
+                    create_teq_inst(reg_right, get_r0());
+                }
                 create_mfhi_inst(reg_right);
             } else {
                 create_div_inst(reg_left, reg_right);
-                create_teq_inst(reg_right, get_r0());
+                if (!divisor_nonzero(expr)) {
+                    create_teq_inst(reg_right, get_r0());
+                }
                 create_mfhi_inst(reg_left);
                 release_reg();
             }
@@ -237,13 +295,13 @@ static void gen_expr(node_t expr) {
             reg_left = get_current_reg();
             spilled = !reg_available();
             if (spilled) {
-                push_temporary(reg_left);
+                spill(reg_left);
             }
             allocate_reg();
             gen_expr(expr->opr[1]);
             reg_right = get_current_reg();
             if (spilled) {
-                pop_temporary(get_restore_reg());
+                reload(get_restore_reg());
                 create_slt_inst(reg_right, get_restore_reg(), reg_right);
             } else {
                 create_slt_inst(reg_left, reg_left, reg_right);
@@ -256,13 +314,13 @@ static void gen_expr(node_t expr) {
             reg_left = get_current_reg();
             spilled = !reg_available();
             if (spilled) {
-                push_temporary(reg_left);
+                spill(reg_left);
             }
             allocate_reg();
             gen_expr(expr->opr[1]);
             reg_right = get_current_reg();
             if (spilled) {
-                pop_temporary(get_restore_reg());
+                reload(get_restore_reg());
                 create_slt_inst(reg_right, reg_right, get_restore_reg());
             } else {
                 create_slt_inst(reg_left, reg_right, reg_left);
@@ -275,13 +333,13 @@ static void gen_expr(node_t expr) {
             reg_left = get_current_reg();
             spilled = !reg_available();
             if (spilled) {
-                push_temporary(reg_left);
+                spill(reg_left);
             }
             allocate_reg();
             gen_expr(expr->opr[1]);
             reg_right = get_current_reg();
             if (spilled) {
-                pop_temporary(get_restore_reg());
+                reload(get_restore_reg());
                 create_slt_inst(reg_right, reg_right, get_restore_reg());
                 create_xori_inst(reg_right, reg_right, 1);
             } else {
@@ -296,13 +354,13 @@ static void gen_expr(node_t expr) {
             reg_left = get_current_reg();
             spilled = !reg_available();
             if (spilled) {
-                push_temporary(reg_left);
+                spill(reg_left);
             }
             allocate_reg();
             gen_expr(expr->opr[1]);
             reg_right = get_current_reg();
             if (spilled) {
-                pop_temporary(get_restore_reg());
+                reload(get_restore_reg());
                 create_slt_inst(reg_right, get_restore_reg(), reg_right);
                 create_xori_inst(reg_right, reg_right, 1);
             } else {
@@ -317,13 +375,13 @@ static void gen_expr(node_t expr) {
             reg_left = get_current_reg();
             spilled = !reg_available();
             if (spilled) {
-                push_temporary(reg_left);
+                spill(reg_left);
             }
             allocate_reg();
             gen_expr(expr->opr[1]);
             reg_right = get_current_reg();
             if (spilled) {
-                pop_temporary(get_restore_reg());
+                reload(get_restore_reg());
                 create_xor_inst(reg_right, get_restore_reg(), reg_right);
                 create_sltiu_inst(reg_right, reg_right, 1);
             } else {
@@ -338,13 +396,13 @@ static void gen_expr(node_t expr) {
             reg_left = get_current_reg();
             spilled = !reg_available();
             if (spilled) {
-                push_temporary(reg_left);
+                spill(reg_left);
             }
             allocate_reg();
             gen_expr(expr->opr[1]);
             reg_right = get_current_reg();
             if (spilled) {
-                pop_temporary(get_restore_reg());
+                reload(get_restore_reg());
                 create_xor_inst(reg_right, get_restore_reg(), reg_right);
                 create_sltu_inst(reg_right, get_r0(), reg_right);
             } else {
@@ -359,13 +417,13 @@ static void gen_expr(node_t expr) {
             reg_left = get_current_reg();
             spilled = !reg_available();
             if (spilled) {
-                push_temporary(reg_left);
+                spill(reg_left);
             }
             allocate_reg();
             gen_expr(expr->opr[1]);
             reg_right = get_current_reg();
             if (spilled) {
-                pop_temporary(get_restore_reg());
+                reload(get_restore_reg());
                 create_and_inst(reg_right, get_restore_reg(), reg_right);
             } else {
                 create_and_inst(reg_left, reg_left, reg_right);
@@ -378,13 +436,13 @@ static void gen_expr(node_t expr) {
             reg_left = get_current_reg();
             spilled = !reg_available();
             if (spilled) {
-                push_temporary(reg_left);
+                spill(reg_left);
             }
             allocate_reg();
             gen_expr(expr->opr[1]);
             reg_right = get_current_reg();
             if (spilled) {
-                pop_temporary(get_restore_reg());
+                reload(get_restore_reg());
                 create_or_inst(reg_right, get_restore_reg(), reg_right);
             } else {
                 create_or_inst(reg_left, reg_left, reg_right);
@@ -403,13 +461,13 @@ static void gen_expr(node_t expr) {
             reg_left = get_current_reg();
             spilled = !reg_available();
             if (spilled) {
-                push_temporary(reg_left);
+                spill(reg_left);
             }
             allocate_reg();
             gen_expr(expr->opr[1]);
             reg_right = get_current_reg();
             if (spilled) {
-                pop_temporary(get_restore_reg());
+                reload(get_restore_reg());
                 create_and_inst(reg_right, get_restore_reg(), reg_right);
             } else {
                 create_and_inst(reg_left, reg_left, reg_right);
@@ -422,13 +480,13 @@ static void gen_expr(node_t expr) {
             reg_left = get_current_reg();
             spilled = !reg_available();
             if (spilled) {
-                push_temporary(reg_left);
+                spill(reg_left);
             }
             allocate_reg();
             gen_expr(expr->opr[1]);
             reg_right = get_current_reg();
             if (spilled) {
-                pop_temporary(get_restore_reg());
+                reload(get_restore_reg());
                 create_or_inst(reg_right, get_restore_reg(), reg_right);
             } else {
                 create_or_inst(reg_left, reg_left, reg_right);
@@ -441,13 +499,13 @@ static void gen_expr(node_t expr) {
             reg_left = get_current_reg();
             spilled = !reg_available();
             if (spilled) {
-                push_temporary(reg_left);
+                spill(reg_left);
             }
             allocate_reg();
             gen_expr(expr->opr[1]);
             reg_right = get_current_reg();
             if (spilled) {
-                pop_temporary(get_restore_reg());
+                reload(get_restore_reg());
                 create_xor_inst(reg_right, get_restore_reg(), reg_right);
             } else {
                 create_xor_inst(reg_left, reg_left, reg_right);
@@ -466,13 +524,13 @@ static void gen_expr(node_t expr) {
             reg_left = get_current_reg();
             spilled = !reg_available();
             if (spilled) {
-                push_temporary(reg_left);
+                spill(reg_left);
             }
             allocate_reg();
             gen_expr(expr->opr[1]);
             reg_right = get_current_reg();
             if (spilled) {
-                pop_temporary(get_restore_reg());
+                reload(get_restore_reg());
                 create_sllv_inst(reg_right, get_restore_reg(), reg_right);
             } else {
                 create_sllv_inst(reg_left, reg_left, reg_right);
@@ -485,13 +543,13 @@ static void gen_expr(node_t expr) {
             reg_left = get_current_reg();
             spilled = !reg_available();
             if (spilled) {
-                push_temporary(reg_left);
+                spill(reg_left);
             }
             allocate_reg();
             gen_expr(expr->opr[1]);
             reg_right = get_current_reg();
             if (spilled) {
-                pop_temporary(get_restore_reg());
+                reload(get_restore_reg());
                 create_srav_inst(reg_right, get_restore_reg(), reg_right);
             } else {
                 create_srav_inst(reg_left, reg_left, reg_right);
@@ -504,13 +562,13 @@ static void gen_expr(node_t expr) {
             reg_left = get_current_reg();
             spilled = !reg_available();
             if (spilled) {
-                push_temporary(reg_left);
+                spill(reg_left);
             }
             allocate_reg();
             gen_expr(expr->opr[1]);
             reg_right = get_current_reg();
             if (spilled) {
-                pop_temporary(get_restore_reg());
+                reload(get_restore_reg());
                 create_srlv_inst(reg_right, get_restore_reg(), reg_right);
             } else {
                 create_srlv_inst(reg_left, reg_left, reg_right);
@@ -537,8 +595,13 @@ static void gen_print_item(node_t item) {
     }
 
     if (item->nature == NODE_STRINGVAL) {
-        create_lui_inst(4, 0x1001);
-        create_ori_inst(4, 4, item->offset);
+        if (item->decl_node != NULL) {
+            // address already computed in a loop preheader
+            create_lw_inst(4, item->decl_node->offset, get_stack_reg());
+        } else {
+            create_lui_inst(4, 0x1001);
+            create_ori_inst(4, 4, item->offset);
+        }
         create_ori_inst(2, get_r0(), 0x4);
         create_syscall_inst();
     } else {
@@ -584,6 +647,41 @@ static void gen_for(node_t node);
 static void gen_dowhile(node_t node);
 static void gen_block(node_t block);
 
+// a counter of -fprofile-generate, turned into an increment by instrument_asm
+static void gen_profile_mark(node_t node, const char * kind) {
+    char text[32];
+    int32_t site = opt_profile_generate ? profile_site(node) : -1;
+
+    if (site < 0) {
+        return;
+    }
+    snprintf(text, sizeof(text), "profile %d %s", site, kind);
+    create_comment_inst(text);
+}
+
+// the source line of the code that follows, and the times it runs, for the
+// cost report of -a
+static void gen_line_mark(node_t node) {
+    char text[48];
+
+    if (!report_costs || node == NULL || node->lineno <= 0) {
+        return;
+    }
+    snprintf(text, sizeof(text), "line %d %.6g", node->lineno, line_weight);
+    create_comment_inst(text);
+}
+
+// where the code of a block of the source starts or resumes, for -fstats
+static void gen_stats_mark(int32_t block) {
+    char text[24];
+
+    if (!(opt_stats || opt_stats_json) || block < 0) {
+        return;
+    }
+    snprintf(text, sizeof(text), "block %d", block);
+    create_comment_inst(text);
+}
+
 static void gen_instr(node_t instr) {
     if (instr == NULL) {
         return;
@@ -606,9 +704,11 @@ static void gen_instr(node_t instr) {
             gen_block(instr);
             break;
         case NODE_PRINT:
+            gen_line_mark(instr);
             gen_print(instr);
             break;
         default:
+            gen_line_mark(instr);
             gen_expr(instr);
             break;
     }
@@ -629,71 +729,154 @@ static void gen_instr_list(node_t instr) {
 
 static void gen_if(node_t node) {
     int32_t label_else = get_new_label();
+    double weight = line_weight;
+    double share = report_costs ? arm_share(node) : 1.0;
 
+    gen_profile_mark(node, "entry");
+    gen_line_mark(node->opr[0]);
     gen_expr(node->opr[0]);
     create_beq_inst(get_current_reg(), get_r0(), label_else);
+    if (opt_profile_use) {
+        set_branch_profile(label_else, node);
+    }
 
+    gen_profile_mark(node, "arm");
+    line_weight = weight * share;
     gen_instr(node->opr[1]);
 
     if (node->opr[2] != NULL) {
         int32_t label_end = get_new_label();
         create_j_inst(label_end);
         create_label_inst(label_else);
+        line_weight = weight * (1.0 - share);
         gen_instr(node->opr[2]);
         create_label_inst(label_end);
     } else {
         create_label_inst(label_else);
     }
+    line_weight = weight;
+}
+
+// Rotated loop: the test is done once on entry, unless known to succeed,
+// then at the bottom as a single backward branch.
+static void gen_rotated_loop(node_t loop, node_t cond, node_t body, node_t incr, bool first_test_true) {
+    bool guard = (cond != NULL && !first_test_true);
+    int32_t label_start = get_new_label();
+    int32_t label_end = guard ? get_new_label() : -1;
+    int32_t value;
+    double weight = line_weight;
+
+    if (guard) {
+        gen_line_mark(cond);
+        gen_expr(cond);
+        create_beq_inst(get_current_reg(), get_r0(), label_end);
+    }
+
+    create_label_inst(label_start);
+    gen_profile_mark(loop, "arm");
+    line_weight = weight * (report_costs ? loop_trips(loop) : 1.0);
+    gen_instr(body);
+    if (incr != NULL) {
+        gen_line_mark(incr);
+        gen_expr(incr);
+    }
+
+    if (cond == NULL || (eval_const_expr(cond, NULL, 0, &value) && value)) {
+        create_j_inst(label_start);
+    } else {
+        gen_line_mark(cond);
+        gen_expr(cond);
+        create_bne_inst(get_current_reg(), get_r0(), label_start);
+    }
+    line_weight = weight;
+
+    if (guard) {
+        create_label_inst(label_end);
+    }
 }
 
 static void gen_while(node_t node) {
+    gen_profile_mark(node, "entry");
+    if (opt_rotate) {
+        gen_rotated_loop(node, node->opr[0], node->opr[1], NULL, loop_first_test_true(node));
+        return;
+    }
+
     int32_t label_start = get_new_label();
     int32_t label_end = get_new_label();
+    double weight = line_weight;
 
     create_label_inst(label_start);
 
+    line_weight = weight * (report_costs ? loop_trips(node) : 1.0);
+    gen_line_mark(node->opr[0]);
     gen_expr(node->opr[0]);
     create_beq_inst(get_current_reg(), get_r0(), label_end);
 
+    gen_profile_mark(node, "arm");
     gen_instr(node->opr[1]);
 
     create_j_inst(label_start);
+    line_weight = weight;
     create_label_inst(label_end);
 }
 
 static void gen_for(node_t node) {
+    gen_profile_mark(node, "entry");
+    if (opt_rotate) {
+        if (node->opr[0] != NULL) {
+            gen_line_mark(node->opr[0]);
+            gen_expr(node->opr[0]);
+        }
+        gen_rotated_loop(node, node->opr[1], node->opr[3], node->opr[2], loop_first_test_true(node));
+        return;
+    }
+
     int32_t label_start = get_new_label();
     int32_t label_end = get_new_label();
+    double weight = line_weight;
 
     if (node->opr[0] != NULL) {
+        gen_line_mark(node->opr[0]);
         gen_expr(node->opr[0]);
     }
 
     create_label_inst(label_start);
 
+    line_weight = weight * (report_costs ? loop_trips(node) : 1.0);
     if (node->opr[1] != NULL) {
+        gen_line_mark(node->opr[1]);
         gen_expr(node->opr[1]);
         create_beq_inst(get_current_reg(), get_r0(), label_end);
     }
 
+    gen_profile_mark(node, "arm");
     gen_instr(node->opr[3]);
 
     if (node->opr[2] != NULL) {
+        gen_line_mark(node->opr[2]);
         gen_expr(node->opr[2]);
     }
 
     create_j_inst(label_start);
+    line_weight = weight;
     create_label_inst(label_end);
 }
 
 static void gen_dowhile(node_t node) {
     int32_t label_start = get_new_label();
+    double weight = line_weight;
 
+    gen_profile_mark(node, "entry");
     create_label_inst(label_start);
+    gen_profile_mark(node, "arm");
+    line_weight = weight * (report_costs ? loop_trips(node) : 1.0);
     gen_instr(node->opr[0]);
 
+    gen_line_mark(node->opr[1]);
     gen_expr(node->opr[1]);
     create_bne_inst(get_current_reg(), get_r0(), label_start);
+    line_weight = weight;
 }
 
 
@@ -718,6 +901,7 @@ static void gen_local_decls(node_t decls) {
             node_t init = decls->opr[1];
 
             if (init != NULL) {
+                gen_line_mark(decls);
                 gen_expr(init);
                 create_sw_inst(get_current_reg(), ident->offset, get_stack_reg());
             }
@@ -729,11 +913,7 @@ static void gen_local_decls(node_t decls) {
     }
 }
 
-static void gen_block(node_t block) {
-    if (block == NULL) {
-        return;
-    }
-
+static void gen_block_code(node_t block) {
     if (block->opr[0] != NULL) {
         gen_local_decls(block->opr[0]);
     }
@@ -743,35 +923,68 @@ static void gen_block(node_t block) {
     }
 }
 
+static void gen_block(node_t block) {
+    if (block == NULL) {
+        return;
+    }
+
+    if (opt_stats || opt_stats_json) {
+        gen_stats_mark(stats_enter_block(block));
+        gen_block_code(block);
+        gen_stats_mark(stats_leave_block());
+    } else {
+        gen_block_code(block);
+    }
+}
+
 
 // text section
 static void gen_text_section(node_t func) {
     create_text_sec_inst();
     create_label_str_inst("main");
 
+    // the body of main is the first block of -fstats, with the prologue
+    // and the epilogue
+    if (opt_stats || opt_stats_json) {
+        gen_stats_mark(stats_enter_block(func));
+    }
+
+    // the prologue and the epilogue go with the line of the function
+    gen_line_mark(func->opr[1]);
     set_temporary_start_offset(func->offset);
     create_stack_allocation_inst();
 
     if (func->opr[2] != NULL) {
-        gen_block(func->opr[2]);
+        gen_block_code(func->opr[2]);
     }
 
     int32_t stack_size = get_temporary_max_offset();
     if (func->offset > stack_size) {
         stack_size = func->offset;
     }
+    gen_line_mark(func->opr[1]);
     create_stack_deallocation_inst(stack_size);
     create_ori_inst(2, get_r0(), 0xa);
     create_syscall_inst();
+
+    if (opt_stats || opt_stats_json) {
+        stats_frame(stack_size, stack_size - func->offset);
+        stats_leave_block();
+    }
 }
 
 
 // main entry point
 void gen_code_passe_2(node_t root) {
-    collect_strings(root);
+    if (opt_merge_strings) {
+        pool_strings(root);
+    } else {
+        collect_strings(root);
+    }
 
     set_max_registers(get_num_registers());
     reset_temporary_max_offset();
+    line_weight = 1.0;
 
     gen_data_section(root);
 
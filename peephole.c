@@ -0,0 +1,483 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "asm.h"
+
+extern int trace_level;
+
+
+// Peephole optimisation.
+// passe_2 builds each construct from a fixed template, so the code is full
+// of local redundancies. The rules of the table are tried in order at each
+// instruction of the text section, looking at a window of its neighbours in
+// the same block, until none applies. The constants held by registers since
+// the start of the block are tracked, so that an address loaded by lui is
+// shared by the following accesses.
+
+// instructions looked at around the current one, for memory accesses
+#define WINDOW 16
+
+#define REG(r) ((asm_regs)1 << (r))
+
+// constants held by registers, set since the start of the block
+typedef struct _consts_s {
+    bool known[32];
+    int32_t value[32];
+    int32_t since[32];      // line of the instruction that set it
+} consts_s;
+
+// rewrites the code at line i, returns true when it did
+typedef bool (*rule_fn)(asm_prog_s * prog, int32_t i);
+
+typedef struct _peephole_rule_s {
+    const char * name;
+    rule_fn apply;
+    int32_t count;
+} peephole_rule_s;
+
+// the constants before the line the rules look at
+static consts_s consts;
+
+
+// helpers
+static int32_t next_inst(asm_prog_s * prog, int32_t i) {
+    for (i++; i < prog->size && prog->lines[i].kind == ASM_LINE_TEXT; i++) {
+    }
+    return i;
+}
+
+static bool is_pure(asm_line_s * l) {
+    uint32_t flags = asm_op_flags(l);
+    asm_regs defs = asm_defs(l);
+
+    return (flags & ~ASM_OP_LOAD) == 0 && defs != 0 && (defs & (defs - 1)) == 0
+        && (defs & (REG(ASM_REG_HI) | REG(ASM_REG_LO) | REG(29))) == 0;
+}
+
+static bool is_copy(asm_line_s * l, int32_t * dst, int32_t * src) {
+    if ((!asm_is_inst(l, "addu") && !asm_is_inst(l, "or")) || l->nargs != 3) {
+        return false;
+    }
+    *dst = l->args[0].reg;
+    if (l->args[2].reg == 0) {
+        *src = l->args[1].reg;
+    } else if (l->args[1].reg == 0) {
+        *src = l->args[2].reg;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// constant written by the instruction, from the known values of its sources
+static bool const_value(asm_line_s * l, consts_s * c, int32_t * reg, int32_t * value) {
+    int32_t src, imm;
+
+    if (asm_is_inst(l, "lui")) {
+        *reg = l->args[0].reg;
+        *value = (int32_t)((uint32_t)l->args[1].imm << 16);
+        return true;
+    }
+    if (is_copy(l, reg, &src)) {
+        *value = c->value[src];
+        return c->known[src];
+    }
+    if (l->nargs != 3 || l->args[1].kind != ASM_ARG_REG || l->args[2].kind != ASM_ARG_IMM) {
+        return false;
+    }
+    *reg = l->args[0].reg;
+    src = l->args[1].reg;
+    imm = l->args[2].imm;
+    if (!c->known[src]) {
+        return false;
+    }
+    if (asm_is_inst(l, "ori")) {
+        *value = c->value[src] | (imm & 0xFFFF);
+    } else if (asm_is_inst(l, "xori")) {
+        *value = c->value[src] ^ (imm & 0xFFFF);
+    } else if (asm_is_inst(l, "andi")) {
+        *value = c->value[src] & imm & 0xFFFF;
+    } else if (asm_is_inst(l, "addiu")) {
+        *value = (int32_t)((uint32_t)c->value[src] + (uint32_t)imm);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void consts_reset(consts_s * c) {
+    memset(c, 0, sizeof(*c));
+    c->known[0] = true;
+}
+
+static void consts_update(consts_s * c, asm_line_s * l, int32_t i) {
+    asm_regs defs = asm_defs(l);
+    int32_t reg, value;
+    bool known = const_value(l, c, &reg, &value);
+
+    if (asm_is_boundary(l)) {
+        consts_reset(c);
+        return;
+    }
+    for (int32_t r = 1; r < 32; r++) {
+        if (defs & REG(r)) {
+            c->known[r] = false;
+        }
+    }
+    if (known && reg != 0) {
+        c->known[reg] = true;
+        c->value[reg] = value;
+        c->since[reg] = i;
+    }
+}
+
+// true when the value of reg after line i is never read
+static bool is_dead_after(asm_prog_s * prog, int32_t i, int32_t reg) {
+    for (int32_t j = i + 1; j < prog->size; j++) {
+        asm_line_s * l = &prog->lines[j];
+        if (l->kind == ASM_LINE_LABEL) {
+            break;
+        }
+        if (l->kind != ASM_LINE_INST) {
+            continue;
+        }
+        if (asm_uses(l) & REG(reg)) {
+            return false;
+        }
+        if (asm_defs(l) & REG(reg)) {
+            return true;
+        }
+        if (asm_is_boundary(l)) {
+            break;
+        }
+    }
+    return (ASM_SCRATCH_REGS & REG(reg)) != 0;
+}
+
+// memory accesses: base register, offset and width
+static bool same_slot(asm_line_s * a, asm_line_s * b) {
+    return a->args[1].reg == b->args[1].reg && a->args[1].imm == b->args[1].imm
+        && asm_mem_width(a) == asm_mem_width(b);
+}
+
+// the stack and the data section are disjoint, offsets from the same base
+// are compared
+static bool may_alias(asm_line_s * a, asm_line_s * b) {
+    int32_t base_a = a->args[1].reg, base_b = b->args[1].reg;
+    int32_t off_a = a->args[1].imm, off_b = b->args[1].imm;
+
+    if (base_a != base_b) {
+        return (base_a == 29) == (base_b == 29);
+    }
+    return off_a < off_b + asm_mem_width(b) && off_b < off_a + asm_mem_width(a);
+}
+
+static bool is_label_after(asm_prog_s * prog, int32_t i, const char * label) {
+    for (int32_t j = i + 1; j < prog->size; j++) {
+        asm_line_s * l = &prog->lines[j];
+        if (l->kind == ASM_LINE_LABEL) {
+            if (strcmp(l->text, label) == 0) {
+                return true;
+            }
+        } else if (l->kind != ASM_LINE_TEXT) {
+            return false;
+        }
+    }
+    return false;
+}
+
+static void replace(asm_prog_s * prog, int32_t i, const char * text) {
+    asm_remove(prog, i);
+    asm_insert(prog, i, "%s", text);
+}
+
+
+// rules
+// lui, ori or addiu of a value the register already holds
+static bool redundant_const(asm_prog_s * prog, int32_t i) {
+    asm_line_s * l = &prog->lines[i];
+    consts_s * c = &consts;
+    int32_t reg, value;
+
+    if (asm_is_boundary(l) || !const_value(l, c, &reg, &value) || reg == 0
+        || !c->known[reg] || c->value[reg] != value) {
+        return false;
+    }
+    asm_remove(prog, i);
+    return true;
+}
+
+// addu $r, $r, $0 and the like
+static bool self_copy(asm_prog_s * prog, int32_t i) {
+    asm_line_s * l = &prog->lines[i];
+    int32_t dst, src;
+
+    if (is_copy(l, &dst, &src) && dst == src) {
+        asm_remove(prog, i);
+        return true;
+    }
+    if ((asm_is_inst(l, "ori") || asm_is_inst(l, "xori") || asm_is_inst(l, "addiu"))
+        && l->args[0].reg == l->args[1].reg && l->args[2].imm == 0) {
+        asm_remove(prog, i);
+        return true;
+    }
+    return false;
+}
+
+// a memory access uses the oldest register holding its base address
+static bool shared_base(asm_prog_s * prog, int32_t i) {
+    asm_line_s * l = &prog->lines[i];
+    consts_s * c = &consts;
+    int32_t base, best = -1;
+
+    if (!(asm_op_flags(l) & (ASM_OP_LOAD | ASM_OP_STORE))) {
+        return false;
+    }
+    base = l->args[1].reg;
+    if (base == 0 || base == 29 || !c->known[base]) {
+        return false;
+    }
+    for (int32_t r = 1; r < 32; r++) {
+        if (c->known[r] && c->value[r] == c->value[base] && c->since[r] < c->since[base]
+            && (best < 0 || c->since[r] < c->since[best])) {
+            best = r;
+        }
+    }
+    if (best < 0) {
+        return false;
+    }
+    l->args[1].reg = best;
+    return true;
+}
+
+// a register written and not read again
+static bool dead_def(asm_prog_s * prog, int32_t i) {
+    asm_line_s * l = &prog->lines[i];
+
+    if (!is_pure(l) || !is_dead_after(prog, i, l->args[0].reg)) {
+        return false;
+    }
+    asm_remove(prog, i);
+    return true;
+}
+
+// lw of a word stored or loaded before in the block, from a register that
+// still holds it
+static bool forward_load(asm_prog_s * prog, int32_t i) {
+    asm_line_s * l = &prog->lines[i];
+    asm_regs killed = 0;
+    char text[64];
+    int32_t dst, src, base, n = 0;
+
+    if (!asm_is_inst(l, "lw")) {
+        return false;
+    }
+    dst = l->args[0].reg;
+    base = l->args[1].reg;
+    for (int32_t j = i - 1; j >= 0 && n < WINDOW; j--) {
+        asm_line_s * p = &prog->lines[j];
+        if (p->kind == ASM_LINE_LABEL || asm_is_boundary(p)) {
+            return false;
+        }
+        if (p->kind != ASM_LINE_INST) {
+            continue;
+        }
+        n++;
+        if ((asm_op_flags(p) & (ASM_OP_LOAD | ASM_OP_STORE)) && same_slot(p, l)
+            && !(asm_is_inst(p, "lw") && p->args[0].reg == base)) {
+            src = p->args[0].reg;
+            if (killed & (REG(src) | REG(base))) {
+                return false;
+            }
+            if (src == dst) {
+                asm_remove(prog, i);
+            } else {
+                snprintf(text, sizeof(text), "addu $%d, $%d, $0", dst, src);
+                replace(prog, i, text);
+            }
+            return true;
+        }
+        if ((asm_op_flags(p) & ASM_OP_STORE) && may_alias(p, l)) {
+            return false;
+        }
+        killed |= asm_defs(p);
+    }
+    return false;
+}
+
+// a store overwritten before being read
+static bool dead_store(asm_prog_s * prog, int32_t i) {
+    asm_line_s * l = &prog->lines[i];
+    int32_t n = 0;
+
+    if (!(asm_op_flags(l) & ASM_OP_STORE)) {
+        return false;
+    }
+    for (int32_t j = i + 1; j < prog->size && n < WINDOW; j++) {
+        asm_line_s * s = &prog->lines[j];
+        if (s->kind == ASM_LINE_LABEL || asm_is_boundary(s)) {
+            return false;
+        }
+        if (s->kind != ASM_LINE_INST) {
+            continue;
+        }
+        n++;
+        if ((asm_op_flags(s) & ASM_OP_STORE) && same_slot(s, l)) {
+            asm_remove(prog, i);
+            return true;
+        }
+        if ((asm_op_flags(s) & (ASM_OP_LOAD | ASM_OP_STORE)) && may_alias(s, l)) {
+            return false;
+        }
+        if (asm_defs(s) & REG(l->args[1].reg)) {
+            return false;
+        }
+    }
+    return false;
+}
+
+// op $s, ... followed by addu $d, $s, $0 with $s dead: op $d, ...
+static bool coalesce_copy(asm_prog_s * prog, int32_t i) {
+    asm_line_s * l = &prog->lines[i];
+    int32_t k = next_inst(prog, i);
+    int32_t dst, src;
+
+    if (!is_pure(l) || asm_reads_dest(l) || k >= prog->size || !is_copy(&prog->lines[k], &dst, &src)
+        || src != l->args[0].reg || dst == 0 || dst == 29 || !is_dead_after(prog, k, src)) {
+        return false;
+    }
+    l->args[0].reg = dst;
+    asm_remove(prog, k);
+    return true;
+}
+
+// j or branch to the label that follows
+static bool jump_to_next(asm_prog_s * prog, int32_t i) {
+    asm_line_s * l = &prog->lines[i];
+    const char * target;
+
+    if (!(asm_op_flags(l) & (ASM_OP_JUMP | ASM_OP_BRANCH)) || (target = asm_target(l)) == NULL
+        || !is_label_after(prog, i, target)) {
+        return false;
+    }
+    asm_remove(prog, i);
+    return true;
+}
+
+static const char * inverse_branches[][2] = {
+    { "beq", "bne" }, { "bne", "beq" },
+    { "bgez", "bltz" }, { "bltz", "bgez" },
+    { "bgtz", "blez" }, { "blez", "bgtz" },
+};
+
+// beq a, b, L1; j L2; L1: is bne a, b, L2; L1:
+static bool branch_over_jump(asm_prog_s * prog, int32_t i) {
+    asm_line_s * l = &prog->lines[i];
+    int32_t k = next_inst(prog, i);
+    asm_line_s * j;
+
+    if (!(asm_op_flags(l) & ASM_OP_BRANCH) || k >= prog->size || !asm_is_inst(&prog->lines[k], "j")
+        || !is_label_after(prog, k, asm_target(l))) {
+        return false;
+    }
+    j = &prog->lines[k];
+    for (int32_t n = 0; n < (int32_t)(sizeof(inverse_branches) / sizeof(inverse_branches[0])); n++) {
+        if (strcmp(l->op, inverse_branches[n][0]) == 0) {
+            strcpy(l->op, inverse_branches[n][1]);
+            asm_set_target(l, j->args[0].label);
+            asm_remove(prog, k);
+            return true;
+        }
+    }
+    return false;
+}
+
+// xori $r, $s, a; xori $r, $r, b is xori $r, $s, a ^ b
+static bool xori_pair(asm_prog_s * prog, int32_t i) {
+    asm_line_s * l = &prog->lines[i];
+    int32_t k = next_inst(prog, i);
+    asm_line_s * n;
+
+    if (!asm_is_inst(l, "xori") || k >= prog->size || !asm_is_inst(&prog->lines[k], "xori")) {
+        return false;
+    }
+    n = &prog->lines[k];
+    if (n->args[0].reg != l->args[0].reg || n->args[1].reg != l->args[0].reg) {
+        return false;
+    }
+    l->args[2].imm ^= n->args[2].imm;
+    asm_remove(prog, k);
+    return true;
+}
+
+static peephole_rule_s rules[] = {
+    { "redundant-const", redundant_const, 0 },
+    { "self-copy", self_copy, 0 },
+    { "shared-base", shared_base, 0 },
+    { "forward-load", forward_load, 0 },
+    { "dead-store", dead_store, 0 },
+    { "dead-def", dead_def, 0 },
+    { "coalesce-copy", coalesce_copy, 0 },
+    { "jump-to-next", jump_to_next, 0 },
+    { "branch-over-jump", branch_over_jump, 0 },
+    { "xori-pair", xori_pair, 0 },
+};
+
+#define NUM_RULES ((int32_t)(sizeof(rules) / sizeof(rules[0])))
+
+
+// driver
+static bool peephole_text(asm_prog_s * prog) {
+    bool in_text = false;
+    bool changed = false;
+
+    consts_reset(&consts);
+    for (int32_t i = 0; i < prog->size; ) {
+        asm_line_s * l = &prog->lines[i];
+        bool applied = false;
+
+        if (l->kind == ASM_LINE_DIRECTIVE) {
+            in_text = (strcmp(l->text, ".text") == 0) || (in_text && strcmp(l->text, ".data") != 0);
+        }
+        if (!in_text || l->kind != ASM_LINE_INST) {
+            if (l->kind == ASM_LINE_LABEL) {
+                consts_reset(&consts);
+            }
+            i++;
+            continue;
+        }
+        for (int32_t r = 0; r < NUM_RULES && !applied; r++) {
+            if (rules[r].apply(prog, i)) {
+                rules[r].count++;
+                applied = true;
+            }
+        }
+        if (applied) {
+            changed = true;
+        } else {
+            consts_update(&consts, l, i);
+            i++;
+        }
+    }
+    return changed;
+}
+
+bool peephole_asm(asm_prog_s * prog) {
+    bool changed = false;
+
+    for (int32_t r = 0; r < NUM_RULES; r++) {
+        rules[r].count = 0;
+    }
+    while (peephole_text(prog)) {
+        changed = true;
+    }
+    for (int32_t r = 0; r < NUM_RULES; r++) {
+        printf_level(2, "peephole: %-16s %d\n", rules[r].name, rules[r].count);
+    }
+    return changed;
+}
@@ -0,0 +1,346 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "optim.h"
+
+extern int trace_level;
+
+
+// Compile-time evaluation.
+// A MiniC program reads no input, so its output only depends on its source.
+// main is run by an interpreter on the checked tree, with the semantics of
+// the code of passe_2: 32-bit wrap around, both operands of && and ||
+// evaluated, variables stored by offset like in memory. Each evaluated node
+// costs one unit of fuel. When the program ends within its fuel, the body of
+// main is replaced by the print of the collected output. A trap, an
+// exhausted fuel, a read of an uninitialised local or a too long output
+// leave the tree unchanged, so the generated code traps as before.
+
+// beyond this size, the output is cheaper to compute at run time
+#define MAX_OUTPUT 65536
+
+typedef struct _memory_s {
+    int32_t * values;
+    bool * defined;
+    int32_t size;
+} memory_s;
+
+static memory_s locals;
+static memory_s globals;
+
+static int64_t fuel;
+static const char * failure;
+static int32_t failure_line;
+
+static char * output;
+static int32_t output_len;
+static int32_t output_cap;
+
+
+static void fail(const char * reason, node_t n) {
+    if (failure == NULL) {
+        failure = reason;
+        failure_line = n->lineno;
+    }
+}
+
+static void memory_init(memory_s * m, int32_t bytes) {
+    m->size = bytes / 4 + 1;
+    m->values = calloc(m->size, sizeof(int32_t));
+    m->defined = calloc(m->size, sizeof(bool));
+}
+
+static void memory_free(memory_s * m) {
+    free(m->values);
+    free(m->defined);
+}
+
+// memory cell of a variable, from its declaration
+static int32_t cell(node_t var, memory_s ** m) {
+    node_t decl = (var->decl_node != NULL) ? var->decl_node : var;
+    *m = decl->global_decl ? &globals : &locals;
+    return decl->offset / 4;
+}
+
+static int32_t read_var(node_t var) {
+    memory_s * m;
+    int32_t i = cell(var, &m);
+
+    if (i < 0 || i >= m->size || !m->defined[i]) {
+        fail("read of an uninitialised variable", var);
+        return 0;
+    }
+    return m->values[i];
+}
+
+static void write_var(node_t var, int32_t v) {
+    memory_s * m;
+    int32_t i = cell(var, &m);
+
+    if (i < 0 || i >= m->size) {
+        fail("variable out of the stack frame", var);
+        return;
+    }
+    m->values[i] = v;
+    m->defined[i] = true;
+}
+
+static void append_output(const char * s, int32_t len, node_t item) {
+    if (output_len + len > MAX_OUTPUT) {
+        fail("output too long", item);
+        return;
+    }
+    if (output_len + len + 1 > output_cap) {
+        output_cap = 2 * (output_len + len + 1);
+        output = realloc(output, output_cap);
+    }
+    memcpy(output + output_len, s, len);
+    output_len += len;
+    output[output_len] = '\0';
+}
+
+
+// expressions
+static int32_t eval(node_t e) {
+    int32_t a, b;
+
+    if (e == NULL || failure != NULL) {
+        return 0;
+    }
+    if (--fuel < 0) {
+        fail("out of fuel", e);
+        return 0;
+    }
+
+    switch (e->nature) {
+        case NODE_INTVAL:
+        case NODE_BOOLVAL:
+            return (int32_t)e->value;
+        case NODE_IDENT:
+            return read_var(e);
+        case NODE_AFFECT:
+            a = eval(e->opr[1]);
+            write_var(e->opr[0], a);
+            return a;
+        case NODE_NOT:
+            return eval(e->opr[0]) ^ 1;
+        case NODE_BNOT:
+            return ~eval(e->opr[0]);
+        case NODE_UMINUS:
+            return (int32_t)(0u - (uint32_t)eval(e->opr[0]));
+        default:
+            break;
+    }
+
+    a = eval(e->opr[0]);
+    b = eval(e->opr[1]);
+    if (failure != NULL) {
+        return 0;
+    }
+
+    switch (e->nature) {
+        case NODE_PLUS:  return (int32_t)((uint32_t)a + (uint32_t)b);
+        case NODE_MINUS: return (int32_t)((uint32_t)a - (uint32_t)b);
+        case NODE_MUL:   return (int32_t)((uint32_t)a * (uint32_t)b);
+        case NODE_DIV:
+        case NODE_MOD:
+            if (b == 0) {
+                fail("division by zero", e);
+                return 0;
+            }
+            // the quotient of INT_MIN / -1 is left to the target
+            if (a == INT32_MIN && b == -1) {
+                fail("overflowing division", e);
+                return 0;
+            }
+            return e->nature == NODE_DIV ? a / b : a % b;
+        case NODE_LT:    return a < b;
+        case NODE_GT:    return a > b;
+        case NODE_LE:    return a <= b;
+        case NODE_GE:    return a >= b;
+        case NODE_EQ:    return a == b;
+        case NODE_NE:    return a != b;
+        case NODE_AND:
+        case NODE_BAND:  return a & b;
+        case NODE_OR:
+        case NODE_BOR:   return a | b;
+        case NODE_BXOR:  return a ^ b;
+        case NODE_SLL:   return (int32_t)((uint32_t)a << (b & 31));
+        case NODE_SRA:   return a >> (b & 31);
+        case NODE_SRL:   return (int32_t)((uint32_t)a >> (b & 31));
+        default:
+            fail("unexpected node", e);
+            return 0;
+    }
+}
+
+
+// instructions
+static void exec(node_t n);
+
+static void exec_decls(node_t decls) {
+    if (decls == NULL) {
+        return;
+    }
+
+    switch (decls->nature) {
+        case NODE_LIST:
+            exec_decls(decls->opr[0]);
+            exec_decls(decls->opr[1]);
+            break;
+        case NODE_DECLS:
+            exec_decls(decls->opr[1]);
+            break;
+        case NODE_DECL:
+            if (decls->nops > 1 && decls->opr[1] != NULL) {
+                write_var(decls->opr[0], eval(decls->opr[1]));
+            } else if (decls->opr[0]->global_decl) {
+                write_var(decls->opr[0], 0);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void exec_print(node_t item) {
+    char buf[16];
+
+    if (item == NULL || failure != NULL) {
+        return;
+    }
+    if (item->nature == NODE_LIST) {
+        exec_print(item->opr[0]);
+        exec_print(item->opr[1]);
+    } else if (item->nature == NODE_STRINGVAL) {
+        // the literal keeps its quotes and escapes
+        append_output(item->str + 1, (int32_t)strlen(item->str) - 2, item);
+    } else {
+        int32_t v = eval(item);
+        append_output(buf, snprintf(buf, sizeof(buf), "%d", v), item);
+    }
+}
+
+static void exec(node_t n) {
+    if (n == NULL || failure != NULL) {
+        return;
+    }
+    if (--fuel < 0) {
+        fail("out of fuel", n);
+        return;
+    }
+
+    switch (n->nature) {
+        case NODE_LIST:
+            exec(n->opr[0]);
+            exec(n->opr[1]);
+            break;
+        case NODE_BLOCK:
+            exec_decls(n->opr[0]);
+            exec(n->opr[1]);
+            break;
+        case NODE_IF:
+            if (eval(n->opr[0])) {
+                exec(n->opr[1]);
+            } else if (n->nops > 2) {
+                exec(n->opr[2]);
+            }
+            break;
+        case NODE_WHILE:
+            while (eval(n->opr[0]) && failure == NULL) {
+                exec(n->opr[1]);
+            }
+            break;
+        case NODE_FOR:
+            for (eval(n->opr[0]); failure == NULL && (n->opr[1] == NULL || eval(n->opr[1])); eval(n->opr[2])) {
+                exec(n->opr[3]);
+                if (--fuel < 0) {
+                    fail("out of fuel", n);
+                }
+            }
+            break;
+        case NODE_DOWHILE:
+            do {
+                exec(n->opr[0]);
+            } while (eval(n->opr[1]) && failure == NULL);
+            break;
+        case NODE_PRINT:
+            exec_print(n->opr[0]);
+            break;
+        default:
+            eval(n);
+            break;
+    }
+}
+
+
+// global data size, from the offsets given by passe_1
+static int32_t globals_size(node_t decls) {
+    int32_t size = 0;
+
+    if (decls == NULL) {
+        return 0;
+    }
+    if (decls->nature == NODE_DECL) {
+        return decls->opr[0]->offset + 4;
+    }
+    for (int32_t i = 0; i < decls->nops; i++) {
+        int32_t s = globals_size(decls->opr[i]);
+        if (s > size) {
+            size = s;
+        }
+    }
+    return size;
+}
+
+// returns true when main has been replaced by its output
+bool peval_tree(node_t root) {
+    node_t func = root->opr[1];
+    node_t block = func->opr[2];
+
+    if (block == NULL) {
+        return false;
+    }
+
+    fuel = opt_peval_fuel;
+    failure = NULL;
+    failure_line = 0;
+    output = NULL;
+    output_len = 0;
+    output_cap = 0;
+    memory_init(&globals, globals_size(root->opr[0]));
+    memory_init(&locals, func->offset);
+
+    exec_decls(root->opr[0]);
+    exec(block);
+    memory_free(&globals);
+    memory_free(&locals);
+
+    if (failure != NULL) {
+        printf_level(2, "peval: %s at line %d, code generated\n", failure, failure_line);
+        free(output);
+        return false;
+    }
+    printf_level(2, "peval: evaluated with %lld units of fuel left, %d bytes of output\n",
+                 (long long)fuel, output_len);
+
+    free_nodes(block->opr[0]);
+    free_nodes(block->opr[1]);
+    block->opr[0] = NULL;
+    block->opr[1] = NULL;
+    if (output_len > 0) {
+        node_t str = make_node(NODE_STRINGVAL, 0);
+        str->str = malloc(output_len + 3);
+        snprintf(str->str, output_len + 3, "\"%s\"", output);
+        str->lineno = block->lineno;
+        block->opr[1] = make_node(NODE_PRINT, 1, str);
+        block->opr[1]->lineno = block->lineno;
+    }
+    free(output);
+    return true;
+}
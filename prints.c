@@ -0,0 +1,349 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "optim.h"
+
+extern int trace_level;
+
+
+// Print coalescing.
+// Each print item costs a syscall. In a list of instructions, a print is
+// merged into the previous one when the instructions in between cannot trap
+// and do not assign the variables it prints. An integer variable holding a
+// known constant is printed as text, then adjacent literals of a print are
+// concatenated into one.
+
+typedef struct _node_array_s {
+    node_t * nodes;
+    int32_t size;
+    int32_t capacity;
+} node_array_s;
+
+// constant values of variables, known at the current instruction
+typedef struct _known_s {
+    node_t * decls;
+    int32_t * values;
+    int32_t size;
+    int32_t capacity;
+} known_s;
+
+static int32_t num_merged = 0;
+static int32_t num_syscalls_saved = 0;
+
+
+static void array_add(node_array_s * a, node_t n) {
+    if (a->size == a->capacity) {
+        a->capacity = a->capacity ? 2 * a->capacity : 16;
+        a->nodes = realloc(a->nodes, a->capacity * sizeof(node_t));
+    }
+    a->nodes[a->size++] = n;
+}
+
+// elements of a left-nested list, the list nodes themselves are freed
+static void flatten_list(node_t list, node_array_s * a) {
+    if (list == NULL) {
+        return;
+    }
+    if (list->nature != NODE_LIST) {
+        array_add(a, list);
+        return;
+    }
+    flatten_list(list->opr[0], a);
+    flatten_list(list->opr[1], a);
+    list->opr[0] = NULL;
+    list->opr[1] = NULL;
+    free_nodes(list);
+}
+
+static node_t rebuild_list(node_array_s * a) {
+    node_t list = NULL;
+
+    for (int32_t i = 0; i < a->size; i++) {
+        if (a->nodes[i] != NULL) {
+            list = (list == NULL) ? a->nodes[i] : list_append(list, a->nodes[i]);
+        }
+    }
+    return list;
+}
+
+
+// known constants
+static int32_t known_find(known_s * k, node_t decl) {
+    for (int32_t i = 0; i < k->size; i++) {
+        if (k->decls[i] == decl) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void known_set(known_s * k, node_t decl, int32_t value) {
+    int32_t i = known_find(k, decl);
+
+    if (i < 0) {
+        if (k->size == k->capacity) {
+            k->capacity = k->capacity ? 2 * k->capacity : 8;
+            k->decls = realloc(k->decls, k->capacity * sizeof(node_t));
+            k->values = realloc(k->values, k->capacity * sizeof(int32_t));
+        }
+        i = k->size++;
+        k->decls[i] = decl;
+    }
+    k->values[i] = value;
+}
+
+// forgets the variables assigned in n
+static void known_kill(known_s * k, node_t n) {
+    decl_set_s assigned = { NULL, 0, 0 };
+
+    collect_assigned(n, &assigned);
+    for (int32_t i = 0; i < k->size; ) {
+        if (decl_set_contains(&assigned, k->decls[i])) {
+            k->size--;
+            k->decls[i] = k->decls[k->size];
+            k->values[i] = k->values[k->size];
+        } else {
+            i++;
+        }
+    }
+    decl_set_free(&assigned);
+}
+
+static void known_free(known_s * k) {
+    free(k->decls);
+    free(k->values);
+}
+
+// x = <constant> as a whole instruction or declaration
+static void known_update(known_s * k, node_t var, node_t value, node_t instr) {
+    known_kill(k, instr);
+    if (var->nature == NODE_IDENT && var->decl_node != NULL && value != NULL
+        && (value->nature == NODE_INTVAL || value->nature == NODE_BOOLVAL)) {
+        known_set(k, var->decl_node, (int32_t)value->value);
+    }
+}
+
+
+// print items
+static node_t make_literal(const char * text, int32_t len, int32_t lineno) {
+    node_t str = make_node(NODE_STRINGVAL, 0);
+
+    str->str = malloc(len + 3);
+    str->str[0] = '"';
+    memcpy(str->str + 1, text, len);
+    str->str[len + 1] = '"';
+    str->str[len + 2] = '\0';
+    str->lineno = lineno;
+    return str;
+}
+
+// text between the quotes of a literal
+static const char * literal_text(node_t str, int32_t * len) {
+    *len = (int32_t)strlen(str->str) - 2;
+    return str->str + 1;
+}
+
+static node_t join_literals(node_t a, node_t b) {
+    int32_t la, lb;
+    const char * ta = literal_text(a, &la);
+    const char * tb = literal_text(b, &lb);
+    char * text = malloc(la + lb + 1);
+
+    memcpy(text, ta, la);
+    memcpy(text + la, tb, lb);
+    node_t str = make_literal(text, la + lb, a->lineno);
+    free(text);
+    free_nodes(a);
+    free_nodes(b);
+    return str;
+}
+
+// variables of known value are printed as text
+static void substitute_known(node_t * pitem, known_s * k) {
+    node_t item = *pitem;
+    char buf[16];
+    int32_t j;
+
+    if (item == NULL) {
+        return;
+    }
+    if (item->nature == NODE_LIST) {
+        substitute_known(&item->opr[0], k);
+        substitute_known(&item->opr[1], k);
+    } else if (item->nature == NODE_IDENT && item->decl_node != NULL
+               && (j = known_find(k, item->decl_node)) >= 0) {
+        int32_t len = snprintf(buf, sizeof(buf), "%d", k->values[j]);
+        *pitem = make_literal(buf, len, item->lineno);
+        free_nodes(item);
+    }
+}
+
+// adjacent literals are printed by one syscall
+static void join_items(node_t print) {
+    node_array_s items = { NULL, 0, 0 };
+    int32_t last = -1;
+
+    flatten_list(print->opr[0], &items);
+    for (int32_t i = 0; i < items.size; i++) {
+        node_t item = items.nodes[i];
+        if (item->nature == NODE_STRINGVAL && last >= 0 && items.nodes[last]->nature == NODE_STRINGVAL) {
+            items.nodes[last] = join_literals(items.nodes[last], item);
+            items.nodes[i] = NULL;
+            num_syscalls_saved++;
+        } else {
+            last = i;
+        }
+    }
+    print->opr[0] = rebuild_list(&items);
+    free(items.nodes);
+}
+
+static bool prints_assigned(node_t item, decl_set_s * assigned) {
+    if (item == NULL) {
+        return false;
+    }
+    if (item->nature == NODE_LIST) {
+        return prints_assigned(item->opr[0], assigned) || prints_assigned(item->opr[1], assigned);
+    }
+    return uses_any(item, assigned);
+}
+
+
+// instructions
+static void merge_instr(node_t * pinstr);
+
+// merges the prints of a list of instructions, known holds the constants at its start
+static node_t merge_list(node_t list, known_s * k) {
+    node_array_s instrs = { NULL, 0, 0 };
+    decl_set_s assigned = { NULL, 0, 0 };     // assigned since the last print
+    int32_t last_print = -1;
+
+    flatten_list(list, &instrs);
+    for (int32_t i = 0; i < instrs.size; i++) {
+        node_t instr = instrs.nodes[i];
+
+        switch (instr->nature) {
+            case NODE_PRINT:
+                substitute_known(&instr->opr[0], k);
+                join_items(instr);
+                if (last_print >= 0 && !prints_assigned(instr->opr[0], &assigned)) {
+                    node_t prev = instrs.nodes[last_print];
+                    prev->opr[0] = list_append(prev->opr[0], instr->opr[0]);
+                    instr->opr[0] = NULL;
+                    free_nodes(instr);
+                    instrs.nodes[i] = NULL;
+                    join_items(prev);
+                    num_merged++;
+                } else {
+                    last_print = i;
+                    decl_set_free(&assigned);
+                }
+                break;
+
+            case NODE_AFFECT:
+                known_update(k, instr->opr[0], instr->opr[1], instr);
+                if (may_trap(instr)) {
+                    last_print = -1;
+                }
+                collect_assigned(instr, &assigned);
+                break;
+
+            default:
+                merge_instr(&instrs.nodes[i]);
+                known_kill(k, instr);
+                if (!is_leaf(instr) && (may_trap(instr) || has_output_or_loop(instr)
+                                        || instr->nature == NODE_IF || instr->nature == NODE_BLOCK)) {
+                    last_print = -1;
+                }
+                collect_assigned(instr, &assigned);
+                break;
+        }
+    }
+
+    node_t result = rebuild_list(&instrs);
+    free(instrs.nodes);
+    decl_set_free(&assigned);
+    return result;
+}
+
+static void seed_decls(node_t decls, known_s * k) {
+    if (decls == NULL) {
+        return;
+    }
+
+    switch (decls->nature) {
+        case NODE_LIST:
+            seed_decls(decls->opr[0], k);
+            seed_decls(decls->opr[1], k);
+            break;
+        case NODE_DECLS:
+            seed_decls(decls->opr[1], k);
+            break;
+        case NODE_DECL:
+            known_update(k, decls->opr[0], decls->nops > 1 ? decls->opr[1] : NULL, decls);
+            break;
+        default:
+            break;
+    }
+}
+
+static node_t merge_body(node_t body) {
+    known_s k = { NULL, NULL, 0, 0 };
+
+    if (body == NULL) {
+        return NULL;
+    }
+    if (body->nature == NODE_BLOCK) {
+        seed_decls(body->opr[0], &k);
+        body->opr[1] = merge_list(body->opr[1], &k);
+    } else {
+        body = merge_list(body, &k);
+    }
+    known_free(&k);
+    return body;
+}
+
+static void merge_instr(node_t * pinstr) {
+    node_t instr = *pinstr;
+
+    if (instr == NULL) {
+        return;
+    }
+
+    switch (instr->nature) {
+        case NODE_BLOCK:
+            *pinstr = merge_body(instr);
+            break;
+        case NODE_IF:
+            instr->opr[1] = merge_body(instr->opr[1]);
+            if (instr->nops > 2) {
+                instr->opr[2] = merge_body(instr->opr[2]);
+            }
+            break;
+        case NODE_WHILE:
+            instr->opr[1] = merge_body(instr->opr[1]);
+            break;
+        case NODE_FOR:
+            instr->opr[3] = merge_body(instr->opr[3]);
+            break;
+        case NODE_DOWHILE:
+            instr->opr[0] = merge_body(instr->opr[0]);
+            break;
+        default:
+            break;
+    }
+}
+
+void merge_prints_tree(node_t root) {
+    node_t func = root->opr[1];
+
+    num_merged = 0;
+    num_syscalls_saved = 0;
+    func->opr[2] = merge_body(func->opr[2]);
+    printf_level(2, "merge-prints: %d prints merged, %d syscalls saved\n", num_merged, num_syscalls_saved);
+}
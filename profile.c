@@ -0,0 +1,326 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "arch.h"
+#include "optim.h"
+#include "asm.h"
+
+extern int trace_level;
+
+
+// Profile-guided optimisation.
+// Each if and each loop of the source is a site, numbered in the order of
+// the tree before any transformation; the number is kept here by node, as
+// node_s is shared with the library, and goes to the copies of the node.
+// A site has two counters: the times it is reached, and the times its then
+// arm or its body runs.
+// With -fprofile-generate, passe_2 marks where they are counted with a
+// comment, and the marks become increments of words in a data area added
+// after the data section. At the exit, the program writes that area to
+// PROFILE_FILE with the file syscalls: the number of sites, a checksum of
+// their kinds and lines, then the counters.
+// With -fprofile-use, the file is read back when it matches the program.
+// The counts then replace the static guesses: unroll leaves alone the
+// loops run less often than they would be unrolled, and the branch of each
+// if gets its probability, which layout and if-convert look up by label.
+
+// permille of the times a branch is taken
+#define PERMILLE 1000
+
+typedef struct _site_entry_s {
+    node_t node;            // NULL for a free slot
+    int32_t site;           // -1 once the node is freed
+} site_entry_s;
+
+typedef struct _branch_profile_s {
+    int32_t label;
+    int32_t taken;
+} branch_profile_s;
+
+static site_entry_s * table = NULL;     // open addressing, a power of 2 slots
+static int32_t table_size = 0;
+static int32_t table_used = 0;
+
+static int32_t num_sites = 0;
+static uint32_t checksum = 0;
+static int64_t * counts = NULL;         // two per site, NULL without a profile
+
+static branch_profile_s * branches = NULL;
+static int32_t num_branches = 0;
+static int32_t capacity = 0;
+
+
+// sites
+static uint32_t hash_node(node_t n) {
+    return (uint32_t)(((uintptr_t)n >> 4) * 2654435761u);
+}
+
+// the slot of n, or the free one where it goes
+static site_entry_s * find_slot(node_t n) {
+    uint32_t mask = table_size - 1;
+    uint32_t i = hash_node(n) & mask;
+
+    while (table[i].node != NULL && table[i].node != n) {
+        i = (i + 1) & mask;
+    }
+    return &table[i];
+}
+
+static void set_site(node_t n, int32_t site) {
+    site_entry_s * e;
+
+    if (2 * (table_used + 1) > table_size) {
+        site_entry_s * old = table;
+        int32_t old_size = table_size;
+
+        table_size = table_size ? 2 * table_size : 64;
+        table = calloc(table_size, sizeof(site_entry_s));
+        for (int32_t i = 0; i < old_size; i++) {
+            if (old[i].node != NULL) {
+                *find_slot(old[i].node) = old[i];
+            }
+        }
+        free(old);
+    }
+    e = find_slot(n);
+    if (e->node == NULL) {
+        e->node = n;
+        table_used++;
+    }
+    e->site = site;
+}
+
+// the site of an if or a loop, -1 for any other node
+int32_t profile_site(node_t n) {
+    site_entry_s * e;
+
+    if (table_used == 0 || n == NULL) {
+        return -1;
+    }
+    e = find_slot(n);
+    return (e->node != NULL) ? e->site : -1;
+}
+
+// c is a copy of n
+void copy_profile_site(node_t n, node_t c) {
+    int32_t site = profile_site(n);
+
+    if (site >= 0) {
+        set_site(c, site);
+    }
+}
+
+// n is freed, another node may get its address
+void drop_profile_site(node_t n) {
+    if (profile_site(n) >= 0) {
+        set_site(n, -1);
+    }
+}
+
+static void number_sites(node_t n) {
+    if (n == NULL) {
+        return;
+    }
+    if (n->nature == NODE_IF || is_loop(n)) {
+        set_site(n, num_sites++);
+        checksum = checksum * 31 + (uint32_t)n->nature;
+        checksum = checksum * 31 + (uint32_t)n->lineno;
+    }
+    for (int32_t i = 0; i < n->nops; i++) {
+        number_sites(n->opr[i]);
+    }
+}
+
+void number_profile_sites(node_t root) {
+    free(table);
+    table = NULL;
+    table_size = 0;
+    table_used = 0;
+    num_sites = 0;
+    checksum = 0;
+    number_sites(root);
+}
+
+
+// reading
+static uint32_t read_word(const uint8_t * p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// returns false when there is no profile for this program
+bool read_profile(void) {
+    FILE * f = fopen(PROFILE_FILE, "rb");
+    int32_t size = 8 + 8 * num_sites;
+    uint8_t * words;
+    bool ok;
+
+    if (f == NULL) {
+        fprintf(stderr, "Warning: no profile in %s, -fprofile-use ignored\n", PROFILE_FILE);
+        return false;
+    }
+    words = malloc(size + 1);
+    ok = (int32_t)fread(words, 1, size + 1, f) == size
+        && read_word(words) == (uint32_t)num_sites && read_word(words + 4) == checksum;
+    fclose(f);
+    if (!ok) {
+        fprintf(stderr, "Warning: %s was written by another program, -fprofile-use ignored\n", PROFILE_FILE);
+        free(words);
+        return false;
+    }
+
+    counts = malloc((2 * num_sites + 1) * sizeof(int64_t));
+    for (int32_t i = 0; i < 2 * num_sites; i++) {
+        counts[i] = read_word(words + 8 + 4 * i);
+    }
+    free(words);
+    printf_level(2, "profile: %d sites read from %s\n", num_sites, PROFILE_FILE);
+    return true;
+}
+
+// times the site of n was reached and its arm or body run
+bool get_profile(node_t n, int64_t * entries, int64_t * arm) {
+    int32_t site;
+
+    if (counts == NULL) {
+        return false;
+    }
+    site = profile_site(n);
+    if (site < 0 || site >= num_sites) {
+        return false;
+    }
+    *entries = counts[2 * site];
+    *arm = counts[2 * site + 1];
+    return true;
+}
+
+
+// branches
+// the branch to label skips the then arm of the if n
+void set_branch_profile(int32_t label, node_t n) {
+    int64_t entries, arm;
+
+    if (!get_profile(n, &entries, &arm) || entries == 0) {
+        return;
+    }
+    if (num_branches == capacity) {
+        capacity = capacity ? 2 * capacity : 16;
+        branches = realloc(branches, capacity * sizeof(branch_profile_s));
+    }
+    branches[num_branches].label = label;
+    branches[num_branches].taken = (int32_t)((entries - arm) * PERMILLE / entries);
+    num_branches++;
+}
+
+// permille of the times a branch to the label is taken, -1 when unknown
+int32_t get_branch_profile(const char * label) {
+    if (label == NULL || strncmp(label, "_L", 2) != 0) {
+        return -1;
+    }
+    for (int32_t i = 0; i < num_branches; i++) {
+        if (branches[i].label == atoi(label + 2)) {
+            return branches[i].taken;
+        }
+    }
+    return -1;
+}
+
+
+// instrumentation
+static void load_value(asm_prog_s * prog, int32_t * pos, int32_t reg, int32_t value) {
+    *pos += asm_insert(prog, *pos, "lui $%d, 0x%x", reg, ((uint32_t)value >> 16) & 0xFFFF);
+    *pos += asm_insert(prog, *pos, "ori $%d, $%d, 0x%x", reg, reg, (uint32_t)value & 0xFFFF);
+}
+
+// "# profile <site> entry|arm", or -1
+static int32_t counter_mark(asm_line_s * l) {
+    const char * s = (l->kind == ASM_LINE_TEXT) ? strstr(l->text, "# profile ") : NULL;
+    int32_t site;
+    char kind[8];
+
+    if (s == NULL || sscanf(s, "# profile %d %7s", &site, kind) != 2 || site < 0 || site >= num_sites) {
+        return -1;
+    }
+    return 2 * site + (strcmp(kind, "arm") == 0);
+}
+
+// between the statements, where the marks are, $2 and $4 hold nothing; as
+// for a syscall, buffer-output may clobber them in between
+static int32_t add_increments(asm_prog_s * prog, int32_t area) {
+    int32_t num = 0;
+
+    for (int32_t i = 0; i < prog->size; i++) {
+        int32_t counter = counter_mark(&prog->lines[i]);
+        int32_t addr = area + 8 + 4 * counter;
+        int32_t pos = i;
+
+        if (counter < 0) {
+            continue;
+        }
+        asm_remove(prog, i);
+        pos += asm_insert(prog, pos, "lui $4, 0x%x", ((uint32_t)(addr + 0x8000) >> 16) & 0xFFFF);
+        pos += asm_insert(prog, pos, "lw $2, %d($4)", (int16_t)(addr & 0xFFFF));
+        pos += asm_insert(prog, pos, "addiu $2, $2, 1");
+        pos += asm_insert(prog, pos, "sw $2, %d($4)", (int16_t)(addr & 0xFFFF));
+        i = pos - 1;
+        num++;
+    }
+    return num;
+}
+
+// writes the area to the file before the exit
+static bool add_dump(asm_prog_s * prog, int32_t area, int32_t file) {
+    for (int32_t i = 1; i < prog->size; i++) {
+        asm_line_s * l = &prog->lines[i - 1];
+        int32_t pos = i - 1;
+
+        if (!asm_is_inst(&prog->lines[i], "syscall") || !asm_is_inst(l, "ori") || l->args[0].reg != 2
+            || l->args[2].kind != ASM_ARG_IMM || l->args[2].imm != 10) {
+            continue;
+        }
+        load_value(prog, &pos, 4, file);
+        pos += asm_insert(prog, pos, "ori $5, $0, 1");
+        pos += asm_insert(prog, pos, "ori $6, $0, 0");
+        pos += asm_insert(prog, pos, "ori $2, $0, 13");
+        pos += asm_insert(prog, pos, "syscall");
+        pos += asm_insert(prog, pos, "bltz $2, _prof_done");
+        pos += asm_insert(prog, pos, "addu $4, $2, $0");
+        load_value(prog, &pos, 5, area);
+        load_value(prog, &pos, 6, 8 + 8 * num_sites);
+        pos += asm_insert(prog, pos, "ori $2, $0, 15");
+        pos += asm_insert(prog, pos, "syscall");
+        pos += asm_insert(prog, pos, "ori $2, $0, 16");
+        pos += asm_insert(prog, pos, "syscall");
+        pos += asm_insert(prog, pos, "_prof_done:");
+        return true;
+    }
+    return false;
+}
+
+bool instrument_asm(asm_prog_s * prog) {
+    int32_t area = get_data_sec_start_addr() + ((asm_data_size(prog) + 3) & ~3);
+    int32_t file = area + 8 + 8 * num_sites;
+    int32_t num, pos;
+
+    if (asm_find_directive(prog, ".text") < 0 || !add_dump(prog, area, file)) {
+        printf_level(2, "profile-generate: no exit, not instrumented\n");
+        return false;
+    }
+    num = add_increments(prog, area);
+
+    pos = asm_data_end(prog);
+    pos += asm_insert(prog, pos, ".align 2");
+    pos += asm_insert(prog, pos, "_prof: .word %d, %d", num_sites, (int32_t)checksum);
+    if (num_sites > 0) {
+        pos += asm_insert(prog, pos, "_prof_counts: .space %d", 8 * num_sites);
+    }
+    pos += asm_insert(prog, pos, "_prof_file: .asciiz \"%s\"", PROFILE_FILE);
+
+    printf_level(2, "profile-generate: %d sites, %d counters incremented, written to %s\n",
+                 num_sites, num, PROFILE_FILE);
+    return true;
+}
@@ -0,0 +1,332 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "arch.h"
+#include "optim.h"
+#include "asm.h"
+#include "report.h"
+
+extern char * infile;
+
+
+// Static cost report.
+// With -a, passe_2 marks the code of each statement with its source line
+// and the times it is expected to run: once at the top level, times the
+// trip count in the body of a loop, times the share of its arm in an if.
+// The trip count is the one of the profile with -fprofile-use, the
+// constant one of a counted loop, else LOOP_TRIPS; without a profile, each
+// arm of an if runs half of the times. asm_read leaves the marks out of the
+// program and gives them to the instructions that follow, which keep them
+// through the assembly passes. The code the optimisations make goes to the
+// line of the operands it was built from, or of the statement before it.
+// Once the assembly passes are done, an instruction costs one cycle, the
+// stalls of an in-order pipeline with the latencies of -mtune on the
+// previous instructions of its block, and the branch penalty when it is
+// taken: always for a jump, when it goes backward or as in the profile for
+// a branch. The cycles of a line are the ones of its instructions times the
+// times they run. The source is listed on stderr with them, followed by
+// the hottest lines. Nothing is run.
+
+bool report_costs = false;
+
+// trip count of a loop without a profile or a constant one
+#define LOOP_TRIPS 10
+
+// lines in the summary
+#define TOP_LINES 10
+
+#define REG(r) ((asm_regs)1 << (r))
+
+typedef struct _line_mark_s {
+    int32_t lineno;
+    double weight;
+} line_mark_s;
+
+typedef struct _line_cost_s {
+    int32_t lineno;
+    double runs;            // times the code of the line runs, the most of its marks
+    double cycles;
+    int32_t insts;
+    int32_t divs;           // div and divu
+    int32_t muls;           // mult, multu and mul
+    int32_t stack;          // loads and stores off $29
+    int32_t global;         // other loads and stores
+} line_cost_s;
+
+static line_mark_s * marks = NULL;
+static int32_t num_marks = 0;
+static int32_t capacity = 0;
+
+
+// weights, from passe_2
+// times the body of the loop runs each time the loop is reached
+double loop_trips(node_t loop) {
+    counted_loop_s cl;
+    int64_t entries, arm;
+    int32_t count, last;
+
+    if (get_profile(loop, &entries, &arm)) {
+        return (entries > 0) ? (double)arm / entries : 0.0;
+    }
+    if (loop->nature == NODE_FOR && match_counted_loop(loop, &cl) && counted_trip_count(loop, &cl, &count, &last)) {
+        return count;
+    }
+    return LOOP_TRIPS;
+}
+
+// part of the times the if n is reached where its then arm runs
+double arm_share(node_t n) {
+    int64_t entries, arm;
+
+    if (get_profile(n, &entries, &arm)) {
+        return (entries > 0) ? (double)arm / entries : 0.0;
+    }
+    return 0.5;
+}
+
+// a "# line <lineno> <weight>" comment read back by asm_read, returns the
+// mark of the instructions that follow
+int32_t report_mark(int32_t lineno, double weight) {
+    if (num_marks == capacity) {
+        capacity = capacity ? 2 * capacity : 64;
+        marks = realloc(marks, capacity * sizeof(line_mark_s));
+    }
+    marks[num_marks].lineno = lineno;
+    marks[num_marks].weight = weight;
+    return ++num_marks;
+}
+
+
+// cost model
+// part of the times the transfer of control at i is taken
+static double taken(asm_prog_s * prog, int32_t i) {
+    asm_line_s * l = &prog->lines[i];
+    uint32_t flags = asm_op_flags(l);
+    int32_t profile, target;
+
+    if (flags & (ASM_OP_JUMP | ASM_OP_CALL)) {
+        return 1.0;
+    }
+    if (!(flags & ASM_OP_BRANCH)) {
+        return 0.0;
+    }
+    profile = get_branch_profile(asm_target(l));
+    if (profile >= 0) {
+        return profile / 1000.0;
+    }
+    target = asm_find_label(prog, asm_target(l));
+    return (target >= 0 && target < i) ? 1.0 : 0.0;
+}
+
+static void add_inst(line_cost_s * c, asm_line_s * l, double cycles, double weight) {
+    uint32_t flags = asm_op_flags(l);
+
+    c->cycles += cycles * weight;
+    if (weight > c->runs) {
+        c->runs = weight;
+    }
+    c->insts++;
+    c->divs += asm_is_inst(l, "div") || asm_is_inst(l, "divu");
+    c->muls += asm_is_inst(l, "mult") || asm_is_inst(l, "multu") || asm_is_inst(l, "mul");
+    if (flags & (ASM_OP_LOAD | ASM_OP_STORE)) {
+        for (int32_t k = 0; k < l->nargs; k++) {
+            if (l->args[k].kind == ASM_ARG_MEM) {
+                c->stack += (l->args[k].reg == get_stack_reg());
+                c->global += (l->args[k].reg != get_stack_reg());
+            }
+        }
+    }
+}
+
+// costs of the instructions by source line, the ones without a mark in
+// other (the runtime of buffer-output, and what -a does not know of)
+static void add_costs(asm_prog_s * prog, line_cost_s * costs, line_cost_s * other) {
+    int32_t ready[ASM_REG_LO + 1];
+    int32_t cycle = 0;
+
+    memset(ready, 0, sizeof(ready));
+    for (int32_t i = 0; i < prog->size; i++) {
+        asm_line_s * l = &prog->lines[i];
+        asm_regs uses, defs;
+        int32_t issue = cycle;
+        double cycles;
+
+        if (l->kind == ASM_LINE_LABEL) {
+            // unknown predecessors, the block starts afresh
+            memset(ready, 0, sizeof(ready));
+            cycle = 0;
+            continue;
+        }
+        if (l->kind != ASM_LINE_INST) {
+            continue;
+        }
+
+        uses = asm_uses(l);
+        defs = asm_defs(l);
+        for (int32_t r = 0; r <= ASM_REG_LO; r++) {
+            if ((uses & REG(r)) && ready[r] > issue) {
+                issue = ready[r];
+            }
+        }
+        for (int32_t r = 0; r <= ASM_REG_LO; r++) {
+            if (defs & REG(r)) {
+                ready[r] = issue + asm_latency(l);
+            }
+        }
+        cycles = 1 + (issue - cycle) + taken(prog, i) * get_branch_penalty();
+        cycle = issue + 1;
+
+        if (l->mark > 0 && l->mark <= num_marks) {
+            line_mark_s * m = &marks[l->mark - 1];
+            add_inst(&costs[m->lineno], l, cycles, m->weight);
+        } else {
+            add_inst(other, l, cycles, 1.0);
+        }
+    }
+}
+
+
+// report
+static int compare_cycles(const void * a, const void * b) {
+    const line_cost_s * x = a;
+    const line_cost_s * y = b;
+
+    if (x->cycles != y->cycles) {
+        return (x->cycles < y->cycles) ? 1 : -1;
+    }
+    return x->lineno - y->lineno;
+}
+
+static double percent(double part, double total) {
+    return (total > 0) ? 100.0 * part / total : 0.0;
+}
+
+// "div:N mul:N global:N stack:N", what makes the line expensive
+static void format_notes(line_cost_s * c, char * notes, int32_t size) {
+    int32_t n = 0;
+
+    notes[0] = '\0';
+    if (c->divs > 0) {
+        n += snprintf(notes + n, size - n, "div:%d ", c->divs);
+    }
+    if (c->muls > 0 && n < size) {
+        n += snprintf(notes + n, size - n, "mul:%d ", c->muls);
+    }
+    if (c->global > 0 && n < size) {
+        n += snprintf(notes + n, size - n, "global:%d ", c->global);
+    }
+    if (c->stack > 0 && n < size) {
+        n += snprintf(notes + n, size - n, "stack:%d ", c->stack);
+    }
+    if (n > 0 && n <= size) {
+        notes[n - 1] = '\0';
+    }
+}
+
+// lines of the source, from 1, NULL when it cannot be read
+static char ** read_source(int32_t * num) {
+    FILE * f = fopen(infile, "r");
+    char ** source = NULL;
+    char buf[1024];
+
+    *num = 1;
+    if (f == NULL) {
+        return NULL;
+    }
+    source = malloc(sizeof(char *));
+    source[0] = NULL;
+    while (fgets(buf, sizeof(buf), f) != NULL) {
+        buf[strcspn(buf, "\r\n")] = '\0';
+        source = realloc(source, (*num + 1) * sizeof(char *));
+        source[(*num)++] = strdupl(buf);
+    }
+    fclose(f);
+    return source;
+}
+
+// the source with the costs of its lines
+static void print_listing(line_cost_s * costs, int32_t num_lines, char ** source, int32_t num_source) {
+    char notes[64];
+
+    fprintf(stderr, "%6s %12s %12s %6s  %-28s | %s\n", "line", "runs", "cycles", "insts", "notes", "source");
+    for (int32_t k = 1; k < num_lines || k < num_source; k++) {
+        const char * text = (k < num_source) ? source[k] : "";
+
+        if (k < num_lines && costs[k].insts > 0) {
+            format_notes(&costs[k], notes, sizeof(notes));
+            fprintf(stderr, "%6d %12.1f %12.0f %6d  %-28s | %s\n", k, costs[k].runs, costs[k].cycles,
+                    costs[k].insts, notes, text);
+        } else {
+            fprintf(stderr, "%6d %12s %12s %6s  %-28s | %s\n", k, "", "", "", "", text);
+        }
+    }
+}
+
+// the lines that cost the most, with their source
+static void print_hottest(line_cost_s * costs, int32_t num_lines, char ** source, int32_t num_source,
+                          double total) {
+    line_cost_s * sorted = malloc(num_lines * sizeof(line_cost_s));
+
+    memcpy(sorted, costs, num_lines * sizeof(line_cost_s));
+    qsort(sorted, num_lines, sizeof(line_cost_s), compare_cycles);
+    fprintf(stderr, "hottest lines:\n");
+    for (int32_t i = 0; i < TOP_LINES && i < num_lines && sorted[i].cycles > 0; i++) {
+        line_cost_s * c = &sorted[i];
+        const char * text = (c->lineno < num_source) ? source[c->lineno] : "";
+
+        while (*text == ' ' || *text == '\t') {
+            text++;
+        }
+        fprintf(stderr, "  %2d. line %-5d %12.0f cycles %5.1f%%  %s\n", i + 1, c->lineno, c->cycles,
+                percent(c->cycles, total), text);
+    }
+    free(sorted);
+}
+
+void report_costs_asm(asm_prog_s * prog) {
+    line_cost_s other;
+    line_cost_s * costs;
+    int32_t num_lines = 1, num_source;
+    char ** source = read_source(&num_source);
+    double total = 0;
+
+    for (int32_t i = 0; i < num_marks; i++) {
+        if (marks[i].lineno >= num_lines) {
+            num_lines = marks[i].lineno + 1;
+        }
+    }
+    costs = calloc(num_lines, sizeof(line_cost_s));
+    for (int32_t k = 0; k < num_lines; k++) {
+        costs[k].lineno = k;
+    }
+    memset(&other, 0, sizeof(other));
+
+    add_costs(prog, costs, &other);
+    for (int32_t k = 0; k < num_lines; k++) {
+        total += costs[k].cycles;
+    }
+
+    fprintf(stderr, "cost report: %.0f cycles estimated on %s, loops of unknown trip count run %d times\n",
+            total, get_tune_name(), LOOP_TRIPS);
+    print_listing(costs, num_lines, source, num_source);
+    if (other.insts > 0) {
+        fprintf(stderr, "not attributed to a line: %d instructions, %.0f cycles each time they run\n",
+                other.insts, other.cycles);
+    }
+    print_hottest(costs, num_lines, source, num_source, total);
+
+    for (int32_t k = 1; k < num_source; k++) {
+        free(source[k]);
+    }
+    free(source);
+    free(costs);
+    free(marks);
+    marks = NULL;
+    num_marks = 0;
+    capacity = 0;
+}
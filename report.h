@@ -0,0 +1,18 @@
+
+#ifndef _REPORT_H_
+#define _REPORT_H_
+
+#include "defs.h"
+#include "asm.h"
+
+
+/* Static cost report, for -a */
+
+extern bool report_costs;
+
+double loop_trips(node_t loop);
+double arm_share(node_t n);
+int32_t report_mark(int32_t lineno, double weight);
+void report_costs_asm(asm_prog_s * prog);
+
+#endif
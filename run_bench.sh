@@ -0,0 +1,164 @@
+#!/bin/bash
+
+# Benchmark runner for MiniC compiler
+# Runs every kernel of Tests/Bench in the simulator of minicc (-x), for each
+# register budget and optimisation level, checks its output and compares
+# the dynamic instructions, the size of the text and the cycles with
+# Tests/Bench/baseline.txt
+
+MINICC="./minicc"
+BENCH_DIR="Tests/Bench"
+BASELINE="$BENCH_DIR/baseline.txt"
+REGS="4 5 6 7 8"
+LEVELS="0 1 2"
+
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+CYAN='\033[0;36m'
+NC='\033[0m'
+
+# Counters
+passed=0
+failed=0
+improved=0
+
+# Flags
+update=false
+threshold=2
+
+usage() {
+    echo "Usage: $0 [OPTIONS]"
+    echo ""
+    echo "Options:"
+    echo "  -t <int>  Regression threshold in percent (default: 2)"
+    echo "  -u        Write the current figures as the new baseline"
+    echo "  -h        Show this help"
+    echo ""
+    echo "Examples:"
+    echo "  $0             # Fail on a metric more than 2% above its baseline"
+    echo "  $0 -t 0        # Fail on any regression"
+    echo "  $0 -u          # Accept the current figures"
+    exit 0
+}
+
+# Parse arguments
+while getopts "t:uh" opt; do
+    case $opt in
+        t) threshold=$OPTARG ;;
+        u) update=true ;;
+        h) usage ;;
+        *) usage ;;
+    esac
+done
+
+if ! [[ "$threshold" =~ ^[0-9]+$ ]]; then
+    echo "Error: the threshold must be a whole number of percent"
+    exit 1
+fi
+
+if [ ! -x "$MINICC" ]; then
+    echo "Error: $MINICC not found, run make first"
+    exit 1
+fi
+
+new_baseline=$(mktemp)
+echo "# kernel regs level instructions size cycles" > "$new_baseline"
+
+# checks one metric against the baseline, returns 1 on a regression
+check_metric() {
+    local what=$1 base=$2 now=$3
+    if [ $((now * 100)) -gt $((base * (100 + threshold))) ]; then
+        echo -e "    ${RED}$what $base -> $now${NC}"
+        return 1
+    fi
+    if [ "$now" -lt "$base" ]; then
+        echo -e "    ${GREEN}$what $base -> $now${NC}"
+        ((improved++))
+    fi
+    return 0
+}
+
+echo -e "${CYAN}=========================================="
+echo "BENCHMARKS (-r $REGS / -O $LEVELS)"
+echo "==========================================${NC}"
+
+for kernel in $BENCH_DIR/*.c; do
+    [ -f "$kernel" ] || continue
+    name=$(basename "$kernel" .c)
+    expected="$BENCH_DIR/$name.out"
+    ok=true
+
+    echo ""
+    echo "--- $name ---"
+    for regs in $REGS; do
+        for level in $LEVELS; do
+            config="-r $regs -O $level"
+            if ! $MINICC -r $regs -O $level -o /tmp/bench.s "$kernel" 2>/dev/null; then
+                echo -e "${RED}[FAIL]${NC} $name $config - compilation failed"
+                ok=false
+                continue
+            fi
+            if ! $MINICC -x /tmp/bench.s > /tmp/bench.txt 2> /tmp/bench.stats; then
+                echo -e "${RED}[FAIL]${NC} $name $config - runtime error"
+                ok=false
+                continue
+            fi
+            if ! diff -q "$expected" /tmp/bench.txt >/dev/null 2>&1; then
+                echo -e "${RED}[FAIL]${NC} $name $config - output differs from $name.out"
+                ok=false
+                continue
+            fi
+
+            instructions=$(sed -n 's/^simulation: exit after \([0-9]*\) instructions, \([0-9]*\) in the text$/\1/p' /tmp/bench.stats)
+            size=$(sed -n 's/^simulation: exit after \([0-9]*\) instructions, \([0-9]*\) in the text$/\2/p' /tmp/bench.stats)
+            cycles=$(sed -n 's/^cycles: \([0-9]*\) .*/\1/p' /tmp/bench.stats)
+            echo "$name $regs $level $instructions $size $cycles" >> "$new_baseline"
+            if $update; then
+                continue
+            fi
+
+            base=$(grep "^$name $regs $level " "$BASELINE" 2>/dev/null)
+            if [ -z "$base" ]; then
+                echo -e "${RED}[FAIL]${NC} $name $config - no baseline, run $0 -u"
+                ok=false
+                continue
+            fi
+            read -r _ _ _ base_instructions base_size base_cycles <<< "$base"
+            metrics_ok=true
+            check_metric "$config instructions" "$base_instructions" "$instructions" || metrics_ok=false
+            check_metric "$config size" "$base_size" "$size" || metrics_ok=false
+            check_metric "$config cycles" "$base_cycles" "$cycles" || metrics_ok=false
+            if ! $metrics_ok; then
+                echo -e "${RED}[FAIL]${NC} $name $config - regression past $threshold%"
+                ok=false
+            fi
+        done
+    done
+
+    if $ok; then
+        echo -e "${GREEN}[PASS]${NC} $name"
+        ((passed++))
+    else
+        ((failed++))
+    fi
+done
+
+if $update && [ $failed -eq 0 ]; then
+    mv "$new_baseline" "$BASELINE"
+    echo ""
+    echo "Baseline written to $BASELINE"
+else
+    rm -f "$new_baseline"
+fi
+
+echo ""
+echo -e "${CYAN}=========================================="
+echo "TOTAL RESULTS"
+echo "==========================================${NC}"
+echo -e "Total: ${GREEN}$passed passed${NC}, ${RED}$failed failed${NC}, $improved metrics improved"
+
+if [ $failed -gt 0 ]; then
+    exit 1
+fi
+exit 0
@@ -1,7 +1,7 @@
 #!/bin/bash
 
 # Test runner for MiniC compiler
-# Supports: Syntaxe, Verif, and Gencode tests
+# Supports: Syntaxe, Verif, Gencode and Optim tests
 
 MINICC="./minicc"
 MINICC_REF="./minicc_ref"
@@ -20,6 +20,7 @@ failed=0
 run_syntaxe=false
 run_verif=false
 run_gencode=false
+run_optim=false
 
 usage() {
     echo "Usage: $0 [OPTIONS]"
@@ -28,6 +29,7 @@ usage() {
     echo "  -s    Run Syntaxe tests"
     echo "  -v    Run Verif tests"
     echo "  -g    Run Gencode tests"
+    echo "  -O    Run Optim tests"
     echo "  -a    Run all tests"
     echo "  -h    Show this help"
     echo ""
@@ -39,19 +41,20 @@ usage() {
 }
 
 # Parse arguments
-while getopts "svgah" opt; do
+while getopts "svgOah" opt; do
     case $opt in
         s) run_syntaxe=true ;;
         v) run_verif=true ;;
         g) run_gencode=true ;;
-        a) run_syntaxe=true; run_verif=true; run_gencode=true ;;
+        O) run_optim=true ;;
+        a) run_syntaxe=true; run_verif=true; run_gencode=true; run_optim=true ;;
         h) usage ;;
         *) usage ;;
     esac
 done
 
 # If no flags provided, show usage
-if ! $run_syntaxe && ! $run_verif && ! $run_gencode; then
+if ! $run_syntaxe && ! $run_verif && ! $run_gencode && ! $run_optim; then
     echo "Error: No test category specified"
     echo ""
     usage
@@ -222,12 +225,15 @@ run_gencode_tests() {
         $MINICC -o /tmp/out.s "$test_file" 2>/dev/null
         status=$?
 
-        if [ $status -eq 0 ]; then
-            echo -e "${GREEN}[PASS]${NC} $name - compiles (runtime error expected)"
-            ((gencode_passed++))
-        else
+        if [ $status -ne 0 ]; then
             echo -e "${RED}[FAIL]${NC} $name - should compile"
             ((gencode_failed++))
+        elif $MINICC -x /tmp/out.s >/dev/null 2>&1; then
+            echo -e "${RED}[FAIL]${NC} $name - runs without the runtime error"
+            ((gencode_failed++))
+        else
+            echo -e "${GREEN}[PASS]${NC} $name - compiles, runtime error"
+            ((gencode_passed++))
         fi
     done
 
@@ -237,6 +243,120 @@ run_gencode_tests() {
     ((failed += gencode_failed))
 }
 
+###########################################
+# OPTIM TESTS
+###########################################
+run_optim_tests() {
+    local optim_passed=0
+    local optim_failed=0
+
+    echo -e "${CYAN}=========================================="
+    echo "OPTIM TESTS (-O1 / -O2)"
+    echo "==========================================${NC}"
+
+    echo ""
+    echo "--- Optim (should compile at every level, same output) ---"
+    for test_file in Tests/Optim/*.c; do
+        [ -f "$test_file" ] || continue
+        name=$(basename "$test_file" .c)
+
+        ok=true
+        for level in 0 1 2; do
+            if ! $MINICC -O $level -o /tmp/out_O$level.s "$test_file" 2>/dev/null; then
+                echo -e "${RED}[FAIL]${NC} $name - compilation failed at -O$level"
+                ok=false
+                break
+            fi
+        done
+        if $ok && ! $MINICC -O 2 -f peval -o /tmp/out_peval.s "$test_file" 2>/dev/null; then
+            echo -e "${RED}[FAIL]${NC} $name - compilation failed with -fpeval"
+            ok=false
+        fi
+        if $ok && ! $MINICC -O 2 -f buffer-output -o /tmp/out_buffer.s "$test_file" 2>/dev/null; then
+            echo -e "${RED}[FAIL]${NC} $name - compilation failed with -fbuffer-output"
+            ok=false
+        fi
+        # the instructions of mips32 and mips32r2, selected by isel and if-convert
+        for isa in mips32 mips32r2; do
+            if $ok && ! $MINICC -O 2 -march=$isa -o /tmp/out_$isa.s "$test_file" 2>/dev/null; then
+                echo -e "${RED}[FAIL]${NC} $name - compilation failed with -march=$isa"
+                ok=false
+            fi
+        done
+        if $ok && ! $MINICC -O 2 -f delay-slots -o /tmp/out_delay.s "$test_file" 2>/dev/null; then
+            echo -e "${RED}[FAIL]${NC} $name - compilation failed with -fdelay-slots"
+            ok=false
+        fi
+        # the latencies of the other cores, for another order of schedule
+        for core in r4000 24k; do
+            if $ok && ! $MINICC -O 2 -mtune=$core -o /tmp/out_$core.s "$test_file" 2>/dev/null; then
+                echo -e "${RED}[FAIL]${NC} $name - compilation failed with -mtune=$core"
+                ok=false
+            fi
+        done
+        if $ok && ! $MINICC -O 2 -a -o /tmp/out_annotate.s "$test_file" 2>/dev/null; then
+            echo -e "${RED}[FAIL]${NC} $name - compilation failed with -a"
+            ok=false
+        fi
+        if $ok && ! $MINICC -r 4 -f stats -o /tmp/out_stats.s "$test_file" 2>/dev/null; then
+            echo -e "${RED}[FAIL]${NC} $name - compilation failed with -fstats"
+            ok=false
+        fi
+        if $ok && ! $MINICC -O 2 -f profile-generate -o /tmp/out_gen.s "$test_file" 2>/dev/null; then
+            echo -e "${RED}[FAIL]${NC} $name - compilation failed with -fprofile-generate"
+            ok=false
+        fi
+        # the instrumented run writes minicc.prof, read back by -fprofile-use
+        if $ok; then
+            rm -f minicc.prof
+            $MINICC -x /tmp/out_gen.s > /dev/null 2>&1
+            if ! $MINICC -O 2 -f profile-use -o /tmp/out_use.s "$test_file" 2>/dev/null; then
+                echo -e "${RED}[FAIL]${NC} $name - compilation failed with -fprofile-use"
+                ok=false
+            fi
+        fi
+        # every version prints the same as -O0 in the simulator
+        if $ok; then
+            $MINICC -x /tmp/out_O0.s > /tmp/run_O0.txt 2>/dev/null
+            for out in O1 O2 peval buffer mips32 mips32r2 delay r4000 24k annotate stats gen use; do
+                # the code of -fdelay-slots only runs right when the simulator
+                # runs the slots too
+                sim_flags=""
+                if [ "$out" = "delay" ]; then
+                    sim_flags="-f delay-slots"
+                fi
+                $MINICC -x $sim_flags /tmp/out_$out.s > /tmp/run_$out.txt 2>/dev/null
+                if ! diff -q /tmp/run_O0.txt /tmp/run_$out.txt >/dev/null 2>&1; then
+                    echo -e "${RED}[FAIL]${NC} $name - output of $out differs from -O0"
+                    ok=false
+                    break
+                fi
+            done
+            # -mtune only changes the order of the instructions, and the cycles
+            # of the simulator: the program prints the same as for the default core
+            for core in r4000 24k; do
+                if $ok && ! diff -q /tmp/run_O2.txt /tmp/run_$core.txt >/dev/null 2>&1; then
+                    echo -e "${RED}[FAIL]${NC} $name - output of -mtune=$core differs from the default core"
+                    ok=false
+                fi
+            done
+            rm -f minicc.prof
+        fi
+
+        if $ok; then
+            echo -e "${GREEN}[PASS]${NC} $name"
+            ((optim_passed++))
+        else
+            ((optim_failed++))
+        fi
+    done
+
+    echo ""
+    echo -e "Optim: ${GREEN}$optim_passed passed${NC}, ${RED}$optim_failed failed${NC}"
+    ((passed += optim_passed))
+    ((failed += optim_failed))
+}
+
 ###########################################
 # MAIN
 ###########################################
@@ -256,6 +376,11 @@ if $run_gencode; then
     echo ""
 fi
 
+if $run_optim; then
+    run_optim_tests
+    echo ""
+fi
+
 echo -e "${CYAN}=========================================="
 echo "TOTAL RESULTS"
 echo "==========================================${NC}"
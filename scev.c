@@ -0,0 +1,813 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "optim.h"
+
+
+// Scalar evolution: closed-form replacement of reduction loops.
+// A loop whose body only assigns integer variables (no print, no branch, no
+// inner loop, no division) is evaluated symbolically over one iteration.
+// Every variable that ends the iteration as "itself + delta" gets a chain of
+// recurrences {a0, +, a1, +, a2, +, a3}: its value after n iterations is
+//     a0 + a1 * C(n, 1) + a2 * C(n, 2) + a3 * C(n, 3)
+// The loop counter must be affine with a constant step, which gives the trip
+// count N. The loop is then replaced by the exit values, computed with the
+// same 32-bit wraparound as the loop itself. A runtime guard keeps the
+// original loop whenever the trip count computation could overflow.
+
+#define MAX_DEGREE 3
+#define MAX_SYMBOLIC_SIZE 256
+
+// C(N, 3) = C(N, 2) * (N - 2) / 3, the division being exact: multiply by
+// the inverse of 3 modulo 2^32
+#define INVERSE_OF_3 ((int32_t)0xAAAAAAAB)
+
+typedef struct _cr_s {
+    node_t coef[MAX_DEGREE + 1];   // NULL stands for 0
+} cr_s;
+
+typedef enum _cr_state_e {
+    CR_TODO,
+    CR_IN_PROGRESS,
+    CR_DONE,
+    CR_NONE,        // no recurrence: local to the body or constant after one iteration
+    CR_FAILED,
+} cr_state_e;
+
+typedef struct _scev_ctx_s {
+    decl_set_s vars;       // variables written by the loop
+    decl_set_s locals;     // variables declared inside the body
+    node_t * value;        // symbolic value at the current point of the iteration
+    cr_state_e * state;
+    cr_s * cr;
+    bool failed;
+} scev_ctx_s;
+
+
+static int32_t var_index(scev_ctx_s * ctx, node_t decl) {
+    for (int32_t i = 0; i < ctx->vars.size; i++) {
+        if (ctx->vars.decls[i] == decl) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static node_t make_binop(node_nature nature, node_t l, node_t r) {
+    node_t n = make_node(nature, 2, l, r);
+    n->type = (nature == NODE_LT || nature == NODE_LE || nature == NODE_GT
+               || nature == NODE_GE || nature == NODE_AND) ? TYPE_BOOL : TYPE_INT;
+    n->lineno = l->lineno;
+    return n;
+}
+
+static node_t make_affect(node_t decl, node_t value) {
+    node_t n = make_node(NODE_AFFECT, 2, make_ref(decl), value);
+    n->type = decl->type;
+    n->lineno = value->lineno;
+    return n;
+}
+
+static node_t append(node_t list, node_t elem) {
+    return list == NULL ? elem : list_append(list, elem);
+}
+
+
+// coefficient arithmetic, folding constants with 32-bit wraparound
+static bool is_const(node_t c, int32_t * v) {
+    if (c == NULL) {
+        *v = 0;
+        return true;
+    }
+    if (c->nature == NODE_INTVAL) {
+        *v = (int32_t)c->value;
+        return true;
+    }
+    return false;
+}
+
+static node_t coef_add(node_t a, node_t b, bool sub) {
+    int32_t va, vb;
+
+    if (is_const(a, &va) && is_const(b, &vb)) {
+        int32_t r = (int32_t)(sub ? (uint32_t)va - (uint32_t)vb : (uint32_t)va + (uint32_t)vb);
+        return r == 0 ? NULL : make_int(r);
+    }
+    if (is_const(b, &vb) && vb == 0) {
+        return copy_tree(a);
+    }
+    if (is_const(a, &va) && va == 0) {
+        if (!sub) {
+            return copy_tree(b);
+        }
+        node_t n = make_node(NODE_UMINUS, 1, copy_tree(b));
+        n->type = TYPE_INT;
+        n->lineno = b->lineno;
+        return n;
+    }
+    return make_binop(sub ? NODE_MINUS : NODE_PLUS, copy_tree(a), copy_tree(b));
+}
+
+static node_t coef_mul(node_t a, node_t b) {
+    int32_t va, vb;
+
+    if (is_const(a, &va) && is_const(b, &vb)) {
+        int32_t r = (int32_t)((uint32_t)va * (uint32_t)vb);
+        return r == 0 ? NULL : make_int(r);
+    }
+    if ((is_const(a, &va) && va == 0) || (is_const(b, &vb) && vb == 0)) {
+        return NULL;
+    }
+    if (is_const(a, &va) && va == 1) {
+        return copy_tree(b);
+    }
+    if (is_const(b, &vb) && vb == 1) {
+        return copy_tree(a);
+    }
+    return make_binop(NODE_MUL, copy_tree(a), copy_tree(b));
+}
+
+static void cr_free(cr_s * cr) {
+    for (int32_t k = 0; k <= MAX_DEGREE; k++) {
+        free_nodes(cr->coef[k]);
+        cr->coef[k] = NULL;
+    }
+}
+
+static int32_t cr_degree(cr_s * cr) {
+    for (int32_t k = MAX_DEGREE; k > 0; k--) {
+        if (cr->coef[k] != NULL) {
+            return k;
+        }
+    }
+    return 0;
+}
+
+static void cr_copy(cr_s * dst, cr_s * src) {
+    for (int32_t k = 0; k <= MAX_DEGREE; k++) {
+        dst->coef[k] = copy_tree(src->coef[k]);
+    }
+}
+
+
+// symbolic evaluation of one iteration
+static bool uses_vars(scev_ctx_s * ctx, node_t e) {
+    return uses_any(e, &ctx->vars);
+}
+
+// copy of e where every loop variable is replaced by its current symbolic value
+static node_t subst(scev_ctx_s * ctx, node_t e) {
+    if (e == NULL) {
+        return NULL;
+    }
+    if (e->nature == NODE_IDENT) {
+        int32_t i = var_index(ctx, e->decl_node);
+        if (i >= 0) {
+            return copy_tree(ctx->value[i]);
+        }
+        return copy_tree(e);
+    }
+
+    node_t c = copy_tree(e);
+    for (int32_t i = 0; i < c->nops; i++) {
+        free_nodes(c->opr[i]);
+        c->opr[i] = subst(ctx, e->opr[i]);
+    }
+    return c;
+}
+
+static void assign(scev_ctx_s * ctx, node_t decl, node_t rhs) {
+    int32_t i = var_index(ctx, decl);
+    node_t value = subst(ctx, rhs);
+
+    free_nodes(ctx->value[i]);
+    ctx->value[i] = value;
+    if (count_nodes(value) > MAX_SYMBOLIC_SIZE || decl->type != TYPE_INT) {
+        ctx->failed = true;
+    }
+}
+
+static void sym_eval_decls(scev_ctx_s * ctx, node_t decls) {
+    if (decls == NULL) {
+        return;
+    }
+    if (decls->nature == NODE_DECL) {
+        decl_set_add(&ctx->locals, decls->opr[0]);
+        if (decls->nops > 1 && decls->opr[1] != NULL) {
+            assign(ctx, decls->opr[0], decls->opr[1]);
+        }
+        return;
+    }
+    for (int32_t i = 0; i < decls->nops; i++) {
+        sym_eval_decls(ctx, decls->opr[i]);
+    }
+}
+
+static void sym_eval_instr(scev_ctx_s * ctx, node_t instr) {
+    if (instr == NULL || ctx->failed) {
+        return;
+    }
+
+    switch (instr->nature) {
+        case NODE_LIST:
+            sym_eval_instr(ctx, instr->opr[0]);
+            sym_eval_instr(ctx, instr->opr[1]);
+            break;
+
+        case NODE_BLOCK:
+            sym_eval_decls(ctx, instr->opr[0]);
+            sym_eval_instr(ctx, instr->opr[1]);
+            break;
+
+        case NODE_AFFECT:
+            if (has_side_effect(instr->opr[1])) {
+                ctx->failed = true;
+                return;
+            }
+            assign(ctx, instr->opr[0]->decl_node, instr->opr[1]);
+            break;
+
+        case NODE_IF:
+        case NODE_WHILE:
+        case NODE_FOR:
+        case NODE_DOWHILE:
+        case NODE_PRINT:
+            ctx->failed = true;
+            break;
+
+        default:
+            // a pure expression statement has no effect
+            break;
+    }
+}
+
+
+// chains of recurrences
+static bool cr_of_var(scev_ctx_s * ctx, int32_t i, cr_s * out);
+
+static bool cr_of_expr(scev_ctx_s * ctx, node_t e, cr_s * out) {
+    cr_s a = { { NULL } }, b = { { NULL } };
+    bool ok = true;
+    int32_t k;
+
+    if (!uses_vars(ctx, e)) {
+        // invariant: constant chain
+        out->coef[0] = (e->nature == NODE_INTVAL && e->value == 0) ? NULL : copy_tree(e);
+        return true;
+    }
+
+    switch (e->nature) {
+        case NODE_IDENT: {
+            int32_t i = var_index(ctx, e->decl_node);
+            if (!cr_of_var(ctx, i, &a)) {
+                return false;
+            }
+            cr_copy(out, &a);
+            return true;
+        }
+
+        case NODE_PLUS:
+        case NODE_MINUS:
+            if (!cr_of_expr(ctx, e->opr[0], &a) || !cr_of_expr(ctx, e->opr[1], &b)) {
+                ok = false;
+                break;
+            }
+            for (k = 0; k <= MAX_DEGREE; k++) {
+                out->coef[k] = coef_add(a.coef[k], b.coef[k], e->nature == NODE_MINUS);
+            }
+            break;
+
+        case NODE_UMINUS:
+            if (!cr_of_expr(ctx, e->opr[0], &a)) {
+                ok = false;
+                break;
+            }
+            for (k = 0; k <= MAX_DEGREE; k++) {
+                out->coef[k] = coef_add(NULL, a.coef[k], true);
+            }
+            break;
+
+        case NODE_MUL:
+            if (!cr_of_expr(ctx, e->opr[0], &a) || !cr_of_expr(ctx, e->opr[1], &b)) {
+                ok = false;
+                break;
+            }
+            if (cr_degree(&b) == 0 || cr_degree(&a) == 0) {
+                cr_s * v = cr_degree(&b) == 0 ? &a : &b;
+                node_t s = cr_degree(&b) == 0 ? b.coef[0] : a.coef[0];
+                for (k = 0; k <= MAX_DEGREE; k++) {
+                    out->coef[k] = coef_mul(v->coef[k], s);
+                }
+            } else if (cr_degree(&a) == 1 && cr_degree(&b) == 1) {
+                // {a0,+,a1} * {b0,+,b1} = {a0b0, +, a0b1 + a1b0 + a1b1, +, 2a1b1}
+                node_t a0b1 = coef_mul(a.coef[0], b.coef[1]);
+                node_t a1b0 = coef_mul(a.coef[1], b.coef[0]);
+                node_t a1b1 = coef_mul(a.coef[1], b.coef[1]);
+                node_t sum = coef_add(a0b1, a1b0, false);
+                node_t two = make_int(2);
+                out->coef[0] = coef_mul(a.coef[0], b.coef[0]);
+                out->coef[1] = coef_add(sum, a1b1, false);
+                out->coef[2] = coef_mul(a1b1, two);
+                free_nodes(a0b1);
+                free_nodes(a1b0);
+                free_nodes(a1b1);
+                free_nodes(sum);
+                free_nodes(two);
+            } else {
+                ok = false;
+            }
+            break;
+
+        case NODE_SLL: {
+            int32_t shift;
+            if (!eval_const_expr(e->opr[1], NULL, 0, &shift) || shift < 0 || shift > 31
+                || !cr_of_expr(ctx, e->opr[0], &a)) {
+                ok = false;
+                break;
+            }
+            node_t factor = make_int((int32_t)(1u << shift));
+            for (k = 0; k <= MAX_DEGREE; k++) {
+                out->coef[k] = coef_mul(a.coef[k], factor);
+            }
+            free_nodes(factor);
+            break;
+        }
+
+        default:
+            ok = false;
+            break;
+    }
+
+    cr_free(&a);
+    cr_free(&b);
+    if (!ok) {
+        cr_free(out);
+    }
+    return ok;
+}
+
+// flattens the additive terms of e; returns the number of "+var" terms,
+// or -1 if var appears anywhere else
+static int32_t split_self(node_t e, node_t var, bool negated, node_t * delta) {
+    if (e->nature == NODE_PLUS || e->nature == NODE_MINUS) {
+        int32_t l = split_self(e->opr[0], var, negated, delta);
+        int32_t r = split_self(e->opr[1], var, negated != (e->nature == NODE_MINUS), delta);
+        return (l < 0 || r < 0) ? -1 : l + r;
+    }
+
+    if (e->nature == NODE_IDENT && e->decl_node == var) {
+        return negated ? -1 : 1;
+    }
+
+    decl_set_s self = { NULL, 0, 0 };
+    decl_set_add(&self, var);
+    bool uses_self = uses_any(e, &self);
+    decl_set_free(&self);
+    if (uses_self) {
+        return -1;
+    }
+
+    node_t term = copy_tree(e);
+    if (*delta == NULL) {
+        if (negated) {
+            term = make_node(NODE_UMINUS, 1, term);
+            term->type = TYPE_INT;
+        }
+        *delta = term;
+    } else {
+        *delta = make_binop(negated ? NODE_MINUS : NODE_PLUS, *delta, term);
+    }
+    return 0;
+}
+
+static bool cr_of_var(scev_ctx_s * ctx, int32_t i, cr_s * out) {
+    node_t var = ctx->vars.decls[i];
+    node_t delta = NULL;
+    cr_s d = { { NULL } };
+
+    switch (ctx->state[i]) {
+        case CR_DONE:
+            cr_copy(out, &ctx->cr[i]);
+            return true;
+        case CR_TODO:
+            break;
+        default:
+            return false;
+    }
+
+    ctx->state[i] = CR_IN_PROGRESS;
+
+    int32_t self = split_self(ctx->value[i], var, false, &delta);
+    if (self != 1) {
+        // locals need no exit value; others must be reset to an invariant
+        bool invariant = (self == 0 && !uses_vars(ctx, ctx->value[i]));
+        free_nodes(delta);
+        ctx->state[i] = (decl_set_contains(&ctx->locals, var) || invariant) ? CR_NONE : CR_FAILED;
+        return false;
+    }
+
+    bool ok = (delta == NULL) || cr_of_expr(ctx, delta, &d);
+    free_nodes(delta);
+    if (!ok || cr_degree(&d) >= MAX_DEGREE) {
+        cr_free(&d);
+        ctx->state[i] = CR_FAILED;
+        return false;
+    }
+
+    // x(n+1) = x(n) + d(n): {x0, +, d0, +, d1, +, d2}
+    ctx->cr[i].coef[0] = make_ref(var);
+    for (int32_t k = 0; k < MAX_DEGREE; k++) {
+        ctx->cr[i].coef[k + 1] = d.coef[k];
+    }
+    ctx->state[i] = CR_DONE;
+    cr_copy(out, &ctx->cr[i]);
+    return true;
+}
+
+
+// code generation of the exit values
+// value of the chain after count iterations, binom[k] holding C(count, k)
+static node_t cr_value(cr_s * cr, node_t * binom) {
+    node_t sum = copy_tree(cr->coef[0]);
+
+    for (int32_t k = 1; k <= MAX_DEGREE; k++) {
+        node_t term = coef_mul(cr->coef[k], binom[k]);
+        node_t next = coef_add(sum, term, false);
+        free_nodes(sum);
+        free_nodes(term);
+        sum = next;
+    }
+    return sum != NULL ? sum : make_int(0);
+}
+
+// C(count, k) for k = 1..degree, as constants or in temporaries; returns setup code
+static node_t make_binomials(node_t count, int32_t degree, node_t * binom) {
+    node_t code = NULL;
+    int32_t n;
+
+    binom[0] = NULL;
+    binom[1] = count;
+
+    if (eval_const_expr(count, NULL, 0, &n)) {
+        uint32_t c2 = (uint32_t)(n >> 1) * (uint32_t)(n - 1 + (n & 1));
+        uint32_t c3 = c2 * (uint32_t)(n - 2) * (uint32_t)INVERSE_OF_3;
+        binom[2] = make_int((int32_t)c2);
+        binom[3] = make_int((int32_t)c3);
+        return NULL;
+    }
+
+    binom[2] = NULL;
+    binom[3] = NULL;
+    if (degree >= 2) {
+        // C(N, 2) = (N >> 1) * (N - 1 + (N & 1)), exact modulo 2^32
+        node_t tmp = new_temporary(TYPE_INT);
+        node_t half = make_binop(NODE_SRA, make_ref(count->decl_node), make_int(1));
+        node_t odd = make_binop(NODE_BAND, make_ref(count->decl_node), make_int(1));
+        node_t other = make_binop(NODE_PLUS, make_binop(NODE_MINUS, make_ref(count->decl_node), make_int(1)), odd);
+        code = append(code, make_affect(tmp, make_binop(NODE_MUL, half, other)));
+        binom[2] = make_ref(tmp);
+    }
+    if (degree >= 3) {
+        node_t tmp = new_temporary(TYPE_INT);
+        node_t prod = make_binop(NODE_MUL, make_ref(binom[2]->decl_node),
+                                 make_binop(NODE_MINUS, make_ref(count->decl_node), make_int(2)));
+        code = append(code, make_affect(tmp, make_binop(NODE_MUL, prod, make_int(INVERSE_OF_3))));
+        binom[3] = make_ref(tmp);
+    }
+    return code;
+}
+
+
+// trip count
+typedef struct _scev_loop_s {
+    node_t var;          // loop counter
+    node_t bound;        // invariant bound
+    node_nature rel;     // test normalised as "var rel bound"
+    int32_t step;
+    bool start_known;    // constant value of var on entry
+    int32_t start;
+} scev_loop_s;
+
+static bool match_test(scev_ctx_s * ctx, node_t cond, scev_loop_s * sl) {
+    if (cond == NULL || (cond->nature != NODE_LT && cond->nature != NODE_LE
+                         && cond->nature != NODE_GT && cond->nature != NODE_GE)) {
+        return false;
+    }
+
+    node_t l = cond->opr[0], r = cond->opr[1];
+    if (l->nature == NODE_IDENT && var_index(ctx, l->decl_node) >= 0 && !uses_vars(ctx, r)) {
+        sl->var = l->decl_node;
+        sl->bound = r;
+        sl->rel = cond->nature;
+    } else if (r->nature == NODE_IDENT && var_index(ctx, r->decl_node) >= 0 && !uses_vars(ctx, l)) {
+        sl->var = r->decl_node;
+        sl->bound = l;
+        sl->rel = swap_rel(cond->nature);
+    } else {
+        return false;
+    }
+
+    return !has_side_effect(sl->bound) && !may_trap(sl->bound);
+}
+
+static bool is_upward(scev_loop_s * sl) {
+    return sl->rel == NODE_LT || sl->rel == NODE_LE;
+}
+
+// The closed form is only used when start >= 0 && bound <= MAX - step
+// (resp. bound >= 0 && start <= MAX - |step| when counting down): then the
+// trip count computation does not overflow and the counter never wraps.
+static node_t make_guard(scev_loop_s * sl) {
+    int32_t m = is_upward(sl) ? sl->step : -sl->step;
+
+    if (is_upward(sl)) {
+        return make_binop(NODE_AND,
+                          make_binop(NODE_GE, make_ref(sl->var), make_int(0)),
+                          make_binop(NODE_LE, copy_tree(sl->bound), make_int(INT32_MAX - m)));
+    }
+    return make_binop(NODE_AND,
+                      make_binop(NODE_GE, copy_tree(sl->bound), make_int(0)),
+                      make_binop(NODE_LE, make_ref(sl->var), make_int(INT32_MAX - m)));
+}
+
+// number of iterations, as a constant or in a temporary set up by *code
+static node_t make_count(scev_loop_s * sl, node_t * code) {
+    int32_t m = is_upward(sl) ? sl->step : -sl->step;
+    int32_t extra = (sl->rel == NODE_LT || sl->rel == NODE_GT) ? m - 1 : m;
+    int32_t bound;
+
+    *code = NULL;
+    if (sl->start_known && eval_const_expr(sl->bound, NULL, 0, &bound)) {
+        int64_t diff = is_upward(sl) ? (int64_t)bound - sl->start : (int64_t)sl->start - bound;
+        return make_int(diff + extra > 0 ? (diff + extra) / m : 0);
+    }
+
+    node_t diff = is_upward(sl)
+        ? make_binop(NODE_MINUS, copy_tree(sl->bound), make_ref(sl->var))
+        : make_binop(NODE_MINUS, make_ref(sl->var), copy_tree(sl->bound));
+    node_t num = make_binop(NODE_PLUS, diff, make_int(extra));
+    node_t value = (m == 1) ? num : make_binop(NODE_DIV, num, make_int(m));
+
+    node_t tmp = new_temporary(TYPE_INT);
+    node_t cond = make_binop(sl->rel, make_ref(sl->var), copy_tree(sl->bound));
+    node_t set = make_node(NODE_IF, 3, cond, make_affect(tmp, value), NULL);
+    *code = list_append(make_affect(tmp, make_int(0)), set);
+    return make_ref(tmp);
+}
+
+
+// loop replacement
+// Symbolic evaluation of one iteration; fills sl and the maximal degree of
+// the chains needed after the loop.
+static bool analyse_loop(scev_ctx_s * ctx, node_t cond, node_t body, node_t incr,
+                         scev_loop_s * sl, int32_t * degree) {
+    cr_s cr = { { NULL } };
+
+    sym_eval_instr(ctx, body);
+    if (incr != NULL && !ctx->failed) {
+        if (incr->nature != NODE_AFFECT || has_side_effect(incr->opr[1])) {
+            return false;
+        }
+        assign(ctx, incr->opr[0]->decl_node, incr->opr[1]);
+    }
+    if (ctx->failed || !match_test(ctx, cond, sl)) {
+        return false;
+    }
+
+    // the counter must be {start, +, step} with a constant step towards the bound
+    bool ok = cr_of_var(ctx, var_index(ctx, sl->var), &cr) && cr_degree(&cr) == 1
+        && is_const(cr.coef[1], &sl->step) && sl->step != 0
+        && sl->step <= 0xFFFF && sl->step >= -0xFFFF
+        && (is_upward(sl) ? sl->step > 0 : sl->step < 0);
+    cr_free(&cr);
+    if (!ok) {
+        return false;
+    }
+
+    // every variable live after the loop needs an exit value
+    *degree = 0;
+    for (int32_t i = 0; i < ctx->vars.size; i++) {
+        if (cr_of_var(ctx, i, &cr)) {
+            if (cr_degree(&cr) > *degree) {
+                *degree = cr_degree(&cr);
+            }
+            cr_free(&cr);
+        } else if (ctx->state[i] != CR_NONE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Exit values are computed from the entry values: a variable is assigned
+// directly once no pending exit value reads it, otherwise through a temporary.
+static node_t exit_values(scev_ctx_s * ctx, node_t * binom) {
+    int32_t n = ctx->vars.size, pending = 0, i;
+    node_t * values = calloc(n, sizeof(node_t));
+    node_t code = NULL, stores = NULL;
+
+    for (i = 0; i < n; i++) {
+        if (ctx->state[i] == CR_DONE) {
+            values[i] = cr_value(&ctx->cr[i], binom);
+            pending++;
+        }
+    }
+
+    while (pending > 0) {
+        int32_t pick = -1, first = -1;
+        for (i = 0; i < n && pick < 0; i++) {
+            if (values[i] == NULL) {
+                continue;
+            }
+            if (first < 0) {
+                first = i;
+            }
+            decl_set_s self = { NULL, 0, 0 };
+            decl_set_add(&self, ctx->vars.decls[i]);
+            bool read = false;
+            for (int32_t j = 0; j < n; j++) {
+                read = read || (j != i && uses_any(values[j], &self));
+            }
+            decl_set_free(&self);
+            if (!read) {
+                pick = i;
+            }
+        }
+
+        if (pick >= 0) {
+            code = append(code, make_affect(ctx->vars.decls[pick], values[pick]));
+        } else {
+            pick = first;
+            node_t tmp = new_temporary(TYPE_INT);
+            code = append(code, make_affect(tmp, values[pick]));
+            stores = append(stores, make_affect(ctx->vars.decls[pick], make_ref(tmp)));
+        }
+        values[pick] = NULL;
+        pending--;
+    }
+
+    free(values);
+    return append(code, stores);
+}
+
+static node_t closed_form(scev_ctx_s * ctx, scev_loop_s * sl, int32_t degree) {
+    node_t binom[MAX_DEGREE + 1];
+    node_t code;
+    int32_t count;
+
+    binom[1] = make_count(sl, &code);
+    code = append(code, make_binomials(binom[1], degree, binom));
+    code = append(code, exit_values(ctx, binom));
+
+    // variables set to the same invariant value at every iteration
+    bool known = eval_const_expr(binom[1], NULL, 0, &count);
+    for (int32_t i = 0; i < ctx->vars.size; i++) {
+        node_t var = ctx->vars.decls[i];
+        if (ctx->state[i] != CR_NONE || decl_set_contains(&ctx->locals, var)
+            || (known && count == 0)) {
+            continue;
+        }
+        node_t set = make_affect(var, copy_tree(ctx->value[i]));
+        if (!known) {
+            node_t test = make_binop(NODE_GT, copy_tree(binom[1]), make_int(0));
+            set = make_node(NODE_IF, 3, test, set, NULL);
+        }
+        code = append(code, set);
+    }
+
+    for (int32_t k = 1; k <= MAX_DEGREE; k++) {
+        free_nodes(binom[k]);
+    }
+    return code;
+}
+
+// returns the code replacing the loop (init excluded), or NULL
+static node_t replace_loop(node_t loop, node_t init, node_t cond, node_t body, node_t incr) {
+    scev_ctx_s ctx = { { NULL, 0, 0 }, { NULL, 0, 0 }, NULL, NULL, NULL, false };
+    scev_loop_s sl;
+    node_t result = NULL;
+    int32_t degree, i;
+
+    if (has_side_effect(cond) || may_trap(body) || may_trap(incr) || has_output_or_loop(body)) {
+        return NULL;
+    }
+
+    collect_assigned(body, &ctx.vars);
+    collect_assigned(incr, &ctx.vars);
+    ctx.value = calloc(ctx.vars.size, sizeof(node_t));
+    ctx.state = calloc(ctx.vars.size, sizeof(cr_state_e));
+    ctx.cr = calloc(ctx.vars.size, sizeof(cr_s));
+    for (i = 0; i < ctx.vars.size; i++) {
+        ctx.value[i] = make_ref(ctx.vars.decls[i]);
+    }
+
+    if (analyse_loop(&ctx, cond, body, incr, &sl, &degree)) {
+        sl.start_known = init != NULL && init->nature == NODE_AFFECT
+            && init->opr[0]->decl_node == sl.var
+            && eval_const_expr(init->opr[1], NULL, 0, &sl.start);
+
+        node_t guard = make_guard(&sl);
+        int32_t holds;
+        bool folded = sl.start_known ? eval_const_expr(guard, sl.var, sl.start, &holds)
+                                     : eval_const_expr(guard, NULL, 0, &holds);
+        if (!folded) {
+            result = make_node(NODE_IF, 3, guard, make_block_list(closed_form(&ctx, &sl, degree)), NULL);
+            result->lineno = loop->lineno;
+        } else {
+            free_nodes(guard);
+            if (holds) {
+                result = make_block_list(closed_form(&ctx, &sl, degree));
+            }
+        }
+    }
+
+    for (i = 0; i < ctx.vars.size; i++) {
+        free_nodes(ctx.value[i]);
+        cr_free(&ctx.cr[i]);
+    }
+    free(ctx.value);
+    free(ctx.state);
+    free(ctx.cr);
+    decl_set_free(&ctx.vars);
+    decl_set_free(&ctx.locals);
+    return result;
+}
+
+static node_t scev_loop(node_t loop) {
+    node_t init = NULL, closed;
+
+    if (loop->nature == NODE_FOR) {
+        init = loop->opr[0];
+        closed = replace_loop(loop, init, loop->opr[1], loop->opr[3], loop->opr[2]);
+    } else {
+        closed = replace_loop(loop, NULL, loop->opr[0], loop->opr[1], NULL);
+    }
+
+    if (closed == NULL) {
+        return loop;
+    }
+
+    // the initialisation runs before the closed form or the original loop
+    if (init != NULL) {
+        loop->opr[0] = NULL;
+    }
+    if (closed->nature == NODE_IF) {
+        closed->opr[2] = loop;
+    } else {
+        free_nodes(loop);
+    }
+
+    return init != NULL ? make_block_list(list_append(init, closed)) : closed;
+}
+
+
+// tree walk
+static void scev_instr(node_t * pinstr) {
+    node_t instr = *pinstr;
+
+    if (instr == NULL) {
+        return;
+    }
+
+    switch (instr->nature) {
+        case NODE_LIST:
+            scev_instr(&instr->opr[0]);
+            scev_instr(&instr->opr[1]);
+            break;
+
+        case NODE_BLOCK:
+            scev_instr(&instr->opr[1]);
+            break;
+
+        case NODE_IF:
+            scev_instr(&instr->opr[1]);
+            scev_instr(&instr->opr[2]);
+            break;
+
+        case NODE_WHILE:
+            scev_instr(&instr->opr[1]);
+            *pinstr = scev_loop(instr);
+            break;
+
+        case NODE_FOR:
+            scev_instr(&instr->opr[3]);
+            *pinstr = scev_loop(instr);
+            break;
+
+        case NODE_DOWHILE:
+            scev_instr(&instr->opr[0]);
+            break;
+
+        default:
+            break;
+    }
+}
+
+void scev_tree(node_t root) {
+    node_t func = root->opr[1];
+    scev_instr(&func->opr[2]);
+}
@@ -0,0 +1,304 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "arch.h"
+#include "asm.h"
+
+extern int trace_level;
+
+
+// Instruction scheduling.
+// passe_2 emits each expression in the order of its tree, so every load
+// and every mflo comes right after the instruction it waits for, and the
+// pipeline stalls on it. Each block is reordered by a list scheduler: of
+// the instructions whose operands are ready, the one heading the longest
+// chain of latencies to the end of the block goes first. The latencies are
+// the ones of the core chosen with -mtune. The order of the accesses to a
+// register, of the memory accesses that may overlap, and of a teq with the
+// stores, the other traps and the writes of HI and LO is kept. A block
+// ends at a label, a transfer of control, a syscall or an unknown
+// instruction, which stays last. passe_2 reuses the same few registers for
+// every expression, so before that the values dying in the block are moved
+// to registers the program never uses, which leaves only the true
+// dependences. A block is only changed when it stalls less.
+
+// instructions scheduled together, longer blocks are cut
+#define MAX_BLOCK 128
+
+#define REG(r) ((asm_regs)1 << (r))
+#define HILO (REG(ASM_REG_HI) | REG(ASM_REG_LO))
+
+static int32_t num_blocks;
+static int32_t num_moved;
+static int32_t num_renamed;
+static int32_t stalls_before;
+static int32_t stalls_after;
+
+
+// dependences
+static bool ends_block(asm_line_s * l) {
+    return l->kind != ASM_LINE_INST || asm_is_boundary(l) || (asm_op_flags(l) & ASM_OP_SYSCALL);
+}
+
+static asm_arg_s * mem_arg(asm_line_s * l) {
+    for (int32_t i = 0; i < l->nargs; i++) {
+        if (l->args[i].kind == ASM_ARG_MEM) {
+            return &l->args[i];
+        }
+    }
+    return NULL;
+}
+
+// the accesses of the lines a and b of the block, in this order, use
+// disjoint words off the same value of a base register
+static bool disjoint(asm_line_s ** block, int32_t a, int32_t b) {
+    asm_arg_s * x = mem_arg(block[a]);
+    asm_arg_s * y = mem_arg(block[b]);
+
+    if (x == NULL || y == NULL || x->reg != y->reg) {
+        return false;
+    }
+    for (int32_t k = a; k < b; k++) {
+        if (asm_defs(block[k]) & REG(x->reg)) {
+            return false;
+        }
+    }
+    return x->imm + asm_mem_width(block[a]) <= y->imm || y->imm + asm_mem_width(block[b]) <= x->imm;
+}
+
+static bool ordered(asm_line_s * trap, asm_line_s * l) {
+    return (asm_op_flags(trap) & ASM_OP_TRAP)
+        && ((asm_op_flags(l) & (ASM_OP_STORE | ASM_OP_TRAP)) || (asm_defs(l) & HILO));
+}
+
+// latency from the line a of the block to the line b after it when b has to
+// stay after a, -1 when they are independent
+static int32_t depends(asm_line_s ** block, int32_t a, int32_t b) {
+    asm_line_s * x = block[a];
+    asm_line_s * y = block[b];
+    uint32_t fx = asm_op_flags(x), fy = asm_op_flags(y);
+
+    if (asm_defs(x) & asm_uses(y)) {
+        return asm_latency(x);
+    }
+    if ((asm_uses(x) & asm_defs(y)) || (asm_defs(x) & asm_defs(y))
+        || ordered(x, y) || ordered(y, x)) {
+        return 0;
+    }
+    if (((fx & ASM_OP_STORE) && (fy & (ASM_OP_LOAD | ASM_OP_STORE)))
+        || ((fx & ASM_OP_LOAD) && (fy & ASM_OP_STORE))) {
+        return disjoint(block, a, b) ? -1 : 0;
+    }
+    return -1;
+}
+
+
+// renaming
+static void rename_uses(asm_line_s * l, int32_t from, int32_t to, int32_t first) {
+    for (int32_t a = 0; a < l->nargs; a++) {
+        asm_arg_s * arg = &l->args[a];
+        if ((arg->kind == ASM_ARG_MEM || (arg->kind == ASM_ARG_REG && a >= first)) && arg->reg == from) {
+            arg->reg = to;
+        }
+    }
+}
+
+// gives a register of free to each value written in the block and read
+// again before the next write of its register, which ends it; a register
+// is taken again once its value is dead, the one released first
+static int32_t rename_block(asm_line_s * lines, int32_t n, asm_regs free) {
+    int32_t released[32];
+    int32_t renamed = 0;
+
+    for (int32_t r = 0; r < 32; r++) {
+        released[r] = -1;
+    }
+    for (int32_t i = 0; i < n && free != 0; i++) {
+        asm_line_s * l = &lines[i];
+        asm_regs def = asm_defs(l);
+        int32_t r, to = -1, j;
+
+        if (def == 0 || (def & (def - 1)) != 0 || (def & ~ASM_SCRATCH_REGS) != 0 || asm_reads_dest(l)
+            || l->nargs == 0 || l->args[0].kind != ASM_ARG_REG) {
+            continue;
+        }
+        r = l->args[0].reg;
+        for (j = i + 1; j < n && !(asm_defs(&lines[j]) & def); j++) {
+        }
+        if (j >= n || asm_reads_dest(&lines[j]) || lines[j].args[0].kind != ASM_ARG_REG) {
+            continue;
+        }
+        for (int32_t t = 0; t < 32; t++) {
+            if ((free & REG(t)) && released[t] < i && (to < 0 || released[t] < released[to])) {
+                to = t;
+            }
+        }
+        if (to < 0) {
+            continue;
+        }
+        released[to] = j;
+        l->args[0].reg = to;
+        for (int32_t k = i + 1; k < j; k++) {
+            rename_uses(&lines[k], r, to, 0);
+        }
+        rename_uses(&lines[j], r, to, 1);
+        renamed++;
+    }
+    return renamed;
+}
+
+
+// scheduling
+// cycles lost by an in-order pipeline issuing the block in this order
+static int32_t stalls(asm_line_s ** block, int32_t n) {
+    int32_t issue[MAX_BLOCK + 1];
+    int32_t cycle = 0, lost = 0;
+
+    for (int32_t j = 0; j < n; j++) {
+        int32_t ready = cycle;
+        for (int32_t i = 0; i < j; i++) {
+            if (asm_defs(block[i]) & asm_uses(block[j]) && issue[i] + asm_latency(block[i]) > ready) {
+                ready = issue[i] + asm_latency(block[i]);
+            }
+        }
+        lost += ready - cycle;
+        issue[j] = ready;
+        cycle = ready + 1;
+    }
+    return lost;
+}
+
+// reorders the n lines of the block, the last one staying in place when
+// it ends the block
+static void schedule_block(asm_line_s * lines, int32_t n, bool fixed_last, asm_regs free) {
+    static int32_t dep[MAX_BLOCK + 1][MAX_BLOCK + 1];
+    asm_line_s * block[MAX_BLOCK + 1];
+    asm_line_s * order[MAX_BLOCK + 1];
+    asm_line_s copy[MAX_BLOCK + 1];
+    asm_line_s saved[MAX_BLOCK + 1];
+    int32_t renamed, before, after;
+    int32_t prio[MAX_BLOCK + 1], earliest[MAX_BLOCK + 1], preds[MAX_BLOCK + 1];
+    bool done[MAX_BLOCK + 1];
+    int32_t cycle = 0;
+
+    memcpy(saved, lines, n * sizeof(asm_line_s));
+    renamed = rename_block(lines, n, free);
+    for (int32_t i = 0; i < n; i++) {
+        block[i] = &lines[i];
+        earliest[i] = 0;
+        preds[i] = 0;
+        done[i] = false;
+    }
+    for (int32_t j = 0; j < n; j++) {
+        for (int32_t i = 0; i < j; i++) {
+            dep[i][j] = (fixed_last && j == n - 1) ? 0 : depends(block, i, j);
+            if (fixed_last && j == n - 1 && (asm_defs(block[i]) & asm_uses(block[j]))) {
+                dep[i][j] = asm_latency(block[i]);
+            }
+            preds[j] += (dep[i][j] >= 0);
+        }
+    }
+    // longest chain of latencies to the end of the block
+    for (int32_t i = n - 1; i >= 0; i--) {
+        prio[i] = 0;
+        for (int32_t j = i + 1; j < n; j++) {
+            if (dep[i][j] >= 0 && dep[i][j] + prio[j] > prio[i]) {
+                prio[i] = dep[i][j] + prio[j];
+            }
+        }
+    }
+
+    for (int32_t k = 0; k < n; k++) {
+        int32_t best = -1;
+        bool best_ready = false;
+
+        // a ready instruction, else the one ready first
+        for (int32_t j = 0; j < n; j++) {
+            bool ready;
+            if (done[j] || preds[j] > 0) {
+                continue;
+            }
+            ready = earliest[j] <= cycle;
+            if (best < 0 || (ready && !best_ready)
+                || (ready == best_ready && (ready ? prio[j] > prio[best] : earliest[j] < earliest[best]))) {
+                best = j;
+                best_ready = ready;
+            }
+        }
+        if (earliest[best] > cycle) {
+            cycle = earliest[best];
+        }
+        done[best] = true;
+        order[k] = block[best];
+        for (int32_t j = best + 1; j < n; j++) {
+            if (dep[best][j] >= 0) {
+                preds[j]--;
+                if (cycle + dep[best][j] > earliest[j]) {
+                    earliest[j] = cycle + dep[best][j];
+                }
+            }
+        }
+        cycle++;
+    }
+
+    before = stalls(block, n);
+    after = stalls(order, n);
+    num_blocks++;
+    stalls_before += before;
+    if (after >= before) {
+        // the renamed arguments are plain numbers, nothing to free
+        memcpy(lines, saved, n * sizeof(asm_line_s));
+        stalls_after += before;
+        return;
+    }
+    for (int32_t k = 0; k < n; k++) {
+        copy[k] = *order[k];
+        num_moved += (order[k] != block[k]);
+    }
+    memcpy(lines, copy, n * sizeof(asm_line_s));
+    num_renamed += renamed;
+    stalls_after += after;
+}
+
+bool schedule_asm(asm_prog_s * prog) {
+    int32_t text = asm_find_directive(prog, ".text");
+    asm_regs free = ASM_SCRATCH_REGS;
+
+    num_blocks = 0;
+    num_moved = 0;
+    num_renamed = 0;
+    stalls_before = 0;
+    stalls_after = 0;
+    if (text < 0) {
+        return false;
+    }
+    for (int32_t i = 0; i < prog->size; i++) {
+        free &= ~(asm_uses(&prog->lines[i]) | asm_defs(&prog->lines[i]));
+    }
+
+    for (int32_t i = text + 1; i < prog->size; ) {
+        int32_t end = i;
+        bool fixed_last;
+
+        while (end < prog->size && end - i < MAX_BLOCK && !ends_block(&prog->lines[end])) {
+            end++;
+        }
+        fixed_last = end < prog->size && end - i < MAX_BLOCK && prog->lines[end].kind == ASM_LINE_INST;
+        if (fixed_last) {
+            end++;
+        }
+        if (end - i > 1) {
+            schedule_block(&prog->lines[i], end - i, fixed_last, free);
+        }
+        i = (end > i) ? end : i + 1;
+    }
+
+    printf_level(2, "schedule (%s): %d blocks, %d instructions moved, %d values renamed, %d stall cycles -> %d\n",
+                 get_tune_name(), num_blocks, num_moved, num_renamed, stalls_before, stalls_after);
+    return num_moved > 0;
+}
@@ -0,0 +1,650 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "defs.h"
+#include "arch.h"
+#include "optim.h"
+#include "asm.h"
+#include "sim.h"
+
+
+// Simulator.
+// With -x, the program written by minicc, or a .s file given instead of the
+// source, is read back and run. Its output goes to stdout and a report to
+// stderr: the instructions executed by opcode, the cycles of an in-order
+// pipeline with the latencies of -mtune, the branches, and the accesses to
+// direct mapped instruction and data caches. Only the instructions of
+// asm.c and the syscalls of passe_2, buffer-output and -fprofile-generate
+// are known. With -fdelay-slots, the instruction after a transfer of
+// control is executed before it.
+
+#define TEXT_START 0x00400000
+#define STACK_TOP 0x7FFFEFFC
+#define STACK_SIZE (1 << 20)
+#define MAX_STEPS 1000000000LL
+
+#define NUM_REGS 34
+
+// files opened by the program, from descriptor 3
+#define MAX_FILES 8
+#define MAX_FILE_NAME 256
+
+typedef enum sim_kind_s {
+    SIM_ALU,                // computed by asm_eval
+    SIM_EXT,
+    SIM_INS,
+    SIM_MOVN,
+    SIM_MOVZ,
+    SIM_MULT,
+    SIM_MULTU,
+    SIM_DIV,
+    SIM_DIVU,
+    SIM_MFHI,
+    SIM_MFLO,
+    SIM_LOAD,
+    SIM_STORE,
+    SIM_BRANCH,
+    SIM_JUMP,
+    SIM_JR,
+    SIM_JAL,
+    SIM_TEQ,
+    SIM_SYSCALL,
+    SIM_NOP,
+} sim_kind;
+
+// an instruction, decoded once
+typedef struct _sim_inst_s {
+    asm_line_s * line;
+    sim_kind kind;
+    int32_t target;         // instruction of the label of a transfer, or -1
+    asm_regs uses;
+    asm_regs defs;
+    int32_t latency;
+    int64_t count;
+} sim_inst_s;
+
+typedef struct _cache_s {
+    uint32_t * tags;        // block held by each line, UINT32_MAX when empty
+    int32_t lines;
+    int32_t line_size;
+    int64_t accesses;
+    int64_t misses;
+} cache_s;
+
+typedef struct _sim_s {
+    sim_inst_s * insts;
+    int32_t num_insts;
+    uint8_t * data;
+    uint32_t data_size;
+    uint8_t * stack;
+    int32_t regs[NUM_REGS];
+    int64_t ready[NUM_REGS];    // cycle from which each register can be read
+    cache_s icache;
+    cache_s dcache;
+    int64_t steps;
+    int64_t cycles;
+    int64_t load_stalls;
+    int64_t hilo_stalls;
+    int64_t branch_stalls;
+    int64_t miss_stalls;
+    int64_t branches;
+    int64_t taken;
+    int64_t backward;
+    int64_t jumps;
+    int64_t calls;
+    int64_t returns;
+    FILE * files[MAX_FILES];
+} sim_s;
+
+
+// loading
+static const struct {
+    const char * op;
+    sim_kind kind;
+} sim_kinds[] = {
+    { "ext", SIM_EXT }, { "ins", SIM_INS }, { "movn", SIM_MOVN }, { "movz", SIM_MOVZ },
+    { "mult", SIM_MULT }, { "multu", SIM_MULTU }, { "div", SIM_DIV }, { "divu", SIM_DIVU },
+    { "mfhi", SIM_MFHI }, { "mflo", SIM_MFLO }, { "j", SIM_JUMP }, { "jr", SIM_JR },
+    { "jal", SIM_JAL }, { "teq", SIM_TEQ }, { "syscall", SIM_SYSCALL }, { "nop", SIM_NOP },
+};
+
+static sim_kind decode(asm_line_s * l) {
+    uint32_t flags = asm_op_flags(l);
+
+    if (flags & ASM_OP_UNKNOWN) {
+        fprintf(stderr, "Error: the simulator does not know the instruction '%s'\n", l->op);
+        exit(1);
+    }
+    if (flags & ASM_OP_LOAD) {
+        return SIM_LOAD;
+    }
+    if (flags & ASM_OP_STORE) {
+        return SIM_STORE;
+    }
+    if (flags & ASM_OP_BRANCH) {
+        return SIM_BRANCH;
+    }
+    for (int32_t i = 0; i < (int32_t)(sizeof(sim_kinds) / sizeof(sim_kinds[0])); i++) {
+        if (strcmp(l->op, sim_kinds[i].op) == 0) {
+            return sim_kinds[i].kind;
+        }
+    }
+    return SIM_ALU;
+}
+
+static void store_value(sim_s * s, uint32_t * pos, int64_t value, int32_t width) {
+    for (int32_t i = 0; i < width; i++) {
+        s->data[*pos + i] = (uint8_t)((uint64_t)value >> (8 * i));
+    }
+    *pos += width;
+}
+
+static void align(uint32_t * pos, int32_t a) {
+    *pos = (*pos + a - 1) & ~(uint32_t)(a - 1);
+}
+
+// the initial contents of the .data section
+static void load_data(sim_s * s, asm_prog_s * prog) {
+    uint32_t pos = 0;
+    bool in_data = false;
+
+    s->data_size = (uint32_t)asm_data_size(prog) + 4;
+    s->data = calloc(s->data_size, 1);
+    for (int32_t i = 0; i < prog->size; i++) {
+        asm_line_s * l = &prog->lines[i];
+        const char * t = l->text;
+        char * end;
+
+        if (l->kind != ASM_LINE_DIRECTIVE) {
+            continue;
+        }
+        if (strcmp(t, ".data") == 0 || strcmp(t, ".text") == 0) {
+            in_data = (t[1] == 'd');
+        } else if (!in_data) {
+            continue;
+        } else if (strncmp(t, ".word", 5) == 0 || strncmp(t, ".half", 5) == 0 || strncmp(t, ".byte", 5) == 0) {
+            int32_t width = (t[1] == 'w') ? 4 : (t[1] == 'h') ? 2 : 1;
+            align(&pos, width);
+            for (t += 5; *t != '\0'; t = (*end == ',') ? end + 1 : end) {
+                int64_t value = strtoll(t, &end, 0);
+                if (end == t) {
+                    break;
+                }
+                store_value(s, &pos, value, width);
+            }
+        } else if (strncmp(t, ".asciiz", 7) == 0) {
+            const char * p = strchr(t, '"');
+            const char * close = strrchr(t, '"');
+            for (p = (p != NULL) ? p + 1 : close; p != NULL && p < close; p++) {
+                char c = *p;
+                if (c == '\\') {
+                    p++;
+                    c = (*p == 'n') ? '\n' : (*p == 't') ? '\t' : (*p == '0') ? '\0' : *p;
+                }
+                s->data[pos++] = (uint8_t)c;
+            }
+            s->data[pos++] = 0;
+        } else if (strncmp(t, ".space", 6) == 0) {
+            pos += atoi(t + 6);
+        } else if (strncmp(t, ".align", 6) == 0) {
+            align(&pos, 1 << atoi(t + 6));
+        }
+    }
+}
+
+static void init_cache(cache_s * c) {
+    c->line_size = get_cache_line_size();
+    c->lines = get_cache_size() / c->line_size;
+    c->tags = malloc(c->lines * sizeof(uint32_t));
+    memset(c->tags, 0xFF, c->lines * sizeof(uint32_t));
+}
+
+// returns the instruction of main
+static int32_t load(sim_s * s, asm_prog_s * prog) {
+    int32_t text = asm_find_directive(prog, ".text");
+    int32_t * first = malloc((prog->size + 1) * sizeof(int32_t));
+    int32_t entry;
+
+    memset(s, 0, sizeof(sim_s));
+    load_data(s, prog);
+    s->stack = calloc(STACK_SIZE + 4, 1);
+    s->insts = calloc(prog->size + 1, sizeof(sim_inst_s));
+
+    // the instruction at or after each line of the text
+    for (int32_t i = 0; i < prog->size; i++) {
+        asm_line_s * l = &prog->lines[i];
+        first[i] = s->num_insts;
+        if (text >= 0 && i > text && l->kind == ASM_LINE_INST) {
+            sim_inst_s * inst = &s->insts[s->num_insts++];
+            inst->line = l;
+            inst->kind = decode(l);
+            inst->uses = asm_uses(l);
+            inst->defs = asm_defs(l);
+            inst->latency = asm_latency(l);
+        }
+    }
+    for (int32_t k = 0; k < s->num_insts; k++) {
+        const char * label = asm_target(s->insts[k].line);
+        int32_t pos = (label != NULL) ? asm_find_label(prog, label) : -1;
+
+        s->insts[k].target = -1;
+        if (label != NULL && (pos < text || first[pos] == s->num_insts)) {
+            fprintf(stderr, "Error: no instruction at the label '%s'\n", label);
+            exit(1);
+        }
+        if (label != NULL) {
+            s->insts[k].target = first[pos];
+        }
+    }
+    entry = asm_find_label(prog, "main");
+    entry = (entry > text) ? first[entry] : 0;
+    free(first);
+
+    s->regs[29] = STACK_TOP;
+    init_cache(&s->icache);
+    init_cache(&s->dcache);
+    return entry;
+}
+
+
+// memory
+static bool cache_access(cache_s * c, uint32_t addr) {
+    uint32_t block = addr / c->line_size;
+    int32_t line = block % c->lines;
+
+    c->accesses++;
+    if (c->tags[line] == block) {
+        return true;
+    }
+    c->tags[line] = block;
+    c->misses++;
+    return false;
+}
+
+static uint8_t * address(sim_s * s, uint32_t addr, int32_t width) {
+    uint32_t data = (uint32_t)get_data_sec_start_addr();
+
+    if (addr % width != 0) {
+        fprintf(stderr, "Error: unaligned access at 0x%08x\n", addr);
+        exit(1);
+    }
+    if (addr >= data && addr - data + width <= s->data_size) {
+        return &s->data[addr - data];
+    }
+    if (addr <= STACK_TOP && STACK_TOP - addr < STACK_SIZE) {
+        return &s->stack[STACK_SIZE - (STACK_TOP - addr)];
+    }
+    fprintf(stderr, "Error: access out of the data and the stack at 0x%08x\n", addr);
+    exit(1);
+}
+
+static int32_t read_mem(sim_s * s, uint32_t addr, int32_t width) {
+    uint8_t * p = address(s, addr, width);
+
+    if (width == 1) {
+        return (int8_t)p[0];
+    }
+    return (int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+static void write_mem(sim_s * s, uint32_t addr, int32_t width, int32_t value) {
+    uint8_t * p = address(s, addr, width);
+
+    for (int32_t i = 0; i < width; i++) {
+        p[i] = (uint8_t)((uint32_t)value >> (8 * i));
+    }
+}
+
+
+// files
+// flags 0 reads, 1 writes and 9 appends, returns the descriptor or -1
+static int32_t open_file(sim_s * s, uint32_t name, int32_t flags) {
+    char path[MAX_FILE_NAME];
+    int32_t n = 0;
+
+    for (; n < MAX_FILE_NAME - 1 && (path[n] = (char)read_mem(s, name + n, 1)) != '\0'; n++) {
+    }
+    path[n] = '\0';
+    for (int32_t fd = 0; fd < MAX_FILES; fd++) {
+        if (s->files[fd] == NULL) {
+            s->files[fd] = fopen(path, (flags == 0) ? "rb" : (flags == 9) ? "ab" : "wb");
+            return (s->files[fd] != NULL) ? fd + 3 : -1;
+        }
+    }
+    return -1;
+}
+
+// returns the bytes written, or -1
+static int32_t write_file(sim_s * s, int32_t fd, uint32_t buffer, int32_t size) {
+    FILE * f = (fd >= 3 && fd < 3 + MAX_FILES) ? s->files[fd - 3] : NULL;
+
+    if (f == NULL || size < 0) {
+        return -1;
+    }
+    for (int32_t i = 0; i < size; i++) {
+        fputc(read_mem(s, buffer + i, 1) & 0xFF, f);
+    }
+    return size;
+}
+
+
+// execution
+static int32_t reg(sim_s * s, asm_line_s * l, int32_t i) {
+    return (i < l->nargs && l->args[i].kind == ASM_ARG_REG) ? s->regs[l->args[i].reg] : 0;
+}
+
+static void set_reg(sim_s * s, int32_t r, int32_t value) {
+    if (r != 0) {
+        s->regs[r] = value;
+    }
+}
+
+// cycles of the instruction k before it can issue, waiting for its operands
+static void timing(sim_s * s, sim_inst_s * inst, int32_t k) {
+    int64_t ready = s->cycles;
+    bool hilo = false;
+
+    if (!cache_access(&s->icache, TEXT_START + 4 * (uint32_t)k)) {
+        s->cycles += get_miss_penalty();
+        s->miss_stalls += get_miss_penalty();
+        ready = s->cycles;
+    }
+    for (int32_t r = 1; r < NUM_REGS; r++) {
+        if ((inst->uses & ((asm_regs)1 << r)) && s->ready[r] > ready) {
+            ready = s->ready[r];
+            hilo = (r >= ASM_REG_HI);
+        }
+    }
+    if (hilo) {
+        s->hilo_stalls += ready - s->cycles;
+    } else {
+        s->load_stalls += ready - s->cycles;
+    }
+    s->cycles = ready;
+    for (int32_t r = 1; r < NUM_REGS; r++) {
+        if (inst->defs & ((asm_regs)1 << r)) {
+            s->ready[r] = s->cycles + inst->latency;
+        }
+    }
+    s->cycles++;
+}
+
+static void data_access(sim_s * s, uint32_t addr) {
+    if (!cache_access(&s->dcache, addr)) {
+        s->cycles += get_miss_penalty();
+        s->miss_stalls += get_miss_penalty();
+    }
+}
+
+// runs the instruction k, returns the next one, -1 at the exit, -2 on a
+// trap; a transfer of control is written in target
+static int32_t step(sim_s * s, int32_t k, int32_t * target) {
+    sim_inst_s * inst = &s->insts[k];
+    asm_line_s * l = inst->line;
+    int32_t a = reg(s, l, 1), b = reg(s, l, 2), result;
+    uint32_t addr;
+    int64_t product;
+    bool taken;
+
+    inst->count++;
+    timing(s, inst, k);
+    *target = -1;
+    switch (inst->kind) {
+        case SIM_ALU:
+            if (!asm_eval(l, a, b, &result)) {
+                fprintf(stderr, "Error: the simulator does not know the instruction '%s'\n", l->op);
+                exit(1);
+            }
+            set_reg(s, l->args[0].reg, result);
+            break;
+        case SIM_EXT:
+            set_reg(s, l->args[0].reg, (int32_t)(((uint32_t)a >> l->args[2].imm)
+                                                 & (uint32_t)(((uint64_t)1 << l->args[3].imm) - 1)));
+            break;
+        case SIM_INS: {
+            uint32_t mask = (uint32_t)((((uint64_t)1 << l->args[3].imm) - 1) << l->args[2].imm);
+            set_reg(s, l->args[0].reg, (int32_t)(((uint32_t)reg(s, l, 0) & ~mask)
+                                                 | (((uint32_t)a << l->args[2].imm) & mask)));
+            break;
+        }
+        case SIM_MOVN:
+        case SIM_MOVZ:
+            if ((b != 0) == (inst->kind == SIM_MOVN)) {
+                set_reg(s, l->args[0].reg, a);
+            }
+            break;
+        case SIM_MULT:
+        case SIM_MULTU:
+            a = reg(s, l, 0);
+            b = reg(s, l, 1);
+            product = (inst->kind == SIM_MULT) ? (int64_t)a * b : (int64_t)((uint64_t)(uint32_t)a * (uint32_t)b);
+            s->regs[ASM_REG_LO] = (int32_t)product;
+            s->regs[ASM_REG_HI] = (int32_t)((uint64_t)product >> 32);
+            break;
+        case SIM_DIV:
+        case SIM_DIVU:
+            // the result of a division by zero is not defined, teq checks it
+            a = reg(s, l, 0);
+            b = reg(s, l, 1);
+            if (b == 0) {
+                break;
+            }
+            if (inst->kind == SIM_DIVU) {
+                s->regs[ASM_REG_LO] = (int32_t)((uint32_t)a / (uint32_t)b);
+                s->regs[ASM_REG_HI] = (int32_t)((uint32_t)a % (uint32_t)b);
+            } else if (a == INT32_MIN && b == -1) {
+                s->regs[ASM_REG_LO] = a;
+                s->regs[ASM_REG_HI] = 0;
+            } else {
+                s->regs[ASM_REG_LO] = a / b;
+                s->regs[ASM_REG_HI] = a % b;
+            }
+            break;
+        case SIM_MFHI:
+            set_reg(s, l->args[0].reg, s->regs[ASM_REG_HI]);
+            break;
+        case SIM_MFLO:
+            set_reg(s, l->args[0].reg, s->regs[ASM_REG_LO]);
+            break;
+        case SIM_LOAD:
+            addr = (uint32_t)s->regs[l->args[1].reg] + (uint32_t)l->args[1].imm;
+            data_access(s, addr);
+            set_reg(s, l->args[0].reg, read_mem(s, addr, asm_mem_width(l)));
+            break;
+        case SIM_STORE:
+            addr = (uint32_t)s->regs[l->args[1].reg] + (uint32_t)l->args[1].imm;
+            data_access(s, addr);
+            write_mem(s, addr, asm_mem_width(l), reg(s, l, 0));
+            break;
+        case SIM_BRANCH:
+            asm_eval_branch(l, reg(s, l, 0), reg(s, l, 1), &taken);
+            s->branches++;
+            if (taken) {
+                s->taken++;
+                s->backward += (inst->target <= k);
+                *target = inst->target;
+            }
+            break;
+        case SIM_JUMP:
+            s->jumps++;
+            *target = inst->target;
+            break;
+        case SIM_JAL:
+            // the return address is past the delay slot
+            s->calls++;
+            s->regs[31] = TEXT_START + 4 * (k + (opt_delay_slots ? 2 : 1));
+            *target = inst->target;
+            break;
+        case SIM_JR:
+            s->returns++;
+            *target = (int32_t)(((uint32_t)reg(s, l, 0) - TEXT_START) / 4);
+            if (*target < 0 || *target >= s->num_insts) {
+                fprintf(stderr, "Error: jump out of the text to 0x%08x\n", (uint32_t)reg(s, l, 0));
+                exit(1);
+            }
+            break;
+        case SIM_TEQ:
+            if (reg(s, l, 0) == reg(s, l, 1)) {
+                return -2;
+            }
+            break;
+        case SIM_SYSCALL:
+            switch (s->regs[2]) {
+                case 1:
+                    printf("%d", s->regs[4]);
+                    break;
+                case 4:
+                    for (addr = (uint32_t)s->regs[4]; read_mem(s, addr, 1) != 0; addr++) {
+                        putchar(read_mem(s, addr, 1));
+                    }
+                    break;
+                case 10:
+                    return -1;
+                case 11:
+                    putchar(s->regs[4] & 0xFF);
+                    break;
+                case 13:
+                    s->regs[2] = open_file(s, (uint32_t)s->regs[4], s->regs[5]);
+                    break;
+                case 15:
+                    s->regs[2] = write_file(s, s->regs[4], (uint32_t)s->regs[5], s->regs[6]);
+                    break;
+                case 16:
+                    if (s->regs[4] >= 3 && s->regs[4] < 3 + MAX_FILES && s->files[s->regs[4] - 3] != NULL) {
+                        fclose(s->files[s->regs[4] - 3]);
+                        s->files[s->regs[4] - 3] = NULL;
+                    }
+                    break;
+                default:
+                    fprintf(stderr, "Error: unknown syscall %d\n", s->regs[2]);
+                    exit(1);
+            }
+            break;
+        case SIM_NOP:
+            break;
+    }
+    if (*target >= 0) {
+        int32_t lost = get_branch_penalty() - (opt_delay_slots ? 1 : 0);
+        s->cycles += (lost > 0) ? lost : 0;
+        s->branch_stalls += (lost > 0) ? lost : 0;
+    }
+    return k + 1;
+}
+
+
+// report
+typedef struct _op_count_s {
+    const char * op;
+    int64_t count;
+} op_count_s;
+
+static int compare_counts(const void * a, const void * b) {
+    const op_count_s * x = a;
+    const op_count_s * y = b;
+
+    return (x->count != y->count) ? ((x->count < y->count) ? 1 : -1) : strcmp(x->op, y->op);
+}
+
+static double percent(int64_t part, int64_t total) {
+    return (total > 0) ? 100.0 * part / total : 0.0;
+}
+
+static void report(sim_s * s, const char * end) {
+    op_count_s * ops = calloc(s->num_insts + 1, sizeof(op_count_s));
+    int32_t num_ops = 0;
+
+    fprintf(stderr, "simulation: %s after %" PRId64 " instructions, %d in the text\n", end, s->steps, s->num_insts);
+    fprintf(stderr, "cycles: %" PRId64 " on %s (CPI %.2f), stalls: %" PRId64 " load-use, %" PRId64 " HI/LO, %" PRId64
+            " taken branches, %" PRId64 " cache misses\n", s->cycles, get_tune_name(),
+            (s->steps > 0) ? (double)s->cycles / s->steps : 0.0, s->load_stalls, s->hilo_stalls,
+            s->branch_stalls, s->miss_stalls);
+    fprintf(stderr, "branches: %" PRId64 " conditional, %" PRId64 " taken (%.1f%%, %" PRId64 " backward), %" PRId64
+            " jumps, %" PRId64 " calls, %" PRId64 " returns\n", s->branches, s->taken,
+            percent(s->taken, s->branches), s->backward, s->jumps, s->calls, s->returns);
+    fprintf(stderr, "icache: %d bytes, %d byte lines: %" PRId64 " accesses, %" PRId64 " misses (%.1f%%)\n",
+            get_cache_size(), s->icache.line_size, s->icache.accesses, s->icache.misses,
+            percent(s->icache.misses, s->icache.accesses));
+    fprintf(stderr, "dcache: %d bytes, %d byte lines: %" PRId64 " accesses, %" PRId64 " misses (%.1f%%)\n",
+            get_cache_size(), s->dcache.line_size, s->dcache.accesses, s->dcache.misses,
+            percent(s->dcache.misses, s->dcache.accesses));
+
+    for (int32_t k = 0; k < s->num_insts; k++) {
+        int32_t i;
+        for (i = 0; i < num_ops && strcmp(ops[i].op, s->insts[k].line->op) != 0; i++) {
+        }
+        if (i == num_ops) {
+            ops[num_ops].op = s->insts[k].line->op;
+            ops[num_ops++].count = 0;
+        }
+        ops[i].count += s->insts[k].count;
+    }
+    qsort(ops, num_ops, sizeof(op_count_s), compare_counts);
+    fprintf(stderr, "instructions by opcode:\n");
+    for (int32_t i = 0; i < num_ops && ops[i].count > 0; i++) {
+        fprintf(stderr, "    %-8s %12" PRId64 "  %5.1f%%\n", ops[i].op, ops[i].count, percent(ops[i].count, s->steps));
+    }
+    free(ops);
+}
+
+// runs the program of the file, returns the exit status of minicc
+int32_t simulate(const char * filename) {
+    asm_prog_s prog = { NULL, 0, 0 };
+    sim_s s;
+    int32_t k, target, delayed = -1;
+    int32_t status = 0;
+
+    asm_read(filename, &prog);
+    k = load(&s, &prog);
+    while (true) {
+        if (k < 0 || k >= s.num_insts) {
+            fflush(stdout);
+            fprintf(stderr, "Error: the program runs out of its text\n");
+            status = 1;
+            break;
+        }
+        if (s.steps++ == MAX_STEPS) {
+            fflush(stdout);
+            fprintf(stderr, "Error: more than %lld instructions, stopped\n", MAX_STEPS);
+            status = 1;
+            break;
+        }
+        k = step(&s, k, &target);
+        if (k == -1) {
+            break;
+        }
+        if (k == -2) {
+            fflush(stdout);
+            fprintf(stderr, "Error: trap, division by zero\n");
+            status = 1;
+            break;
+        }
+        // with delay slots, a transfer takes effect after the next instruction
+        if (opt_delay_slots) {
+            int32_t t = delayed;
+            delayed = target;
+            target = t;
+        }
+        if (target >= 0) {
+            k = target;
+        }
+    }
+    fflush(stdout);
+    report(&s, (status == 0) ? "exit" : "stopped");
+
+    free(s.insts);
+    free(s.data);
+    free(s.stack);
+    for (int32_t fd = 0; fd < MAX_FILES; fd++) {
+        if (s.files[fd] != NULL) {
+            fclose(s.files[fd]);
+        }
+    }
+    free(s.icache.tags);
+    free(s.dcache.tags);
+    asm_free(&prog);
+    return status;
+}
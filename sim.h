@@ -0,0 +1,12 @@
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include "defs.h"
+
+
+/* Built-in simulator, for -x */
+
+int32_t simulate(const char * filename);
+
+#endif
@@ -0,0 +1,535 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "optim.h"
+
+extern int trace_level;
+
+
+// Algebraic simplification.
+// Expressions are rewritten bottom-up by a table of rules. Each rule returns
+// the replacement of a node, or NULL when it does not apply. An operand is
+// only dropped when it has no side effect and cannot trap, so a division by
+// a possibly null divisor always survives.
+
+typedef node_t (*rule_fn)(node_t n);
+
+typedef struct _simplify_rule_s {
+    const char * name;
+    rule_fn apply;
+    int32_t fired;
+} simplify_rule_s;
+
+
+// helpers
+static bool is_int(node_t n, int32_t v) {
+    return n->nature == NODE_INTVAL && (int32_t)n->value == v;
+}
+
+static bool is_bool(node_t n, bool v) {
+    return n->nature == NODE_BOOLVAL && (n->value != 0) == v;
+}
+
+static bool is_constant(node_t n) {
+    return n->nature == NODE_INTVAL || n->nature == NODE_BOOLVAL;
+}
+
+static bool is_binary_op(node_t n) {
+    return (n->nature >= NODE_PLUS && n->nature <= NODE_BXOR)
+        || n->nature == NODE_SLL || n->nature == NODE_SRA || n->nature == NODE_SRL;
+}
+
+static bool is_compare(node_nature nature) {
+    return nature >= NODE_LT && nature <= NODE_NE;
+}
+
+// the value of n can be discarded
+static bool removable(node_t n) {
+    return !has_side_effect(n) && !may_trap(n);
+}
+
+static node_t with_line(node_t n, int32_t lineno) {
+    n->lineno = lineno;
+    return n;
+}
+
+// returns operand i of n, freeing the rest of n
+static node_t keep_operand(node_t n, int32_t i) {
+    node_t op = n->opr[i];
+    n->opr[i] = NULL;
+    free_nodes(n);
+    return op;
+}
+
+static node_t replace_by_int(node_t n, int32_t v) {
+    int32_t lineno = n->lineno;
+    free_nodes(n);
+    return with_line(make_int(v), lineno);
+}
+
+static node_t replace_by_bool(node_t n, bool v) {
+    int32_t lineno = n->lineno;
+    free_nodes(n);
+    return with_line(make_bool(v), lineno);
+}
+
+static node_t make_unary(node_nature nature, node_type type, node_t op, int32_t lineno) {
+    node_t n = make_node(nature, 1, op);
+    n->type = type;
+    return with_line(n, lineno);
+}
+
+static node_t make_binary(node_nature nature, node_type type, node_t l, node_t r, int32_t lineno) {
+    node_t n = make_node(nature, 2, l, r);
+    n->type = type;
+    return with_line(n, lineno);
+}
+
+// operand i of n under a unary operator, freeing the rest of n
+static node_t wrap_operand(node_t n, int32_t i, node_nature nature) {
+    int32_t lineno = n->lineno;
+    node_type type = n->opr[i]->type;
+    return make_unary(nature, type, keep_operand(n, i), lineno);
+}
+
+
+// constant folding
+static node_t rule_fold(node_t n) {
+    int32_t v;
+
+    if (!is_binary_op(n) && n->nature != NODE_NOT && n->nature != NODE_BNOT
+        && n->nature != NODE_UMINUS) {
+        return NULL;
+    }
+    for (int32_t i = 0; i < n->nops; i++) {
+        if (!is_constant(n->opr[i])) {
+            return NULL;
+        }
+    }
+    // a division by zero is left to trap at run time
+    if (!eval_const_expr(n, NULL, 0, &v)) {
+        return NULL;
+    }
+    return n->type == TYPE_BOOL ? replace_by_bool(n, v != 0) : replace_by_int(n, v);
+}
+
+// x + 0, x - 0, x * 1, x / 1, x | 0, x ^ 0, x & -1, x << 0, b && true, b || false
+static node_t rule_neutral(node_t n) {
+    if (n->nops != 2) {
+        return NULL;
+    }
+
+    node_t l = n->opr[0], r = n->opr[1];
+    switch (n->nature) {
+        case NODE_PLUS:
+        case NODE_BOR:
+        case NODE_BXOR:
+            if (is_int(r, 0)) return keep_operand(n, 0);
+            if (is_int(l, 0)) return keep_operand(n, 1);
+            break;
+        case NODE_MINUS:
+        case NODE_SLL:
+        case NODE_SRA:
+        case NODE_SRL:
+            if (is_int(r, 0)) return keep_operand(n, 0);
+            break;
+        case NODE_MUL:
+            if (is_int(r, 1)) return keep_operand(n, 0);
+            if (is_int(l, 1)) return keep_operand(n, 1);
+            break;
+        case NODE_DIV:
+            if (is_int(r, 1)) return keep_operand(n, 0);
+            break;
+        case NODE_BAND:
+            if (is_int(r, -1)) return keep_operand(n, 0);
+            if (is_int(l, -1)) return keep_operand(n, 1);
+            break;
+        case NODE_AND:
+            if (is_bool(r, true)) return keep_operand(n, 0);
+            if (is_bool(l, true)) return keep_operand(n, 1);
+            break;
+        case NODE_OR:
+            if (is_bool(r, false)) return keep_operand(n, 0);
+            if (is_bool(l, false)) return keep_operand(n, 1);
+            break;
+        default:
+            break;
+    }
+    return NULL;
+}
+
+// x * 0, x & 0, x | -1, x % 1, b && false, b || true
+static node_t rule_absorb(node_t n) {
+    if (n->nops != 2) {
+        return NULL;
+    }
+
+    node_t l = n->opr[0], r = n->opr[1];
+    switch (n->nature) {
+        case NODE_MUL:
+        case NODE_BAND:
+            if ((is_int(r, 0) && removable(l)) || (is_int(l, 0) && removable(r))) {
+                return replace_by_int(n, 0);
+            }
+            break;
+        case NODE_BOR:
+            if ((is_int(r, -1) && removable(l)) || (is_int(l, -1) && removable(r))) {
+                return replace_by_int(n, -1);
+            }
+            break;
+        case NODE_MOD:
+            if (is_int(r, 1) && removable(l)) {
+                return replace_by_int(n, 0);
+            }
+            break;
+        case NODE_AND:
+            if ((is_bool(r, false) && removable(l)) || (is_bool(l, false) && removable(r))) {
+                return replace_by_bool(n, false);
+            }
+            break;
+        case NODE_OR:
+            if ((is_bool(r, true) && removable(l)) || (is_bool(l, true) && removable(r))) {
+                return replace_by_bool(n, true);
+            }
+            break;
+        default:
+            break;
+    }
+    return NULL;
+}
+
+// x - x, x ^ x, x & x, x | x, x == x, x < x...
+static node_t rule_self(node_t n) {
+    if (n->nops != 2 || !same_tree(n->opr[0], n->opr[1]) || !removable(n->opr[0])) {
+        return NULL;
+    }
+
+    switch (n->nature) {
+        case NODE_MINUS:
+        case NODE_BXOR:
+            return replace_by_int(n, 0);
+        case NODE_BAND:
+        case NODE_BOR:
+        case NODE_AND:
+        case NODE_OR:
+            return keep_operand(n, 0);
+        case NODE_EQ:
+        case NODE_LE:
+        case NODE_GE:
+            return replace_by_bool(n, true);
+        case NODE_NE:
+        case NODE_LT:
+        case NODE_GT:
+            return replace_by_bool(n, false);
+        default:
+            return NULL;
+    }
+}
+
+// !!b, ~~x, -(-x)
+static node_t rule_involution(node_t n) {
+    if ((n->nature == NODE_NOT || n->nature == NODE_BNOT || n->nature == NODE_UMINUS)
+        && n->opr[0]->nature == n->nature) {
+        node_t inner = keep_operand(n, 0);
+        return keep_operand(inner, 0);
+    }
+    return NULL;
+}
+
+// 0 - x, x * -1
+static node_t rule_negate(node_t n) {
+    if (n->nature == NODE_MINUS && is_int(n->opr[0], 0)) {
+        return wrap_operand(n, 1, NODE_UMINUS);
+    }
+    if (n->nature == NODE_MUL && is_int(n->opr[1], -1)) {
+        return wrap_operand(n, 0, NODE_UMINUS);
+    }
+    if (n->nature == NODE_MUL && is_int(n->opr[0], -1)) {
+        return wrap_operand(n, 1, NODE_UMINUS);
+    }
+    return NULL;
+}
+
+// b == true, b == false, b != true, b != false
+static node_t rule_bool_compare(node_t n) {
+    if ((n->nature != NODE_EQ && n->nature != NODE_NE) || n->opr[0]->type != TYPE_BOOL) {
+        return NULL;
+    }
+
+    int32_t k = n->opr[1]->nature == NODE_BOOLVAL ? 1
+              : n->opr[0]->nature == NODE_BOOLVAL ? 0 : -1;
+    if (k < 0) {
+        return NULL;
+    }
+    // the comparison holds when b equals "keep"
+    bool keep = (n->opr[k]->value != 0) == (n->nature == NODE_EQ);
+    return keep ? keep_operand(n, 1 - k) : wrap_operand(n, 1 - k, NODE_NOT);
+}
+
+// !(a < b) -> a >= b, !(a == b) -> a != b...
+static node_t rule_not_compare(node_t n) {
+    static const node_nature inverse[] = {
+        [NODE_LT] = NODE_GE, [NODE_GT] = NODE_LE, [NODE_LE] = NODE_GT,
+        [NODE_GE] = NODE_LT, [NODE_EQ] = NODE_NE, [NODE_NE] = NODE_EQ,
+    };
+
+    if (n->nature != NODE_NOT || !is_compare(n->opr[0]->nature)) {
+        return NULL;
+    }
+    node_t cmp = keep_operand(n, 0);
+    cmp->nature = inverse[cmp->nature];
+    return cmp;
+}
+
+// constants go to the right of comparisons and commutative operators
+static node_t rule_canonical(node_t n) {
+    static const node_nature mirror[] = {
+        [NODE_LT] = NODE_GT, [NODE_GT] = NODE_LT, [NODE_LE] = NODE_GE,
+        [NODE_GE] = NODE_LE, [NODE_EQ] = NODE_EQ, [NODE_NE] = NODE_NE,
+    };
+
+    if (n->nops != 2 || !is_constant(n->opr[0]) || is_constant(n->opr[1])) {
+        return NULL;
+    }
+
+    switch (n->nature) {
+        case NODE_LT: case NODE_GT: case NODE_LE: case NODE_GE: case NODE_EQ: case NODE_NE:
+            n->nature = mirror[n->nature];
+            break;
+        case NODE_PLUS: case NODE_MUL: case NODE_BAND: case NODE_BOR: case NODE_BXOR:
+        case NODE_AND: case NODE_OR:
+            break;
+        default:
+            return NULL;
+    }
+    node_t tmp = n->opr[0];
+    n->opr[0] = n->opr[1];
+    n->opr[1] = tmp;
+    return n;
+}
+
+// x * 2^k -> x << k
+static node_t rule_mul_pow2(node_t n) {
+    if (n->nature != NODE_MUL || n->opr[1]->nature != NODE_INTVAL) {
+        return NULL;
+    }
+
+    uint32_t v = (uint32_t)n->opr[1]->value;
+    if (v < 2 || (v & (v - 1)) != 0) {
+        return NULL;
+    }
+    int32_t k = 0;
+    while ((1u << k) != v) {
+        k++;
+    }
+    n->nature = NODE_SLL;
+    n->opr[1]->value = k;
+    return n;
+}
+
+
+// reassociation
+typedef struct _term_s {
+    node_t expr;
+    bool negated;
+} term_s;
+
+typedef struct _terms_s {
+    term_s * terms;
+    int32_t size;
+    int32_t capacity;
+    int32_t constants;
+    uint32_t sum;          // constants combined with the operator
+} terms_s;
+
+static void add_term(terms_s * t, node_t expr, bool negated) {
+    if (t->size == t->capacity) {
+        t->capacity = t->capacity ? 2 * t->capacity : 8;
+        t->terms = realloc(t->terms, t->capacity * sizeof(term_s));
+    }
+    t->terms[t->size].expr = expr;
+    t->terms[t->size].negated = negated;
+    t->size++;
+}
+
+static uint32_t combine(node_nature nature, uint32_t a, uint32_t b) {
+    switch (nature) {
+        case NODE_MUL:  return a * b;
+        case NODE_BAND: return a & b;
+        case NODE_BOR:  return a | b;
+        case NODE_BXOR: return a ^ b;
+        default:        return a + b;
+    }
+}
+
+// operands of a chain of the same operator (of + and - for additions), in order
+static void flatten(node_t n, node_nature nature, bool negated, terms_s * t) {
+    bool additive = (nature == NODE_PLUS);
+
+    if (n->type == TYPE_INT && (n->nature == nature || (additive && n->nature == NODE_MINUS))) {
+        flatten(n->opr[0], nature, negated, t);
+        flatten(n->opr[1], nature, negated != (n->nature == NODE_MINUS), t);
+        return;
+    }
+    if (n->nature == NODE_INTVAL) {
+        uint32_t v = (uint32_t)n->value;
+        t->sum = combine(nature, t->sum, negated ? 0u - v : v);
+        t->constants++;
+        return;
+    }
+    add_term(t, n, negated);
+}
+
+// removes pairs x and -x of pure terms; returns the number of pairs
+static int32_t cancel_terms(terms_s * t) {
+    int32_t cancelled = 0;
+
+    for (int32_t i = 0; i < t->size; i++) {
+        if (t->terms[i].expr == NULL || !removable(t->terms[i].expr)) {
+            continue;
+        }
+        for (int32_t j = i + 1; j < t->size; j++) {
+            if (t->terms[j].expr != NULL && t->terms[j].negated != t->terms[i].negated
+                && same_tree(t->terms[i].expr, t->terms[j].expr)) {
+                t->terms[i].expr = NULL;
+                t->terms[j].expr = NULL;
+                cancelled++;
+                break;
+            }
+        }
+    }
+    return cancelled;
+}
+
+static node_t rule_reassociate(node_t n) {
+    node_nature nature = (n->nature == NODE_MINUS) ? NODE_PLUS : n->nature;
+    terms_s t = { NULL, 0, 0, 0, 0 };
+    int32_t lineno = n->lineno, i;
+    node_t result = NULL;
+
+    if (n->type != TYPE_INT || (nature != NODE_PLUS && nature != NODE_MUL
+                                && nature != NODE_BAND && nature != NODE_BOR && nature != NODE_BXOR)) {
+        return NULL;
+    }
+
+    // neutral elements of the chain
+    t.sum = (nature == NODE_MUL) ? 1u : (nature == NODE_BAND) ? ~0u : 0u;
+    flatten(n, nature, false, &t);
+
+    // a term with a side effect, such as an assignment, may change what the
+    // others read: the chain is left in its order
+    for (i = 0; i < t.size; i++) {
+        if (has_side_effect(t.terms[i].expr)) {
+            free(t.terms);
+            return NULL;
+        }
+    }
+
+    int32_t cancelled = (nature == NODE_PLUS) ? cancel_terms(&t) : 0;
+    if (t.constants < 2 && cancelled == 0) {
+        free(t.terms);
+        return NULL;
+    }
+
+    // detach the kept terms, then rebuild left to right with the constant last
+    for (i = 0; i < t.size; i++) {
+        if (t.terms[i].expr != NULL) {
+            t.terms[i].expr = copy_tree(t.terms[i].expr);
+        }
+    }
+    free_nodes(n);
+
+    for (i = 0; i < t.size; i++) {
+        node_t e = t.terms[i].expr;
+        if (e == NULL) {
+            continue;
+        }
+        if (result == NULL) {
+            result = t.terms[i].negated ? make_unary(NODE_UMINUS, TYPE_INT, e, lineno) : e;
+        } else {
+            node_nature op = (nature != NODE_PLUS) ? nature : t.terms[i].negated ? NODE_MINUS : NODE_PLUS;
+            result = make_binary(op, TYPE_INT, result, e, lineno);
+        }
+    }
+    free(t.terms);
+
+    int32_t c = (int32_t)t.sum;
+    if (result == NULL) {
+        return with_line(make_int(c), lineno);
+    }
+    if (nature == NODE_PLUS && c < 0 && c != INT32_MIN) {
+        return make_binary(NODE_MINUS, TYPE_INT, result, make_int(-c), lineno);
+    }
+    return make_binary(nature, TYPE_INT, result, make_int(c), lineno);
+}
+
+
+// rule table, tried in order on every operator node
+static simplify_rule_s rules[] = {
+    { "fold", rule_fold, 0 },
+    { "neutral", rule_neutral, 0 },
+    { "absorb", rule_absorb, 0 },
+    { "self", rule_self, 0 },
+    { "involution", rule_involution, 0 },
+    { "negate", rule_negate, 0 },
+    { "bool-compare", rule_bool_compare, 0 },
+    { "not-compare", rule_not_compare, 0 },
+    { "canonical", rule_canonical, 0 },
+    { "reassociate", rule_reassociate, 0 },
+    { "mul-pow2", rule_mul_pow2, 0 },
+};
+
+#define NUM_RULES ((int32_t)(sizeof(rules) / sizeof(rules[0])))
+
+// rules may fire again on their own result; a bound keeps this finite
+#define MAX_REWRITES 16
+
+static void simplify_node(node_t * pn) {
+    node_t n = *pn;
+
+    if (n == NULL) {
+        return;
+    }
+    for (int32_t i = 0; i < n->nops; i++) {
+        simplify_node(&n->opr[i]);
+    }
+
+    // only operators are rewritten, statements and leaves are kept as is
+    if (n->nature < NODE_PLUS || n->nature > NODE_UMINUS) {
+        return;
+    }
+
+    for (int32_t count = 0; count < MAX_REWRITES; count++) {
+        node_t r = NULL;
+        int32_t i;
+        for (i = 0; i < NUM_RULES && r == NULL; i++) {
+            r = rules[i].apply(n);
+        }
+        if (r == NULL) {
+            break;
+        }
+        rules[i - 1].fired++;
+        n = r;
+        // a rebuilt chain may expose rules on its inner nodes
+        for (int32_t j = 0; j < n->nops; j++) {
+            simplify_node(&n->opr[j]);
+        }
+    }
+    *pn = n;
+}
+
+void simplify_tree(node_t root) {
+    node_t func = root->opr[1];
+    simplify_node(&func->opr[2]);
+
+    for (int32_t i = 0; i < NUM_RULES; i++) {
+        if (rules[i].fired > 0) {
+            printf_level(2, "simplify: %s fired %d times\n", rules[i].name, rules[i].fired);
+            rules[i].fired = 0;
+        }
+    }
+}
@@ -0,0 +1,309 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "arch.h"
+#include "optim.h"
+#include "asm.h"
+#include "stats.h"
+
+
+// Code generation statistics.
+// With -fstats, or -fstats-json for a JSON object, the code of passe_2 is
+// described on stderr block by block, before the assembly passes change
+// it. A block is main, then each { } of the source, its counts leaving out
+// the blocks nested in it. passe_2 counts the values it saves on the stack
+// when no register is left and reloads, and how many are saved at once,
+// and marks with a comment where the code of each block starts and where
+// the one of the enclosing block resumes. When the program is read back,
+// each instruction goes to the block of the mark before it: counts by
+// opcode, loads and stores off $29 (locals and spills) or another base
+// (globals), labels, branches and jumps; then the marks are removed.
+
+typedef struct _op_count_s {
+    char op[8];
+    int32_t count;
+} op_count_s;
+
+typedef struct _block_stats_s {
+    int32_t parent;             // enclosing block, -1 for main
+    int32_t depth;
+    int32_t first_line;
+    int32_t last_line;
+    int32_t spills;
+    int32_t reloads;
+    int32_t peak;               // most values saved at once in the block
+    int32_t insts;
+    int32_t stack_loads;
+    int32_t stack_stores;
+    int32_t global_loads;
+    int32_t global_stores;
+    int32_t labels;
+    int32_t branches;
+    int32_t jumps;
+    op_count_s * ops;
+    int32_t num_ops;
+} block_stats_s;
+
+static block_stats_s * blocks = NULL;
+static int32_t num_blocks = 0;
+static int32_t capacity = 0;
+static int32_t current = -1;
+static int32_t saved = 0;               // values on the stack now
+static int32_t frame_size = 0;
+static int32_t temporaries = 0;
+
+
+// from passe_2
+static void line_range(node_t n, int32_t * first, int32_t * last) {
+    if (n == NULL) {
+        return;
+    }
+    if (n->lineno > 0 && (*first == 0 || n->lineno < *first)) {
+        *first = n->lineno;
+    }
+    if (n->lineno > *last) {
+        *last = n->lineno;
+    }
+    for (int32_t i = 0; i < n->nops; i++) {
+        line_range(n->opr[i], first, last);
+    }
+}
+
+// the code of block follows, returns the number of its mark
+int32_t stats_enter_block(node_t block) {
+    block_stats_s * b;
+
+    if (num_blocks == capacity) {
+        capacity = capacity ? 2 * capacity : 16;
+        blocks = realloc(blocks, capacity * sizeof(block_stats_s));
+    }
+    b = &blocks[num_blocks];
+    memset(b, 0, sizeof(block_stats_s));
+    b->parent = current;
+    b->depth = (current >= 0) ? blocks[current].depth + 1 : 0;
+    line_range(block, &b->first_line, &b->last_line);
+    current = num_blocks++;
+    return current;
+}
+
+// the code of the enclosing block resumes, returns its mark or -1
+int32_t stats_leave_block(void) {
+    current = (current >= 0) ? blocks[current].parent : -1;
+    return current;
+}
+
+void stats_spill(void) {
+    saved++;
+    if (current >= 0) {
+        blocks[current].spills++;
+        if (saved > blocks[current].peak) {
+            blocks[current].peak = saved;
+        }
+    }
+}
+
+void stats_reload(void) {
+    saved--;
+    if (current >= 0) {
+        blocks[current].reloads++;
+    }
+}
+
+// frame of main, and the bytes of it taken by the saved values
+void stats_frame(int32_t size, int32_t temp_bytes) {
+    frame_size = size;
+    temporaries = temp_bytes;
+}
+
+
+// counting
+static void count_op(block_stats_s * b, const char * op, int32_t count) {
+    int32_t i;
+
+    for (i = 0; i < b->num_ops && strcmp(b->ops[i].op, op) != 0; i++) {
+    }
+    if (i == b->num_ops) {
+        b->ops = realloc(b->ops, (b->num_ops + 1) * sizeof(op_count_s));
+        snprintf(b->ops[i].op, sizeof(b->ops[i].op), "%s", op);
+        b->ops[i].count = 0;
+        b->num_ops++;
+    }
+    b->ops[i].count += count;
+}
+
+static void count_inst(block_stats_s * b, asm_line_s * l) {
+    uint32_t flags = asm_op_flags(l);
+
+    b->insts++;
+    count_op(b, l->op, 1);
+    if (flags & (ASM_OP_LOAD | ASM_OP_STORE)) {
+        bool stack = false;
+        for (int32_t k = 0; k < l->nargs; k++) {
+            stack |= (l->args[k].kind == ASM_ARG_MEM && l->args[k].reg == get_stack_reg());
+        }
+        if (flags & ASM_OP_LOAD) {
+            b->stack_loads += stack;
+            b->global_loads += !stack;
+        } else {
+            b->stack_stores += stack;
+            b->global_stores += !stack;
+        }
+    }
+    b->branches += (flags & ASM_OP_BRANCH) != 0;
+    b->jumps += (flags & ASM_OP_JUMP) != 0;
+}
+
+// "# block <n>", or -1
+static int32_t block_mark(asm_line_s * l) {
+    const char * s = (l->kind == ASM_LINE_TEXT) ? strstr(l->text, "# block ") : NULL;
+    int32_t n;
+
+    if (s == NULL || sscanf(s, "# block %d", &n) != 1 || n < 0 || n >= num_blocks) {
+        return -1;
+    }
+    return n;
+}
+
+
+// report
+static int compare_counts(const void * a, const void * b) {
+    const op_count_s * x = a;
+    const op_count_s * y = b;
+
+    return (x->count != y->count) ? ((x->count < y->count) ? 1 : -1) : strcmp(x->op, y->op);
+}
+
+// counts by opcode of all the blocks, the most frequent first
+static op_count_s * total_ops(int32_t * num) {
+    block_stats_s total;
+
+    memset(&total, 0, sizeof(total));
+    for (int32_t i = 0; i < num_blocks; i++) {
+        for (int32_t k = 0; k < blocks[i].num_ops; k++) {
+            count_op(&total, blocks[i].ops[k].op, blocks[i].ops[k].count);
+        }
+    }
+    qsort(total.ops, total.num_ops, sizeof(op_count_s), compare_counts);
+    *num = total.num_ops;
+    return total.ops;
+}
+
+static void print_ops(const char * before, op_count_s * ops, int32_t num, bool json) {
+    fprintf(stderr, "%s", before);
+    for (int32_t k = 0; k < num; k++) {
+        if (json) {
+            fprintf(stderr, "%s\"%s\": %d", (k > 0) ? ", " : "", ops[k].op, ops[k].count);
+        } else {
+            fprintf(stderr, "%s%s %d", (k > 0) ? ", " : "", ops[k].op, ops[k].count);
+        }
+    }
+}
+
+static void print_text(int32_t data_size, int32_t insts, int32_t spills, int32_t reloads, int32_t peak) {
+    op_count_s * ops;
+    int32_t num_ops;
+
+    fprintf(stderr, "codegen statistics: %d registers, frame %d bytes (%d of saved values), data %d bytes\n",
+            get_num_registers(), frame_size, temporaries, data_size);
+    fprintf(stderr, "%d instructions, %d spills, %d reloads, at most %d values saved at once\n",
+            insts, spills, reloads, peak);
+    fprintf(stderr, "%-16s %-9s %6s %6s %7s %4s %9s %9s %6s %8s %5s\n", "block", "lines", "insts", "spills",
+            "reloads", "peak", "stack l/s", "globl l/s", "labels", "branches", "jumps");
+    for (int32_t i = 0; i < num_blocks; i++) {
+        block_stats_s * b = &blocks[i];
+        char name[32], lines[24], stack[16], global[16];
+
+        snprintf(name, sizeof(name), "%*s%s", 2 * b->depth, "", (i == 0) ? "main" : "block");
+        snprintf(lines, sizeof(lines), "%d-%d", b->first_line, b->last_line);
+        snprintf(stack, sizeof(stack), "%d/%d", b->stack_loads, b->stack_stores);
+        snprintf(global, sizeof(global), "%d/%d", b->global_loads, b->global_stores);
+        fprintf(stderr, "%-16s %-9s %6d %6d %7d %4d %9s %9s %6d %8d %5d\n", name, lines, b->insts, b->spills,
+                b->reloads, b->peak, stack, global, b->labels, b->branches, b->jumps);
+        qsort(b->ops, b->num_ops, sizeof(op_count_s), compare_counts);
+        print_ops("                 ", b->ops, b->num_ops, false);
+        fprintf(stderr, "\n");
+    }
+    ops = total_ops(&num_ops);
+    print_ops("instructions by opcode: ", ops, num_ops, false);
+    fprintf(stderr, "\n");
+    free(ops);
+}
+
+static void print_json(int32_t data_size, int32_t insts, int32_t spills, int32_t reloads, int32_t peak) {
+    op_count_s * ops;
+    int32_t num_ops;
+
+    fprintf(stderr, "{\n");
+    fprintf(stderr, "  \"registers\": %d,\n  \"frame\": %d,\n  \"temporaries\": %d,\n  \"data\": %d,\n",
+            get_num_registers(), frame_size, temporaries, data_size);
+    fprintf(stderr, "  \"instructions\": %d,\n  \"spills\": %d,\n  \"reloads\": %d,\n  \"peak\": %d,\n",
+            insts, spills, reloads, peak);
+    ops = total_ops(&num_ops);
+    print_ops("  \"opcodes\": {", ops, num_ops, true);
+    fprintf(stderr, "},\n  \"blocks\": [\n");
+    free(ops);
+    for (int32_t i = 0; i < num_blocks; i++) {
+        block_stats_s * b = &blocks[i];
+
+        fprintf(stderr, "    {\"id\": %d, \"parent\": %d, \"kind\": \"%s\", \"first_line\": %d, \"last_line\": %d, ",
+                i, b->parent, (i == 0) ? "function" : "block", b->first_line, b->last_line);
+        fprintf(stderr, "\"instructions\": %d, \"spills\": %d, \"reloads\": %d, \"peak\": %d, ",
+                b->insts, b->spills, b->reloads, b->peak);
+        fprintf(stderr, "\"stack_loads\": %d, \"stack_stores\": %d, \"global_loads\": %d, \"global_stores\": %d, ",
+                b->stack_loads, b->stack_stores, b->global_loads, b->global_stores);
+        fprintf(stderr, "\"labels\": %d, \"branches\": %d, \"jumps\": %d, ", b->labels, b->branches, b->jumps);
+        qsort(b->ops, b->num_ops, sizeof(op_count_s), compare_counts);
+        print_ops("\"opcodes\": {", b->ops, b->num_ops, true);
+        fprintf(stderr, "}}%s\n", (i + 1 < num_blocks) ? "," : "");
+    }
+    fprintf(stderr, "  ]\n}\n");
+}
+
+// counts the program as written by passe_2 and removes the marks
+bool stats_asm(asm_prog_s * prog) {
+    int32_t block = -1, insts = 0, spills = 0, reloads = 0, peak = 0;
+    bool changed = false;
+
+    for (int32_t i = 0; i < prog->size; i++) {
+        asm_line_s * l = &prog->lines[i];
+        int32_t mark = block_mark(l);
+
+        if (mark >= 0) {
+            block = mark;
+            asm_remove(prog, i--);
+            changed = true;
+        } else if (block >= 0 && l->kind == ASM_LINE_INST) {
+            count_inst(&blocks[block], l);
+        } else if (block >= 0 && l->kind == ASM_LINE_LABEL) {
+            blocks[block].labels++;
+        }
+    }
+
+    for (int32_t i = 0; i < num_blocks; i++) {
+        insts += blocks[i].insts;
+        spills += blocks[i].spills;
+        reloads += blocks[i].reloads;
+        peak = (blocks[i].peak > peak) ? blocks[i].peak : peak;
+    }
+    if (opt_stats_json) {
+        print_json(asm_data_size(prog), insts, spills, reloads, peak);
+    } else {
+        print_text(asm_data_size(prog), insts, spills, reloads, peak);
+    }
+
+    for (int32_t i = 0; i < num_blocks; i++) {
+        free(blocks[i].ops);
+    }
+    free(blocks);
+    blocks = NULL;
+    num_blocks = 0;
+    capacity = 0;
+    current = -1;
+    saved = 0;
+    return changed;
+}
@@ -0,0 +1,18 @@
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include "defs.h"
+#include "asm.h"
+
+
+/* Code generation statistics, for -fstats and -fstats-json */
+
+int32_t stats_enter_block(node_t block);
+int32_t stats_leave_block(void);
+void stats_spill(void);
+void stats_reload(void);
+void stats_frame(int32_t frame_size, int32_t temporaries);
+bool stats_asm(asm_prog_s * prog);
+
+#endif
@@ -0,0 +1,207 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "asm.h"
+
+extern int trace_level;
+
+
+// Tail merging and hoisting.
+// The arms of an if/else often end or begin with the same instructions,
+// like the syscall of a print or the store of an assigned variable. When
+// the instruction before a j to a label is the same as one before another
+// entry of that label, it is removed and the jump goes to the other copy,
+// in front of which a label is added. When both arms start with the same
+// instruction, not writing a register read by the branch, it is moved
+// above the branch. Registers of passe_2 stay dead across labels and
+// branches, as the later passes expect.
+
+static int32_t num_merged;
+static int32_t num_hoisted;
+
+
+static bool same_inst(asm_line_s * a, asm_line_s * b) {
+    if (a->kind != ASM_LINE_INST || b->kind != ASM_LINE_INST || strcmp(a->op, b->op) != 0
+        || a->nargs != b->nargs) {
+        return false;
+    }
+    for (int32_t i = 0; i < a->nargs; i++) {
+        asm_arg_s * x = &a->args[i];
+        asm_arg_s * y = &b->args[i];
+        if (x->kind != y->kind || x->reg != y->reg || x->imm != y->imm
+            || (x->kind == ASM_ARG_LABEL && strcmp(x->label, y->label) != 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int32_t prev_line(asm_prog_s * prog, int32_t i) {
+    for (i--; i >= 0 && prog->lines[i].kind == ASM_LINE_TEXT; i--) {
+    }
+    return i;
+}
+
+static int32_t next_line(asm_prog_s * prog, int32_t i) {
+    for (i++; i < prog->size && prog->lines[i].kind == ASM_LINE_TEXT; i++) {
+    }
+    return i;
+}
+
+static bool ends_flow(asm_line_s * l) {
+    return asm_is_inst(l, "j") || asm_is_inst(l, "jr");
+}
+
+// number of identical instructions before the lines a and b, in the same
+// block; the values of passe_2 are not kept across a label, so the shared
+// part must not read a register of ASM_SCRATCH_REGS before writing it, and
+// buffer-output expects the service number just before a syscall
+static int32_t common_tail(asm_prog_s * prog, int32_t a, int32_t b) {
+    int32_t n = 0;
+    int32_t best = 0;
+    asm_regs live = 0;
+
+    while (true) {
+        a = prev_line(prog, a);
+        b = prev_line(prog, b);
+        if (a < 0 || b < 0 || a == b || !same_inst(&prog->lines[a], &prog->lines[b])
+            || ends_flow(&prog->lines[a]) || asm_is_inst(&prog->lines[a], "jal")) {
+            break;
+        }
+        n++;
+        live = (live & ~asm_defs(&prog->lines[a])) | asm_uses(&prog->lines[a]);
+        if ((live & ASM_SCRATCH_REGS) == 0 && !asm_is_inst(&prog->lines[a], "syscall")) {
+            best = n;
+        }
+    }
+    return best;
+}
+
+// the other entry of the label of the jump at line i sharing the longest
+// tail with it: the fall through into the label or another jump to it
+static int32_t find_partner(asm_prog_s * prog, int32_t i, int32_t * length) {
+    const char * label = asm_target(&prog->lines[i]);
+    int32_t pos = asm_find_label(prog, label);
+    int32_t partner = -1;
+    int32_t p;
+
+    *length = 0;
+    if (pos < 0) {
+        return -1;
+    }
+    p = prev_line(prog, pos);
+    if (p >= 0 && prog->lines[p].kind == ASM_LINE_INST && !ends_flow(&prog->lines[p])) {
+        *length = common_tail(prog, i, pos);
+        partner = pos;
+    }
+    for (int32_t j = 0; j < prog->size; j++) {
+        if (j != i && asm_is_inst(&prog->lines[j], "j") && strcmp(asm_target(&prog->lines[j]), label) == 0) {
+            int32_t n = common_tail(prog, i, j);
+            if (n > *length) {
+                *length = n;
+                partner = j;
+            }
+        }
+    }
+    return (*length > 0) ? partner : -1;
+}
+
+// the j at line i: its tail is removed and it jumps to the copy of the
+// partner, in front of which a label is added
+static void merge_tail(asm_prog_s * prog, int32_t * i) {
+    char name[32];
+    int32_t partner, length;
+    int32_t cut;
+
+    partner = find_partner(prog, *i, &length);
+    if (partner < 0) {
+        return;
+    }
+    cut = partner;
+    for (int32_t n = 0; n < length; n++) {
+        cut = prev_line(prog, cut);
+    }
+    int32_t p = prev_line(prog, cut);
+    if (p >= 0 && prog->lines[p].kind == ASM_LINE_LABEL) {
+        snprintf(name, sizeof(name), "%s", prog->lines[p].text);
+    } else {
+        asm_new_label(prog, name, sizeof(name));
+        asm_insert(prog, cut, "%s:", name);
+        if (cut <= *i) {
+            (*i)++;
+        }
+    }
+    asm_set_target(&prog->lines[*i], name);
+    for (int32_t n = 0; n < length; n++) {
+        asm_remove(prog, prev_line(prog, *i));
+        (*i)--;
+    }
+    num_merged += length;
+}
+
+// the branch at line i, when its target is only reached from it
+static bool hoist_head(asm_prog_s * prog, int32_t i) {
+    asm_line_s * branch = &prog->lines[i];
+    const char * label = asm_target(branch);
+    int32_t pos = asm_find_label(prog, label);
+    int32_t p, x, y;
+
+    if (pos < 0 || pos < i) {
+        return false;
+    }
+    p = prev_line(prog, pos);
+    if (p < 0 || !ends_flow(&prog->lines[p])) {
+        return false;
+    }
+    for (int32_t j = 0; j < prog->size; j++) {
+        if (j != i && prog->lines[j].kind == ASM_LINE_INST && asm_target(&prog->lines[j]) != NULL
+            && strcmp(asm_target(&prog->lines[j]), label) == 0) {
+            return false;
+        }
+    }
+    x = next_line(prog, i);
+    y = next_line(prog, pos);
+    if (y >= prog->size || next_line(prog, x) >= prog->size || !same_inst(&prog->lines[x], &prog->lines[y])
+        || asm_is_boundary(&prog->lines[x]) || asm_is_inst(&prog->lines[x], "syscall")
+        || asm_is_inst(&prog->lines[next_line(prog, x)], "syscall")
+        || (asm_defs(&prog->lines[x]) & (asm_uses(branch) | ASM_SCRATCH_REGS)) != 0) {
+        return false;
+    }
+
+    asm_line_s moved = prog->lines[x];
+    memmove(&prog->lines[i + 1], &prog->lines[i], (x - i) * sizeof(asm_line_s));
+    prog->lines[i] = moved;
+    asm_remove(prog, y);
+    num_hoisted++;
+    return true;
+}
+
+bool merge_tails_asm(asm_prog_s * prog) {
+    int32_t text = asm_find_directive(prog, ".text");
+
+    num_merged = 0;
+    num_hoisted = 0;
+    if (text < 0) {
+        return false;
+    }
+
+    for (int32_t i = text; i < prog->size; i++) {
+        asm_line_s * l = &prog->lines[i];
+
+        if (asm_is_inst(l, "j")) {
+            merge_tail(prog, &i);
+        } else if (asm_op_flags(l) & ASM_OP_BRANCH) {
+            while (hoist_head(prog, i)) {
+                i++;
+            }
+        }
+    }
+    printf_level(2, "merge-tails: %d instructions merged into a join, %d hoisted above a branch\n",
+                 num_merged, num_hoisted);
+    return num_merged + num_hoisted > 0;
+}
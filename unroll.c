@@ -0,0 +1,201 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "optim.h"
+
+
+// Loop unrolling of counted for-loops:
+//     for (i = init; i rel bound; i = i + step) body
+// where bound is invariant and body does not write i. With a constant trip
+// count that fits in the size budget the loop is fully unrolled, with i
+// replaced by its value in each copy. Otherwise the body is replicated
+// unroll-factor times in a main loop, followed by the original loop for the
+// remaining iterations. With -fprofile-use, a loop never reached is left
+// alone, and so is one running fewer iterations than the factor each time.
+
+static void subst_var(node_t * pn, node_t var, int32_t value) {
+    node_t n = *pn;
+
+    if (n == NULL) {
+        return;
+    }
+    if (is_var(n, var)) {
+        node_t c = make_int(value);
+        c->lineno = n->lineno;
+        free_nodes(n);
+        *pn = c;
+        return;
+    }
+    for (int32_t i = 0; i < n->nops; i++) {
+        subst_var(&n->opr[i], var, value);
+    }
+}
+
+static node_t append(node_t list, node_t elem) {
+    return list == NULL ? elem : list_append(list, elem);
+}
+
+static node_t make_binop(node_nature nature, node_type type, node_t l, node_t r) {
+    node_t n = make_node(nature, 2, l, r);
+    n->type = type;
+    n->lineno = l->lineno;
+    return n;
+}
+
+
+// full unrolling: one copy of the body per iteration, i replaced by its value
+static node_t full_unroll(node_t loop, counted_loop_s * cl, int32_t count, int32_t last) {
+    node_t list = loop->opr[0];
+    int32_t i;
+
+    eval_const_expr(loop->opr[0]->opr[1], NULL, 0, &i);
+    for (int32_t n = 0; n < count; n++) {
+        node_t copy = copy_instr(loop->opr[3]);
+        subst_var(&copy, cl->var, i);
+        list = append(list, copy);
+        i = (int32_t)((uint32_t)i + (uint32_t)cl->step);
+    }
+
+    node_t final = make_binop(NODE_AFFECT, TYPE_INT, make_ref(cl->var), make_int(last));
+    list = append(list, final);
+
+    loop->opr[0] = NULL;
+    free_nodes(loop);
+    return make_block_list(list);
+}
+
+// partial unrolling: main loop running factor iterations per test
+static node_t partial_unroll(node_t loop, counted_loop_s * cl, int32_t factor) {
+    int64_t span = (int64_t)(factor - 1) * cl->step;
+    bool upward = (cl->rel == NODE_LT || cl->rel == NODE_LE);
+    node_t init = loop->opr[0];
+    node_t main_bound, guard = NULL, setup = NULL;
+    int32_t bound, count, last;
+    bool known = counted_trip_count(loop, cl, &count, &last);
+
+    if (eval_const_expr(cl->bound, NULL, 0, &bound)) {
+        // "var rel bound - span" must not wrap around
+        int64_t b = (int64_t)bound - span;
+        if (b < INT32_MIN || b > INT32_MAX) {
+            return loop;
+        }
+        main_bound = make_int(b);
+    } else {
+        node_t tmp = new_temporary(TYPE_INT);
+        node_t limit = make_int(upward ? INT32_MIN + span : INT32_MAX + span);
+        guard = make_binop(upward ? NODE_GE : NODE_LE, TYPE_BOOL, copy_tree(cl->bound), limit);
+        setup = make_binop(NODE_AFFECT, TYPE_INT, tmp,
+                           make_binop(NODE_MINUS, TYPE_INT, copy_tree(cl->bound), make_int(span)));
+        main_bound = make_ref(tmp);
+    }
+
+    node_t body = NULL;
+    for (int32_t n = 0; n < factor; n++) {
+        body = append(body, copy_instr(loop->opr[3]));
+        body = append(body, copy_tree(loop->opr[2]));
+    }
+
+    node_t test = make_binop(cl->rel, TYPE_BOOL, make_ref(cl->var), main_bound);
+    node_t main_loop = make_node(NODE_WHILE, 2, test, make_block_list(body));
+    main_loop->lineno = loop->lineno;
+
+    if (guard != NULL) {
+        node_t then = make_block_list(list_append(setup, main_loop));
+        main_loop = make_node(NODE_IF, 3, guard, then, NULL);
+        main_loop->lineno = loop->lineno;
+    }
+
+    node_t list = list_append(init, main_loop);
+    loop->opr[0] = NULL;
+
+    if (known) {
+        // the remaining iterations are straight-line code
+        for (int32_t n = 0; n < count % factor; n++) {
+            list = append(list, copy_instr(loop->opr[3]));
+            list = append(list, copy_tree(loop->opr[2]));
+        }
+        free_nodes(loop);
+    } else {
+        list = append(list, loop);
+    }
+
+    return make_block_list(list);
+}
+
+static node_t unroll_loop(node_t loop) {
+    counted_loop_s cl;
+    int32_t count, last;
+
+    if (!match_counted_loop(loop, &cl)) {
+        return loop;
+    }
+
+    int32_t size = count_nodes(loop->opr[3]) + count_nodes(loop->opr[2]);
+    int32_t max_copies = opt_unroll_budget / size;
+    int64_t entries, iterations;
+    bool profiled = get_profile(loop, &entries, &iterations);
+
+    if (profiled && entries == 0) {
+        return loop;
+    }
+    if (counted_trip_count(loop, &cl, &count, &last) && count <= max_copies) {
+        return full_unroll(loop, &cl, count, last);
+    }
+
+    int32_t factor = opt_unroll_factor < max_copies ? opt_unroll_factor : max_copies;
+    if (factor < 2 || (profiled && iterations < (int64_t)factor * entries)) {
+        return loop;
+    }
+    return partial_unroll(loop, &cl, factor);
+}
+
+
+// tree walk, innermost loops first
+static void unroll_instr(node_t * pinstr) {
+    node_t instr = *pinstr;
+
+    if (instr == NULL) {
+        return;
+    }
+
+    switch (instr->nature) {
+        case NODE_LIST:
+            unroll_instr(&instr->opr[0]);
+            unroll_instr(&instr->opr[1]);
+            break;
+
+        case NODE_BLOCK:
+            unroll_instr(&instr->opr[1]);
+            break;
+
+        case NODE_IF:
+            unroll_instr(&instr->opr[1]);
+            unroll_instr(&instr->opr[2]);
+            break;
+
+        case NODE_WHILE:
+            unroll_instr(&instr->opr[1]);
+            break;
+
+        case NODE_DOWHILE:
+            unroll_instr(&instr->opr[0]);
+            break;
+
+        case NODE_FOR:
+            unroll_instr(&instr->opr[3]);
+            *pinstr = unroll_loop(instr);
+            break;
+
+        default:
+            break;
+    }
+}
+
+void unroll_tree(node_t root) {
+    node_t func = root->opr[1];
+    unroll_instr(&func->opr[2]);
+}
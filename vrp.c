@@ -0,0 +1,774 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "defs.h"
+#include "common.h"
+#include "optim.h"
+
+extern int trace_level;
+
+
+// Value range propagation.
+// Integer variables are given an interval, plus a flag telling that 0 is
+// excluded, by an abstract interpretation of the function. Branch conditions
+// narrow the intervals and loops are iterated to a fixed point, with widening.
+// A division is proven safe when its divisor excludes 0 each time it is
+// reached with the final states: passe_2 then omits the check for a null
+// divisor. When the dividend is also never negative, a division or modulo
+// by a power of two becomes a shift or a mask.
+
+#define RANGE_MIN ((int64_t)INT32_MIN)
+#define RANGE_MAX ((int64_t)INT32_MAX)
+
+// iterations of a loop before the changing bounds are widened
+#define WIDEN_AFTER 2
+#define MAX_THRESHOLDS 64
+
+typedef struct _range_s {
+    int64_t lo;
+    int64_t hi;
+    bool nonzero;
+} range_s;
+
+typedef struct _var_range_s {
+    node_t decl;
+    range_s range;
+} var_range_s;
+
+// variables missing from a state may hold any value
+typedef struct _state_s {
+    bool reachable;
+    var_range_s * vars;
+    int32_t size;
+    int32_t capacity;
+} state_s;
+
+// divisions seen with a divisor excluding 0, with a possibly null divisor,
+// and with a possibly negative dividend
+static decl_set_s nonzero_divs;
+static decl_set_s checked_divs;
+static decl_set_s signed_divs;
+
+// constants compared against in the function, with their neighbours: a
+// widened bound stops at the nearest one before going to the type limits
+static int64_t thresholds[MAX_THRESHOLDS];
+static int32_t num_thresholds = 0;
+
+// off while a loop is iterated to its fixed point
+static bool recording = true;
+
+// divisions left to passe_2 without a check
+static decl_set_s safe_divs;
+
+
+// ranges
+static range_s range_top(void) {
+    range_s r = { RANGE_MIN, RANGE_MAX, false };
+    return r;
+}
+
+static range_s range_of(int64_t lo, int64_t hi) {
+    range_s r = { lo, hi, false };
+    if (lo < RANGE_MIN || hi > RANGE_MAX) {
+        return range_top();
+    }
+    return r;
+}
+
+static range_s range_const(int32_t v) {
+    return range_of(v, v);
+}
+
+static bool range_excludes_zero(range_s r) {
+    return r.nonzero || r.lo > 0 || r.hi < 0;
+}
+
+static bool range_is_const(range_s r) {
+    return r.lo == r.hi;
+}
+
+static int64_t min64(int64_t a, int64_t b) {
+    return a < b ? a : b;
+}
+
+static int64_t max64(int64_t a, int64_t b) {
+    return a > b ? a : b;
+}
+
+// smallest 2^k - 1 covering v >= 0
+static int64_t low_mask(int64_t v) {
+    int64_t m = 0;
+    while (m < v) {
+        m = 2 * m + 1;
+    }
+    return m;
+}
+
+
+static void add_threshold(int64_t v) {
+    for (int32_t i = 0; i < num_thresholds; i++) {
+        if (thresholds[i] == v) {
+            return;
+        }
+    }
+    if (num_thresholds < MAX_THRESHOLDS && v >= RANGE_MIN && v <= RANGE_MAX) {
+        thresholds[num_thresholds++] = v;
+    }
+}
+
+static void collect_thresholds(node_t n) {
+    if (n == NULL) {
+        return;
+    }
+    if (n->nature >= NODE_LT && n->nature <= NODE_NE) {
+        for (int32_t i = 0; i < 2; i++) {
+            if (n->opr[i]->nature == NODE_INTVAL) {
+                add_threshold(n->opr[i]->value - 1);
+                add_threshold(n->opr[i]->value);
+                add_threshold(n->opr[i]->value + 1);
+            }
+        }
+    }
+    for (int32_t i = 0; i < n->nops; i++) {
+        collect_thresholds(n->opr[i]);
+    }
+}
+
+static int64_t widen_up(int64_t v) {
+    int64_t w = RANGE_MAX;
+    for (int32_t i = 0; i < num_thresholds; i++) {
+        if (thresholds[i] >= v && thresholds[i] < w) {
+            w = thresholds[i];
+        }
+    }
+    return w;
+}
+
+static int64_t widen_down(int64_t v) {
+    int64_t w = RANGE_MIN;
+    for (int32_t i = 0; i < num_thresholds; i++) {
+        if (thresholds[i] <= v && thresholds[i] > w) {
+            w = thresholds[i];
+        }
+    }
+    return w;
+}
+
+
+// states
+static void state_init(state_s * s) {
+    s->reachable = true;
+    s->vars = NULL;
+    s->size = 0;
+    s->capacity = 0;
+}
+
+static void state_free(state_s * s) {
+    free(s->vars);
+    s->vars = NULL;
+    s->size = 0;
+    s->capacity = 0;
+}
+
+static void state_copy(state_s * dst, state_s * src) {
+    dst->reachable = src->reachable;
+    dst->size = src->size;
+    dst->capacity = src->size;
+    dst->vars = NULL;
+    if (src->size > 0) {
+        dst->vars = malloc(src->size * sizeof(var_range_s));
+        memcpy(dst->vars, src->vars, src->size * sizeof(var_range_s));
+    }
+}
+
+static int32_t state_find(state_s * s, node_t decl) {
+    for (int32_t i = 0; i < s->size; i++) {
+        if (s->vars[i].decl == decl) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static range_s state_get(state_s * s, node_t decl) {
+    int32_t i = state_find(s, decl);
+    return i < 0 ? range_top() : s->vars[i].range;
+}
+
+static void state_set(state_s * s, node_t decl, range_s r) {
+    int32_t i = state_find(s, decl);
+
+    if (i < 0) {
+        if (s->size == s->capacity) {
+            s->capacity = s->capacity ? 2 * s->capacity : 8;
+            s->vars = realloc(s->vars, s->capacity * sizeof(var_range_s));
+        }
+        i = s->size++;
+        s->vars[i].decl = decl;
+    }
+    s->vars[i].range = r;
+}
+
+// joins src into dst, returns true if dst grew
+static bool state_join(state_s * dst, state_s * src, bool widen) {
+    bool changed = false;
+
+    if (!src->reachable) {
+        return false;
+    }
+    if (!dst->reachable) {
+        state_free(dst);
+        state_copy(dst, src);
+        return true;
+    }
+
+    for (int32_t i = 0; i < dst->size; i++) {
+        range_s a = dst->vars[i].range;
+        range_s b = state_get(src, dst->vars[i].decl);
+        range_s r;
+
+        r.lo = min64(a.lo, b.lo);
+        r.hi = max64(a.hi, b.hi);
+        r.nonzero = range_excludes_zero(a) && range_excludes_zero(b);
+        if (widen && r.lo < a.lo) {
+            r.lo = widen_down(r.lo);
+        }
+        if (widen && r.hi > a.hi) {
+            r.hi = widen_up(r.hi);
+        }
+        if (r.lo != a.lo || r.hi != a.hi || r.nonzero != range_excludes_zero(a)) {
+            changed = true;
+        }
+        dst->vars[i].range = r;
+    }
+    return changed;
+}
+
+static bool is_int_var(node_t n) {
+    return n->nature == NODE_IDENT && n->type == TYPE_INT && n->decl_node != NULL;
+}
+
+
+// expressions
+static void refine(state_s * s, node_t cond, bool truth);
+
+static range_s eval(node_t e, state_s * s);
+
+static void note_division(node_t e, range_s dividend, range_s divisor) {
+    if (!recording) {
+        return;
+    }
+    decl_set_add(range_excludes_zero(divisor) ? &nonzero_divs : &checked_divs, e);
+    if (dividend.lo < 0) {
+        decl_set_add(&signed_divs, e);
+    }
+}
+
+static range_s eval_arith(node_t e, range_s a, range_s b) {
+    int64_t p[4];
+
+    switch (e->nature) {
+        case NODE_PLUS:
+            return range_of(a.lo + b.lo, a.hi + b.hi);
+        case NODE_MINUS:
+            return range_of(a.lo - b.hi, a.hi - b.lo);
+        case NODE_MUL:
+            p[0] = a.lo * b.lo;
+            p[1] = a.lo * b.hi;
+            p[2] = a.hi * b.lo;
+            p[3] = a.hi * b.hi;
+            return range_of(min64(min64(p[0], p[1]), min64(p[2], p[3])),
+                            max64(max64(p[0], p[1]), max64(p[2], p[3])));
+        case NODE_DIV:
+            if (b.lo > 0) {
+                return range_of(a.lo >= 0 ? a.lo / b.hi : a.lo / b.lo,
+                                a.hi >= 0 ? a.hi / b.lo : a.hi / b.hi);
+            }
+            return range_top();
+        case NODE_MOD:
+            if (b.lo > 0) {
+                int64_t m = b.hi - 1;
+                if (a.lo >= 0) {
+                    return range_of(0, min64(a.hi, m));
+                }
+                if (a.hi <= 0) {
+                    return range_of(max64(a.lo, -m), 0);
+                }
+                return range_of(-m, m);
+            }
+            return range_top();
+        case NODE_BAND:
+            if (a.lo >= 0 || b.lo >= 0) {
+                return range_of(0, min64(a.lo >= 0 ? a.hi : RANGE_MAX, b.lo >= 0 ? b.hi : RANGE_MAX));
+            }
+            return range_top();
+        case NODE_BOR:
+        case NODE_BXOR:
+            if (a.lo >= 0 && b.lo >= 0) {
+                return range_of(0, low_mask(max64(a.hi, b.hi)));
+            }
+            return range_top();
+        case NODE_SRA:
+            if (range_is_const(b)) {
+                int32_t k = (int32_t)(b.lo & 31);
+                return range_of(a.lo >> k, a.hi >> k);
+            }
+            return a.lo >= 0 ? range_of(0, a.hi) : range_top();
+        case NODE_SRL:
+            if (a.lo >= 0) {
+                return range_is_const(b) ? range_of(a.lo >> (b.lo & 31), a.hi >> (b.lo & 31)) : range_of(0, a.hi);
+            }
+            if (range_is_const(b) && (b.lo & 31) != 0) {
+                return range_of(0, (int64_t)(UINT32_MAX >> (b.lo & 31)));
+            }
+            return range_top();
+        case NODE_SLL:
+            if (a.lo >= 0 && range_is_const(b)) {
+                int32_t k = (int32_t)(b.lo & 31);
+                return range_of(a.lo << k, a.hi << k);
+            }
+            return range_top();
+        default:
+            return range_top();
+    }
+}
+
+static range_s eval(node_t e, state_s * s) {
+    range_s a, b;
+
+    if (e == NULL || !s->reachable) {
+        return range_top();
+    }
+
+    switch (e->nature) {
+        case NODE_INTVAL:
+            return range_const((int32_t)e->value);
+
+        case NODE_BOOLVAL:
+            return range_const(e->value != 0);
+
+        case NODE_IDENT:
+            if (is_int_var(e)) {
+                return state_get(s, e->decl_node);
+            }
+            return e->type == TYPE_BOOL ? range_of(0, 1) : range_top();
+
+        case NODE_AFFECT:
+            a = eval(e->opr[1], s);
+            if (is_int_var(e->opr[0])) {
+                state_set(s, e->opr[0]->decl_node, a);
+            }
+            return a;
+
+        case NODE_UMINUS:
+            a = eval(e->opr[0], s);
+            if (a.lo == RANGE_MIN) {
+                return range_top();
+            }
+            b = range_of(-a.hi, -a.lo);
+            b.nonzero = a.nonzero;
+            return b;
+
+        case NODE_BNOT:
+            a = eval(e->opr[0], s);
+            return range_of(-a.hi - 1, -a.lo - 1);
+
+        case NODE_NOT:
+            eval(e->opr[0], s);
+            return range_of(0, 1);
+
+        // && and || evaluate both operands
+        case NODE_AND:
+        case NODE_OR:
+        case NODE_LT:
+        case NODE_GT:
+        case NODE_LE:
+        case NODE_GE:
+        case NODE_EQ:
+        case NODE_NE:
+            eval(e->opr[0], s);
+            eval(e->opr[1], s);
+            return range_of(0, 1);
+
+        case NODE_DIV:
+        case NODE_MOD:
+            a = eval(e->opr[0], s);
+            b = eval(e->opr[1], s);
+            note_division(e, a, b);
+            return eval_arith(e, a, b);
+
+        case NODE_PLUS:
+        case NODE_MINUS:
+        case NODE_MUL:
+        case NODE_BAND:
+        case NODE_BOR:
+        case NODE_BXOR:
+        case NODE_SLL:
+        case NODE_SRA:
+        case NODE_SRL:
+            a = eval(e->opr[0], s);
+            b = eval(e->opr[1], s);
+            return eval_arith(e, a, b);
+
+        default:
+            return range_top();
+    }
+}
+
+
+// branch conditions
+static node_nature negate_rel(node_nature rel) {
+    switch (rel) {
+        case NODE_LT: return NODE_GE;
+        case NODE_GT: return NODE_LE;
+        case NODE_LE: return NODE_GT;
+        case NODE_GE: return NODE_LT;
+        case NODE_EQ: return NODE_NE;
+        default:      return NODE_EQ;
+    }
+}
+
+// var rel r is known to hold
+static void narrow(state_s * s, node_t decl, node_nature rel, range_s r) {
+    range_s x = state_get(s, decl);
+
+    switch (rel) {
+        case NODE_LT:
+            x.hi = min64(x.hi, r.hi - 1);
+            break;
+        case NODE_LE:
+            x.hi = min64(x.hi, r.hi);
+            break;
+        case NODE_GT:
+            x.lo = max64(x.lo, r.lo + 1);
+            break;
+        case NODE_GE:
+            x.lo = max64(x.lo, r.lo);
+            break;
+        case NODE_EQ:
+            x.lo = max64(x.lo, r.lo);
+            x.hi = min64(x.hi, r.hi);
+            x.nonzero = x.nonzero || range_excludes_zero(r);
+            break;
+        case NODE_NE:
+            if (range_is_const(r)) {
+                x.nonzero = x.nonzero || r.lo == 0;
+                if (x.lo == r.lo) {
+                    x.lo++;
+                }
+                if (x.hi == r.lo) {
+                    x.hi--;
+                }
+            }
+            break;
+        default:
+            break;
+    }
+
+    if (x.nonzero && x.lo == 0) {
+        x.lo = 1;
+    }
+    if (x.nonzero && x.hi == 0) {
+        x.hi = -1;
+    }
+    if (x.lo > x.hi) {
+        s->reachable = false;
+        return;
+    }
+    state_set(s, decl, x);
+}
+
+// narrows s to the executions where cond evaluates to truth
+static void refine(state_s * s, node_t cond, bool truth) {
+    state_s other;
+
+    if (!s->reachable || has_side_effect(cond)) {
+        return;
+    }
+
+    switch (cond->nature) {
+        case NODE_BOOLVAL:
+            if ((cond->value != 0) != truth) {
+                s->reachable = false;
+            }
+            break;
+
+        case NODE_NOT:
+            refine(s, cond->opr[0], !truth);
+            break;
+
+        case NODE_AND:
+        case NODE_OR:
+            if (truth == (cond->nature == NODE_AND)) {
+                refine(s, cond->opr[0], truth);
+                refine(s, cond->opr[1], truth);
+            } else {
+                state_copy(&other, s);
+                refine(s, cond->opr[0], truth);
+                refine(&other, cond->opr[0], !truth);
+                refine(&other, cond->opr[1], truth);
+                state_join(s, &other, false);
+                state_free(&other);
+            }
+            break;
+
+        case NODE_LT:
+        case NODE_GT:
+        case NODE_LE:
+        case NODE_GE:
+        case NODE_EQ:
+        case NODE_NE: {
+            node_t l = cond->opr[0], r = cond->opr[1];
+            node_nature rel = truth ? cond->nature : negate_rel(cond->nature);
+            range_s rl, rr;
+
+            if (l->type != TYPE_INT) {
+                break;
+            }
+            rl = eval(l, s);
+            rr = eval(r, s);
+            if (is_int_var(l)) {
+                narrow(s, l->decl_node, rel, rr);
+            }
+            if (is_int_var(r) && s->reachable) {
+                narrow(s, r->decl_node, swap_rel(rel), rl);
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+
+// instructions
+static void analyse(node_t n, state_s * s);
+
+static void analyse_decls(node_t decls, state_s * s) {
+    if (decls == NULL) {
+        return;
+    }
+
+    switch (decls->nature) {
+        case NODE_LIST:
+            analyse_decls(decls->opr[0], s);
+            analyse_decls(decls->opr[1], s);
+            break;
+        case NODE_DECLS:
+            analyse_decls(decls->opr[1], s);
+            break;
+        case NODE_DECL: {
+            node_t ident = decls->opr[0];
+            node_t init = (decls->nops > 1) ? decls->opr[1] : NULL;
+            // globals default to 0, an uninitialised local keeps whatever its slot held
+            range_s r = (init != NULL) ? eval(init, s) : ident->global_decl ? range_const(0) : range_top();
+            if (ident->type == TYPE_INT) {
+                state_set(s, ident, r);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// state back at the test of a loop after one more trip
+static void loop_trip(node_t loop, state_s * s) {
+    if (loop->nature == NODE_DOWHILE) {
+        analyse(loop->opr[0], s);
+        eval(loop->opr[1], s);
+        refine(s, loop->opr[1], true);
+        return;
+    }
+
+    node_t cond = loop->opr[loop->nature == NODE_FOR ? 1 : 0];
+    node_t body = loop->opr[loop->nature == NODE_FOR ? 3 : 1];
+
+    eval(cond, s);
+    if (cond != NULL) {
+        refine(s, cond, true);
+    }
+    analyse(body, s);
+    if (loop->nature == NODE_FOR) {
+        eval(loop->opr[2], s);
+    }
+}
+
+static void loop_exit(node_t loop, state_s * s) {
+    node_t cond = loop->opr[loop->nature == NODE_WHILE ? 0 : 1];
+
+    if (loop->nature == NODE_DOWHILE) {
+        analyse(loop->opr[0], s);
+    }
+    if (cond == NULL) {
+        s->reachable = false;
+        return;
+    }
+    eval(cond, s);
+    refine(s, cond, false);
+}
+
+// s is the state on entry of the loop, then after it
+static void analyse_loop(node_t loop, state_s * s) {
+    bool outer = recording;
+    state_s head, next;
+
+    // the trips are repeated until the state at the test is stable,
+    // divisions are only noted once it is known
+    recording = false;
+    state_copy(&head, s);
+    for (int32_t i = 0; ; i++) {
+        state_copy(&next, &head);
+        loop_trip(loop, &next);
+        bool changed = state_join(&head, &next, i >= WIDEN_AFTER);
+        state_free(&next);
+        if (!changed) {
+            break;
+        }
+    }
+
+    // one more trip without widening recovers the bounds given by the tests
+    state_copy(&next, &head);
+    loop_trip(loop, &next);
+    state_join(s, &next, false);
+    state_free(&next);
+    state_free(&head);
+    recording = outer;
+
+    state_copy(&next, s);
+    loop_trip(loop, &next);
+    state_free(&next);
+    loop_exit(loop, s);
+}
+
+static void analyse(node_t n, state_s * s) {
+    state_s other;
+
+    if (n == NULL || !s->reachable) {
+        return;
+    }
+
+    switch (n->nature) {
+        case NODE_LIST:
+            analyse(n->opr[0], s);
+            analyse(n->opr[1], s);
+            break;
+
+        case NODE_BLOCK:
+            analyse_decls(n->opr[0], s);
+            analyse(n->opr[1], s);
+            break;
+
+        case NODE_IF:
+            eval(n->opr[0], s);
+            state_copy(&other, s);
+            refine(&other, n->opr[0], true);
+            refine(s, n->opr[0], false);
+            analyse(n->opr[1], &other);
+            if (n->nops > 2) {
+                analyse(n->opr[2], s);
+            }
+            state_join(s, &other, false);
+            state_free(&other);
+            break;
+
+        case NODE_WHILE:
+        case NODE_DOWHILE:
+            analyse_loop(n, s);
+            break;
+
+        case NODE_FOR:
+            eval(n->opr[0], s);
+            analyse_loop(n, s);
+            break;
+
+        case NODE_PRINT:
+            break;
+
+        default:
+            eval(n, s);
+            break;
+    }
+}
+
+
+// rewriting
+static int32_t num_lowered = 0;
+static int32_t num_checks = 0;
+
+static int32_t log2_exact(int64_t v) {
+    int32_t k = 0;
+    if (v <= 0 || (v & (v - 1)) != 0) {
+        return -1;
+    }
+    while (((int64_t)1 << k) != v) {
+        k++;
+    }
+    return k;
+}
+
+static void apply_ranges(node_t n) {
+    if (n == NULL) {
+        return;
+    }
+    for (int32_t i = 0; i < n->nops; i++) {
+        apply_ranges(n->opr[i]);
+    }
+
+    if (n->nature != NODE_DIV && n->nature != NODE_MOD) {
+        return;
+    }
+
+    // every evaluation must have been seen with a divisor excluding 0
+    bool reached = decl_set_contains(&nonzero_divs, n) || decl_set_contains(&checked_divs, n);
+    bool nonzero = decl_set_contains(&nonzero_divs, n) && !decl_set_contains(&checked_divs, n);
+    bool unsigned_div = reached && !decl_set_contains(&signed_divs, n);
+    node_t divisor = n->opr[1];
+    int32_t k = (divisor->nature == NODE_INTVAL) ? log2_exact(divisor->value) : -1;
+
+    if (unsigned_div && k >= 0) {
+        // x / 2^k = x >> k and x % 2^k = x & (2^k - 1) when x >= 0
+        if (n->nature == NODE_DIV) {
+            n->nature = NODE_SRA;
+            divisor->value = k;
+        } else {
+            n->nature = NODE_BAND;
+            divisor->value = ((int64_t)1 << k) - 1;
+        }
+        num_lowered++;
+    } else if (nonzero) {
+        decl_set_add(&safe_divs, n);
+        num_checks++;
+    }
+}
+
+bool divisor_nonzero(node_t div) {
+    return decl_set_contains(&safe_divs, div);
+}
+
+void vrp_tree(node_t root) {
+    node_t func = root->opr[1];
+    state_s s;
+
+    num_thresholds = 0;
+    collect_thresholds(func->opr[2]);
+
+    state_init(&s);
+    // main is the only function: globals start from their initial value
+    analyse_decls(root->opr[0], &s);
+    analyse(func->opr[2], &s);
+    state_free(&s);
+
+    num_lowered = 0;
+    num_checks = 0;
+    apply_ranges(func->opr[2]);
+    printf_level(2, "vrp: %d division checks removed, %d divisions lowered\n", num_checks, num_lowered);
+
+    decl_set_free(&nonzero_divs);
+    decl_set_free(&checked_divs);
+    decl_set_free(&signed_divs);
+}